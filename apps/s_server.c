@@ -745,7 +745,7 @@ typedef enum OPTION_choice {
     OPT_CRLF, OPT_QUIET, OPT_BRIEF, OPT_NO_DHE,
     OPT_NO_RESUME_EPHEMERAL, OPT_PSK_IDENTITY, OPT_PSK_HINT, OPT_PSK,
     OPT_PSK_SESS, OPT_SRPVFILE, OPT_SRPUSERSEED, OPT_REV, OPT_WWW,
-    OPT_UPPER_WWW, OPT_HTTP, OPT_ASYNC, OPT_SSL_CONFIG,
+    OPT_UPPER_WWW, OPT_HTTP, OPT_ASYNC, OPT_ASYNC_THREADS, OPT_SSL_CONFIG,
     OPT_MAX_SEND_FRAG, OPT_SPLIT_SEND_FRAG, OPT_MAX_PIPELINES, OPT_READ_BUF,
     OPT_SSL3, OPT_TLS1_3, OPT_TLS1_2, OPT_TLS1_1, OPT_TLS1, OPT_DTLS, OPT_DTLS1,
     OPT_DTLS1_2, OPT_SCTP, OPT_TIMEOUT, OPT_MTU, OPT_LISTEN, OPT_STATELESS,
@@ -886,6 +886,10 @@ const OPTIONS s_server_options[] = {
     {"rev", OPT_REV, '-',
      "act as a simple test server which just sends back with the received text reversed"},
     {"async", OPT_ASYNC, '-', "Operate in asynchronous mode"},
+#ifndef OPENSSL_NO_ENGINE
+    {"async_threads", OPT_ASYNC_THREADS, 'p',
+     "Have the engine offload asynchronous operations to threads"},
+#endif
     {"ssl_config", OPT_SSL_CONFIG, 's',
      "Configure SSL_CTX using the configuration 'val'"},
     {"max_send_frag", OPT_MAX_SEND_FRAG, 'p', "Maximum Size of send frames "},
@@ -1048,6 +1052,7 @@ int s_server_main(int argc, char *argv[])
     int no_resume_ephemeral = 0;
     unsigned int max_send_fragment = 0;
     unsigned int split_send_fragment = 0, max_pipelines = 0;
+    int async_threads = 0;
     const char *s_serverinfo_file = NULL;
     const char *keylog_file = NULL;
     int max_early_data = -1, recv_max_early_data = -1;
@@ -1565,6 +1570,11 @@ int s_server_main(int argc, char *argv[])
         case OPT_ASYNC:
             async = 1;
             break;
+        case OPT_ASYNC_THREADS:
+            if (!opt_int(opt_arg(), &async_threads))
+                goto opthelp;
+            async = 1;
+            break;
         case OPT_MAX_SEND_FRAG:
             max_send_fragment = atoi(opt_arg());
             break;
@@ -1786,6 +1796,18 @@ int s_server_main(int argc, char *argv[])
         s_key_file2 = NULL;
     }
 
+#ifndef OPENSSL_NO_ENGINE
+    if (async_threads > 0
+        && (engine == NULL
+            || !ENGINE_ctrl_cmd(engine, "THREADS", async_threads, NULL, NULL,
+                                0))) {
+        BIO_printf(bio_err, "%s: Engine does not support -async_threads\n",
+                   prog);
+        ERR_print_errors(bio_err);
+        goto end;
+    }
+#endif
+
     ctx = SSL_CTX_new(meth);
     if (ctx == NULL) {
         ERR_print_errors(bio_err);
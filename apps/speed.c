@@ -24,6 +24,7 @@
 #include "progs.h"
 #include <openssl/crypto.h>
 #include <openssl/rand.h>
+#include <openssl/rand_drbg.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/objects.h>
@@ -211,6 +212,11 @@ static const int aead_lengths_list[] = {
     2, 31, 136, 1024, 8 * 1024, 16 * 1024
 };
 
+/* Random requests are mostly small: nonces, IVs, session IDs */
+static const int rand_lengths_list[] = {
+    16, 32, 64, 256, 1024, 8 * 1024
+};
+
 #define START   0
 #define STOP    1
 
@@ -305,7 +311,7 @@ typedef enum OPTION_choice {
     OPT_ERR = -1, OPT_EOF = 0, OPT_HELP,
     OPT_ELAPSED, OPT_EVP, OPT_HMAC, OPT_DECRYPT, OPT_ENGINE, OPT_MULTI,
     OPT_MR, OPT_MB, OPT_MISALIGN, OPT_ASYNCJOBS, OPT_R_ENUM,
-    OPT_PRIMES, OPT_SECONDS, OPT_BYTES, OPT_AEAD, OPT_CMAC
+    OPT_PRIMES, OPT_SECONDS, OPT_BYTES, OPT_AEAD, OPT_CMAC, OPT_RANDBUF
 } OPTION_CHOICE;
 
 const OPTIONS speed_options[] = {
@@ -323,6 +329,8 @@ const OPTIONS speed_options[] = {
      "Benchmark EVP-named AEAD cipher in TLS-like sequence"},
     {"mb", OPT_MB, '-',
      "Enable (tls1>=1) multi-block mode on EVP-named cipher"},
+    {"randbuf", OPT_RANDBUF, '-',
+     "Use buffered DRBG output for the rand benchmark"},
     {"mr", OPT_MR, '-', "Produce machine readable output"},
 #ifndef NO_FORK
     {"multi", OPT_MULTI, 'p', "Run benchmarks in parallel"},
@@ -1462,7 +1470,7 @@ int speed_main(int argc, char **argv)
     OPTION_CHOICE o;
     int async_init = 0, multiblock = 0, pr_header = 0;
     int doit[ALGOR_NUM] = { 0 };
-    int ret = 1, misalign = 0, lengths_single = 0, aead = 0;
+    int ret = 1, misalign = 0, lengths_single = 0, aead = 0, randbuf = 0;
     long count = 0;
     unsigned int size_num = OSSL_NELEM(lengths_list);
     unsigned int i, k, loop, loopargs_len = 0, async_jobs = 0;
@@ -1736,6 +1744,9 @@ int speed_main(int argc, char **argv)
         case OPT_AEAD:
             aead = 1;
             break;
+        case OPT_RANDBUF:
+            randbuf = 1;
+            break;
         }
     }
     argc = opt_num_rest();
@@ -1836,6 +1847,17 @@ int speed_main(int argc, char **argv)
             goto end;
         }
     }
+    /* Must be set before the per-thread DRBGs are first used */
+    if (randbuf
+            && !RAND_DRBG_set_defaults(RAND_DRBG_TYPE,
+                                       RAND_DRBG_FLAGS
+                                       | RAND_DRBG_FLAG_BUFFERED
+                                       | RAND_DRBG_FLAG_PUBLIC
+                                       | RAND_DRBG_FLAG_PRIVATE)) {
+        BIO_printf(bio_err, "Failed to enable buffered DRBG output\n");
+        ERR_print_errors(bio_err);
+        goto end;
+    }
     if (multiblock) {
         if (evp_cipher == NULL) {
             BIO_printf(bio_err,"-mb can be used only with a multi-block"
@@ -2680,6 +2702,14 @@ int speed_main(int argc, char **argv)
     }
 #endif
     if (doit[D_RAND]) {
+        /* Use sizes typical of random requests if rand is all we run */
+        if (lengths == lengths_list) {
+            for (i = 0; i < ALGOR_NUM; i++)
+                if (doit[i] && i != D_RAND)
+                    break;
+            if (i == ALGOR_NUM)
+                lengths = rand_lengths_list;
+        }
         for (testnum = 0; testnum < size_num; testnum++) {
             print_message(names[D_RAND], c[D_RAND][testnum], lengths[testnum],
                           seconds.sym);
@@ -20,6 +20,8 @@
 #include <openssl/evp.h>
 #include "internal/asn1_int.h"
 #include "internal/evp_int.h"
+#include "internal/thread_once.h"
+#include "internal/tsan_assist.h"
 
 #ifndef NO_ASN1_OLD
 
@@ -85,12 +87,157 @@ int ASN1_verify(i2d_of_void *i2d, X509_ALGOR *a, ASN1_BIT_STRING *signature,
 
 #endif
 
+/*
+ * Memo of successful signature verifications, see
+ * ASN1_item_verify_set_memo_size().  It is a direct-mapped table of SHA-256
+ * digests over the signature algorithm, the public key, the signature and
+ * the signed data, so that a new entry simply replaces the one in its slot.
+ */
+
+#define VERIFY_MEMO_LEN 32
+
+typedef struct {
+    int used;
+    unsigned char md[VERIFY_MEMO_LEN];
+} VERIFY_MEMO;
+
+static CRYPTO_ONCE memo_once = CRYPTO_ONCE_STATIC_INIT;
+static CRYPTO_RWLOCK *memo_lock = NULL;
+static VERIFY_MEMO *memo = NULL;
+static TSAN_QUALIFIER size_t memo_size = 0;
+static TSAN_QUALIFIER unsigned long memo_hits = 0;
+static TSAN_QUALIFIER unsigned long memo_misses = 0;
+
+DEFINE_RUN_ONCE_STATIC(do_memo_init)
+{
+    memo_lock = CRYPTO_THREAD_lock_new();
+    return memo_lock != NULL;
+}
+
+void asn1_verify_memo_cleanup_int(void)
+{
+    OPENSSL_free(memo);
+    memo = NULL;
+    memo_size = 0;
+    CRYPTO_THREAD_lock_free(memo_lock);
+    memo_lock = NULL;
+}
+
+int ASN1_item_verify_set_memo_size(size_t size)
+{
+    VERIFY_MEMO *table = NULL;
+
+    if (!RUN_ONCE(&memo_once, do_memo_init)) {
+        ASN1err(0, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    if (size > 0 && (table = OPENSSL_zalloc(size * sizeof(*table))) == NULL) {
+        ASN1err(0, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    CRYPTO_THREAD_write_lock(memo_lock);
+    OPENSSL_free(memo);
+    memo = table;
+    tsan_store(&memo_size, size);
+    CRYPTO_THREAD_unlock(memo_lock);
+    return 1;
+}
+
+void ASN1_item_verify_get_memo_stats(unsigned long *hits,
+                                     unsigned long *misses)
+{
+    if (hits != NULL)
+        *hits = tsan_load(&memo_hits);
+    if (misses != NULL)
+        *misses = tsan_load(&memo_misses);
+}
+
+/*
+ * Compute the memo key of a verification into |md|.  Returns 0 if the memo
+ * is not in use or on error, which just means it is not consulted.
+ */
+static int verify_memo_key(unsigned char *md, const X509_ALGOR *a,
+                           const ASN1_BIT_STRING *signature, EVP_PKEY *pkey,
+                           const unsigned char *tbs, int tbslen)
+{
+    EVP_MD_CTX *mctx = NULL;
+    unsigned char *alg = NULL, *pub = NULL;
+    int lens[4];
+    int ret = 0;
+
+    if (tsan_load(&memo_size) == 0)
+        return 0;
+
+    lens[0] = i2d_X509_ALGOR(a, &alg);
+    lens[1] = i2d_PUBKEY(pkey, &pub);
+    lens[2] = signature->length;
+    lens[3] = tbslen;
+    if (lens[0] <= 0 || lens[1] <= 0
+        || (mctx = EVP_MD_CTX_new()) == NULL
+        || !EVP_DigestInit_ex(mctx, EVP_sha256(), NULL)
+        || !EVP_DigestUpdate(mctx, lens, sizeof(lens))
+        || !EVP_DigestUpdate(mctx, alg, lens[0])
+        || !EVP_DigestUpdate(mctx, pub, lens[1])
+        || !EVP_DigestUpdate(mctx, signature->data, lens[2])
+        || !EVP_DigestUpdate(mctx, tbs, lens[3])
+        || !EVP_DigestFinal_ex(mctx, md, NULL))
+        goto err;
+    ret = 1;
+
+ err:
+    EVP_MD_CTX_free(mctx);
+    OPENSSL_free(alg);
+    OPENSSL_free(pub);
+    return ret;
+}
+
+static size_t verify_memo_slot(const unsigned char *md, size_t size)
+{
+    size_t i, h = 0;
+
+    for (i = 0; i < sizeof(h); i++)
+        h = (h << 8) | md[i];
+    return h % size;
+}
+
+static int verify_memo_find(const unsigned char *md)
+{
+    VERIFY_MEMO *m;
+    int ret = 0;
+
+    CRYPTO_THREAD_read_lock(memo_lock);
+    if (memo_size > 0) {
+        m = &memo[verify_memo_slot(md, memo_size)];
+        ret = m->used && memcmp(m->md, md, sizeof(m->md)) == 0;
+    }
+    CRYPTO_THREAD_unlock(memo_lock);
+    if (ret)
+        tsan_counter(&memo_hits);
+    else
+        tsan_counter(&memo_misses);
+    return ret;
+}
+
+static void verify_memo_add(const unsigned char *md)
+{
+    VERIFY_MEMO *m;
+
+    CRYPTO_THREAD_write_lock(memo_lock);
+    if (memo_size > 0) {
+        m = &memo[verify_memo_slot(md, memo_size)];
+        memcpy(m->md, md, sizeof(m->md));
+        m->used = 1;
+    }
+    CRYPTO_THREAD_unlock(memo_lock);
+}
+
 int ASN1_item_verify(const ASN1_ITEM *it, X509_ALGOR *a,
                      ASN1_BIT_STRING *signature, void *asn, EVP_PKEY *pkey)
 {
     EVP_MD_CTX *ctx = NULL;
     unsigned char *buf_in = NULL;
-    int ret = -1, inl = 0;
+    unsigned char memo_md[VERIFY_MEMO_LEN];
+    int ret = -1, inl = 0, memoise = 0;
     int mdnid, pknid;
     size_t inll = 0;
 
@@ -104,6 +251,25 @@ int ASN1_item_verify(const ASN1_ITEM *it, X509_ALGOR *a,
         return -1;
     }
 
+    inl = ASN1_item_i2d(asn, &buf_in, it);
+    if (inl <= 0) {
+        ASN1err(ASN1_F_ASN1_ITEM_VERIFY, ERR_R_INTERNAL_ERROR);
+        goto err;
+    }
+    if (buf_in == NULL) {
+        ASN1err(ASN1_F_ASN1_ITEM_VERIFY, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+    inll = inl;
+
+    if (verify_memo_key(memo_md, a, signature, pkey, buf_in, inl)) {
+        if (verify_memo_find(memo_md)) {
+            ret = 1;
+            goto err;
+        }
+        memoise = 1;
+    }
+
     ctx = EVP_MD_CTX_new();
     if (ctx == NULL) {
         ASN1err(ASN1_F_ASN1_ITEM_VERIFY, ERR_R_MALLOC_FAILURE);
@@ -152,23 +318,14 @@ int ASN1_item_verify(const ASN1_ITEM *it, X509_ALGOR *a,
         }
     }
 
-    inl = ASN1_item_i2d(asn, &buf_in, it);
-    if (inl <= 0) {
-        ASN1err(ASN1_F_ASN1_ITEM_VERIFY, ERR_R_INTERNAL_ERROR);
-        goto err;
-    }
-    if (buf_in == NULL) {
-        ASN1err(ASN1_F_ASN1_ITEM_VERIFY, ERR_R_MALLOC_FAILURE);
-        goto err;
-    }
-    inll = inl;
-
     ret = EVP_DigestVerify(ctx, signature->data, (size_t)signature->length,
                            buf_in, inl);
     if (ret <= 0) {
         ASN1err(ASN1_F_ASN1_ITEM_VERIFY, ERR_R_EVP_LIB);
         goto err;
     }
+    if (memoise)
+        verify_memo_add(memo_md);
     ret = 1;
  err:
     OPENSSL_clear_free(buf_in, inll);
@@ -18,6 +18,7 @@
 #include "comp_lcl.h"
 
 COMP_METHOD *COMP_zlib(void);
+COMP_METHOD *COMP_zlib_oneshot(void);
 
 static COMP_METHOD zlib_method_nozlib = {
     NID_undef,
@@ -67,6 +68,22 @@ static COMP_METHOD zlib_stateful_method = {
     zlib_stateful_expand_block
 };
 
+static int zlib_oneshot_compress_block(COMP_CTX *ctx, unsigned char *out,
+                                       unsigned int olen, unsigned char *in,
+                                       unsigned int ilen);
+static int zlib_oneshot_expand_block(COMP_CTX *ctx, unsigned char *out,
+                                     unsigned int olen, unsigned char *in,
+                                     unsigned int ilen);
+
+static COMP_METHOD zlib_oneshot_method = {
+    NID_zlib_compression,
+    LN_zlib_compression,
+    NULL,
+    NULL,
+    zlib_oneshot_compress_block,
+    zlib_oneshot_expand_block
+};
+
 /*
  * When OpenSSL is built on Windows, we do not want to require that
  * the ZLIB.DLL be available in order for the OpenSSL DLLs to
@@ -204,6 +221,47 @@ static int zlib_stateful_expand_block(COMP_CTX *ctx, unsigned char *out,
     return olen - state->istream.avail_out;
 }
 
+/*
+ * Each block is a complete zlib stream on its own, with its final block and
+ * Adler-32 trailer.
+ */
+static int zlib_oneshot_compress_block(COMP_CTX *ctx, unsigned char *out,
+                                       unsigned int olen, unsigned char *in,
+                                       unsigned int ilen)
+{
+    uLongf out_size = olen;
+
+    if (ilen == 0)
+        return 0;
+    if (compress(out, &out_size, in, ilen) != Z_OK)
+        return -1;
+    return (int)out_size;
+}
+
+static int zlib_oneshot_expand_block(COMP_CTX *ctx, unsigned char *out,
+                                     unsigned int olen, unsigned char *in,
+                                     unsigned int ilen)
+{
+    z_stream zs;
+    int err;
+
+    memset(&zs, 0, sizeof(zs));
+    zs.zalloc = zlib_zalloc;
+    zs.zfree = zlib_zfree;
+    if (inflateInit_(&zs, ZLIB_VERSION, sizeof(zs)) != Z_OK)
+        return -1;
+    zs.next_in = in;
+    zs.avail_in = ilen;
+    zs.next_out = out;
+    zs.avail_out = olen;
+    err = inflate(&zs, Z_FINISH);
+    inflateEnd(&zs);
+    /* Only a whole stream that fits, with nothing after it */
+    if (err != Z_STREAM_END || zs.avail_in != 0)
+        return -1;
+    return olen - zs.avail_out;
+}
+
 #endif
 
 COMP_METHOD *COMP_zlib(void)
@@ -259,6 +317,18 @@ COMP_METHOD *COMP_zlib(void)
     return meth;
 }
 
+COMP_METHOD *COMP_zlib_oneshot(void)
+{
+    COMP_METHOD *meth = &zlib_method_nozlib;
+
+#if defined(ZLIB)
+    if (COMP_zlib() != &zlib_method_nozlib)
+        meth = &zlib_oneshot_method;
+#endif
+
+    return meth;
+}
+
 void comp_zlib_cleanup_int(void)
 {
 #ifdef ZLIB_SHARED
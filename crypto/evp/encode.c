@@ -20,6 +20,10 @@ static int evp_encodeblock_int(EVP_ENCODE_CTX *ctx, unsigned char *t,
                                const unsigned char *f, int dlen);
 static int evp_decodeblock_int(EVP_ENCODE_CTX *ctx, unsigned char *t,
                                const unsigned char *f, int n);
+#ifndef CHARSET_EBCDIC
+static int evp_decode_run(unsigned char *t, const unsigned char *f,
+                          const unsigned char *table);
+#endif
 
 #ifndef CHARSET_EBCDIC
 # define conv_bin2ascii(a, table)       ((table)[(a)&0x3f])
@@ -328,6 +332,27 @@ int EVP_DecodeUpdate(EVP_ENCODE_CTX *ctx, unsigned char *out, int *outl,
         table = data_ascii2bin;
 
     for (i = 0; i < inl; i++) {
+#ifndef CHARSET_EBCDIC
+        /*
+         * A whole block of plain base64 characters, such as a line in the
+         * middle of a PEM file, is decoded straight from |in| together with
+         * the line break after it.  The result is the same as buffering it
+         * one character at a time below.
+         */
+        if (n == 0 && eof == 0 && inl - i >= 64 && *in != '\n'
+            && (decoded_len = evp_decode_run(out, in, table)) >= 0) {
+            ret += decoded_len;
+            out += decoded_len;
+            v = 64;
+            if (i + v < inl && in[v] == '\r')
+                v++;
+            if (i + v < inl && in[v] == '\n')
+                v++;
+            in += v;
+            i += v - 1;         /* The loop counts the last one */
+            continue;
+        }
+#endif
         tmp = *(in++);
         v = conv_ascii2bin(tmp, table);
         if (v == B64_ERROR) {
@@ -456,6 +481,44 @@ static int evp_decodeblock_int(EVP_ENCODE_CTX *ctx, unsigned char *t,
     return ret;
 }
 
+#ifndef CHARSET_EBCDIC
+/*
+ * Decode the 64 characters at |f| if they are all in the base64 alphabet.
+ * Returns the number of bytes written to |t|, or -1 if there is padding,
+ * white space or an invalid character, in which case nothing is written and
+ * the caller has to handle them one at a time.  |t| may overlap |f|, as
+ * PEM_read_bio_ex() decodes in place.
+ */
+static int evp_decode_run(unsigned char *t, const unsigned char *f,
+                          const unsigned char *table)
+{
+    unsigned char buf[64 / 4 * 3], *p = buf;
+    unsigned int a, b, c, d, bad = 0;
+    int i;
+
+    /* '=' is in the tables as 0 */
+    if (memchr(f, '=', 64) != NULL)
+        return -1;
+    /* Anything else that is not base64 has the top bit set */
+    for (i = 0; i < 64; i += 4) {
+        a = table[f[0] & 0x7f] | (f[0] & 0x80);
+        b = table[f[1] & 0x7f] | (f[1] & 0x80);
+        c = table[f[2] & 0x7f] | (f[2] & 0x80);
+        d = table[f[3] & 0x7f] | (f[3] & 0x80);
+        bad |= a | b | c | d;
+        p[0] = (unsigned char)((a << 2) | (b >> 4));
+        p[1] = (unsigned char)((b << 4) | (c >> 2));
+        p[2] = (unsigned char)((c << 6) | d);
+        f += 4;
+        p += 3;
+    }
+    if ((bad & 0x80) != 0)
+        return -1;
+    memmove(t, buf, sizeof(buf));
+    return sizeof(buf);
+}
+#endif
+
 int EVP_DecodeBlock(unsigned char *t, const unsigned char *f, int n)
 {
     return evp_decodeblock_int(NULL, t, f, n);
@@ -119,3 +119,4 @@ struct asn1_pctx_st {
 } /* ASN1_PCTX */ ;
 
 int asn1_d2i_read_bio(BIO *in, BUF_MEM **pb);
+void asn1_verify_memo_cleanup_int(void);
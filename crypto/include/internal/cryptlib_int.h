@@ -30,3 +30,4 @@ void ossl_ctx_thread_stop(void *arg);
 int ossl_trace_init(void);
 void ossl_trace_cleanup(void);
 void ossl_malloc_setup_failures(void);
+void ossl_mem_cache_cleanup(void);
@@ -35,6 +35,14 @@ struct X509_name_st {
     /* canonical encoding used for rapid Name comparison */
     unsigned char *canon_enc;
     int canon_enclen;
+    int lazy;                   /* decoded by x509_name_lazy_ex_d2i() */
+    /*
+     * For a lazy name: 1 once entries and canon_enc are decoded, -1 if that
+     * failed.  Only set under |lock|, the lock of the certificate or CRL
+     * that the name is in.
+     */
+    volatile int expanded;
+    CRYPTO_RWLOCK *lock;
 } /* X509_NAME */ ;
 
 /* Signature info structure */
@@ -112,6 +120,13 @@ struct X509_crl_st {
     const X509_CRL_METHOD *meth;
     void *meth_data;
     CRYPTO_RWLOCK *lock;
+    /*
+     * Set if decoded by d2i_X509_CRL_lazy(): until |serials| is freed by
+     * x509_crl_expand() the revoked list is only an index of |crl.enc|.
+     */
+    int lazy;
+    struct x509_crl_serial_st *serials;
+    int nserials;
 };
 
 struct x509_revoked_st {
@@ -172,12 +187,19 @@ struct x509_st {
     uint32_t ex_kusage;
     uint32_t ex_xkusage;
     uint32_t ex_nscert;
+    /*
+     * Set by X509_set_proxy_flag() and X509_set_proxy_pathlen(), kept when
+     * the values derived from the extensions are cleared
+     */
+    uint32_t ex_user_flags;
+    long ex_user_pcpathlen;
     ASN1_OCTET_STRING *skid;
     AUTHORITY_KEYID *akid;
     X509_POLICY_CACHE *policy_cache;
     STACK_OF(DIST_POINT) *crldp;
     STACK_OF(GENERAL_NAME) *altname;
     NAME_CONSTRAINTS *nc;
+    struct x509_nc_index_st *nc_index; /* nc compiled for lookups */
 # ifndef OPENSSL_NO_RFC3779
     STACK_OF(IPAddressFamily) *rfc3779_addr;
     struct ASIdentifiers_st *rfc3779_asid;
@@ -259,6 +281,8 @@ struct x509_store_ctx_st {      /* X509_STORE_CTX */
     SSL_DANE *dane;
     /* signed via bare TA public key, rather than CA certificate */
     int bare_ta_signed;
+    /* Earliest nextUpdate of the CRLs used so far, 0 if none */
+    time_t crl_expires;
 };
 
 /* PKCS#8 private key info structure */
@@ -290,3 +314,19 @@ int a2i_ipadd(unsigned char *ipout, const char *ipasc);
 int x509_set1_time(ASN1_TIME **ptm, const ASN1_TIME *tm);
 
 void x509_init_sig_info(X509 *x);
+void x509v3_cache_extensions(X509 *x);
+void x509v3_cache_clear(X509 *x);
+
+/* Name constraints of a CA certificate, indexed by x509v3_cache_extensions */
+typedef struct x509_nc_index_st X509_NC_INDEX;
+X509_NC_INDEX *x509_nc_index_new(NAME_CONSTRAINTS *nc);
+void x509_nc_index_free(X509_NC_INDEX *idx);
+int x509_nc_check(X509 *x, const X509 *ca);
+int x509_nc_check_CN(X509 *x, const X509 *ca);
+
+/* Lazily decoded certificates and CRLs, see d2i_X509_lazy() */
+DECLARE_ASN1_ITEM(X509_NAME_LAZY)
+DECLARE_ASN1_ITEM(X509_PUBKEY_LAZY)
+int x509_name_expand(const X509_NAME *nm);
+void x509_pubkey_set0_lock(X509_PUBKEY *key, CRYPTO_RWLOCK *lock);
+int x509_crl_expand(X509_CRL *crl);
@@ -27,6 +27,7 @@
 #include "internal/dso_conf.h"
 #include "internal/dso.h"
 #include "internal/store.h"
+#include "internal/asn1_int.h"
 #include <openssl/trace.h>
 
 static int stopped = 0;
@@ -463,6 +464,9 @@ void OPENSSL_cleanup(void)
     OSSL_TRACE(INIT, "OPENSSL_cleanup: evp_cleanup_int()\n");
     evp_cleanup_int();
 
+    OSSL_TRACE(INIT, "OPENSSL_cleanup: asn1_verify_memo_cleanup_int()\n");
+    asn1_verify_memo_cleanup_int();
+
     OSSL_TRACE(INIT, "OPENSSL_cleanup: obj_cleanup_int()\n");
     obj_cleanup_int();
 
@@ -475,6 +479,9 @@ void OPENSSL_cleanup(void)
     OSSL_TRACE(INIT, "OPENSSL_cleanup: ossl_trace_cleanup()\n");
     ossl_trace_cleanup();
 
+    OSSL_TRACE(INIT, "OPENSSL_cleanup: ossl_mem_cache_cleanup()\n");
+    ossl_mem_cache_cleanup();
+
     base_inited = 0;
 }
 
@@ -0,0 +1,406 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * A thread-caching front end for the system allocator.
+ *
+ * Small requests are rounded up to one of a handful of power-of-two size
+ * classes.  Freed blocks are kept on a per-thread free list for their class
+ * so that the common "allocate, use briefly, free" pattern never leaves the
+ * calling thread.  When a thread's list grows too long, a batch of blocks
+ * is moved to a shared depot (protected by a single lock) from which other
+ * threads refill their own lists; this handles the producer/consumer case
+ * where blocks are freed on a different thread from the one that allocated
+ * them.  Requests larger than the largest class go straight to malloc().
+ *
+ * Every block carries a small header recording its class, which makes it
+ * possible to tell cached blocks from pass-through ones on free/realloc.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <openssl/crypto.h>
+#include "internal/cryptlib_int.h"
+#include "internal/tsan_assist.h"
+
+#define MEM_CACHE_MIN_SHIFT     4       /* smallest class: 16 bytes */
+#define MEM_CACHE_NUM_CLASSES   8       /* largest class: 2048 bytes */
+#define MEM_CACHE_LARGE         MEM_CACHE_NUM_CLASSES
+#define MEM_CACHE_MAX_SIZE      \
+    ((size_t)1 << (MEM_CACHE_MIN_SHIFT + MEM_CACHE_NUM_CLASSES - 1))
+
+/* Per-thread list length at which a batch is returned to the depot */
+#define MEM_CACHE_THREAD_MAX    64
+/* Number of blocks moved between a thread and the depot at once */
+#define MEM_CACHE_BATCH         32
+/* Blocks beyond this many per class in the depot are given back to libc */
+#define MEM_CACHE_DEPOT_MAX     4096
+
+/* Prefixed to every block; sized to keep the user pointer malloc-aligned */
+typedef union {
+    size_t cls;
+    long double align_ld;
+    void *align_p;
+} MEM_CACHE_HDR;
+
+/* Free blocks are chained through their (unused) user area */
+typedef struct mem_cache_free_st {
+    struct mem_cache_free_st *next;
+} MEM_CACHE_FREE;
+
+typedef struct {
+    MEM_CACHE_FREE *head;
+    size_t count;
+} MEM_CACHE_LIST;
+
+typedef struct {
+    uint64_t allocs;
+    uint64_t hits;
+    uint64_t frees;
+} MEM_CACHE_STATS;
+
+typedef struct {
+    MEM_CACHE_LIST lists[MEM_CACHE_NUM_CLASSES];
+    /* Activity not yet folded into the global counters */
+    MEM_CACHE_STATS stats[MEM_CACHE_NUM_CLASSES];
+} MEM_CACHE_THREAD;
+
+/* Only changed when no other thread uses OpenSSL, but read everywhere */
+static TSAN_QUALIFIER int mem_cache_ready = 0;
+static CRYPTO_THREAD_LOCAL mem_cache_key;
+static CRYPTO_RWLOCK *depot_lock = NULL;
+static MEM_CACHE_LIST depot[MEM_CACHE_NUM_CLASSES];
+/*
+ * A copy of each depot count that can be read without the lock, so that a
+ * thread with an empty list does not take the lock to find an empty depot
+ */
+static TSAN_QUALIFIER size_t depot_avail[MEM_CACHE_NUM_CLASSES];
+static MEM_CACHE_STATS global_stats[MEM_CACHE_NUM_CLASSES];
+
+/*
+ * The thread-local value of a thread whose cache has been torn down.  Blocks
+ * freed by later thread-exit destructors go straight back to libc instead of
+ * bringing up a new cache that nothing would free.
+ */
+static char mem_cache_dead;
+#define MEM_CACHE_DEAD  ((MEM_CACHE_THREAD *)&mem_cache_dead)
+
+#define HDR(ptr)    ((MEM_CACHE_HDR *)(ptr) - 1)
+#define USER(hdr)   ((void *)((MEM_CACHE_HDR *)(hdr) + 1))
+
+static ossl_inline size_t class_size(size_t cls)
+{
+    return (size_t)1 << (cls + MEM_CACHE_MIN_SHIFT);
+}
+
+static ossl_inline size_t size_to_class(size_t num)
+{
+    size_t cls = 0;
+
+    if (num > MEM_CACHE_MAX_SIZE)
+        return MEM_CACHE_LARGE;
+    while (class_size(cls) < num)
+        cls++;
+    return cls;
+}
+
+/* Move up to |n| blocks from the front of |from| onto |to| */
+static void list_move(MEM_CACHE_LIST *to, MEM_CACHE_LIST *from, size_t n)
+{
+    while (n-- > 0 && from->head != NULL) {
+        MEM_CACHE_FREE *blk = from->head;
+
+        from->head = blk->next;
+        from->count--;
+        blk->next = to->head;
+        to->head = blk;
+        to->count++;
+    }
+}
+
+static void list_release(MEM_CACHE_LIST *list)
+{
+    MEM_CACHE_FREE *blk, *next;
+
+    for (blk = list->head; blk != NULL; blk = next) {
+        next = blk->next;
+        free(HDR(blk));
+    }
+    list->head = NULL;
+    list->count = 0;
+}
+
+/* Must be called with depot_lock held */
+static void stats_merge(MEM_CACHE_THREAD *tc, size_t cls)
+{
+    global_stats[cls].allocs += tc->stats[cls].allocs;
+    global_stats[cls].hits += tc->stats[cls].hits;
+    global_stats[cls].frees += tc->stats[cls].frees;
+    memset(&tc->stats[cls], 0, sizeof(tc->stats[cls]));
+}
+
+/* Must be called with depot_lock held */
+static void depot_put(MEM_CACHE_LIST *list, size_t cls, size_t n)
+{
+    list_move(&depot[cls], list, n);
+    if (depot[cls].count > MEM_CACHE_DEPOT_MAX) {
+        MEM_CACHE_LIST excess = { NULL, 0 };
+
+        list_move(&excess, &depot[cls], depot[cls].count - MEM_CACHE_DEPOT_MAX);
+        list_release(&excess);
+    }
+    tsan_store(&depot_avail[cls], depot[cls].count);
+}
+
+/* Thread-exit destructor: hand everything this thread cached to the depot */
+static void mem_cache_thread_free(void *arg)
+{
+    MEM_CACHE_THREAD *tc = arg;
+    size_t cls;
+
+    if (tc == NULL)
+        return;
+    /*
+     * Keep the marker in place, the destructor is called again for as long
+     * as other destructors leave a value behind.
+     */
+    CRYPTO_THREAD_set_local(&mem_cache_key, MEM_CACHE_DEAD);
+    if (tc == MEM_CACHE_DEAD)
+        return;
+    CRYPTO_THREAD_write_lock(depot_lock);
+    for (cls = 0; cls < MEM_CACHE_NUM_CLASSES; cls++) {
+        depot_put(&tc->lists[cls], cls, tc->lists[cls].count);
+        stats_merge(tc, cls);
+    }
+    CRYPTO_THREAD_unlock(depot_lock);
+    free(tc);
+}
+
+static MEM_CACHE_THREAD *mem_cache_thread_get(void)
+{
+    MEM_CACHE_THREAD *tc;
+
+    if (!tsan_load(&mem_cache_ready))
+        return NULL;
+    tc = CRYPTO_THREAD_get_local(&mem_cache_key);
+    if (tc == NULL) {
+        /*
+         * The thread state must not come from the cache itself, otherwise
+         * it would be recycled into its own free lists on thread exit.
+         */
+        if ((tc = calloc(1, sizeof(*tc))) == NULL)
+            return NULL;
+        if (!CRYPTO_THREAD_set_local(&mem_cache_key, tc)) {
+            free(tc);
+            return NULL;
+        }
+    }
+    return tc == MEM_CACHE_DEAD ? NULL : tc;
+}
+
+void *CRYPTO_mem_cache_malloc(size_t num, const char *file, int line)
+{
+    MEM_CACHE_THREAD *tc;
+    MEM_CACHE_HDR *hdr;
+    MEM_CACHE_LIST *list;
+    size_t cls;
+
+    (void)file;
+    (void)line;
+    if (num == 0)
+        return NULL;
+
+    cls = size_to_class(num);
+    if (cls == MEM_CACHE_LARGE || (tc = mem_cache_thread_get()) == NULL) {
+        if (num > SIZE_MAX - sizeof(*hdr)
+                || (hdr = malloc(sizeof(*hdr) + num)) == NULL)
+            return NULL;
+        hdr->cls = MEM_CACHE_LARGE;
+        return USER(hdr);
+    }
+
+    list = &tc->lists[cls];
+    tc->stats[cls].allocs++;
+    if (list->head == NULL && tsan_load(&depot_avail[cls]) > 0) {
+        CRYPTO_THREAD_write_lock(depot_lock);
+        list_move(list, &depot[cls], MEM_CACHE_BATCH);
+        tsan_store(&depot_avail[cls], depot[cls].count);
+        stats_merge(tc, cls);
+        CRYPTO_THREAD_unlock(depot_lock);
+    }
+    if (list->head != NULL) {
+        MEM_CACHE_FREE *blk = list->head;
+
+        list->head = blk->next;
+        list->count--;
+        tc->stats[cls].hits++;
+        return blk;
+    }
+
+    if ((hdr = malloc(sizeof(*hdr) + class_size(cls))) == NULL)
+        return NULL;
+    hdr->cls = cls;
+    return USER(hdr);
+}
+
+void CRYPTO_mem_cache_free(void *str, const char *file, int line)
+{
+    MEM_CACHE_THREAD *tc;
+    MEM_CACHE_FREE *blk = str;
+    MEM_CACHE_LIST *list;
+    size_t cls;
+
+    (void)file;
+    (void)line;
+    if (str == NULL)
+        return;
+
+    cls = HDR(str)->cls;
+    if (cls == MEM_CACHE_LARGE || (tc = mem_cache_thread_get()) == NULL) {
+        free(HDR(str));
+        return;
+    }
+
+    list = &tc->lists[cls];
+    tc->stats[cls].frees++;
+    blk->next = list->head;
+    list->head = blk;
+    list->count++;
+    if (list->count >= MEM_CACHE_THREAD_MAX) {
+        CRYPTO_THREAD_write_lock(depot_lock);
+        depot_put(list, cls, MEM_CACHE_BATCH);
+        stats_merge(tc, cls);
+        CRYPTO_THREAD_unlock(depot_lock);
+    }
+}
+
+void *CRYPTO_mem_cache_realloc(void *str, size_t num, const char *file,
+                               int line)
+{
+    MEM_CACHE_HDR *hdr;
+    void *ret;
+    size_t cls;
+
+    if (str == NULL)
+        return CRYPTO_mem_cache_malloc(num, file, line);
+    if (num == 0) {
+        CRYPTO_mem_cache_free(str, file, line);
+        return NULL;
+    }
+
+    cls = HDR(str)->cls;
+    if (cls == MEM_CACHE_LARGE) {
+        if (num > SIZE_MAX - sizeof(*hdr)
+                || (hdr = realloc(HDR(str), sizeof(*hdr) + num)) == NULL)
+            return NULL;
+        return USER(hdr);
+    }
+
+    /* Anything that still fits in the block needs no copy */
+    if (num <= class_size(cls))
+        return str;
+
+    if ((ret = CRYPTO_mem_cache_malloc(num, file, line)) == NULL)
+        return NULL;
+    memcpy(ret, str, class_size(cls));
+    CRYPTO_mem_cache_free(str, file, line);
+    return ret;
+}
+
+int CRYPTO_mem_cache_enable(void)
+{
+    /*
+     * Install the functions first: customisation is only possible until
+     * the first allocation, and creating the lock below allocates.  Until
+     * |mem_cache_ready| is set every request takes the uncached path.
+     */
+    if (tsan_load(&mem_cache_ready))
+        return 0;
+    if (!CRYPTO_set_mem_functions(CRYPTO_mem_cache_malloc,
+                                  CRYPTO_mem_cache_realloc,
+                                  CRYPTO_mem_cache_free))
+        return 0;
+    if (!CRYPTO_THREAD_init_local(&mem_cache_key, mem_cache_thread_free))
+        return 0;
+    if ((depot_lock = CRYPTO_THREAD_lock_new()) == NULL) {
+        CRYPTO_THREAD_cleanup_local(&mem_cache_key);
+        return 0;
+    }
+    tsan_store(&mem_cache_ready, 1);
+    return 1;
+}
+
+int CRYPTO_mem_cache_get_stats(int idx, size_t *size, uint64_t *allocs,
+                               uint64_t *hits, uint64_t *frees)
+{
+    MEM_CACHE_THREAD *tc;
+    MEM_CACHE_STATS st;
+
+    if (idx < 0 || idx >= MEM_CACHE_NUM_CLASSES)
+        return 0;
+
+    memset(&st, 0, sizeof(st));
+    if (tsan_load(&mem_cache_ready)) {
+        CRYPTO_THREAD_read_lock(depot_lock);
+        st = global_stats[idx];
+        CRYPTO_THREAD_unlock(depot_lock);
+        /* Other threads' recent activity shows up at their next depot visit */
+        tc = CRYPTO_THREAD_get_local(&mem_cache_key);
+        if (tc != NULL && tc != MEM_CACHE_DEAD) {
+            st.allocs += tc->stats[idx].allocs;
+            st.hits += tc->stats[idx].hits;
+            st.frees += tc->stats[idx].frees;
+        }
+    }
+
+    if (size != NULL)
+        *size = class_size(idx);
+    if (allocs != NULL)
+        *allocs = st.allocs;
+    if (hits != NULL)
+        *hits = st.hits;
+    if (frees != NULL)
+        *frees = st.frees;
+    return 1;
+}
+
+/*
+ * Called from OPENSSL_cleanup(), when no other thread uses OpenSSL any more:
+ * give the blocks cached by the calling thread and the depot back to libc
+ * and release the shared state.  Blocks that are still allocated carry their
+ * header, so from now on every request simply passes through to libc.
+ */
+void ossl_mem_cache_cleanup(void)
+{
+    MEM_CACHE_THREAD *tc;
+    size_t cls;
+
+    if (!tsan_load(&mem_cache_ready))
+        return;
+    tc = CRYPTO_THREAD_get_local(&mem_cache_key);
+    if (tc == MEM_CACHE_DEAD)
+        tc = NULL;
+    CRYPTO_THREAD_write_lock(depot_lock);
+    for (cls = 0; cls < MEM_CACHE_NUM_CLASSES; cls++) {
+        if (tc != NULL) {
+            list_release(&tc->lists[cls]);
+            stats_merge(tc, cls);
+        }
+        list_release(&depot[cls]);
+        tsan_store(&depot_avail[cls], 0);
+    }
+    CRYPTO_THREAD_unlock(depot_lock);
+
+    tsan_store(&mem_cache_ready, 0);
+    CRYPTO_THREAD_set_local(&mem_cache_key, NULL);
+    free(tc);
+    CRYPTO_THREAD_cleanup_local(&mem_cache_key);
+    CRYPTO_THREAD_lock_free(depot_lock);
+    depot_lock = NULL;
+}
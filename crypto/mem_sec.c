@@ -1,5 +1,5 @@
 /*
- * Copyright 2015-2018 The OpenSSL Project Authors. All Rights Reserved.
+ * Copyright 2015-2019 The OpenSSL Project Authors. All Rights Reserved.
  * Copyright 2004-2014, Akamai Technologies. All Rights Reserved.
  *
  * Licensed under the Apache License 2.0 (the "License").  You may not use
@@ -63,6 +63,266 @@ static void sh_free(void *ptr);
 static void sh_done(void);
 static size_t sh_actual_size(char *ptr);
 static int sh_allocated(const char *ptr);
+static size_t sh_class(size_t size);
+static size_t sh_class_of(char *ptr);
+static size_t sh_class_size(size_t cls);
+static void sh_stats(size_t *arena, size_t *chunks, size_t *largest);
+
+/*
+ * Small blocks are not returned to the heap straight away but kept in one
+ * of several caches, each with its own lock.  Threads are spread over the
+ * caches round-robin, so that the common case of a thread allocating and
+ * freeing BIGNUM temporaries only ever touches its own cache lock, while
+ * the heap itself (and |sec_malloc_lock|) is only visited to move blocks
+ * in and out of a cache in batches.  Blocks in a cache are still allocated
+ * as far as the heap is concerned, and have already been cleansed.
+ */
+# define SEC_CACHE_SHARDS   16
+# define SEC_CACHE_CLASSES  8      /* minsize up to minsize << 7 */
+# define SEC_CACHE_MAX_SIZE 1024   /* but never larger blocks than this */
+# define SEC_CACHE_MAX      32     /* per shard and class */
+# define SEC_CACHE_BATCH    8
+
+typedef struct sec_cache_blk_st {
+    struct sec_cache_blk_st *next;
+} SEC_CACHE_BLK;
+
+typedef struct {
+    CRYPTO_RWLOCK *lock;
+    SEC_CACHE_BLK *list[SEC_CACHE_CLASSES];
+    size_t count[SEC_CACHE_CLASSES];
+    size_t cached;                 /* bytes held in this shard */
+} SEC_CACHE;
+
+static SEC_CACHE sec_cache[SEC_CACHE_SHARDS];
+static CRYPTO_THREAD_LOCAL sec_cache_key;
+static int sec_cache_next;
+
+static int sec_cacheable(size_t cls)
+{
+    return cls < SEC_CACHE_CLASSES && sh_class_size(cls) <= SEC_CACHE_MAX_SIZE;
+}
+
+static SEC_CACHE *sec_cache_get(void)
+{
+    void *idx = CRYPTO_THREAD_get_local(&sec_cache_key);
+    int n;
+
+    /* The index is stored off by one so that NULL means "not assigned" */
+    if (idx == NULL) {
+        if (!CRYPTO_atomic_add(&sec_cache_next, 1, &n, sec_malloc_lock))
+            n = 0;
+        idx = (void *)(size_t)((unsigned int)n % SEC_CACHE_SHARDS + 1);
+        CRYPTO_THREAD_set_local(&sec_cache_key, idx);
+    }
+    return &sec_cache[(size_t)idx - 1];
+}
+
+/* Must be called with |sec_malloc_lock| held */
+static void *sec_heap_malloc(size_t num)
+{
+    void *ret = sh_malloc(num);
+
+    if (ret != NULL)
+        secure_mem_used += sh_actual_size(ret);
+    return ret;
+}
+
+/* Must be called with |sec_malloc_lock| held; |ptr| must be cleansed */
+static void sec_heap_free(void *ptr)
+{
+    secure_mem_used -= sh_actual_size(ptr);
+    sh_free(ptr);
+}
+
+static void *sec_cache_malloc(size_t num)
+{
+    SEC_CACHE *cache = sec_cache_get();
+    SEC_CACHE_BLK *blk = NULL, *extra = NULL;
+    size_t cls = sh_class(num), size, i;
+
+    if (sec_cacheable(cls)) {
+        CRYPTO_THREAD_write_lock(cache->lock);
+        if ((blk = cache->list[cls]) != NULL) {
+            cache->list[cls] = blk->next;
+            cache->count[cls]--;
+            cache->cached -= sh_class_size(cls);
+        }
+        CRYPTO_THREAD_unlock(cache->lock);
+        if (blk != NULL) {
+            /* The rest of the block was cleansed when it was freed */
+            memset(blk, 0, sizeof(*blk));
+            return blk;
+        }
+    }
+
+    CRYPTO_THREAD_write_lock(sec_malloc_lock);
+    blk = sec_heap_malloc(num);
+    if (blk != NULL && sec_cacheable(cls)) {
+        /* Refill the cache while we hold the heap lock anyway */
+        for (i = 1; i < SEC_CACHE_BATCH; i++) {
+            SEC_CACHE_BLK *tmp = sec_heap_malloc(num);
+
+            if (tmp == NULL)
+                break;
+            tmp->next = extra;
+            extra = tmp;
+        }
+    }
+    CRYPTO_THREAD_unlock(sec_malloc_lock);
+
+    if (blk == NULL)
+        return NULL;
+
+    if (extra != NULL) {
+        size = sh_class_size(cls);
+        CRYPTO_THREAD_write_lock(cache->lock);
+        while (extra != NULL) {
+            SEC_CACHE_BLK *tmp = extra;
+
+            extra = tmp->next;
+            tmp->next = cache->list[cls];
+            cache->list[cls] = tmp;
+            cache->count[cls]++;
+            cache->cached += size;
+        }
+        CRYPTO_THREAD_unlock(cache->lock);
+    }
+    return blk;
+}
+
+/*
+ * Size and cache size class of the allocated block |ptr|.  Both are read
+ * from the bit tables, which the heap changes under |sec_malloc_lock|.
+ */
+static size_t sec_block_class(void *ptr, size_t *size)
+{
+    size_t cls;
+
+    CRYPTO_THREAD_read_lock(sec_malloc_lock);
+    *size = sh_actual_size(ptr);
+    cls = sh_class_of(ptr);
+    CRYPTO_THREAD_unlock(sec_malloc_lock);
+    return cls;
+}
+
+/* |ptr|, of the size class |cls|, must already be cleansed */
+static void sec_cache_free(void *ptr, size_t cls)
+{
+    SEC_CACHE *cache;
+    SEC_CACHE_BLK *blk = ptr, *spill = NULL;
+    size_t size, i;
+
+    if (!sec_cacheable(cls)) {
+        CRYPTO_THREAD_write_lock(sec_malloc_lock);
+        sec_heap_free(ptr);
+        CRYPTO_THREAD_unlock(sec_malloc_lock);
+        return;
+    }
+
+    cache = sec_cache_get();
+    size = sh_class_size(cls);
+    CRYPTO_THREAD_write_lock(cache->lock);
+    blk->next = cache->list[cls];
+    cache->list[cls] = blk;
+    cache->count[cls]++;
+    cache->cached += size;
+    if (cache->count[cls] > SEC_CACHE_MAX) {
+        for (i = 0; i < SEC_CACHE_BATCH && cache->list[cls] != NULL; i++) {
+            SEC_CACHE_BLK *tmp = cache->list[cls];
+
+            cache->list[cls] = tmp->next;
+            cache->count[cls]--;
+            cache->cached -= size;
+            tmp->next = spill;
+            spill = tmp;
+        }
+    }
+    CRYPTO_THREAD_unlock(cache->lock);
+
+    if (spill != NULL) {
+        CRYPTO_THREAD_write_lock(sec_malloc_lock);
+        while (spill != NULL) {
+            SEC_CACHE_BLK *tmp = spill;
+
+            spill = tmp->next;
+            memset(tmp, 0, sizeof(*tmp));
+            sec_heap_free(tmp);
+        }
+        CRYPTO_THREAD_unlock(sec_malloc_lock);
+    }
+}
+
+/* Return every cached block to the heap */
+static void sec_cache_drain(void)
+{
+    SEC_CACHE_BLK *spill;
+    size_t i, cls;
+
+    for (i = 0; i < SEC_CACHE_SHARDS; i++) {
+        SEC_CACHE *cache = &sec_cache[i];
+
+        for (cls = 0; cls < SEC_CACHE_CLASSES; cls++) {
+            CRYPTO_THREAD_write_lock(cache->lock);
+            spill = cache->list[cls];
+            cache->cached -= cache->count[cls] * sh_class_size(cls);
+            cache->list[cls] = NULL;
+            cache->count[cls] = 0;
+            CRYPTO_THREAD_unlock(cache->lock);
+
+            if (spill == NULL)
+                continue;
+            CRYPTO_THREAD_write_lock(sec_malloc_lock);
+            while (spill != NULL) {
+                SEC_CACHE_BLK *tmp = spill;
+
+                spill = tmp->next;
+                memset(tmp, 0, sizeof(*tmp));
+                sec_heap_free(tmp);
+            }
+            CRYPTO_THREAD_unlock(sec_malloc_lock);
+        }
+    }
+}
+
+static size_t sec_cache_bytes(void)
+{
+    size_t i, total = 0;
+
+    for (i = 0; i < SEC_CACHE_SHARDS; i++) {
+        CRYPTO_THREAD_read_lock(sec_cache[i].lock);
+        total += sec_cache[i].cached;
+        CRYPTO_THREAD_unlock(sec_cache[i].lock);
+    }
+    return total;
+}
+
+static void sec_cache_done(void)
+{
+    size_t i;
+
+    for (i = 0; i < SEC_CACHE_SHARDS; i++) {
+        CRYPTO_THREAD_lock_free(sec_cache[i].lock);
+        sec_cache[i].lock = NULL;
+    }
+    CRYPTO_THREAD_cleanup_local(&sec_cache_key);
+}
+
+static int sec_cache_init(void)
+{
+    size_t i;
+
+    memset(sec_cache, 0, sizeof(sec_cache));
+    if (!CRYPTO_THREAD_init_local(&sec_cache_key, NULL))
+        return 0;
+    for (i = 0; i < SEC_CACHE_SHARDS; i++) {
+        if ((sec_cache[i].lock = CRYPTO_THREAD_lock_new()) == NULL) {
+            sec_cache_done();
+            return 0;
+        }
+    }
+    return 1;
+}
 #endif
 
 int CRYPTO_secure_malloc_init(size_t size, int minsize)
@@ -74,9 +334,15 @@ int CRYPTO_secure_malloc_init(size_t size, int minsize)
         sec_malloc_lock = CRYPTO_THREAD_lock_new();
         if (sec_malloc_lock == NULL)
             return 0;
+        if (!sec_cache_init()) {
+            CRYPTO_THREAD_lock_free(sec_malloc_lock);
+            sec_malloc_lock = NULL;
+            return 0;
+        }
         if ((ret = sh_init(size, minsize)) != 0) {
             secure_mem_initialized = 1;
         } else {
+            sec_cache_done();
             CRYPTO_THREAD_lock_free(sec_malloc_lock);
             sec_malloc_lock = NULL;
         }
@@ -91,9 +357,13 @@ int CRYPTO_secure_malloc_init(size_t size, int minsize)
 int CRYPTO_secure_malloc_done(void)
 {
 #ifdef OPENSSL_SECURE_MEMORY
+    if (!secure_mem_initialized)
+        return secure_mem_used == 0;
+    sec_cache_drain();
     if (secure_mem_used == 0) {
         sh_done();
         secure_mem_initialized = 0;
+        sec_cache_done();
         CRYPTO_THREAD_lock_free(sec_malloc_lock);
         sec_malloc_lock = NULL;
         return 1;
@@ -115,16 +385,15 @@ void *CRYPTO_secure_malloc(size_t num, const char *file, int line)
 {
 #ifdef OPENSSL_SECURE_MEMORY
     void *ret;
-    size_t actual_size;
 
     if (!secure_mem_initialized) {
         return CRYPTO_malloc(num, file, line);
     }
-    CRYPTO_THREAD_write_lock(sec_malloc_lock);
-    ret = sh_malloc(num);
-    actual_size = ret ? sh_actual_size(ret) : 0;
-    secure_mem_used += actual_size;
-    CRYPTO_THREAD_unlock(sec_malloc_lock);
+    if ((ret = sec_cache_malloc(num)) == NULL) {
+        /* Blocks parked in the caches might be all that is missing */
+        sec_cache_drain();
+        ret = sec_cache_malloc(num);
+    }
     return ret;
 #else
     return CRYPTO_malloc(num, file, line);
@@ -144,20 +413,18 @@ void *CRYPTO_secure_zalloc(size_t num, const char *file, int line)
 void CRYPTO_secure_free(void *ptr, const char *file, int line)
 {
 #ifdef OPENSSL_SECURE_MEMORY
-    size_t actual_size;
+    size_t actual_size, cls;
 
     if (ptr == NULL)
         return;
-    if (!CRYPTO_secure_allocated(ptr)) {
+    /* The arena bounds do not change while the heap is initialised */
+    if (!secure_mem_initialized || !sh_allocated(ptr)) {
         CRYPTO_free(ptr, file, line);
         return;
     }
-    CRYPTO_THREAD_write_lock(sec_malloc_lock);
-    actual_size = sh_actual_size(ptr);
+    cls = sec_block_class(ptr, &actual_size);
     CLEAR(ptr, actual_size);
-    secure_mem_used -= actual_size;
-    sh_free(ptr);
-    CRYPTO_THREAD_unlock(sec_malloc_lock);
+    sec_cache_free(ptr, cls);
 #else
     CRYPTO_free(ptr, file, line);
 #endif /* OPENSSL_SECURE_MEMORY */
@@ -167,21 +434,18 @@ void CRYPTO_secure_clear_free(void *ptr, size_t num,
                               const char *file, int line)
 {
 #ifdef OPENSSL_SECURE_MEMORY
-    size_t actual_size;
+    size_t actual_size, cls;
 
     if (ptr == NULL)
         return;
-    if (!CRYPTO_secure_allocated(ptr)) {
+    if (!secure_mem_initialized || !sh_allocated(ptr)) {
         OPENSSL_cleanse(ptr, num);
         CRYPTO_free(ptr, file, line);
         return;
     }
-    CRYPTO_THREAD_write_lock(sec_malloc_lock);
-    actual_size = sh_actual_size(ptr);
+    cls = sec_block_class(ptr, &actual_size);
     CLEAR(ptr, actual_size);
-    secure_mem_used -= actual_size;
-    sh_free(ptr);
-    CRYPTO_THREAD_unlock(sec_malloc_lock);
+    sec_cache_free(ptr, cls);
 #else
     if (ptr == NULL)
         return;
@@ -193,14 +457,9 @@ void CRYPTO_secure_clear_free(void *ptr, size_t num,
 int CRYPTO_secure_allocated(const void *ptr)
 {
 #ifdef OPENSSL_SECURE_MEMORY
-    int ret;
-
     if (!secure_mem_initialized)
         return 0;
-    CRYPTO_THREAD_write_lock(sec_malloc_lock);
-    ret = sh_allocated(ptr);
-    CRYPTO_THREAD_unlock(sec_malloc_lock);
-    return ret;
+    return sh_allocated(ptr);
 #else
     return 0;
 #endif /* OPENSSL_SECURE_MEMORY */
@@ -209,7 +468,14 @@ int CRYPTO_secure_allocated(const void *ptr)
 size_t CRYPTO_secure_used(void)
 {
 #ifdef OPENSSL_SECURE_MEMORY
-    return secure_mem_used;
+    size_t used;
+
+    if (!secure_mem_initialized)
+        return 0;
+    CRYPTO_THREAD_read_lock(sec_malloc_lock);
+    used = secure_mem_used;
+    CRYPTO_THREAD_unlock(sec_malloc_lock);
+    return used - sec_cache_bytes();
 #else
     return 0;
 #endif /* OPENSSL_SECURE_MEMORY */
@@ -220,7 +486,7 @@ size_t CRYPTO_secure_actual_size(void *ptr)
 #ifdef OPENSSL_SECURE_MEMORY
     size_t actual_size;
 
-    CRYPTO_THREAD_write_lock(sec_malloc_lock);
+    CRYPTO_THREAD_read_lock(sec_malloc_lock);
     actual_size = sh_actual_size(ptr);
     CRYPTO_THREAD_unlock(sec_malloc_lock);
     return actual_size;
@@ -228,6 +494,36 @@ size_t CRYPTO_secure_actual_size(void *ptr)
     return 0;
 #endif
 }
+
+int CRYPTO_secure_malloc_stats(size_t *arena, size_t *used, size_t *cached,
+                               size_t *free_chunks, size_t *largest_free)
+{
+#ifdef OPENSSL_SECURE_MEMORY
+    size_t heap_size, heap_used, cache_bytes, chunks, largest;
+
+    if (!secure_mem_initialized)
+        return 0;
+    cache_bytes = sec_cache_bytes();
+    CRYPTO_THREAD_read_lock(sec_malloc_lock);
+    heap_used = secure_mem_used;
+    sh_stats(&heap_size, &chunks, &largest);
+    CRYPTO_THREAD_unlock(sec_malloc_lock);
+
+    if (arena != NULL)
+        *arena = heap_size;
+    if (used != NULL)
+        *used = heap_used - cache_bytes;
+    if (cached != NULL)
+        *cached = cache_bytes;
+    if (free_chunks != NULL)
+        *free_chunks = chunks;
+    if (largest_free != NULL)
+        *largest_free = largest;
+    return 1;
+#else
+    return 0;
+#endif /* OPENSSL_SECURE_MEMORY */
+}
 /* END OF PAGE ...
 
    ... START OF PAGE */
@@ -302,6 +598,57 @@ static size_t sh_getlist(char *ptr)
 }
 
 
+/* Index of the free list (0 = largest) that serves a request of |size| */
+static ossl_ssize_t sh_list_for(size_t size)
+{
+    ossl_ssize_t list = sh.freelist_size - 1;
+    size_t i;
+
+    for (i = sh.minsize; i < size; i <<= 1)
+        list--;
+    return list;
+}
+
+/* Cache size class of a request, 0 being blocks of |sh.minsize| */
+static size_t sh_class(size_t size)
+{
+    if (size > sh.arena_size)
+        return SIZE_MAX;
+    return sh.freelist_size - 1 - sh_list_for(size);
+}
+
+static size_t sh_class_of(char *ptr)
+{
+    return sh.freelist_size - 1 - sh_getlist(ptr);
+}
+
+static size_t sh_class_size(size_t cls)
+{
+    return sh.minsize << cls;
+}
+
+/*
+ * Heap size, number of free chunks and size of the largest of them; the
+ * last two are a measure of fragmentation.
+ */
+static void sh_stats(size_t *arena, size_t *chunks, size_t *largest)
+{
+    ossl_ssize_t list;
+    SH_LIST *temp;
+
+    *arena = sh.arena_size;
+    *chunks = 0;
+    *largest = 0;
+    for (list = 0; list < sh.freelist_size; list++) {
+        for (temp = (SH_LIST *)sh.freelist[list]; temp != NULL;
+             temp = temp->next) {
+            if (*largest == 0)
+                *largest = sh.arena_size >> list;
+            (*chunks)++;
+        }
+    }
+}
+
 static int sh_testbit(char *ptr, int list, unsigned char *table)
 {
     size_t bit;
@@ -529,15 +876,12 @@ static char *sh_find_my_buddy(char *ptr, int list)
 static void *sh_malloc(size_t size)
 {
     ossl_ssize_t list, slist;
-    size_t i;
     char *chunk;
 
     if (size > sh.arena_size)
         return NULL;
 
-    list = sh.freelist_size - 1;
-    for (i = sh.minsize; i < size; i <<= 1)
-        list--;
+    list = sh_list_for(size);
     if (list < 0)
         return NULL;
 
@@ -18,6 +18,10 @@
 /*
  * Implementation of NIST SP 800-90A CTR DRBG.
  */
+
+/* Maximum number of output bytes encrypted by one EVP_CipherUpdate() call */
+#define DRBG_CTR_MAX_CHUNK      (1 << 16)
+
 static void inc_128(RAND_DRBG_CTR *ctr)
 {
     int i;
@@ -323,26 +327,39 @@ __owur static int drbg_ctr_generate(RAND_DRBG *drbg,
         adinlen = 0;
     }
 
-    for ( ; ; ) {
+    /*
+     * Lay out as many successive counter blocks as fit in the output
+     * buffer and encrypt them in place with a single call, so that the
+     * underlying ECB implementation can process several blocks in
+     * parallel (the AES-NI and VPAES kernels interleave up to 8 blocks).
+     */
+    while (outlen >= AES_BLOCK_SIZE) {
+        size_t i, n = outlen & ~(size_t)(AES_BLOCK_SIZE - 1);
+        int outl;
+
+        if (n > DRBG_CTR_MAX_CHUNK)
+            n = DRBG_CTR_MAX_CHUNK;
+        for (i = 0; i < n; i += AES_BLOCK_SIZE) {
+            inc_128(ctr);
+            memcpy(out + i, ctr->V, AES_BLOCK_SIZE);
+        }
+        if (!EVP_CipherUpdate(ctr->ctx, out, &outl, out, (int)n)
+            || outl != (int)n)
+            return 0;
+        out += n;
+        outlen -= n;
+    }
+
+    if (outlen > 0) {
         int outl = AES_BLOCK_SIZE;
 
         inc_128(ctr);
-        if (outlen < 16) {
-            /* Use K as temp space as it will be updated */
-            if (!EVP_CipherUpdate(ctr->ctx, ctr->K, &outl, ctr->V,
-                                  AES_BLOCK_SIZE)
-                || outl != AES_BLOCK_SIZE)
-                return 0;
-            memcpy(out, ctr->K, outlen);
-            break;
-        }
-        if (!EVP_CipherUpdate(ctr->ctx, out, &outl, ctr->V, AES_BLOCK_SIZE)
+        /* Use K as temp space as it will be updated */
+        if (!EVP_CipherUpdate(ctr->ctx, ctr->K, &outl, ctr->V,
+                              AES_BLOCK_SIZE)
             || outl != AES_BLOCK_SIZE)
             return 0;
-        out += 16;
-        outlen -= 16;
-        if (outlen == 0)
-            break;
+        memcpy(out, ctr->K, outlen);
     }
 
     if (!ctr_update(drbg, adin, adinlen, NULL, 0, NULL, 0))
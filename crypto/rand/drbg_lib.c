@@ -102,9 +102,10 @@ static unsigned int slave_reseed_interval  = SLAVE_RESEED_INTERVAL;
 static time_t master_reseed_time_interval = MASTER_RESEED_TIME_INTERVAL;
 static time_t slave_reseed_time_interval  = SLAVE_RESEED_TIME_INTERVAL;
 
-/* A logical OR of all used DRBG flag bits (currently there is only one) */
+/* A logical OR of all used DRBG flag bits */
 static const unsigned int rand_drbg_used_flags =
-    RAND_DRBG_FLAG_CTR_NO_DF | RAND_DRBG_FLAG_HMAC | RAND_DRBG_TYPE_FLAGS;
+    RAND_DRBG_FLAG_CTR_NO_DF | RAND_DRBG_FLAG_HMAC | RAND_DRBG_FLAG_BUFFERED
+    | RAND_DRBG_TYPE_FLAGS;
 
 
 static RAND_DRBG *drbg_setup(OPENSSL_CTX *ctx, RAND_DRBG *parent, int drbg_type);
@@ -147,6 +148,18 @@ static int is_digest(int type)
     }
 }
 
+/*
+ * Discard any output buffered ahead of time.  It must not survive a
+ * reseed: bytes generated before it would be handed out afterwards.
+ */
+static void drbg_outbuf_clear(RAND_DRBG *drbg)
+{
+    if (drbg->outbuf_len > 0) {
+        OPENSSL_cleanse(drbg->outbuf, drbg->outbuf_len);
+        drbg->outbuf_len = 0;
+    }
+}
+
 /*
  * Initialize the OPENSSL_CTX global DRBGs on first use.
  * Returns the allocated global data on success or NULL on failure.
@@ -314,6 +327,8 @@ int RAND_DRBG_set(RAND_DRBG *drbg, int type, unsigned int flags)
         flags = rand_drbg_flags[RAND_DRBG_TYPE_MASTER];
     }
 
+    drbg_outbuf_clear(drbg);
+
     /* If set is called multiple times - clear the old one */
     if (drbg->type != 0 && (type != drbg->type || flags != drbg->flags)) {
         drbg->meth->uninstantiate(drbg);
@@ -496,6 +511,12 @@ void RAND_DRBG_free(RAND_DRBG *drbg)
     if (drbg->meth != NULL)
         drbg->meth->uninstantiate(drbg);
     rand_pool_free(drbg->adin_pool);
+    if (drbg->outbuf != NULL) {
+        if (drbg->secure)
+            OPENSSL_secure_clear_free(drbg->outbuf, DRBG_OUTBUF_SIZE);
+        else
+            OPENSSL_clear_free(drbg->outbuf, DRBG_OUTBUF_SIZE);
+    }
     CRYPTO_THREAD_lock_free(drbg->lock);
     CRYPTO_free_ex_data(CRYPTO_EX_INDEX_DRBG, drbg, &drbg->ex_data);
 
@@ -542,6 +563,7 @@ int RAND_DRBG_instantiate(RAND_DRBG *drbg,
     }
 
     drbg->state = DRBG_ERROR;
+    drbg_outbuf_clear(drbg);
 
     /*
      * NIST SP800-90Ar1 section 9.1 says you can combine getting the entropy
@@ -673,6 +695,7 @@ int RAND_DRBG_reseed(RAND_DRBG *drbg,
     }
 
     drbg->state = DRBG_ERROR;
+    drbg_outbuf_clear(drbg);
 
     drbg->reseed_next_counter = tsan_load(&drbg->reseed_prop_counter);
     if (drbg->reseed_next_counter) {
@@ -892,14 +915,11 @@ int RAND_DRBG_generate(RAND_DRBG *drbg, unsigned char *out, size_t outlen,
 }
 
 /*
- * Generates |outlen| random bytes and stores them in |out|. It will
- * using the given |drbg| to generate the bytes.
- *
- * Requires that drbg->lock is already locked for write, if non-null.
- *
- * Returns 1 on success 0 on failure.
+ * Generates |outlen| random bytes into |out| with a fresh generate request
+ * (or several, if |outlen| exceeds the maximum request size).
  */
-int RAND_DRBG_bytes(RAND_DRBG *drbg, unsigned char *out, size_t outlen)
+static int drbg_bytes_direct(RAND_DRBG *drbg, unsigned char *out,
+                             size_t outlen)
 {
     unsigned char *additional = NULL;
     size_t additional_len;
@@ -934,6 +954,85 @@ int RAND_DRBG_bytes(RAND_DRBG *drbg, unsigned char *out, size_t outlen)
     return ret;
 }
 
+/*
+ * Checks whether output buffered by |drbg| may still be handed out, i.e.
+ * whether none of the conditions that make RAND_DRBG_generate() reseed
+ * (other than the generate counter, which only advances on refills) has
+ * occurred since it was generated.
+ */
+static int drbg_outbuf_fresh(RAND_DRBG *drbg)
+{
+    if (drbg->state != DRBG_READY || drbg->fork_count != rand_fork_count)
+        return 0;
+    if (drbg->reseed_time_interval > 0) {
+        time_t now = time(NULL);
+
+        if (now < drbg->reseed_time
+            || now - drbg->reseed_time >= drbg->reseed_time_interval)
+            return 0;
+    }
+    if (drbg->parent != NULL) {
+        unsigned int reseed_counter = tsan_load(&drbg->reseed_prop_counter);
+
+        if (reseed_counter > 0
+                && tsan_load(&drbg->parent->reseed_prop_counter)
+                   != reseed_counter)
+            return 0;
+    }
+    return 1;
+}
+
+/*
+ * Serves |outlen| bytes from the output buffer of |drbg|, refilling it
+ * with a single large generate request when it runs dry.
+ */
+static int drbg_bytes_buffered(RAND_DRBG *drbg, unsigned char *out,
+                               size_t outlen)
+{
+    if (!drbg_outbuf_fresh(drbg))
+        drbg_outbuf_clear(drbg);
+
+    if (drbg->outbuf_len < outlen) {
+        if (drbg->outbuf == NULL) {
+            drbg->outbuf = drbg->secure
+                           ? OPENSSL_secure_malloc(DRBG_OUTBUF_SIZE)
+                           : OPENSSL_malloc(DRBG_OUTBUF_SIZE);
+            if (drbg->outbuf == NULL)
+                return drbg_bytes_direct(drbg, out, outlen);
+        }
+        /* Leftovers are dropped rather than stitched to newer output */
+        drbg_outbuf_clear(drbg);
+        if (!drbg_bytes_direct(drbg, drbg->outbuf, DRBG_OUTBUF_SIZE))
+            return 0;
+        drbg->outbuf_len = DRBG_OUTBUF_SIZE;
+    }
+
+    drbg->outbuf_len -= outlen;
+    memcpy(out, drbg->outbuf + drbg->outbuf_len, outlen);
+    OPENSSL_cleanse(drbg->outbuf + drbg->outbuf_len, outlen);
+    return 1;
+}
+
+/*
+ * Generates |outlen| random bytes and stores them in |out|. It will
+ * using the given |drbg| to generate the bytes.
+ *
+ * If |drbg| was created with RAND_DRBG_FLAG_BUFFERED, small requests are
+ * served from output generated ahead of time.
+ *
+ * Requires that drbg->lock is already locked for write, if non-null.
+ *
+ * Returns 1 on success 0 on failure.
+ */
+int RAND_DRBG_bytes(RAND_DRBG *drbg, unsigned char *out, size_t outlen)
+{
+    if ((drbg->flags & RAND_DRBG_FLAG_BUFFERED) != 0
+            && outlen <= DRBG_OUTBUF_MAX_REQUEST
+            && DRBG_OUTBUF_SIZE <= drbg->max_request)
+        return drbg_bytes_buffered(drbg, out, outlen);
+    return drbg_bytes_direct(drbg, out, outlen);
+}
+
 /*
  * Set the RAND_DRBG callbacks for obtaining entropy and nonce.
  *
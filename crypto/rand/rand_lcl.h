@@ -53,6 +53,14 @@
  */
 # define DRBG_MAX_LENGTH                         INT32_MAX
 
+/*
+ * In buffered mode (RAND_DRBG_FLAG_BUFFERED), RAND_DRBG_bytes() requests of
+ * up to DRBG_OUTBUF_MAX_REQUEST bytes are served from a buffer of
+ * DRBG_OUTBUF_SIZE bytes that is generated in one go.
+ */
+# define DRBG_OUTBUF_SIZE                        4096
+# define DRBG_OUTBUF_MAX_REQUEST                 256
+
 /* The default nonce */
 # define DRBG_DEFAULT_PERS_STRING                "OpenSSL NIST SP 800-90A DRBG"
 
@@ -302,6 +310,14 @@ struct rand_drbg_st {
     size_t seedlen;
     DRBG_STATUS state;
 
+    /*
+     * Output generated ahead of time in buffered mode.  It is handed out
+     * from the end and cleansed as it is consumed, and discarded whenever
+     * the DRBG is reseeded, uninstantiated or detects a fork.
+     */
+    unsigned char *outbuf;
+    size_t outbuf_len;
+
     /* Application data, mainly used in the KATs. */
     CRYPTO_EX_DATA ex_data;
 
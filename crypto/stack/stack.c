@@ -15,9 +15,13 @@
 #include <openssl/e_os2.h>      /* For ossl_inline */
 
 /*
- * The initial number of nodes in the array.
+ * The initial number of nodes in the array.  That many nodes are kept in
+ * the stack structure itself, so that small stacks (which is most of them,
+ * for example in decoded ASN.1 structures) need a single allocation.
  */
-static const int min_nodes = 4;
+#define MIN_NODES   4
+
+static const int min_nodes = MIN_NODES;
 static const int max_nodes = SIZE_MAX / sizeof(void *) < INT_MAX
                              ? (int)(SIZE_MAX / sizeof(void *))
                              : INT_MAX;
@@ -28,8 +32,15 @@ struct stack_st {
     int sorted;
     int num_alloc;
     OPENSSL_sk_compfunc comp;
+    const void *inline_data[MIN_NODES];
 };
 
+static ossl_inline void sk_free_data(OPENSSL_STACK *st)
+{
+    if (st->data != st->inline_data)
+        OPENSSL_free(st->data);
+}
+
 OPENSSL_sk_compfunc OPENSSL_sk_set_cmp_func(OPENSSL_STACK *sk, OPENSSL_sk_compfunc c)
 {
     OPENSSL_sk_compfunc old = sk->comp;
@@ -60,13 +71,15 @@ OPENSSL_STACK *OPENSSL_sk_dup(const OPENSSL_STACK *sk)
         return ret;
     }
     /* duplicate |sk->data| content */
-    if ((ret->data = OPENSSL_malloc(sizeof(*ret->data) * sk->num_alloc)) == NULL)
-        goto err;
+    if (sk->num_alloc <= MIN_NODES) {
+        ret->data = ret->inline_data;
+    } else if ((ret->data = OPENSSL_malloc(sizeof(*ret->data)
+                                           * sk->num_alloc)) == NULL) {
+        OPENSSL_free(ret);
+        return NULL;
+    }
     memcpy(ret->data, sk->data, sizeof(void *) * sk->num);
     return ret;
- err:
-    OPENSSL_sk_free(ret);
-    return NULL;
 }
 
 OPENSSL_STACK *OPENSSL_sk_deep_copy(const OPENSSL_STACK *sk,
@@ -92,8 +105,11 @@ OPENSSL_STACK *OPENSSL_sk_deep_copy(const OPENSSL_STACK *sk,
     }
 
     ret->num_alloc = sk->num > min_nodes ? sk->num : min_nodes;
-    ret->data = OPENSSL_zalloc(sizeof(*ret->data) * ret->num_alloc);
-    if (ret->data == NULL) {
+    if (ret->num_alloc == MIN_NODES) {
+        ret->data = ret->inline_data;
+        memset(ret->inline_data, 0, sizeof(ret->inline_data));
+    } else if ((ret->data = OPENSSL_zalloc(sizeof(*ret->data)
+                                           * ret->num_alloc)) == NULL) {
         OPENSSL_free(ret);
         return NULL;
     }
@@ -176,7 +192,11 @@ static int sk_reserve(OPENSSL_STACK *st, int n, int exact)
          * At this point, |st->num_alloc| and |st->num| are 0;
          * so |num_alloc| value is |n| or |min_nodes| if greater than |n|.
          */
-        if ((st->data = OPENSSL_zalloc(sizeof(void *) * num_alloc)) == NULL) {
+        if (num_alloc == MIN_NODES) {
+            st->data = st->inline_data;
+            memset(st->inline_data, 0, sizeof(st->inline_data));
+        } else if ((st->data = OPENSSL_zalloc(sizeof(void *)
+                                              * num_alloc)) == NULL) {
             CRYPTOerr(CRYPTO_F_SK_RESERVE, ERR_R_MALLOC_FAILURE);
             return 0;
         }
@@ -194,7 +214,17 @@ static int sk_reserve(OPENSSL_STACK *st, int n, int exact)
         return 1;
     }
 
-    tmpdata = OPENSSL_realloc((void *)st->data, sizeof(void *) * num_alloc);
+    if (st->data == st->inline_data) {
+        /* The inline nodes cannot shrink, and growing moves them out */
+        if (num_alloc <= MIN_NODES)
+            return 1;
+        tmpdata = OPENSSL_malloc(sizeof(void *) * num_alloc);
+        if (tmpdata != NULL)
+            memcpy(tmpdata, st->data, sizeof(void *) * st->num);
+    } else {
+        tmpdata = OPENSSL_realloc((void *)st->data,
+                                  sizeof(void *) * num_alloc);
+    }
     if (tmpdata == NULL)
         return 0;
 
@@ -372,7 +402,7 @@ void OPENSSL_sk_free(OPENSSL_STACK *st)
 {
     if (st == NULL)
         return;
-    OPENSSL_free(st->data);
+    sk_free_data(st);
     OPENSSL_free(st);
 }
 
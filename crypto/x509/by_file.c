@@ -77,6 +77,7 @@ int X509_load_cert_file(X509_LOOKUP *ctx, const char *file, int type)
     BIO *in = NULL;
     int i, count = 0;
     X509 *x = NULL;
+    STACK_OF(X509) *certs = NULL;
 
     in = BIO_new(BIO_s_file());
 
@@ -86,6 +87,11 @@ int X509_load_cert_file(X509_LOOKUP *ctx, const char *file, int type)
     }
 
     if (type == X509_FILETYPE_PEM) {
+        /* Read them all first, so that they are added in one batch */
+        if ((certs = sk_X509_new_null()) == NULL) {
+            X509err(X509_F_X509_LOAD_CERT_FILE, ERR_R_MALLOC_FAILURE);
+            goto err;
+        }
         for (;;) {
             x = PEM_read_bio_X509_AUX(in, NULL, NULL, "");
             if (x == NULL) {
@@ -95,15 +101,21 @@ int X509_load_cert_file(X509_LOOKUP *ctx, const char *file, int type)
                     break;
                 } else {
                     X509err(X509_F_X509_LOAD_CERT_FILE, ERR_R_PEM_LIB);
+                    /* The certificates before the bad one are still added */
+                    x509_store_add_batch(ctx->store_ctx, certs, NULL);
                     goto err;
                 }
             }
-            i = X509_STORE_add_cert(ctx->store_ctx, x);
-            if (!i)
+            if (!sk_X509_push(certs, x)) {
+                X509err(X509_F_X509_LOAD_CERT_FILE, ERR_R_MALLOC_FAILURE);
                 goto err;
-            count++;
-            X509_free(x);
+            }
             x = NULL;
+            count++;
+        }
+        if (!x509_store_add_batch(ctx->store_ctx, certs, NULL)) {
+            X509err(X509_F_X509_LOAD_CERT_FILE, ERR_R_MALLOC_FAILURE);
+            goto err;
         }
         ret = count;
     } else if (type == X509_FILETYPE_ASN1) {
@@ -124,6 +136,7 @@ int X509_load_cert_file(X509_LOOKUP *ctx, const char *file, int type)
         X509err(X509_F_X509_LOAD_CERT_FILE, X509_R_NO_CERTIFICATE_FOUND);
  err:
     X509_free(x);
+    sk_X509_pop_free(certs, X509_free);
     BIO_free(in);
     return ret;
 }
@@ -134,6 +147,7 @@ int X509_load_crl_file(X509_LOOKUP *ctx, const char *file, int type)
     BIO *in = NULL;
     int i, count = 0;
     X509_CRL *x = NULL;
+    STACK_OF(X509_CRL) *crls = NULL;
 
     in = BIO_new(BIO_s_file());
 
@@ -143,8 +157,13 @@ int X509_load_crl_file(X509_LOOKUP *ctx, const char *file, int type)
     }
 
     if (type == X509_FILETYPE_PEM) {
+        if ((crls = sk_X509_CRL_new_null()) == NULL) {
+            X509err(X509_F_X509_LOAD_CRL_FILE, ERR_R_MALLOC_FAILURE);
+            goto err;
+        }
         for (;;) {
-            x = PEM_read_bio_X509_CRL(in, NULL, NULL, "");
+            x = PEM_ASN1_read_bio((d2i_of_void *)d2i_X509_CRL_lazy,
+                                  PEM_STRING_X509_CRL, in, NULL, NULL, "");
             if (x == NULL) {
                 if ((ERR_GET_REASON(ERR_peek_last_error()) ==
                      PEM_R_NO_START_LINE) && (count > 0)) {
@@ -152,19 +171,25 @@ int X509_load_crl_file(X509_LOOKUP *ctx, const char *file, int type)
                     break;
                 } else {
                     X509err(X509_F_X509_LOAD_CRL_FILE, ERR_R_PEM_LIB);
+                    x509_store_add_batch(ctx->store_ctx, NULL, crls);
                     goto err;
                 }
             }
-            i = X509_STORE_add_crl(ctx->store_ctx, x);
-            if (!i)
+            if (!sk_X509_CRL_push(crls, x)) {
+                X509err(X509_F_X509_LOAD_CRL_FILE, ERR_R_MALLOC_FAILURE);
                 goto err;
-            count++;
-            X509_CRL_free(x);
+            }
             x = NULL;
+            count++;
+        }
+        if (!x509_store_add_batch(ctx->store_ctx, NULL, crls)) {
+            X509err(X509_F_X509_LOAD_CRL_FILE, ERR_R_MALLOC_FAILURE);
+            goto err;
         }
         ret = count;
     } else if (type == X509_FILETYPE_ASN1) {
-        x = d2i_X509_CRL_bio(in, NULL);
+        x = ASN1_d2i_bio_of(X509_CRL, X509_CRL_new, d2i_X509_CRL_lazy, in,
+                            NULL);
         if (x == NULL) {
             X509err(X509_F_X509_LOAD_CRL_FILE, ERR_R_ASN1_LIB);
             goto err;
@@ -181,6 +206,7 @@ int X509_load_crl_file(X509_LOOKUP *ctx, const char *file, int type)
         X509err(X509_F_X509_LOAD_CRL_FILE, X509_R_NO_CRL_FOUND);
  err:
     X509_CRL_free(x);
+    sk_X509_CRL_pop_free(crls, X509_CRL_free);
     BIO_free(in);
     return ret;
 }
@@ -188,6 +214,8 @@ int X509_load_crl_file(X509_LOOKUP *ctx, const char *file, int type)
 int X509_load_cert_crl_file(X509_LOOKUP *ctx, const char *file, int type)
 {
     STACK_OF(X509_INFO) *inf;
+    STACK_OF(X509) *certs = NULL;
+    STACK_OF(X509_CRL) *crls = NULL;
     X509_INFO *itmp;
     BIO *in;
     int i, count = 0;
@@ -205,23 +233,30 @@ int X509_load_cert_crl_file(X509_LOOKUP *ctx, const char *file, int type)
         X509err(X509_F_X509_LOAD_CERT_CRL_FILE, ERR_R_PEM_LIB);
         return 0;
     }
+    /* These do not own their contents, |inf| does */
+    if ((certs = sk_X509_new_null()) == NULL
+        || (crls = sk_X509_CRL_new_null()) == NULL)
+        goto merr;
     for (i = 0; i < sk_X509_INFO_num(inf); i++) {
         itmp = sk_X509_INFO_value(inf, i);
-        if (itmp->x509) {
-            if (!X509_STORE_add_cert(ctx->store_ctx, itmp->x509))
-                goto err;
-            count++;
-        }
-        if (itmp->crl) {
-            if (!X509_STORE_add_crl(ctx->store_ctx, itmp->crl))
-                goto err;
-            count++;
-        }
+        if (itmp->x509 && !sk_X509_push(certs, itmp->x509))
+            goto merr;
+        if (itmp->crl && !sk_X509_CRL_push(crls, itmp->crl))
+            goto merr;
     }
+    if (!x509_store_add_batch(ctx->store_ctx, certs, crls))
+        goto merr;
+    count = sk_X509_num(certs) + sk_X509_CRL_num(crls);
     if (count == 0)
         X509err(X509_F_X509_LOAD_CERT_CRL_FILE,
                 X509_R_NO_CERTIFICATE_OR_CRL_FOUND);
- err:
+    goto end;
+
+ merr:
+    X509err(X509_F_X509_LOAD_CERT_CRL_FILE, ERR_R_MALLOC_FAILURE);
+ end:
+    sk_X509_free(certs);
+    sk_X509_CRL_free(crls);
     sk_X509_INFO_pop_free(inf, X509_INFO_free);
     return count;
 }
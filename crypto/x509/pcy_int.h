@@ -85,13 +85,21 @@ struct X509_POLICY_CACHE_st {
  * #define POLICY_CACHE_FLAG_CRITICAL POLICY_DATA_FLAG_CRITICAL
  */
 
-/* This structure represents the relationship between nodes */
+/*
+ * This structure represents the relationship between nodes.  A level has at
+ * most one node for each policy, so that the number of nodes stays bounded
+ * by the number of certificates and policies.  A node that RFC 5280 would
+ * repeat under several parents has the other parents in |extra_parents|
+ * instead, which makes the "tree" a directed acyclic graph.
+ */
 
 struct X509_POLICY_NODE_st {
     /* node data this refers to */
     const X509_POLICY_DATA *data;
     /* Parent node */
     X509_POLICY_NODE *parent;
+    /* Any other parent nodes, NULL if there are none */
+    STACK_OF(X509_POLICY_NODE) *extra_parents;
     /* Number of child nodes */
     int nchild;
 };
@@ -160,6 +168,8 @@ X509_POLICY_NODE *level_add_node(X509_POLICY_LEVEL *level,
                                  X509_POLICY_DATA *data,
                                  X509_POLICY_NODE *parent,
                                  X509_POLICY_TREE *tree);
+int policy_node_add_parent(X509_POLICY_NODE *node, X509_POLICY_NODE *parent);
+void policy_node_unlink(X509_POLICY_NODE *node);
 void policy_node_free(X509_POLICY_NODE *node);
 int policy_node_match(const X509_POLICY_LEVEL *lvl,
                       const X509_POLICY_NODE *node, const ASN1_OBJECT *oid);
@@ -99,6 +99,7 @@ STACK_OF(POLICYQUALINFO) *X509_policy_node_get0_qualifiers(const
     return node->data->qualifier_set;
 }
 
+/* A node that has several parents returns the first of them */
 const X509_POLICY_NODE *X509_policy_node_get0_parent(const X509_POLICY_NODE
                                                      *node)
 {
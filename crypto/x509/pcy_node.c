@@ -40,6 +40,23 @@ X509_POLICY_NODE *tree_find_sk(STACK_OF(X509_POLICY_NODE) *nodes,
 
 }
 
+static int node_has_parent(const X509_POLICY_NODE *node,
+                           const X509_POLICY_NODE *parent)
+{
+    int i;
+
+    if (node->parent == parent)
+        return 1;
+    for (i = 0; i < sk_X509_POLICY_NODE_num(node->extra_parents); i++)
+        if (sk_X509_POLICY_NODE_value(node->extra_parents, i) == parent)
+            return 1;
+    return 0;
+}
+
+/*
+ * Find the node for |id| in |level|, provided that |parent| is one of its
+ * parents unless |parent| is NULL.
+ */
 X509_POLICY_NODE *level_find_node(const X509_POLICY_LEVEL *level,
                                   const X509_POLICY_NODE *parent,
                                   const ASN1_OBJECT *id)
@@ -48,10 +65,9 @@ X509_POLICY_NODE *level_find_node(const X509_POLICY_LEVEL *level,
     int i;
     for (i = 0; i < sk_X509_POLICY_NODE_num(level->nodes); i++) {
         node = sk_X509_POLICY_NODE_value(level->nodes, i);
-        if (node->parent == parent) {
-            if (!OBJ_cmp(node->data->valid_policy, id))
-                return node;
-        }
+        if (!OBJ_cmp(node->data->valid_policy, id))
+            return parent == NULL || node_has_parent(node, parent) ? node
+                                                                   : NULL;
     }
     return NULL;
 }
@@ -113,8 +129,43 @@ X509_POLICY_NODE *level_add_node(X509_POLICY_LEVEL *level,
     return NULL;
 }
 
+/*
+ * Link |node| to one more |parent|, in place of a copy of |node| under that
+ * parent.
+ */
+int policy_node_add_parent(X509_POLICY_NODE *node, X509_POLICY_NODE *parent)
+{
+    if (node_has_parent(node, parent))
+        return 1;
+    if (node->extra_parents == NULL
+        && (node->extra_parents = sk_X509_POLICY_NODE_new_null()) == NULL) {
+        X509V3err(0, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    if (!sk_X509_POLICY_NODE_push(node->extra_parents, parent)) {
+        X509V3err(0, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    parent->nchild++;
+    return 1;
+}
+
+/* Remove |node| from the children of all its parents before it is freed */
+void policy_node_unlink(X509_POLICY_NODE *node)
+{
+    int i;
+
+    if (node->parent != NULL)
+        node->parent->nchild--;
+    for (i = 0; i < sk_X509_POLICY_NODE_num(node->extra_parents); i++)
+        sk_X509_POLICY_NODE_value(node->extra_parents, i)->nchild--;
+}
+
 void policy_node_free(X509_POLICY_NODE *node)
 {
+    if (node == NULL)
+        return;
+    sk_X509_POLICY_NODE_free(node->extra_parents);
     OPENSSL_free(node);
 }
 
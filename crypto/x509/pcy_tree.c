@@ -241,19 +241,27 @@ static int tree_link_matching_nodes(X509_POLICY_LEVEL *curr,
                                     X509_POLICY_DATA *data)
 {
     X509_POLICY_LEVEL *last = curr - 1;
-    int i, matched = 0;
+    X509_POLICY_NODE *child = NULL;
+    int i;
 
-    /* Iterate through all in nodes linking matches */
+    /*
+     * Iterate through all in nodes linking matches.  A single node is added
+     * for all of them, copies of it under each parent would make the tree
+     * grow exponentially with policy mappings.
+     */
     for (i = 0; i < sk_X509_POLICY_NODE_num(last->nodes); i++) {
         X509_POLICY_NODE *node = sk_X509_POLICY_NODE_value(last->nodes, i);
 
-        if (policy_node_match(last, node, data->valid_policy)) {
-            if (level_add_node(curr, data, node, NULL) == NULL)
+        if (!policy_node_match(last, node, data->valid_policy))
+            continue;
+        if (child == NULL) {
+            if ((child = level_add_node(curr, data, node, NULL)) == NULL)
                 return 0;
-            matched = 1;
+        } else if (!policy_node_add_parent(child, node)) {
+            return 0;
         }
     }
-    if (!matched && last->anyPolicy) {
+    if (child == NULL && last->anyPolicy) {
         if (level_add_node(curr, data, last->anyPolicy, NULL) == NULL)
             return 0;
     }
@@ -293,9 +301,13 @@ static int tree_add_unmatched(X509_POLICY_LEVEL *curr,
                               X509_POLICY_NODE *node, X509_POLICY_TREE *tree)
 {
     X509_POLICY_DATA *data;
+    X509_POLICY_NODE *child;
 
     if (id == NULL)
         id = node->data->valid_policy;
+    /* Another parent may have added the policy to this level already */
+    if ((child = level_find_node(curr, NULL, id)) != NULL)
+        return policy_node_add_parent(child, node);
     /*
      * Create a new node with qualifiers from anyPolicy and id from unmatched
      * node.
@@ -394,8 +406,8 @@ static int tree_prune(X509_POLICY_TREE *tree, X509_POLICY_LEVEL *curr)
             node = sk_X509_POLICY_NODE_value(nodes, i);
             /* Delete any mapped data: see RFC3280 XXXX */
             if (node->data->flags & POLICY_DATA_FLAG_MAP_MASK) {
-                node->parent->nchild--;
-                OPENSSL_free(node);
+                policy_node_unlink(node);
+                policy_node_free(node);
                 (void)sk_X509_POLICY_NODE_delete(nodes, i);
             }
         }
@@ -407,15 +419,14 @@ static int tree_prune(X509_POLICY_TREE *tree, X509_POLICY_LEVEL *curr)
         for (i = sk_X509_POLICY_NODE_num(nodes) - 1; i >= 0; i--) {
             node = sk_X509_POLICY_NODE_value(nodes, i);
             if (node->nchild == 0) {
-                node->parent->nchild--;
-                OPENSSL_free(node);
+                policy_node_unlink(node);
+                policy_node_free(node);
                 (void)sk_X509_POLICY_NODE_delete(nodes, i);
             }
         }
         if (curr->anyPolicy && !curr->anyPolicy->nchild) {
-            if (curr->anyPolicy->parent)
-                curr->anyPolicy->parent->nchild--;
-            OPENSSL_free(curr->anyPolicy);
+            policy_node_unlink(curr->anyPolicy);
+            policy_node_free(curr->anyPolicy);
             curr->anyPolicy = NULL;
         }
         if (curr == tree->levels) {
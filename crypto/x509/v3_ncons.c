@@ -10,9 +10,11 @@
 #include "internal/cryptlib.h"
 #include "internal/numbers.h"
 #include <stdio.h>
+#include <stdlib.h>
 #include "internal/asn1_int.h"
 #include <openssl/asn1t.h>
 #include <openssl/conf.h>
+#include <openssl/objects.h>
 #include <openssl/x509v3.h>
 #include <openssl/bn.h>
 
@@ -29,7 +31,13 @@ static int do_i2r_name_constraints(const X509V3_EXT_METHOD *method,
                                    int ind, const char *name);
 static int print_nc_ipadd(BIO *bp, ASN1_OCTET_STRING *ip);
 
+static int nc_check(X509 *x, NAME_CONSTRAINTS *nc, const X509_NC_INDEX *idx);
+static int nc_check_CN(X509 *x, NAME_CONSTRAINTS *nc,
+                       const X509_NC_INDEX *idx);
 static int nc_match(GENERAL_NAME *gen, NAME_CONSTRAINTS *nc);
+static int nc_match_idx(GENERAL_NAME *gen, NAME_CONSTRAINTS *nc,
+                        const X509_NC_INDEX *idx);
+static int nc_idx_fallbacks(X509 *x, const X509_NC_INDEX *idx);
 static int nc_match_single(GENERAL_NAME *sub, GENERAL_NAME *gen);
 static int nc_dn(X509_NAME *sub, X509_NAME *nm);
 static int nc_dns(ASN1_IA5STRING *sub, ASN1_IA5STRING *dns);
@@ -64,6 +72,39 @@ ASN1_SEQUENCE(NAME_CONSTRAINTS) = {
 IMPLEMENT_ASN1_ALLOC_FUNCTIONS(GENERAL_SUBTREE)
 IMPLEMENT_ASN1_ALLOC_FUNCTIONS(NAME_CONSTRAINTS)
 
+/*
+ * Name constraints compiled once per CA certificate.  The DNS name, email
+ * address and IP address subtrees are turned into sorted arrays of keys, and
+ * a name is matched by looking up the few keys that could match it instead
+ * of comparing it with every subtree.  Subtrees of other types, and of any
+ * type with a subtree that cannot be keyed, are left in |rest| and compared
+ * one by one as before.
+ */
+
+#define NC_IDX_DNS      0
+#define NC_IDX_EMAIL    1
+#define NC_IDX_IP       2
+#define NC_IDX_NUM      3
+
+typedef struct {
+    unsigned char *data;
+    size_t len;
+} NC_KEY;
+
+typedef struct {
+    NC_KEY *keys[NC_IDX_NUM];
+    int num[NC_IDX_NUM];
+    /* Nonzero for each IPv4 and IPv6 prefix length used by a key */
+    unsigned char v4len[33];
+    unsigned char v6len[129];
+} NC_KEYS;
+
+struct x509_nc_index_st {
+    int indexed[NC_IDX_NUM];
+    NC_KEYS permitted, excluded;
+    NAME_CONSTRAINTS rest;      /* The subtrees are owned by the certificate */
+};
+
 /*
  * We cannot use strncasecmp here because that applies locale specific rules.
  * For example in Turkish 'I' is not the uppercase character for 'i'. We need to
@@ -211,6 +252,8 @@ static int print_nc_ipadd(BIO *bp, ASN1_OCTET_STRING *ip)
 }
 
 #define NAME_CHECK_MAX (1 << 20)
+/* What looking up a name in the index counts as, in subtree comparisons */
+#define NAME_CHECK_INDEX_COST 64
 
 static int add_lengths(int *out, int a, int b)
 {
@@ -240,7 +283,18 @@ static int add_lengths(int *out, int a, int b)
 
 int NAME_CONSTRAINTS_check(X509 *x, NAME_CONSTRAINTS *nc)
 {
-    int r, i, name_count, constraint_count;
+    return nc_check(x, nc, NULL);
+}
+
+/* NAME_CONSTRAINTS_check() with the constraints of CA certificate |ca| */
+int x509_nc_check(X509 *x, const X509 *ca)
+{
+    return nc_check(x, ca->nc, ca->nc_index);
+}
+
+static int nc_check(X509 *x, NAME_CONSTRAINTS *nc, const X509_NC_INDEX *idx)
+{
+    int r, i, name_count, constraint_count, rest_count, fallbacks;
     X509_NAME *nm;
 
     nm = X509_get_subject_name(x);
@@ -253,16 +307,36 @@ int NAME_CONSTRAINTS_check(X509 *x, NAME_CONSTRAINTS *nc)
                      sk_GENERAL_NAME_num(x->altname))
         || !add_lengths(&constraint_count,
                         sk_GENERAL_SUBTREE_num(nc->permittedSubtrees),
-                        sk_GENERAL_SUBTREE_num(nc->excludedSubtrees))
-        || (name_count > 0 && constraint_count > NAME_CHECK_MAX / name_count))
+                        sk_GENERAL_SUBTREE_num(nc->excludedSubtrees)))
         return X509_V_ERR_UNSPECIFIED;
+    if (idx == NULL) {
+        if (name_count > 0 && constraint_count > NAME_CHECK_MAX / name_count)
+            return X509_V_ERR_UNSPECIFIED;
+    } else {
+        /*
+         * Every name is looked up in the index or compared with the
+         * subtrees that were left out of it, and only the names that the
+         * index cannot take are compared with all of the subtrees.
+         */
+        fallbacks = nc_idx_fallbacks(x, idx);
+        if (!add_lengths(&rest_count,
+                         sk_GENERAL_SUBTREE_num(idx->rest.permittedSubtrees),
+                         sk_GENERAL_SUBTREE_num(idx->rest.excludedSubtrees))
+            || !add_lengths(&rest_count, rest_count, NAME_CHECK_INDEX_COST)
+            || (name_count > 0 && rest_count > NAME_CHECK_MAX / name_count))
+            return X509_V_ERR_UNSPECIFIED;
+        if (fallbacks > 0
+            && constraint_count
+               > (NAME_CHECK_MAX - name_count * rest_count) / fallbacks)
+            return X509_V_ERR_UNSPECIFIED;
+    }
 
     if (X509_NAME_entry_count(nm) > 0) {
         GENERAL_NAME gntmp;
         gntmp.type = GEN_DIRNAME;
         gntmp.d.directoryName = nm;
 
-        r = nc_match(&gntmp, nc);
+        r = nc_match_idx(&gntmp, nc, idx);
 
         if (r != X509_V_OK)
             return r;
@@ -282,7 +356,7 @@ int NAME_CONSTRAINTS_check(X509 *x, NAME_CONSTRAINTS *nc)
             if (gntmp.d.rfc822Name->type != V_ASN1_IA5STRING)
                 return X509_V_ERR_UNSUPPORTED_NAME_SYNTAX;
 
-            r = nc_match(&gntmp, nc);
+            r = nc_match_idx(&gntmp, nc, idx);
 
             if (r != X509_V_OK)
                 return r;
@@ -292,7 +366,7 @@ int NAME_CONSTRAINTS_check(X509 *x, NAME_CONSTRAINTS *nc)
 
     for (i = 0; i < sk_GENERAL_NAME_num(x->altname); i++) {
         GENERAL_NAME *gen = sk_GENERAL_NAME_value(x->altname, i);
-        r = nc_match(gen, nc);
+        r = nc_match_idx(gen, nc, idx);
         if (r != X509_V_OK)
             return r;
     }
@@ -398,6 +472,17 @@ static int cn2dnsid(ASN1_STRING *cn, unsigned char **dnsid, size_t *idlen)
  * Check CN against DNS-ID name constraints.
  */
 int NAME_CONSTRAINTS_check_CN(X509 *x, NAME_CONSTRAINTS *nc)
+{
+    return nc_check_CN(x, nc, NULL);
+}
+
+int x509_nc_check_CN(X509 *x, const X509 *ca)
+{
+    return nc_check_CN(x, ca->nc, ca->nc_index);
+}
+
+static int nc_check_CN(X509 *x, NAME_CONSTRAINTS *nc,
+                       const X509_NC_INDEX *idx)
 {
     int r, i;
     X509_NAME *nm = X509_get_subject_name(x);
@@ -431,7 +516,7 @@ int NAME_CONSTRAINTS_check_CN(X509 *x, NAME_CONSTRAINTS *nc)
 
         stmp.length = idlen;
         stmp.data = idval;
-        r = nc_match(&gntmp, nc);
+        r = nc_match_idx(&gntmp, nc, idx);
         OPENSSL_free(idval);
         if (r != X509_V_OK)
             return r;
@@ -546,6 +631,8 @@ static int nc_match_single(GENERAL_NAME *gen, GENERAL_NAME *base)
 static int nc_dn(X509_NAME *nm, X509_NAME *base)
 {
     /* Ensure canonical encodings are up to date.  */
+    if (!x509_name_expand(nm) || !x509_name_expand(base))
+        return X509_V_ERR_OUT_OF_MEM;
     if (nm->modified && i2d_X509_NAME(nm, NULL) < 0)
         return X509_V_ERR_OUT_OF_MEM;
     if (base->modified && i2d_X509_NAME(base, NULL) < 0)
@@ -698,3 +785,412 @@ static int nc_ip(ASN1_OCTET_STRING *ip, ASN1_OCTET_STRING *base)
     return X509_V_OK;
 
 }
+
+/*
+ * Indexed name constraints.  A DNS subtree "B" matches the name "B" and the
+ * names that end in ".B", or in "B" when B starts with '.'; its key is B in
+ * lower case.  An email subtree is keyed on its host part in lower case and
+ * its case sensitive local part, if any: "L@host" is "L@host" and both
+ * "@host" and "host" are "@host", but a bare ".domain" is kept as it is to
+ * match the hosts in the domain.  An IP subtree is keyed on its masked
+ * address followed by the length of its mask.  The keys that could match a
+ * name are all suffixes of it, once its host part is in lower case, or are
+ * its address masked with each of the mask lengths in use.
+ */
+
+static int nc_key_cmp(const NC_KEY *a, const NC_KEY *b)
+{
+    size_t len = a->len < b->len ? a->len : b->len;
+    int r = len > 0 ? memcmp(a->data, b->data, len) : 0;
+
+    if (r != 0)
+        return r;
+    return a->len < b->len ? -1 : a->len > b->len;
+}
+
+static int nc_key_qsort_cmp(const void *a, const void *b)
+{
+    return nc_key_cmp(a, b);
+}
+
+DECLARE_OBJ_BSEARCH_CMP_FN(NC_KEY, NC_KEY, nc_key);
+IMPLEMENT_OBJ_BSEARCH_CMP_FN(NC_KEY, NC_KEY, nc_key);
+
+static int nc_idx_type(int type)
+{
+    switch (type) {
+    case GEN_DNS:
+        return NC_IDX_DNS;
+    case GEN_EMAIL:
+        return NC_IDX_EMAIL;
+    case GEN_IPADD:
+        return NC_IDX_IP;
+    }
+    return -1;
+}
+
+/* Copy |len| characters lowering their ASCII case like ia5casecmp() */
+static void nc_lower(unsigned char *out, const unsigned char *in, size_t len)
+{
+    for (; len > 0; len--, in++, out++)
+        *out = *in >= 0x41 /* A */ && *in <= 0x5A /* Z */ ? *in + 0x20 : *in;
+}
+
+/* Returns the length of a contiguous network mask, -1 if it has holes */
+static int nc_mask_len(const unsigned char *mask, int len)
+{
+    int i, bits = 0;
+    unsigned char m;
+
+    for (i = 0; i < len && mask[i] == 0xff; i++)
+        bits += 8;
+    if (i == len)
+        return bits;
+    for (m = mask[i]; (m & 0x80) != 0; m <<= 1)
+        bits++;
+    if (m != 0)
+        return -1;
+    for (i++; i < len; i++)
+        if (mask[i] != 0)
+            return -1;
+    return bits;
+}
+
+/* Write |addr| masked to |bits| and then |bits| itself to |key| */
+static void nc_ip_key(unsigned char *key, const unsigned char *addr, int len,
+                      int bits)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (8 * (i + 1) <= bits)
+            key[i] = addr[i];
+        else if (8 * i < bits)
+            key[i] = addr[i] & (0xff << (8 * (i + 1) - bits));
+        else
+            key[i] = 0;
+    }
+    key[len] = (unsigned char)bits;
+}
+
+static int nc_subtree_indexable(GENERAL_SUBTREE *sub)
+{
+    ASN1_STRING *base = sub->base->d.ia5;
+
+    if (!nc_minmax_valid(sub) || base->data == NULL)
+        return 0;
+    if (sub->base->type == GEN_IPADD)
+        return (base->length == 8 || base->length == 32)
+            && nc_mask_len(base->data + base->length / 2,
+                           base->length / 2) >= 0;
+    /* Subtrees with embedded NULs have to be compared as strings */
+    return memchr(base->data, 0, base->length) == NULL;
+}
+
+static int nc_key_set(NC_KEY *key, NC_KEYS *keys, GENERAL_NAME *base)
+{
+    ASN1_STRING *str = base->d.ia5;
+    const unsigned char *p = str->data, *at;
+    size_t len = str->length;
+    int bits;
+
+    if (base->type == GEN_IPADD) {
+        len /= 2;
+        bits = nc_mask_len(p + len, len);
+        if ((key->data = OPENSSL_malloc(len + 1)) == NULL)
+            return 0;
+        nc_ip_key(key->data, p, len, bits);
+        key->len = len + 1;
+        if (len == 4)
+            keys->v4len[bits] = 1;
+        else
+            keys->v6len[bits] = 1;
+        return 1;
+    }
+
+    at = base->type == GEN_EMAIL ? memchr(p, '@', len) : NULL;
+    key->len = len;
+    if (base->type == GEN_EMAIL && at == NULL && (len == 0 || *p != '.'))
+        key->len++;
+    if ((key->data = OPENSSL_malloc(key->len > 0 ? key->len : 1)) == NULL)
+        return 0;
+    if (at != NULL) {
+        memcpy(key->data, p, at - p + 1);
+        nc_lower(key->data + (at - p) + 1, at + 1, len - (at - p) - 1);
+    } else if (key->len > len) {
+        /* "host" is the same as "@host" */
+        key->data[0] = '@';
+        nc_lower(key->data + 1, p, len);
+    } else {
+        nc_lower(key->data, p, len);
+    }
+    return 1;
+}
+
+/*
+ * Key the subtrees of the types in |idx->indexed| into |keys|, and add the
+ * others to |*rest|.
+ */
+static int nc_keys_build(NC_KEYS *keys, STACK_OF(GENERAL_SUBTREE) **rest,
+                         const X509_NC_INDEX *idx,
+                         STACK_OF(GENERAL_SUBTREE) *subs)
+{
+    GENERAL_SUBTREE *sub;
+    int i, t, num[NC_IDX_NUM] = { 0, 0, 0 };
+
+    for (i = 0; i < sk_GENERAL_SUBTREE_num(subs); i++) {
+        sub = sk_GENERAL_SUBTREE_value(subs, i);
+        t = nc_idx_type(sub->base->type);
+        if (t >= 0 && idx->indexed[t]) {
+            num[t]++;
+            continue;
+        }
+        if (*rest == NULL && (*rest = sk_GENERAL_SUBTREE_new_null()) == NULL)
+            return 0;
+        if (!sk_GENERAL_SUBTREE_push(*rest, sub))
+            return 0;
+    }
+    for (t = 0; t < NC_IDX_NUM; t++)
+        if (num[t] > 0
+            && (keys->keys[t] = OPENSSL_malloc(num[t] * sizeof(NC_KEY))) == NULL)
+            return 0;
+
+    for (i = 0; i < sk_GENERAL_SUBTREE_num(subs); i++) {
+        sub = sk_GENERAL_SUBTREE_value(subs, i);
+        t = nc_idx_type(sub->base->type);
+        if (t < 0 || !idx->indexed[t])
+            continue;
+        if (!nc_key_set(&keys->keys[t][keys->num[t]], keys, sub->base))
+            return 0;
+        keys->num[t]++;
+    }
+
+    for (t = 0; t < NC_IDX_NUM; t++)
+        if (keys->num[t] > 1)
+            qsort(keys->keys[t], keys->num[t], sizeof(NC_KEY),
+                  nc_key_qsort_cmp);
+    return 1;
+}
+
+static void nc_keys_free(NC_KEYS *keys)
+{
+    int i, t;
+
+    for (t = 0; t < NC_IDX_NUM; t++) {
+        for (i = 0; i < keys->num[t]; i++)
+            OPENSSL_free(keys->keys[t][i].data);
+        OPENSSL_free(keys->keys[t]);
+    }
+}
+
+/*
+ * Returns NULL if there are no constraints or on allocation failure, the
+ * constraints are then only compared one by one.
+ */
+X509_NC_INDEX *x509_nc_index_new(NAME_CONSTRAINTS *nc)
+{
+    X509_NC_INDEX *idx;
+    STACK_OF(GENERAL_SUBTREE) *subs;
+    GENERAL_SUBTREE *sub;
+    int i, j, t;
+
+    if (nc == NULL || (idx = OPENSSL_zalloc(sizeof(*idx))) == NULL)
+        return NULL;
+
+    for (t = 0; t < NC_IDX_NUM; t++)
+        idx->indexed[t] = 1;
+    for (j = 0; j < 2; j++) {
+        subs = j == 0 ? nc->permittedSubtrees : nc->excludedSubtrees;
+        for (i = 0; i < sk_GENERAL_SUBTREE_num(subs); i++) {
+            sub = sk_GENERAL_SUBTREE_value(subs, i);
+            if ((t = nc_idx_type(sub->base->type)) >= 0
+                && !nc_subtree_indexable(sub))
+                idx->indexed[t] = 0;
+        }
+    }
+
+    if (!nc_keys_build(&idx->permitted, &idx->rest.permittedSubtrees, idx,
+                       nc->permittedSubtrees)
+        || !nc_keys_build(&idx->excluded, &idx->rest.excludedSubtrees, idx,
+                          nc->excludedSubtrees)) {
+        x509_nc_index_free(idx);
+        return NULL;
+    }
+    return idx;
+}
+
+void x509_nc_index_free(X509_NC_INDEX *idx)
+{
+    if (idx == NULL)
+        return;
+    nc_keys_free(&idx->permitted);
+    nc_keys_free(&idx->excluded);
+    sk_GENERAL_SUBTREE_free(idx->rest.permittedSubtrees);
+    sk_GENERAL_SUBTREE_free(idx->rest.excludedSubtrees);
+    OPENSSL_free(idx);
+}
+
+static int nc_keys_find(const NC_KEYS *keys, int t, const unsigned char *data,
+                        size_t len)
+{
+    NC_KEY key;
+
+    key.data = (unsigned char *)data;
+    key.len = len;
+    return OBJ_bsearch_nc_key(&key, keys->keys[t], keys->num[t]) != NULL;
+}
+
+/*
+ * Look up the keys that could match the name |buf|, with its host part in
+ * lower case and for an email address its first '@' at offset |at|, or
+ * the IP address |buf|.
+ */
+static int nc_keys_match(const NC_KEYS *keys, int t, const unsigned char *buf,
+                         size_t len, size_t at)
+{
+    const unsigned char *lens = len == 4 ? keys->v4len : keys->v6len;
+    unsigned char key[17];
+    size_t i, start = at + 1;
+    int bits;
+
+    if (keys->num[t] == 0)
+        return 0;
+
+    switch (t) {
+    case NC_IDX_IP:
+        for (bits = 0; bits <= 8 * (int)len; bits++) {
+            if (!lens[bits])
+                continue;
+            nc_ip_key(key, buf, len, bits);
+            if (nc_keys_find(keys, t, key, len + 1))
+                return 1;
+        }
+        return 0;
+
+    case NC_IDX_DNS:
+        /* The name itself, any name, then its parent domains */
+        if (nc_keys_find(keys, t, buf, len)
+            || nc_keys_find(keys, t, buf + len, 0))
+            return 1;
+        for (i = 0; i < len; i++)
+            if (buf[i] == '.'
+                && (nc_keys_find(keys, t, buf + i, len - i)
+                    || nc_keys_find(keys, t, buf + i + 1, len - i - 1)))
+                return 1;
+        return 0;
+
+    default:
+        /* The address itself, any address at its host, then ".domain" */
+        if (nc_keys_find(keys, t, buf, len)
+            || nc_keys_find(keys, t, buf + at, len - at))
+            return 1;
+        for (i = start; i < len; i++)
+            if (buf[i] == '@')
+                start = i + 1;
+        for (i = start; i < len; i++)
+            if (buf[i] == '.' && nc_keys_find(keys, t, buf + i, len - i))
+                return 1;
+        return 0;
+    }
+}
+
+/*
+ * Whether the name |str| of the indexed type |t| has to be compared with
+ * each subtree, which leaves what to make of a bad name to nc_match()
+ */
+static int nc_keys_fallback(const ASN1_STRING *str, const X509_NC_INDEX *idx,
+                            int t)
+{
+    if (idx->permitted.num[t] == 0 && idx->excluded.num[t] == 0)
+        return 0;
+    if (t == NC_IDX_IP)
+        return str->length != 4 && str->length != 16;
+    return str->data == NULL || memchr(str->data, 0, str->length) != NULL;
+}
+
+/* The number of names of |x| that nc_match_keys() cannot take */
+static int nc_idx_fallbacks(X509 *x, const X509_NC_INDEX *idx)
+{
+    X509_NAME *nm = X509_get_subject_name(x);
+    GENERAL_NAME *gen;
+    int i, t, n = 0;
+
+    if (idx->indexed[NC_IDX_EMAIL]) {
+        for (i = -1;;) {
+            i = X509_NAME_get_index_by_NID(nm, NID_pkcs9_emailAddress, i);
+            if (i == -1)
+                break;
+            if (nc_keys_fallback(
+                    X509_NAME_ENTRY_get_data(X509_NAME_get_entry(nm, i)),
+                    idx, NC_IDX_EMAIL))
+                n++;
+        }
+    }
+    for (i = 0; i < sk_GENERAL_NAME_num(x->altname); i++) {
+        gen = sk_GENERAL_NAME_value(x->altname, i);
+        t = nc_idx_type(gen->type);
+        if (t >= 0 && idx->indexed[t] && nc_keys_fallback(gen->d.ia5, idx, t))
+            n++;
+    }
+    return n;
+}
+
+/*
+ * nc_match() for a name of an indexed type, with the same results.  Returns
+ * -1 if the name has to be compared with each subtree instead.
+ */
+static int nc_match_keys(GENERAL_NAME *gen, const X509_NC_INDEX *idx, int t)
+{
+    const NC_KEYS *perm = &idx->permitted, *excl = &idx->excluded;
+    ASN1_STRING *str = gen->d.ia5;
+    unsigned char sbuf[256], *buf = sbuf;
+    const unsigned char *at;
+    size_t len = str->length, atoff = 0;
+    int r;
+
+    if (perm->num[t] == 0 && excl->num[t] == 0)
+        return X509_V_OK;
+    if (nc_keys_fallback(str, idx, t))
+        return -1;
+
+    if (t == NC_IDX_IP) {
+        buf = str->data;
+    } else {
+        if (t == NC_IDX_EMAIL) {
+            if ((at = memchr(str->data, '@', len)) == NULL)
+                return X509_V_ERR_UNSUPPORTED_NAME_SYNTAX;
+            atoff = at - str->data;
+        }
+        if (len > sizeof(sbuf) && (buf = OPENSSL_malloc(len)) == NULL)
+            return X509_V_ERR_OUT_OF_MEM;
+        /* The local part of an email address is case sensitive */
+        memcpy(buf, str->data, atoff);
+        nc_lower(buf + atoff, str->data + atoff, len - atoff);
+    }
+
+    if (perm->num[t] > 0 && !nc_keys_match(perm, t, buf, len, atoff))
+        r = X509_V_ERR_PERMITTED_VIOLATION;
+    else if (nc_keys_match(excl, t, buf, len, atoff))
+        r = X509_V_ERR_EXCLUDED_VIOLATION;
+    else
+        r = X509_V_OK;
+
+    if (buf != sbuf && buf != str->data)
+        OPENSSL_free(buf);
+    return r;
+}
+
+static int nc_match_idx(GENERAL_NAME *gen, NAME_CONSTRAINTS *nc,
+                        const X509_NC_INDEX *idx)
+{
+    int r, t;
+
+    if (idx == NULL)
+        return nc_match(gen, nc);
+    t = nc_idx_type(gen->type);
+    if (t < 0 || !idx->indexed[t])
+        return nc_match(gen, (NAME_CONSTRAINTS *)&idx->rest);
+    if ((r = nc_match_keys(gen, idx, t)) >= 0)
+        return r;
+    return nc_match(gen, nc);
+}
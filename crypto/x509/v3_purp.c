@@ -15,8 +15,6 @@
 #include "internal/x509_int.h"
 #include "internal/tsan_assist.h"
 
-static void x509v3_cache_extensions(X509 *x);
-
 static int check_ssl_ca(const X509 *x);
 static int check_purpose_ssl_client(const X509_PURPOSE *xp, const X509 *x,
                                     int ca);
@@ -344,7 +342,13 @@ static void setup_crldp(X509 *x)
 #define ns_reject(x, usage) \
         (((x)->ex_flags & EXFLAG_NSCERT) && !((x)->ex_nscert & (usage)))
 
-static void x509v3_cache_extensions(X509 *x)
+/*
+ * Certificates decoded with d2i_X509() get this done by x509_cb() before
+ * anybody else can see them, so that threads sharing a certificate only
+ * ever take the lock-free path below.  Lazily decoded and locally built
+ * certificates still fill the cache on first use.
+ */
+void x509v3_cache_extensions(X509 *x)
 {
     BASIC_CONSTRAINTS *bs;
     PROXY_CERT_INFO_EXTENSION *pci;
@@ -360,6 +364,13 @@ static void x509v3_cache_extensions(X509 *x)
         return;
 #endif
 
+    /*
+     * The names of a lazy certificate are decoded under x->lock, so do that
+     * before they are compared below
+     */
+    x509_name_expand(X509_get_subject_name(x));
+    x509_name_expand(X509_get_issuer_name(x));
+
     CRYPTO_THREAD_write_lock(x->lock);
     if (x->ex_flags & EXFLAG_SET) {
         CRYPTO_THREAD_unlock(x->lock);
@@ -479,6 +490,8 @@ static void x509v3_cache_extensions(X509 *x)
     x->nc = X509_get_ext_d2i(x, NID_name_constraints, &i, NULL);
     if (!x->nc && (i != -1))
         x->ex_flags |= EXFLAG_INVALID;
+    /* Without an index the constraints are just searched linearly */
+    x->nc_index = x509_nc_index_new(x->nc);
     setup_crldp(x);
 
 #ifndef OPENSSL_NO_RFC3779
@@ -552,11 +565,13 @@ static int check_ca(const X509 *x)
 void X509_set_proxy_flag(X509 *x)
 {
     x->ex_flags |= EXFLAG_PROXY;
+    x->ex_user_flags |= EXFLAG_PROXY;
 }
 
 void X509_set_proxy_pathlen(X509 *x, long l)
 {
     x->ex_pcpathlen = l;
+    x->ex_user_pcpathlen = l;
 }
 
 int X509_check_ca(X509 *x)
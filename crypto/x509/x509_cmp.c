@@ -159,6 +159,9 @@ int X509_NAME_cmp(const X509_NAME *a, const X509_NAME *b)
 
     /* Ensure canonical encoding is present and up to date */
 
+    if (!x509_name_expand(a) || !x509_name_expand(b))
+        return -2;
+
     if (!a->canon_enc || a->modified) {
         ret = i2d_X509_NAME((X509_NAME *)a, NULL);
         if (ret < 0)
@@ -186,6 +189,8 @@ unsigned long X509_NAME_hash(X509_NAME *x)
     unsigned char md[SHA_DIGEST_LENGTH];
 
     /* Make sure X509_NAME structure contains valid cached encoding */
+    if (!x509_name_expand(x))
+        return 0;
     i2d_X509_NAME(x, NULL);
     if (!EVP_Digest(x->canon_enc, x->canon_enclen, md, NULL, EVP_sha1(),
                     NULL))
@@ -91,11 +91,13 @@ X509_EXTENSION *X509_get_ext(const X509 *x, int loc)
 
 X509_EXTENSION *X509_delete_ext(X509 *x, int loc)
 {
+    x509v3_cache_clear(x);
     return X509v3_delete_ext(x->cert_info.extensions, loc);
 }
 
 int X509_add_ext(X509 *x, X509_EXTENSION *ex, int loc)
 {
+    x509v3_cache_clear(x);
     return (X509v3_add_ext(&(x->cert_info.extensions), ex, loc) != NULL);
 }
 
@@ -107,6 +109,7 @@ void *X509_get_ext_d2i(const X509 *x, int nid, int *crit, int *idx)
 int X509_add1_ext_i2d(X509 *x, int nid, void *value, int crit,
                       unsigned long flags)
 {
+    x509v3_cache_clear(x);
     return X509V3_add1_i2d(&x->cert_info.extensions, nid, value, crit,
                            flags);
 }
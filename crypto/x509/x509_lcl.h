@@ -97,6 +97,8 @@ struct x509_lookup_st {
     X509_STORE *store_ctx;      /* who owns us */
 };
 
+typedef struct x509_verify_cache_st X509_VERIFY_CACHE;
+
 /*
  * This is used to hold everything.  It is used for all certificate
  * validation.  Once we have a certificate chain, the 'verify' function is
@@ -134,6 +136,8 @@ struct x509_store_st {
     CRYPTO_EX_DATA ex_data;
     CRYPTO_REF_COUNT references;
     CRYPTO_RWLOCK *lock;
+    /* Results of earlier verifications, see X509_STORE_set_verify_cache_size */
+    X509_VERIFY_CACHE *vcache;
 };
 
 typedef struct lookup_dir_hashes_st BY_DIR_HASH;
@@ -145,3 +149,16 @@ DEFINE_STACK_OF(STACK_OF_X509_NAME_ENTRY)
 
 void x509_set_signature_info(X509_SIG_INFO *siginf, const X509_ALGOR *alg,
                              const ASN1_STRING *sig);
+int x509_store_add_batch(X509_STORE *store, STACK_OF(X509) *certs,
+                         STACK_OF(X509_CRL) *crls);
+
+/* The verification cache, the store lock protects it */
+#define X509_VERIFY_CACHE_KEY_LEN       32 /* SHA-256 */
+
+void x509_verify_cache_free(X509_VERIFY_CACHE *cache);
+void x509_verify_cache_flush(X509_VERIFY_CACHE *cache);
+int x509_verify_cache_enabled(const X509_STORE *store);
+int x509_verify_cache_key(X509_STORE_CTX *ctx, unsigned char *key);
+int x509_verify_cache_get(X509_STORE_CTX *ctx, const unsigned char *key);
+void x509_verify_cache_put(X509_STORE_CTX *ctx, const unsigned char *key,
+                           time_t expires);
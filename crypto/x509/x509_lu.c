@@ -226,6 +226,7 @@ void X509_STORE_free(X509_STORE *vfy)
 
     CRYPTO_free_ex_data(CRYPTO_EX_INDEX_X509_STORE, vfy, &vfy->ex_data);
     X509_VERIFY_PARAM_free(vfy->param);
+    x509_verify_cache_free(vfy->vcache);
     CRYPTO_THREAD_lock_free(vfy->lock);
     OPENSSL_free(vfy);
 }
@@ -263,8 +264,10 @@ X509_LOOKUP *X509_STORE_add_lookup(X509_STORE *v, X509_LOOKUP_METHOD *m)
     }
 
     lu->store_ctx = v;
-    if (sk_X509_LOOKUP_push(v->get_cert_methods, lu))
+    if (sk_X509_LOOKUP_push(v->get_cert_methods, lu)) {
+        X509_STORE_flush_verify_cache(v);
         return lu;
+    }
     /* malloc failed */
     X509err(X509_F_X509_STORE_ADD_LOOKUP, ERR_R_MALLOC_FAILURE);
     X509_LOOKUP_free(lu);
@@ -352,6 +355,9 @@ static int x509_store_add(X509_STORE *store, void *x, int crl) {
         added = sk_X509_OBJECT_push(store->objs, obj);
         ret = added != 0;
     }
+    /* A new object can change which chains are built */
+    if (added)
+        x509_verify_cache_flush(store->vcache);
     X509_STORE_unlock(store);
 
     if (added == 0)             /* obj not pushed */
@@ -360,6 +366,108 @@ static int x509_store_add(X509_STORE *store, void *x, int crl) {
     return ret;
 }
 
+/*
+ * Order objects the way x509_object_cmp() does and then by fingerprint, so
+ * that copies of the same certificate or CRL end up next to each other.
+ */
+static int x509_object_batch_cmp(const X509_OBJECT *const *a,
+                                 const X509_OBJECT *const *b)
+{
+    int ret = x509_object_cmp(a, b);
+
+    if (ret != 0)
+        return ret;
+    if ((*a)->type == X509_LU_X509)
+        return X509_cmp((*a)->data.x509, (*b)->data.x509);
+    return X509_CRL_match((*a)->data.crl, (*b)->data.crl);
+}
+
+/* Drop the entries of |sk| from |num| on, they have been freed or moved */
+static void x509_object_truncate(STACK_OF(X509_OBJECT) *sk, int num)
+{
+    while (sk_X509_OBJECT_num(sk) > num)
+        sk_X509_OBJECT_pop(sk);
+}
+
+/*
+ * Add all of |certs| and |crls| to |store|, either of which may be NULL.
+ * Adding objects one at a time re-sorts the store for every duplicate check,
+ * here duplicates are found with one sort of the batch and lookups in the
+ * store while it stays sorted, and everything is added under a single lock.
+ * Returns 1 on success or 0 if memory could not be allocated, in which case
+ * nothing is added.
+ */
+int x509_store_add_batch(X509_STORE *store, STACK_OF(X509) *certs,
+                         STACK_OF(X509_CRL) *crls)
+{
+    STACK_OF(X509_OBJECT) *batch;
+    X509_OBJECT *obj, *prev = NULL;
+    int ncerts = certs != NULL ? sk_X509_num(certs) : 0;
+    int num = ncerts + (crls != NULL ? sk_X509_CRL_num(crls) : 0);
+    int i, keep;
+
+    batch = sk_X509_OBJECT_new_reserve(x509_object_batch_cmp, num);
+    if (batch == NULL)
+        return 0;
+    for (i = 0; i < num; i++) {
+        if ((obj = X509_OBJECT_new()) == NULL)
+            goto err;
+        if (i < ncerts) {
+            obj->type = X509_LU_X509;
+            obj->data.x509 = sk_X509_value(certs, i);
+        } else {
+            obj->type = X509_LU_CRL;
+            obj->data.crl = sk_X509_CRL_value(crls, i - ncerts);
+        }
+        X509_OBJECT_up_ref_count(obj);
+        /* Cannot fail, the space is reserved */
+        sk_X509_OBJECT_push(batch, obj);
+    }
+
+    /* Drop the copies within the batch */
+    sk_X509_OBJECT_sort(batch);
+    for (i = keep = 0; i < num; i++) {
+        obj = sk_X509_OBJECT_value(batch, i);
+        if (keep > 0 && x509_object_batch_cmp((const X509_OBJECT **)&prev,
+                                              (const X509_OBJECT **)&obj) == 0) {
+            X509_OBJECT_free(obj);
+            continue;
+        }
+        sk_X509_OBJECT_set(batch, keep++, prev = obj);
+    }
+    x509_object_truncate(batch, keep);
+
+    X509_STORE_lock(store);
+    /*
+     * Look for objects that are already in the store before pushing any,
+     * pushing leaves the store unsorted.
+     */
+    for (i = keep = 0; i < sk_X509_OBJECT_num(batch); i++) {
+        obj = sk_X509_OBJECT_value(batch, i);
+        if (X509_OBJECT_retrieve_match(store->objs, obj) != NULL)
+            X509_OBJECT_free(obj);
+        else
+            sk_X509_OBJECT_set(batch, keep++, obj);
+    }
+    x509_object_truncate(batch, keep);
+    if (!sk_X509_OBJECT_reserve(store->objs, keep)) {
+        X509_STORE_unlock(store);
+        goto err;
+    }
+    for (i = 0; i < keep; i++)
+        sk_X509_OBJECT_push(store->objs, sk_X509_OBJECT_value(batch, i));
+    /* A new object can change which chains are built */
+    if (keep > 0)
+        x509_verify_cache_flush(store->vcache);
+    X509_STORE_unlock(store);
+    sk_X509_OBJECT_free(batch);
+    return 1;
+
+ err:
+    sk_X509_OBJECT_pop_free(batch, X509_OBJECT_free);
+    return 0;
+}
+
 int X509_STORE_add_cert(X509_STORE *ctx, X509 *x)
 {
     if (!x509_store_add(ctx, x, 0)) {
@@ -37,6 +37,9 @@ char *X509_NAME_oneline(const X509_NAME *a, char *buf, int len)
     unsigned char ebcdic_buf[1024];
 #endif
 
+    if (!x509_name_expand(a))
+        return NULL;
+
     if (buf == NULL) {
         if ((b = BUF_MEM_new()) == NULL)
             goto err;
@@ -23,6 +23,7 @@ int X509_set_version(X509 *x, long version)
 {
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     if (version == 0) {
         ASN1_INTEGER_free(x->cert_info.version);
         x->cert_info.version = NULL;
@@ -41,6 +42,7 @@ int X509_set_serialNumber(X509 *x, ASN1_INTEGER *serial)
 
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     in = &x->cert_info.serialNumber;
     if (in != serial)
         return ASN1_STRING_copy(in, serial);
@@ -51,6 +53,7 @@ int X509_set_issuer_name(X509 *x, X509_NAME *name)
 {
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     return X509_NAME_set(&x->cert_info.issuer, name);
 }
 
@@ -58,6 +61,7 @@ int X509_set_subject_name(X509 *x, X509_NAME *name)
 {
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     return X509_NAME_set(&x->cert_info.subject, name);
 }
 
@@ -79,6 +83,7 @@ int X509_set1_notBefore(X509 *x, const ASN1_TIME *tm)
 {
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     return x509_set1_time(&x->cert_info.validity.notBefore, tm);
 }
 
@@ -86,6 +91,7 @@ int X509_set1_notAfter(X509 *x, const ASN1_TIME *tm)
 {
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     return x509_set1_time(&x->cert_info.validity.notAfter, tm);
 }
 
@@ -93,6 +99,7 @@ int X509_set_pubkey(X509 *x, EVP_PKEY *pkey)
 {
     if (x == NULL)
         return 0;
+    x509v3_cache_clear(x);
     return X509_PUBKEY_set(&(x->cert_info.key), pkey);
 }
 
@@ -178,6 +178,8 @@ const char *X509_verify_cert_error_string(long n)
         return "Subject signature algorithm and issuer public key algorithm mismatch";
     case X509_V_ERR_NO_ISSUER_PUBLIC_KEY:
         return "Issuer certificate doesn't have a public key";
+    case X509_V_ERR_UNABLE_TO_DECODE_CRL_ENTRY:
+        return "unable to decode CRL entry";
 
     default:
         /* Printing an error number into a static buffer is not thread-safe */
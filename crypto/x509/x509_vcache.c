@@ -0,0 +1,304 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+#include <string.h>
+#include <time.h>
+#include "internal/cryptlib.h"
+#include <openssl/evp.h>
+#include <openssl/lhash.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include "internal/tsan_assist.h"
+#include "internal/x509_int.h"
+#include "x509_lcl.h"
+
+/*
+ * A cache of successful chain verifications, kept by an X509_STORE.  An entry
+ * is keyed by a digest of the leaf certificate, the untrusted certificates and
+ * the verification parameters, and holds the chain that was built for them.
+ * It is good until the first of the chain's certificates or of the CRLs that
+ * were checked expires, or until something is added to the store.
+ */
+
+typedef struct x509_verify_cache_entry_st X509_VERIFY_CACHE_ENTRY;
+
+struct x509_verify_cache_entry_st {
+    unsigned char key[X509_VERIFY_CACHE_KEY_LEN];
+    STACK_OF(X509) *chain;
+    int num_untrusted;
+    time_t expires;             /* 0 if it never does */
+    /* Insertion order, the oldest entry is evicted first */
+    X509_VERIFY_CACHE_ENTRY *prev, *next;
+};
+
+DEFINE_LHASH_OF(X509_VERIFY_CACHE_ENTRY);
+
+struct x509_verify_cache_st {
+    LHASH_OF(X509_VERIFY_CACHE_ENTRY) *entries;
+    X509_VERIFY_CACHE_ENTRY *head, *tail;
+    size_t num, max;
+    TSAN_QUALIFIER unsigned long hits;
+    TSAN_QUALIFIER unsigned long misses;
+};
+
+static unsigned long entry_hash(const X509_VERIFY_CACHE_ENTRY *e)
+{
+    unsigned long h = 0;
+    size_t i;
+
+    for (i = 0; i < sizeof(h); i++)
+        h = (h << 8) | e->key[i];
+    return h;
+}
+
+static int entry_cmp(const X509_VERIFY_CACHE_ENTRY *a,
+                     const X509_VERIFY_CACHE_ENTRY *b)
+{
+    return memcmp(a->key, b->key, sizeof(a->key));
+}
+
+static void entry_free(X509_VERIFY_CACHE_ENTRY *e)
+{
+    sk_X509_pop_free(e->chain, X509_free);
+    OPENSSL_free(e);
+}
+
+static void entry_unlink(X509_VERIFY_CACHE *cache, X509_VERIFY_CACHE_ENTRY *e)
+{
+    if (e->prev != NULL)
+        e->prev->next = e->next;
+    else
+        cache->head = e->next;
+    if (e->next != NULL)
+        e->next->prev = e->prev;
+    else
+        cache->tail = e->prev;
+    cache->num--;
+}
+
+/* Evict the oldest entries until there are no more than allowed */
+static void cache_trim(X509_VERIFY_CACHE *cache)
+{
+    X509_VERIFY_CACHE_ENTRY *e;
+
+    while (cache->num > cache->max) {
+        e = cache->head;
+        entry_unlink(cache, e);
+        (void)lh_X509_VERIFY_CACHE_ENTRY_delete(cache->entries, e);
+        entry_free(e);
+    }
+}
+
+void x509_verify_cache_flush(X509_VERIFY_CACHE *cache)
+{
+    X509_VERIFY_CACHE_ENTRY *e, *next;
+
+    if (cache == NULL)
+        return;
+    for (e = cache->head; e != NULL; e = next) {
+        next = e->next;
+        (void)lh_X509_VERIFY_CACHE_ENTRY_delete(cache->entries, e);
+        entry_free(e);
+    }
+    cache->head = cache->tail = NULL;
+    cache->num = 0;
+}
+
+void x509_verify_cache_free(X509_VERIFY_CACHE *cache)
+{
+    if (cache == NULL)
+        return;
+    x509_verify_cache_flush(cache);
+    lh_X509_VERIFY_CACHE_ENTRY_free(cache->entries);
+    OPENSSL_free(cache);
+}
+
+int x509_verify_cache_enabled(const X509_STORE *store)
+{
+    return store->vcache != NULL && store->vcache->max > 0;
+}
+
+static int digest_cert(EVP_MD_CTX *mctx, X509 *x)
+{
+    unsigned char md[EVP_MAX_MD_SIZE];
+    unsigned int len;
+
+    return X509_digest(x, EVP_sha256(), md, &len)
+        && EVP_DigestUpdate(mctx, md, len);
+}
+
+/*
+ * Everything that decides which chain is built and whether it is accepted,
+ * apart from the store contents.  Host, email and IP checks are not part of
+ * the key, they are repeated on every hit.
+ */
+int x509_verify_cache_key(X509_STORE_CTX *ctx, unsigned char *key)
+{
+    const X509_VERIFY_PARAM *vpm = ctx->param;
+    EVP_MD_CTX *mctx;
+    long params[6];
+    int i, n = sk_X509_num(ctx->untrusted);
+    int ret = 0;
+
+    memset(params, 0, sizeof(params));
+    params[0] = (long)vpm->flags;
+    params[1] = vpm->purpose;
+    params[2] = vpm->trust;
+    params[3] = vpm->depth;
+    params[4] = vpm->auth_level;
+    params[5] = n;
+
+    if ((mctx = EVP_MD_CTX_new()) == NULL
+        || !EVP_DigestInit_ex(mctx, EVP_sha256(), NULL)
+        || !EVP_DigestUpdate(mctx, params, sizeof(params))
+        || ((vpm->flags & X509_V_FLAG_USE_CHECK_TIME) != 0
+            && !EVP_DigestUpdate(mctx, &vpm->check_time,
+                                 sizeof(vpm->check_time)))
+        || !digest_cert(mctx, ctx->cert))
+        goto err;
+    for (i = 0; i < n; i++)
+        if (!digest_cert(mctx, sk_X509_value(ctx->untrusted, i)))
+            goto err;
+    ret = EVP_DigestFinal_ex(mctx, key, NULL);
+
+ err:
+    EVP_MD_CTX_free(mctx);
+    return ret;
+}
+
+/*
+ * On a hit complete |ctx->chain|, which only holds the leaf, with the
+ * cached chain and return 1.  Returns 0 on a miss.
+ */
+int x509_verify_cache_get(X509_STORE_CTX *ctx, const unsigned char *key)
+{
+    X509_STORE *store = ctx->ctx;
+    X509_VERIFY_CACHE *cache;
+    X509_VERIFY_CACHE_ENTRY tmp, *e;
+    int i, ret = 0;
+
+    memcpy(tmp.key, key, sizeof(tmp.key));
+    CRYPTO_THREAD_read_lock(store->lock);
+    if ((cache = store->vcache) == NULL || cache->max == 0)
+        goto end;
+
+    e = lh_X509_VERIFY_CACHE_ENTRY_retrieve(cache->entries, &tmp);
+    if (e == NULL || (e->expires != 0 && time(NULL) >= e->expires)) {
+        tsan_counter(&cache->misses);
+        goto end;
+    }
+    for (i = 1; i < sk_X509_num(e->chain); i++) {
+        X509 *x = sk_X509_value(e->chain, i);
+
+        if (!sk_X509_push(ctx->chain, x)) {
+            /* Fall back to a full verification */
+            while (sk_X509_num(ctx->chain) > 1)
+                X509_free(sk_X509_pop(ctx->chain));
+            goto end;
+        }
+        X509_up_ref(x);
+    }
+    ctx->num_untrusted = e->num_untrusted;
+    tsan_counter(&cache->hits);
+    ret = 1;
+
+ end:
+    CRYPTO_THREAD_unlock(store->lock);
+    return ret;
+}
+
+/* Remember that |ctx->chain| was verified, until |expires| */
+void x509_verify_cache_put(X509_STORE_CTX *ctx, const unsigned char *key,
+                           time_t expires)
+{
+    X509_STORE *store = ctx->ctx;
+    X509_VERIFY_CACHE *cache;
+    X509_VERIFY_CACHE_ENTRY *e, *old;
+
+    if ((e = OPENSSL_zalloc(sizeof(*e))) == NULL)
+        return;
+    memcpy(e->key, key, sizeof(e->key));
+    e->num_untrusted = ctx->num_untrusted;
+    e->expires = expires;
+    if ((e->chain = X509_chain_up_ref(ctx->chain)) == NULL) {
+        OPENSSL_free(e);
+        return;
+    }
+
+    X509_STORE_lock(store);
+    if ((cache = store->vcache) == NULL || cache->max == 0)
+        goto err;
+    old = lh_X509_VERIFY_CACHE_ENTRY_insert(cache->entries, e);
+    if (old != NULL) {
+        entry_unlink(cache, old);
+        entry_free(old);
+    } else if (lh_X509_VERIFY_CACHE_ENTRY_error(cache->entries)) {
+        goto err;
+    }
+    e->prev = cache->tail;
+    if (cache->tail != NULL)
+        cache->tail->next = e;
+    else
+        cache->head = e;
+    cache->tail = e;
+    cache->num++;
+
+    cache_trim(cache);
+    X509_STORE_unlock(store);
+    return;
+
+ err:
+    X509_STORE_unlock(store);
+    entry_free(e);
+}
+
+int X509_STORE_set_verify_cache_size(X509_STORE *ctx, size_t size)
+{
+    X509_VERIFY_CACHE *cache = NULL;
+    int ret = 0;
+
+    X509_STORE_lock(ctx);
+    if (ctx->vcache == NULL && size > 0) {
+        if ((cache = OPENSSL_zalloc(sizeof(*cache))) == NULL
+            || (cache->entries =
+                lh_X509_VERIFY_CACHE_ENTRY_new(entry_hash, entry_cmp)) == NULL) {
+            X509err(0, ERR_R_MALLOC_FAILURE);
+            OPENSSL_free(cache);
+            goto end;
+        }
+        ctx->vcache = cache;
+    }
+    if ((cache = ctx->vcache) != NULL) {
+        cache->max = size;
+        cache_trim(cache);
+    }
+    ret = 1;
+
+ end:
+    X509_STORE_unlock(ctx);
+    return ret;
+}
+
+void X509_STORE_flush_verify_cache(X509_STORE *ctx)
+{
+    X509_STORE_lock(ctx);
+    x509_verify_cache_flush(ctx->vcache);
+    X509_STORE_unlock(ctx);
+}
+
+void X509_STORE_get_verify_cache_stats(X509_STORE *ctx, unsigned long *hits,
+                                       unsigned long *misses)
+{
+    X509_VERIFY_CACHE *cache = ctx->vcache;
+
+    if (hits != NULL)
+        *hits = cache != NULL ? tsan_load(&cache->hits) : 0;
+    if (misses != NULL)
+        *misses = cache != NULL ? tsan_load(&cache->misses) : 0;
+}
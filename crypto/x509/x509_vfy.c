@@ -97,6 +97,8 @@ static int check_crl_chain(X509_STORE_CTX *ctx,
                            STACK_OF(X509) *cert_path,
                            STACK_OF(X509) *crl_path);
 
+static int check_crl(X509_STORE_CTX *ctx, X509_CRL *crl);
+static int cert_crl(X509_STORE_CTX *ctx, X509_CRL *crl, X509 *x);
 static int internal_verify(X509_STORE_CTX *ctx);
 
 static int null_callback(int ok, X509_STORE_CTX *e)
@@ -250,9 +252,110 @@ static int verify_chain(X509_STORE_CTX *ctx)
     return ok;
 }
 
+/*
+ * The store's verification cache is only used when nothing but the default
+ * methods can observe or change the outcome: no callbacks, no DANE, no
+ * policy tree to return and no trust settings on the leaf.
+ */
+static int verify_cache_usable(X509_STORE_CTX *ctx)
+{
+    return ctx->ctx != NULL && x509_verify_cache_enabled(ctx->ctx)
+        && ctx->parent == NULL && ctx->other_ctx == NULL && ctx->crls == NULL
+        && ctx->cert->aux == NULL
+        && (ctx->param->flags & X509_V_FLAG_POLICY_CHECK) == 0
+        && ctx->verify == internal_verify
+        && ctx->verify_cb == null_callback
+        && ctx->get_issuer == X509_STORE_CTX_get1_issuer
+        && ctx->check_issued == check_issued
+        && ctx->check_revocation == check_revocation
+        && ctx->get_crl == NULL
+        && ctx->check_crl == check_crl
+        && ctx->cert_crl == cert_crl
+        && ctx->lookup_certs == X509_STORE_CTX_get1_certs
+        && ctx->lookup_crls == X509_STORE_CTX_get1_crls;
+}
+
+/* Time at which |t| has passed, or 0 if it cannot be represented */
+static time_t verify_cache_time(const ASN1_TIME *t, time_t now)
+{
+    int day, sec;
+
+    if (!ASN1_TIME_diff(&day, &sec, NULL, t))
+        return 0;
+    return now + (time_t)day * 24 * 3600 + sec;
+}
+
+/*
+ * Set |*expires| to when the chain and the CRLs that were checked stop
+ * being valid, or to 0 if that does not depend on the current time.
+ */
+static int verify_cache_expiry(X509_STORE_CTX *ctx, time_t *expires)
+{
+    time_t now, t;
+    int i;
+
+    *expires = 0;
+    if (ctx->param->flags
+        & (X509_V_FLAG_USE_CHECK_TIME | X509_V_FLAG_NO_CHECK_TIME))
+        return 1;
+
+    now = time(NULL);
+    for (i = 0; i < sk_X509_num(ctx->chain); i++) {
+        t = verify_cache_time(X509_get0_notAfter(sk_X509_value(ctx->chain, i)),
+                              now);
+        if (t == 0)
+            return 0;
+        if (*expires == 0 || t < *expires)
+            *expires = t;
+    }
+    if (ctx->crl_expires != 0 && ctx->crl_expires < *expires)
+        *expires = ctx->crl_expires;
+    return 1;
+}
+
+/* Let the verification cache know that |crl| was relied on */
+static void verify_cache_note_crl(X509_STORE_CTX *ctx, X509_CRL *crl)
+{
+    const ASN1_TIME *next = X509_CRL_get0_nextUpdate(crl);
+    time_t t;
+
+    if (next == NULL || ctx->ctx == NULL
+        || !x509_verify_cache_enabled(ctx->ctx))
+        return;
+    /* If in doubt, make the result expire at once */
+    if ((t = verify_cache_time(next, time(NULL))) == 0)
+        t = 1;
+    if (ctx->crl_expires == 0 || t < ctx->crl_expires)
+        ctx->crl_expires = t;
+}
+
+/*
+ * verify_chain() through the store's verification cache.  A hit still does
+ * the identity checks, which are not part of the cache key.
+ */
+static int verify_chain_cached(X509_STORE_CTX *ctx, const unsigned char *key)
+{
+    time_t expires;
+    int ok;
+
+    if (x509_verify_cache_get(ctx, key)) {
+        X509_get_pubkey_parameters(NULL, ctx->chain);
+        ctx->current_cert = ctx->cert;
+        ctx->error_depth = 0;
+        return check_id(ctx);
+    }
+
+    ctx->crl_expires = 0;
+    ok = verify_chain(ctx);
+    if (ok > 0 && ctx->error == X509_V_OK && verify_cache_expiry(ctx, &expires))
+        x509_verify_cache_put(ctx, key, expires);
+    return ok;
+}
+
 int X509_verify_cert(X509_STORE_CTX *ctx)
 {
     SSL_DANE *dane = ctx->dane;
+    unsigned char key[X509_VERIFY_CACHE_KEY_LEN];
     int ret;
 
     if (ctx->cert == NULL) {
@@ -291,6 +394,8 @@ int X509_verify_cert(X509_STORE_CTX *ctx)
 
     if (DANETLS_ENABLED(dane))
         ret = dane_verify(ctx);
+    else if (verify_cache_usable(ctx) && x509_verify_cache_key(ctx, key))
+        ret = verify_chain_cached(ctx, key);
     else
         ret = verify_chain(ctx);
 
@@ -672,10 +777,10 @@ static int check_name_constraints(X509_STORE_CTX *ctx)
          * to be obeyed.
          */
         for (j = sk_X509_num(ctx->chain) - 1; j > i; j--) {
-            NAME_CONSTRAINTS *nc = sk_X509_value(ctx->chain, j)->nc;
+            X509 *ca = sk_X509_value(ctx->chain, j);
 
-            if (nc) {
-                int rv = NAME_CONSTRAINTS_check(x, nc);
+            if (ca->nc) {
+                int rv = x509_nc_check(x, ca);
 
                 /* If EE certificate check commonName too */
                 if (rv == X509_V_OK && i == 0
@@ -684,7 +789,7 @@ static int check_name_constraints(X509_STORE_CTX *ctx)
                     && ((ctx->param->hostflags
                          & X509_CHECK_FLAG_ALWAYS_CHECK_SUBJECT) != 0
                         || !has_san_id(x, GEN_DNS)))
-                    rv = NAME_CONSTRAINTS_check_CN(x, nc);
+                    rv = x509_nc_check_CN(x, ca);
 
                 switch (rv) {
                 case X509_V_OK:
@@ -897,11 +1002,13 @@ static int check_cert(X509_STORE_CTX *ctx)
         ok = ctx->check_crl(ctx, crl);
         if (!ok)
             goto done;
+        verify_cache_note_crl(ctx, crl);
 
         if (dcrl) {
             ok = ctx->check_crl(ctx, dcrl);
             if (!ok)
                 goto done;
+            verify_cache_note_crl(ctx, dcrl);
             ok = ctx->cert_crl(ctx, dcrl, x);
             if (!ok)
                 goto done;
@@ -1560,6 +1667,7 @@ static int check_crl(X509_STORE_CTX *ctx, X509_CRL *crl)
 static int cert_crl(X509_STORE_CTX *ctx, X509_CRL *crl, X509 *x)
 {
     X509_REVOKED *rev;
+    int ret;
 
     /*
      * The rules changed for this... previously if a CRL contained unhandled
@@ -1575,7 +1683,11 @@ static int cert_crl(X509_STORE_CTX *ctx, X509_CRL *crl, X509 *x)
      * Look for serial number of certificate in CRL.  If found, make sure
      * reason is not removeFromCRL.
      */
-    if (X509_CRL_get0_by_cert(crl, &rev, x)) {
+    ret = X509_CRL_get0_by_cert(crl, &rev, x);
+    if (ret < 0
+        && !verify_cb_crl(ctx, X509_V_ERR_UNABLE_TO_DECODE_CRL_ENTRY))
+        return 0;
+    if (ret > 0) {
         if (rev->reason == CRL_REASON_REMOVE_FROM_CRL)
             return 2;
         if (!verify_cb_crl(ctx, X509_V_ERR_CERT_REVOKED))
@@ -1986,16 +2098,23 @@ X509_CRL *X509_CRL_diff(X509_CRL *base, X509_CRL *newer,
 
     /* Go through revoked entries, copying as needed */
 
+    if (!x509_crl_expand(newer))
+        goto memerr;
     revs = X509_CRL_get_REVOKED(newer);
 
     for (i = 0; i < sk_X509_REVOKED_num(revs); i++) {
         X509_REVOKED *rvn, *rvtmp;
+        int found;
+
         rvn = sk_X509_REVOKED_value(revs, i);
         /*
          * Add only if not also in base. TODO: need something cleverer here
          * for some more complex CRLs covering multiple CAs.
          */
-        if (!X509_CRL_get0_by_serial(base, &rvtmp, &rvn->serialNumber)) {
+        found = X509_CRL_get0_by_serial(base, &rvtmp, &rvn->serialNumber);
+        if (found < 0)
+            goto memerr;
+        if (found == 0) {
             rvtmp = X509_REVOKED_dup(rvn);
             if (!rvtmp)
                 goto memerr;
@@ -2221,6 +2340,7 @@ int X509_STORE_CTX_init(X509_STORE_CTX *ctx, X509_STORE *store, X509 *x509,
     ctx->parent = NULL;
     ctx->dane = NULL;
     ctx->bare_ta_signed = 0;
+    ctx->crl_expires = 0;
     /* Zero ex_data to make sure we're cleanup-safe */
     memset(&ctx->ex_data, 0, sizeof(ctx->ex_data));
 
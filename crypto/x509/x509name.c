@@ -48,7 +48,7 @@ int X509_NAME_get_text_by_OBJ(X509_NAME *name, const ASN1_OBJECT *obj,
 
 int X509_NAME_entry_count(const X509_NAME *name)
 {
-    if (name == NULL)
+    if (name == NULL || !x509_name_expand(name))
         return 0;
     return sk_X509_NAME_ENTRY_num(name->entries);
 }
@@ -70,7 +70,7 @@ int X509_NAME_get_index_by_OBJ(X509_NAME *name, const ASN1_OBJECT *obj, int last
     X509_NAME_ENTRY *ne;
     STACK_OF(X509_NAME_ENTRY) *sk;
 
-    if (name == NULL)
+    if (name == NULL || !x509_name_expand(name))
         return -1;
     if (lastpos < 0)
         lastpos = -1;
@@ -86,7 +86,8 @@ int X509_NAME_get_index_by_OBJ(X509_NAME *name, const ASN1_OBJECT *obj, int last
 
 X509_NAME_ENTRY *X509_NAME_get_entry(const X509_NAME *name, int loc)
 {
-    if (name == NULL || sk_X509_NAME_ENTRY_num(name->entries) <= loc
+    if (name == NULL || !x509_name_expand(name)
+        || sk_X509_NAME_ENTRY_num(name->entries) <= loc
         || loc < 0)
         return NULL;
 
@@ -99,7 +100,8 @@ X509_NAME_ENTRY *X509_NAME_delete_entry(X509_NAME *name, int loc)
     int i, n, set_prev, set_next;
     STACK_OF(X509_NAME_ENTRY) *sk;
 
-    if (name == NULL || sk_X509_NAME_ENTRY_num(name->entries) <= loc
+    if (name == NULL || !x509_name_expand(name)
+        || sk_X509_NAME_ENTRY_num(name->entries) <= loc
         || loc < 0)
         return NULL;
 
@@ -187,7 +189,7 @@ int X509_NAME_add_entry(X509_NAME *name, const X509_NAME_ENTRY *ne, int loc,
     int n, i, inc;
     STACK_OF(X509_NAME_ENTRY) *sk;
 
-    if (name == NULL)
+    if (name == NULL || !x509_name_expand(name))
         return 0;
     sk = name->entries;
     n = sk_X509_NAME_ENTRY_num(sk);
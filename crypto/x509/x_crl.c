@@ -8,6 +8,7 @@
  */
 
 #include <stdio.h>
+#include <limits.h>
 #include "internal/cryptlib.h"
 #include <openssl/asn1t.h>
 #include <openssl/x509.h>
@@ -18,6 +19,7 @@
 static int X509_REVOKED_cmp(const X509_REVOKED *const *a,
                             const X509_REVOKED *const *b);
 static void setup_idp(X509_CRL *crl, ISSUING_DIST_POINT *idp);
+static void crl_free_serials(X509_CRL *crl);
 
 ASN1_SEQUENCE(X509_REVOKED) = {
         ASN1_EMBED(X509_REVOKED,serialNumber, ASN1_INTEGER),
@@ -79,6 +81,25 @@ ASN1_SEQUENCE_enc(X509_CRL_INFO, enc, crl_inf_cb) = {
  * for unhandled critical CRL entry extensions.
  */
 
+/* Set the revocation reason of |rev|, 0 if its extension is invalid */
+static int crl_set_reason(X509_REVOKED *rev)
+{
+    ASN1_ENUMERATED *reason;
+    int j;
+
+    reason = X509_REVOKED_get_ext_d2i(rev, NID_crl_reason, &j, NULL);
+    if (reason == NULL && j != -1)
+        return 0;
+
+    if (reason != NULL) {
+        rev->reason = ASN1_ENUMERATED_get(reason);
+        ASN1_ENUMERATED_free(reason);
+    } else {
+        rev->reason = CRL_REASON_NONE;
+    }
+    return 1;
+}
+
 static int crl_set_issuers(X509_CRL *crl)
 {
 
@@ -86,13 +107,13 @@ static int crl_set_issuers(X509_CRL *crl)
     GENERAL_NAMES *gens, *gtmp;
     STACK_OF(X509_REVOKED) *revoked;
 
-    revoked = X509_CRL_get_REVOKED(crl);
+    /* Not X509_CRL_get_REVOKED(): a lazily decoded CRL must stay so */
+    revoked = crl->crl.revoked;
 
     gens = NULL;
     for (i = 0; i < sk_X509_REVOKED_num(revoked); i++) {
         X509_REVOKED *rev = sk_X509_REVOKED_value(revoked, i);
         STACK_OF(X509_EXTENSION) *exts;
-        ASN1_ENUMERATED *reason;
         X509_EXTENSION *ext;
         gtmp = X509_REVOKED_get_ext_d2i(rev,
                                         NID_certificate_issuer, &j, NULL);
@@ -113,18 +134,11 @@ static int crl_set_issuers(X509_CRL *crl)
         }
         rev->issuer = gens;
 
-        reason = X509_REVOKED_get_ext_d2i(rev, NID_crl_reason, &j, NULL);
-        if (!reason && (j != -1)) {
+        if (!crl_set_reason(rev)) {
             crl->flags |= EXFLAG_INVALID;
             return 1;
         }
 
-        if (reason) {
-            rev->reason = ASN1_ENUMERATED_get(reason);
-            ASN1_ENUMERATED_free(reason);
-        } else
-            rev->reason = CRL_REASON_NONE;
-
         /* Check for critical CRL entry extensions */
 
         exts = rev->extensions;
@@ -168,6 +182,7 @@ static int crl_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         ASN1_INTEGER_free(crl->crl_number);
         ASN1_INTEGER_free(crl->base_crl_number);
         sk_GENERAL_NAMES_pop_free(crl->issuers, GENERAL_NAMES_free);
+        crl_free_serials(crl);
         /* fall thru */
 
     case ASN1_OP_NEW_POST:
@@ -181,6 +196,9 @@ static int crl_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         crl->issuers = NULL;
         crl->crl_number = NULL;
         crl->base_crl_number = NULL;
+        crl->lazy = 0;
+        crl->serials = NULL;
+        crl->nserials = 0;
         break;
 
     case ASN1_OP_D2I_POST:
@@ -242,6 +260,15 @@ static int crl_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         crl->flags |= EXFLAG_SET;
         break;
 
+    case ASN1_OP_I2D_PRE:
+        /*
+         * A CRL_INFO that is encoded again, rather than from its cached
+         * encoding, needs all the entries of a lazily decoded CRL.
+         */
+        if (crl->crl.enc.modified && !x509_crl_expand(crl))
+            return 0;
+        break;
+
     case ASN1_OP_FREE_POST:
         if (crl->meth->crl_free) {
             if (!crl->meth->crl_free(crl))
@@ -252,6 +279,7 @@ static int crl_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         ASN1_INTEGER_free(crl->crl_number);
         ASN1_INTEGER_free(crl->base_crl_number);
         sk_GENERAL_NAMES_pop_free(crl->issuers, GENERAL_NAMES_free);
+        crl_free_serials(crl);
         break;
     }
     return 1;
@@ -311,6 +339,530 @@ IMPLEMENT_ASN1_FUNCTIONS(X509_CRL)
 
 IMPLEMENT_ASN1_DUP_FUNCTION(X509_CRL)
 
+/*
+ * Lazily decoded CRLs: the revoked entries are not decoded, but indexed by
+ * serial number in the cached encoding of the CRL_INFO.  An entry is only
+ * decoded when a lookup finds it, and all of them when the list itself is
+ * asked for.  The objects are freed and encoded through the normal X509_CRL
+ * item.
+ */
+
+struct x509_crl_serial_st {
+    const unsigned char *der;       /* X509_REVOKED encoding in crl.enc */
+    const unsigned char *serial;    /* serial number, without sign octet */
+    int length;
+    int serial_len;
+    X509_REVOKED *rev;              /* decoded entry or NULL */
+};
+
+typedef struct x509_crl_serial_st X509_CRL_SERIAL;
+
+ASN1_ITEM_TEMPLATE(X509_REVOKED_LIST) =
+        ASN1_EX_TEMPLATE_TYPE(ASN1_TFLG_SEQUENCE_OF, 0, revoked, X509_REVOKED)
+static_ASN1_ITEM_TEMPLATE_END(X509_REVOKED_LIST)
+
+static void revoked_list_lazy_ex_free(ASN1_VALUE **pval, const ASN1_ITEM *it)
+{
+    ASN1_item_ex_free(pval, ASN1_ITEM_rptr(X509_REVOKED_LIST));
+}
+
+/*
+ * A definite length list is skipped here and indexed by crl_index_revoked()
+ * once the whole CRL is decoded, anything else is decoded as usual.
+ */
+static int revoked_list_lazy_ex_d2i(ASN1_VALUE **pval,
+                                    const unsigned char **in, long len,
+                                    const ASN1_ITEM *it, int tag, int aclass,
+                                    char opt, ASN1_TLC *ctx)
+{
+    const unsigned char *p = *in;
+    long plen;
+    int ptag, pclass, inf;
+
+    ERR_set_mark();
+    inf = ASN1_get_object(&p, &plen, &ptag, &pclass, len);
+    ERR_pop_to_mark();
+    if ((inf & 0x80) == 0
+        && (ptag != V_ASN1_SEQUENCE || pclass != V_ASN1_UNIVERSAL)) {
+        if (opt)
+            return -1;
+    } else if (inf == V_ASN1_CONSTRUCTED) {
+        revoked_list_lazy_ex_free(pval, it);
+        if (ctx != NULL)
+            ctx->valid = 0;
+        *in = p + plen;
+        return 1;
+    }
+    return ASN1_item_ex_d2i(pval, in, len, ASN1_ITEM_rptr(X509_REVOKED_LIST),
+                            -1, 0, 0, ctx);
+}
+
+static int revoked_list_lazy_ex_i2d(const ASN1_VALUE **pval,
+                                    unsigned char **out, const ASN1_ITEM *it,
+                                    int tag, int aclass)
+{
+    return ASN1_item_ex_i2d(pval, out, ASN1_ITEM_rptr(X509_REVOKED_LIST),
+                            tag, aclass);
+}
+
+static const ASN1_EXTERN_FUNCS revoked_list_lazy_ff = {
+    NULL,
+    NULL,
+    revoked_list_lazy_ex_free,
+    0,                          /* Default clear behaviour is OK */
+    revoked_list_lazy_ex_d2i,
+    revoked_list_lazy_ex_i2d,
+    NULL
+};
+
+static_ASN1_ITEM_start(X509_REVOKED_LIST_LAZY)
+        ASN1_ITYPE_EXTERN, V_ASN1_SEQUENCE, NULL, 0, &revoked_list_lazy_ff, 0,
+        "X509_REVOKED_LIST"
+ASN1_ITEM_end(X509_REVOKED_LIST_LAZY)
+
+/*
+ * Read a definite length element of universal type |tag| from |*pp|, set
+ * |*cont| and |*clen| to its contents and move |*pp| past it.  Returns 0 if
+ * the element is anything else.
+ */
+static int crl_der_get(const unsigned char **pp, const unsigned char *end,
+                       int tag, int cons, const unsigned char **cont,
+                       long *clen)
+{
+    const unsigned char *p = *pp;
+    long plen;
+    int ptag, pclass;
+
+    if (p >= end
+        || ASN1_get_object(&p, &plen, &ptag, &pclass, end - p)
+           != (cons ? V_ASN1_CONSTRUCTED : 0)
+        || ptag != tag || pclass != V_ASN1_UNIVERSAL)
+        return 0;
+    *cont = p;
+    *clen = plen;
+    *pp = p + plen;
+    return 1;
+}
+
+/* Skip any element at |*pp|, including indefinite length ones */
+static int crl_der_skip(const unsigned char **pp, const unsigned char *end,
+                        int depth)
+{
+    const unsigned char *p = *pp;
+    long plen;
+    int ptag, pclass, inf;
+
+    if (p >= end || depth > 30)
+        return 0;
+    inf = ASN1_get_object(&p, &plen, &ptag, &pclass, end - p);
+    if (inf & 0x80)
+        return 0;
+    if (inf == (V_ASN1_CONSTRUCTED | 1)) {
+        while (end - p >= 2 && (p[0] != 0 || p[1] != 0))
+            if (!crl_der_skip(&p, end, depth + 1))
+                return 0;
+        if (end - p < 2)
+            return 0;
+        plen = 2;
+    }
+    *pp = p + plen;
+    return 1;
+}
+
+/* Same checks as c2i_ASN1_INTEGER(): not empty and no superfluous octet */
+static int crl_der_integer_ok(const unsigned char *p, long len)
+{
+    if (len <= 0)
+        return 0;
+    if (len > 1 && ((p[0] == 0 && (p[1] & 0x80) == 0)
+                    || (p[0] == 0xff && (p[1] & 0x80) != 0)))
+        return 0;
+    return 1;
+}
+
+/* Same checks as c2i_ASN1_OBJECT() */
+static int crl_der_object_ok(const unsigned char *p, long len)
+{
+    long i;
+
+    if (len <= 0 || len > INT_MAX || (p[len - 1] & 0x80) != 0)
+        return 0;
+    for (i = 0; i < len; i++)
+        if (p[i] == 0x80 && (i == 0 || (p[i - 1] & 0x80) == 0))
+            return 0;
+    return 1;
+}
+
+static int crl_der_is_object(const unsigned char *p, long len, int nid)
+{
+    const ASN1_OBJECT *obj = OBJ_nid2obj(nid);
+
+    return len >= 0 && (size_t)len == OBJ_length(obj)
+        && memcmp(p, OBJ_get0_data(obj), len) == 0;
+}
+
+/*
+ * Check the extensions of a revoked entry, which must all be in DER and such
+ * that their meaning doesn't depend on the other entries: there must not be
+ * a certificate issuer extension.  |*critical| is set if one of them is
+ * critical.
+ */
+static int crl_scan_entry_exts(const unsigned char *p, long len,
+                               int *critical)
+{
+    const unsigned char *end = p + len, *c, *cend, *obj, *v, *vend, *e;
+    long clen, objlen, vlen, elen;
+    int nreason = 0;
+
+    while (p < end) {
+        if (!crl_der_get(&p, end, V_ASN1_SEQUENCE, 1, &c, &clen))
+            return 0;
+        cend = c + clen;
+        if (!crl_der_get(&c, cend, V_ASN1_OBJECT, 0, &obj, &objlen)
+            || !crl_der_object_ok(obj, objlen)
+            || crl_der_is_object(obj, objlen, NID_certificate_issuer))
+            return 0;
+        if (crl_der_get(&c, cend, V_ASN1_BOOLEAN, 0, &v, &vlen)) {
+            if (vlen != 1)
+                return 0;
+            if (v[0] != 0)
+                *critical = 1;
+        }
+        if (!crl_der_get(&c, cend, V_ASN1_OCTET_STRING, 0, &v, &vlen)
+            || c != cend)
+            return 0;
+        if (crl_der_is_object(obj, objlen, NID_crl_reason)) {
+            vend = v + vlen;
+            if (nreason++ > 0
+                || !crl_der_get(&v, vend, V_ASN1_ENUMERATED, 0, &e, &elen)
+                || v != vend || !crl_der_integer_ok(e, elen))
+                return 0;
+        }
+    }
+    return 1;
+}
+
+/* Same order as X509_REVOKED_cmp() */
+static int crl_serial_key_cmp(const X509_CRL_SERIAL *e,
+                              const ASN1_INTEGER *serial)
+{
+    if (e->serial_len != serial->length)
+        return e->serial_len - serial->length;
+    return memcmp(e->serial, serial->data, e->serial_len);
+}
+
+static int crl_serial_cmp(const void *a, const void *b)
+{
+    const X509_CRL_SERIAL *sa = a, *sb = b;
+    int ret;
+
+    if (sa->serial_len != sb->serial_len)
+        return sa->serial_len - sb->serial_len;
+    ret = memcmp(sa->serial, sb->serial, sa->serial_len);
+    if (ret == 0)
+        ret = (sa->der > sb->der) - (sa->der < sb->der);
+    return ret;
+}
+
+static int crl_serial_der_cmp(const void *a, const void *b)
+{
+    const X509_CRL_SERIAL *sa = a, *sb = b;
+
+    return (sa->der > sb->der) - (sa->der < sb->der);
+}
+
+/*
+ * Index the entries of the revokedCertificates at |p|.  Returns 0 if they
+ * cannot be indexed, -1 on allocation failure.
+ */
+static int crl_scan_revoked(X509_CRL *crl, const unsigned char *p, long len)
+{
+    const unsigned char *end = p + len, *c, *cend, *s, *t;
+    X509_CRL_SERIAL *serials = NULL, *tmp, *e;
+    long clen, slen, tlen;
+    int n = 0, num_alloc = 0, critical = 0;
+
+    while (p < end) {
+        if (n == num_alloc) {
+            if (num_alloc > INT_MAX / 2 / (int)sizeof(*serials))
+                goto notindexed;
+            num_alloc = num_alloc == 0 ? 64 : num_alloc * 2;
+            tmp = OPENSSL_realloc(serials, num_alloc * sizeof(*serials));
+            if (tmp == NULL) {
+                OPENSSL_free(serials);
+                return -1;
+            }
+            serials = tmp;
+        }
+        e = &serials[n];
+        e->der = p;
+        if (!crl_der_get(&p, end, V_ASN1_SEQUENCE, 1, &c, &clen)
+            || p - e->der > INT_MAX)
+            goto notindexed;
+        cend = c + clen;
+        /* Negative serial numbers are rare enough to be left out */
+        if (!crl_der_get(&c, cend, V_ASN1_INTEGER, 0, &s, &slen)
+            || !crl_der_integer_ok(s, slen) || (s[0] & 0x80) != 0)
+            goto notindexed;
+        if (slen > 1 && s[0] == 0) {
+            s++;
+            slen--;
+        }
+        if (!crl_der_get(&c, cend, V_ASN1_UTCTIME, 0, &t, &tlen)
+            && !crl_der_get(&c, cend, V_ASN1_GENERALIZEDTIME, 0, &t, &tlen))
+            goto notindexed;
+        if (c < cend
+            && (!crl_der_get(&c, cend, V_ASN1_SEQUENCE, 1, &t, &tlen)
+                || c != cend || !crl_scan_entry_exts(t, tlen, &critical)))
+            goto notindexed;
+        e->length = (int)(p - e->der);
+        e->serial = s;
+        e->serial_len = (int)slen;
+        e->rev = NULL;
+        n++;
+    }
+    if (n == 0)
+        goto notindexed;
+
+    qsort(serials, n, sizeof(*serials), crl_serial_cmp);
+    crl->serials = serials;
+    crl->nserials = n;
+    crl->lazy = 1;
+    if (critical)
+        crl->flags |= EXFLAG_CRITICAL;
+    return 1;
+
+ notindexed:
+    OPENSSL_free(serials);
+    return 0;
+}
+
+/*
+ * Find the revokedCertificates that revoked_list_lazy_ex_d2i() skipped in
+ * the cached CRL_INFO encoding and index them, or decode them if they cannot
+ * be indexed.
+ */
+static int crl_index_revoked(X509_CRL *crl)
+{
+    const unsigned char *p = crl->crl.enc.enc, *end, *list, *c;
+    long len, clen;
+    int tag, xclass, ret;
+
+    if (crl->crl.revoked != NULL || p == NULL)
+        return 1;
+    end = p + crl->crl.enc.len;
+    if (ASN1_get_object(&p, &len, &tag, &xclass, end - p) & 0x80)
+        return 0;
+
+    /* Skip version, signature, issuer and thisUpdate */
+    (void)crl_der_get(&p, end, V_ASN1_INTEGER, 0, &c, &clen);
+    if (!crl_der_skip(&p, end, 0) || !crl_der_skip(&p, end, 0)
+        || !crl_der_skip(&p, end, 0))
+        return 0;
+    /* The list is the next SEQUENCE, unless nextUpdate comes first */
+    list = p;
+    if (!crl_der_get(&p, end, V_ASN1_SEQUENCE, 1, &c, &clen)) {
+        if (!crl_der_skip(&p, end, 0))
+            return 1;
+        list = p;
+        if (!crl_der_get(&p, end, V_ASN1_SEQUENCE, 1, &c, &clen))
+            return 1;
+    }
+
+    ERR_set_mark();
+    ret = crl_scan_revoked(crl, c, clen);
+    ERR_pop_to_mark();
+    if (ret < 0) {
+        X509err(0, ERR_R_MALLOC_FAILURE);
+        return 0;
+    }
+    if (ret == 0) {
+        crl->crl.revoked = (STACK_OF(X509_REVOKED) *)
+            ASN1_item_d2i(NULL, &list, p - list,
+                          ASN1_ITEM_rptr(X509_REVOKED_LIST));
+        if (crl->crl.revoked == NULL)
+            return 0;
+        (void)sk_X509_REVOKED_set_cmp_func(crl->crl.revoked, X509_REVOKED_cmp);
+    }
+    return 1;
+}
+
+static X509_REVOKED *crl_decode_serial(const X509_CRL_SERIAL *e)
+{
+    const unsigned char *p = e->der;
+    X509_REVOKED *rev = d2i_X509_REVOKED(NULL, &p, e->length);
+
+    if (rev != NULL && (p != e->der + e->length || !crl_set_reason(rev))) {
+        X509_REVOKED_free(rev);
+        rev = NULL;
+    }
+    return rev;
+}
+
+static void crl_free_serials(X509_CRL *crl)
+{
+    int i;
+
+    for (i = 0; i < crl->nserials; i++)
+        X509_REVOKED_free(crl->serials[i].rev);
+    OPENSSL_free(crl->serials);
+    crl->serials = NULL;
+    crl->nserials = 0;
+    crl->lazy = 0;
+}
+
+/*
+ * Look up |serial| in the index of a lazily decoded CRL and decode the entry
+ * that matches.  Returns -2 if the CRL has been expanded in the meantime.
+ */
+static int crl_lookup_serial(X509_CRL *crl, X509_REVOKED **ret,
+                             const ASN1_INTEGER *serial, X509_NAME *issuer)
+{
+    X509_CRL_SERIAL *e;
+    X509_REVOKED *rev;
+    int lo, hi, mid;
+
+    /* No certificate issuer extensions: all entries are for the CRL issuer */
+    if (serial->type != V_ASN1_INTEGER
+        || (issuer != NULL && X509_NAME_cmp(issuer, X509_CRL_get_issuer(crl))))
+        return 0;
+
+    if (!CRYPTO_THREAD_read_lock(crl->lock))
+        return -1;
+    if (crl->serials == NULL) {
+        CRYPTO_THREAD_unlock(crl->lock);
+        return -2;
+    }
+    /* The first of the entries with that serial number, if any */
+    for (lo = 0, hi = crl->nserials; lo < hi; ) {
+        mid = lo + (hi - lo) / 2;
+        if (crl_serial_key_cmp(&crl->serials[mid], serial) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == crl->nserials
+        || crl_serial_key_cmp(&crl->serials[lo], serial) != 0) {
+        CRYPTO_THREAD_unlock(crl->lock);
+        return 0;
+    }
+    rev = crl->serials[lo].rev;
+    CRYPTO_THREAD_unlock(crl->lock);
+
+    if (rev == NULL) {
+        if (!CRYPTO_THREAD_write_lock(crl->lock))
+            return -1;
+        if (crl->serials == NULL) {
+            CRYPTO_THREAD_unlock(crl->lock);
+            return -2;
+        }
+        e = &crl->serials[lo];
+        if (e->rev == NULL)
+            e->rev = crl_decode_serial(e);
+        rev = e->rev;
+        CRYPTO_THREAD_unlock(crl->lock);
+        if (rev == NULL) {
+            X509err(0, ERR_R_NESTED_ASN1_ERROR);
+            return -1;
+        }
+    }
+    if (ret != NULL)
+        *ret = rev;
+    if (rev->reason == CRL_REASON_REMOVE_FROM_CRL)
+        return 2;
+    return 1;
+}
+
+/*
+ * Decode all the entries of a lazily decoded CRL in their original order
+ * and drop the index.  The entries already looked up are kept.
+ */
+int x509_crl_expand(X509_CRL *crl)
+{
+    STACK_OF(X509_REVOKED) *revoked = NULL;
+    X509_CRL_SERIAL *e;
+    int i, ret = 0;
+
+    if (!crl->lazy)
+        return 1;
+    if (!CRYPTO_THREAD_write_lock(crl->lock))
+        return 0;
+    if (crl->serials == NULL) {
+        ret = 1;
+        goto end;
+    }
+
+    qsort(crl->serials, crl->nserials, sizeof(*crl->serials),
+          crl_serial_der_cmp);
+    revoked = sk_X509_REVOKED_new_reserve(X509_REVOKED_cmp, crl->nserials);
+    if (revoked == NULL) {
+        X509err(0, ERR_R_MALLOC_FAILURE);
+        goto end;
+    }
+    for (i = 0; i < crl->nserials; i++) {
+        e = &crl->serials[i];
+        if (e->rev == NULL && (e->rev = crl_decode_serial(e)) == NULL) {
+            X509err(0, ERR_R_NESTED_ASN1_ERROR);
+            goto end;
+        }
+        sk_X509_REVOKED_push(revoked, e->rev);
+    }
+    crl->crl.revoked = revoked;
+    revoked = NULL;
+    OPENSSL_free(crl->serials);
+    crl->serials = NULL;
+    crl->nserials = 0;
+    ret = 1;
+
+ end:
+    if (ret == 0 && crl->serials != NULL) {
+        sk_X509_REVOKED_free(revoked);
+        qsort(crl->serials, crl->nserials, sizeof(*crl->serials),
+              crl_serial_cmp);
+    }
+    CRYPTO_THREAD_unlock(crl->lock);
+    return ret;
+}
+
+static int crl_lazy_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
+                       void *exarg)
+{
+    if (operation == ASN1_OP_D2I_POST) {
+        X509_CRL *crl = (X509_CRL *)*pval;
+
+        /* The issuer name is decoded under the CRL's lock */
+        crl->crl.issuer->lock = crl->lock;
+        if (!crl_index_revoked(crl))
+            return 0;
+    }
+    return crl_cb(operation, pval, it, exarg);
+}
+
+typedef X509_CRL_INFO X509_CRL_INFO_LAZY;
+typedef X509_CRL X509_CRL_LAZY;
+
+ASN1_SEQUENCE_enc(X509_CRL_INFO_LAZY, enc, crl_inf_cb) = {
+        ASN1_OPT(X509_CRL_INFO, version, ASN1_INTEGER),
+        ASN1_EMBED(X509_CRL_INFO, sig_alg, X509_ALGOR),
+        ASN1_SIMPLE(X509_CRL_INFO, issuer, X509_NAME_LAZY),
+        ASN1_SIMPLE(X509_CRL_INFO, lastUpdate, ASN1_TIME),
+        ASN1_OPT(X509_CRL_INFO, nextUpdate, ASN1_TIME),
+        ASN1_OPT(X509_CRL_INFO, revoked, X509_REVOKED_LIST_LAZY),
+        ASN1_EXP_SEQUENCE_OF_OPT(X509_CRL_INFO, extensions, X509_EXTENSION, 0)
+} static_ASN1_SEQUENCE_END_ref(X509_CRL_INFO, X509_CRL_INFO_LAZY)
+
+ASN1_SEQUENCE_ref(X509_CRL_LAZY, crl_lazy_cb) = {
+        ASN1_EMBED(X509_CRL, crl, X509_CRL_INFO_LAZY),
+        ASN1_EMBED(X509_CRL, sig_alg, X509_ALGOR),
+        ASN1_EMBED(X509_CRL, signature, ASN1_BIT_STRING)
+} static_ASN1_SEQUENCE_END_ref(X509_CRL, X509_CRL_LAZY)
+
+X509_CRL *d2i_X509_CRL_lazy(X509_CRL **a, const unsigned char **in, long len)
+{
+    return (X509_CRL *)ASN1_item_d2i((ASN1_VALUE **)a, in, len,
+                                     ASN1_ITEM_rptr(X509_CRL_LAZY));
+}
+
 static int X509_REVOKED_cmp(const X509_REVOKED *const *a,
                             const X509_REVOKED *const *b)
 {
@@ -322,6 +874,8 @@ int X509_CRL_add0_revoked(X509_CRL *crl, X509_REVOKED *rev)
 {
     X509_CRL_INFO *inf;
 
+    if (!x509_crl_expand(crl))
+        return 0;
     inf = &crl->crl;
     if (inf->revoked == NULL)
         inf->revoked = sk_X509_REVOKED_new(X509_REVOKED_cmp);
@@ -397,6 +951,11 @@ static int def_crl_lookup(X509_CRL *crl,
     X509_REVOKED rtmp, *rev;
     int idx, num;
 
+    if (crl->lazy) {
+        idx = crl_lookup_serial(crl, ret, serial, issuer);
+        if (idx != -2)
+            return idx;
+    }
     if (crl->crl.revoked == NULL)
         return 0;
 
@@ -14,6 +14,7 @@
 #include <openssl/x509.h>
 #include "internal/x509_int.h"
 #include "internal/asn1_int.h"
+#include "internal/tsan_assist.h"
 #include "x509_lcl.h"
 
 /*
@@ -27,6 +28,12 @@ static int x509_name_ex_d2i(ASN1_VALUE **val,
                             const unsigned char **in, long len,
                             const ASN1_ITEM *it,
                             int tag, int aclass, char opt, ASN1_TLC *ctx);
+#ifdef tsan_ld_acq
+static int x509_name_lazy_ex_d2i(ASN1_VALUE **val,
+                                 const unsigned char **in, long len,
+                                 const ASN1_ITEM *it,
+                                 int tag, int aclass, char opt, ASN1_TLC *ctx);
+#endif
 
 static int x509_name_ex_i2d(const ASN1_VALUE **val, unsigned char **out,
                             const ASN1_ITEM *it, int tag, int aclass);
@@ -34,6 +41,8 @@ static int x509_name_ex_new(ASN1_VALUE **val, const ASN1_ITEM *it);
 static void x509_name_ex_free(ASN1_VALUE **val, const ASN1_ITEM *it);
 
 static int x509_name_encode(X509_NAME *a);
+static int x509_name_set_entries(X509_NAME *nm,
+                                 STACK_OF(STACK_OF_X509_NAME_ENTRY) *intname);
 static int x509_name_canon(X509_NAME *a);
 static int asn1_string_canon(ASN1_STRING *out, const ASN1_STRING *in);
 static int i2d_name_canon(const STACK_OF(STACK_OF_X509_NAME_ENTRY) * intname,
@@ -83,6 +92,33 @@ static const ASN1_EXTERN_FUNCS x509_name_ff = {
 
 IMPLEMENT_EXTERN_ASN1(X509_NAME, V_ASN1_SEQUENCE, x509_name_ff)
 
+/*
+ * Same as X509_NAME except that decoding only keeps the encoding: the
+ * entries and the canonical encoding are built by x509_name_expand() the
+ * first time they are needed.  That is under the lock of the certificate,
+ * which x509v3_cache_extensions() holds while it compares names, so it is
+ * only done where it can be checked for without the lock.
+ */
+
+static const ASN1_EXTERN_FUNCS x509_name_lazy_ff = {
+    NULL,
+    x509_name_ex_new,
+    x509_name_ex_free,
+    0,                          /* Default clear behaviour is OK */
+#ifdef tsan_ld_acq
+    x509_name_lazy_ex_d2i,
+#else
+    x509_name_ex_d2i,
+#endif
+    x509_name_ex_i2d,
+    x509_name_ex_print
+};
+
+ASN1_ITEM_start(X509_NAME_LAZY)
+        ASN1_ITYPE_EXTERN, V_ASN1_SEQUENCE, NULL, 0, &x509_name_lazy_ff, 0,
+        "X509_NAME"
+ASN1_ITEM_end(X509_NAME_LAZY)
+
 IMPLEMENT_ASN1_FUNCTIONS(X509_NAME)
 
 IMPLEMENT_ASN1_DUP_FUNCTION(X509_NAME)
@@ -153,9 +189,7 @@ static int x509_name_ex_d2i(ASN1_VALUE **val,
     } nm = {
         NULL
     };
-    int i, j, ret;
-    STACK_OF(X509_NAME_ENTRY) *entries;
-    X509_NAME_ENTRY *entry;
+    int ret;
 
     if (len > X509_NAME_MAX)
         len = X509_NAME_MAX;
@@ -178,18 +212,7 @@ static int x509_name_ex_d2i(ASN1_VALUE **val,
         goto err;
     memcpy(nm.x->bytes->data, q, p - q);
 
-    /* Convert internal representation to X509_NAME structure */
-    for (i = 0; i < sk_STACK_OF_X509_NAME_ENTRY_num(intname.s); i++) {
-        entries = sk_STACK_OF_X509_NAME_ENTRY_value(intname.s, i);
-        for (j = 0; j < sk_X509_NAME_ENTRY_num(entries); j++) {
-            entry = sk_X509_NAME_ENTRY_value(entries, j);
-            entry->set = i;
-            if (!sk_X509_NAME_ENTRY_push(nm.x->entries, entry))
-                goto err;
-            sk_X509_NAME_ENTRY_set(entries, j, NULL);
-        }
-    }
-    ret = x509_name_canon(nm.x);
+    ret = x509_name_set_entries(nm.x, intname.s);
     if (!ret)
         goto err;
     sk_STACK_OF_X509_NAME_ENTRY_pop_free(intname.s,
@@ -208,6 +231,138 @@ static int x509_name_ex_d2i(ASN1_VALUE **val,
     return 0;
 }
 
+#ifdef tsan_ld_acq
+static int x509_name_lazy_ex_d2i(ASN1_VALUE **val,
+                                 const unsigned char **in, long len,
+                                 const ASN1_ITEM *it, int tag, int aclass,
+                                 char opt, ASN1_TLC *ctx)
+{
+    const unsigned char *p = *in;
+    X509_NAME *nm = NULL;
+    long plen;
+    int ptag, pclass, inf;
+
+    if (len > X509_NAME_MAX)
+        len = X509_NAME_MAX;
+    if (tag == -1) {
+        tag = V_ASN1_SEQUENCE;
+        aclass = V_ASN1_UNIVERSAL;
+    }
+
+    /*
+     * Only a definite length encoding can be kept as is, leave anything
+     * else (including errors) to the full decoder.
+     */
+    ERR_set_mark();
+    inf = ASN1_get_object(&p, &plen, &ptag, &pclass, len);
+    ERR_pop_to_mark();
+    if (inf != V_ASN1_CONSTRUCTED || ptag != tag || pclass != aclass)
+        return x509_name_ex_d2i(val, in, len, it, tag, aclass, opt, ctx);
+    plen += p - *in;
+
+    if (*val)
+        x509_name_ex_free(val, NULL);
+    if (!x509_name_ex_new((ASN1_VALUE **)&nm, NULL))
+        goto err;
+    if (!BUF_MEM_grow(nm->bytes, plen))
+        goto err;
+    memcpy(nm->bytes->data, *in, plen);
+    nm->modified = 0;
+    nm->lazy = 1;
+    nm->expanded = 0;
+    if (ctx != NULL)
+        ctx->valid = 0;
+    *val = (ASN1_VALUE *)nm;
+    *in += plen;
+    return 1;
+
+ err:
+    X509_NAME_free(nm);
+    ASN1err(ASN1_F_X509_NAME_EX_D2I, ERR_R_NESTED_ASN1_ERROR);
+    return 0;
+}
+#endif
+
+/*
+ * Decode the entries of a name that was parsed by x509_name_lazy_ex_d2i().
+ * This is done once, under the lock of the certificate or CRL that the name
+ * is in, so that it looks like a read only operation to the callers that
+ * share the name.  A failure is remembered too.
+ */
+int x509_name_expand(const X509_NAME *name)
+{
+#ifdef tsan_ld_acq
+    X509_NAME *nm = (X509_NAME *)name;
+    STACK_OF(STACK_OF_X509_NAME_ENTRY) *intname = NULL;
+    const unsigned char *p;
+    int expanded;
+
+    if (nm == NULL || !nm->lazy)
+        return 1;
+
+    /* fast lock-free check, as in x509v3_cache_extensions() */
+    expanded = tsan_ld_acq((TSAN_QUALIFIER int *)&nm->expanded);
+    if (expanded != 0)
+        goto end;
+
+    if (!CRYPTO_THREAD_write_lock(nm->lock))
+        return 0;
+    if (nm->expanded == 0) {
+        p = (const unsigned char *)nm->bytes->data;
+        intname = (STACK_OF(STACK_OF_X509_NAME_ENTRY) *)
+            ASN1_item_d2i(NULL, &p, nm->bytes->length,
+                          ASN1_ITEM_rptr(X509_NAME_INTERNAL));
+        if (intname != NULL && x509_name_set_entries(nm, intname)) {
+            expanded = 1;
+        } else {
+            X509_NAME_ENTRY *entry;
+
+            while ((entry = sk_X509_NAME_ENTRY_pop(nm->entries)) != NULL)
+                X509_NAME_ENTRY_free(entry);
+            expanded = -1;
+        }
+        /* Make the entries visible before the flag, see above */
+        tsan_st_rel((TSAN_QUALIFIER int *)&nm->expanded, expanded);
+    }
+    expanded = nm->expanded;
+    CRYPTO_THREAD_unlock(nm->lock);
+    sk_STACK_OF_X509_NAME_ENTRY_pop_free(intname,
+                                         local_sk_X509_NAME_ENTRY_pop_free);
+
+ end:
+    if (expanded < 0) {
+        ASN1err(ASN1_F_X509_NAME_EX_D2I, ERR_R_NESTED_ASN1_ERROR);
+        return 0;
+    }
+#endif
+    /* Without tsan_ld_acq() names are never lazy */
+    return 1;
+}
+
+/*
+ * Convert the internal representation of a name to the X509_NAME
+ * structure: the entries are moved from |intname| to |nm|.
+ */
+static int x509_name_set_entries(X509_NAME *nm,
+                                 STACK_OF(STACK_OF_X509_NAME_ENTRY) *intname)
+{
+    STACK_OF(X509_NAME_ENTRY) *entries;
+    X509_NAME_ENTRY *entry;
+    int i, j;
+
+    for (i = 0; i < sk_STACK_OF_X509_NAME_ENTRY_num(intname); i++) {
+        entries = sk_STACK_OF_X509_NAME_ENTRY_value(intname, i);
+        for (j = 0; j < sk_X509_NAME_ENTRY_num(entries); j++) {
+            entry = sk_X509_NAME_ENTRY_value(entries, j);
+            entry->set = i;
+            if (!sk_X509_NAME_ENTRY_push(nm->entries, entry))
+                return 0;
+            sk_X509_NAME_ENTRY_set(entries, j, NULL);
+        }
+    }
+    return x509_name_canon(nm);
+}
+
 static int x509_name_ex_i2d(const ASN1_VALUE **val, unsigned char **out,
                             const ASN1_ITEM *it, int tag, int aclass)
 {
@@ -14,6 +14,7 @@
 #include "internal/asn1_int.h"
 #include "internal/evp_int.h"
 #include "internal/x509_int.h"
+#include "internal/tsan_assist.h"
 #include <openssl/rsa.h>
 #include <openssl/dsa.h>
 
@@ -21,6 +22,9 @@ struct X509_pubkey_st {
     X509_ALGOR *algor;
     ASN1_BIT_STRING *public_key;
     EVP_PKEY *pkey;
+    int lazy;                   /* decoded by the X509_PUBKEY_LAZY item */
+    volatile int decoded;       /* lazy: pkey decoded, or failed to */
+    CRYPTO_RWLOCK *lock;        /* lazy: the lock of the certificate */
 };
 
 static int x509_pubkey_decode(EVP_PKEY **pk, X509_PUBKEY *key);
@@ -58,6 +62,38 @@ ASN1_SEQUENCE_cb(X509_PUBKEY, pubkey_cb) = {
 IMPLEMENT_ASN1_FUNCTIONS(X509_PUBKEY)
 IMPLEMENT_ASN1_DUP_FUNCTION(X509_PUBKEY)
 
+/*
+ * As X509_PUBKEY but the key is only decoded by X509_PUBKEY_get0(), where
+ * that can be checked for without a lock, as for X509_NAME_LAZY
+ */
+static int pubkey_lazy_cb(int operation, ASN1_VALUE **pval,
+                          const ASN1_ITEM *it, void *exarg)
+{
+#ifdef tsan_ld_acq
+    if (operation == ASN1_OP_D2I_POST) {
+        X509_PUBKEY *pubkey = (X509_PUBKEY *)*pval;
+
+        EVP_PKEY_free(pubkey->pkey);
+        pubkey->pkey = NULL;
+        pubkey->lazy = 1;
+        pubkey->decoded = 0;
+        return 1;
+    }
+#endif
+    return pubkey_cb(operation, pval, it, exarg);
+}
+
+/* Set the lock that a lazy |key| is decoded under */
+void x509_pubkey_set0_lock(X509_PUBKEY *key, CRYPTO_RWLOCK *lock)
+{
+    key->lock = lock;
+}
+
+ASN1_SEQUENCE_cb(X509_PUBKEY_LAZY, pubkey_lazy_cb) = {
+        ASN1_SIMPLE(X509_PUBKEY, algor, X509_ALGOR),
+        ASN1_SIMPLE(X509_PUBKEY, public_key, ASN1_BIT_STRING)
+} ASN1_SEQUENCE_END_cb(X509_PUBKEY, X509_PUBKEY_LAZY)
+
 /* TODO should better be called X509_PUBKEY_set1 */
 int X509_PUBKEY_set(X509_PUBKEY **x, EVP_PKEY *pkey)
 {
@@ -146,6 +182,25 @@ EVP_PKEY *X509_PUBKEY_get0(X509_PUBKEY *key)
     if (key == NULL || key->public_key == NULL)
         return NULL;
 
+#ifdef tsan_ld_acq
+    /* fast lock-free check, as in x509v3_cache_extensions() */
+    if (key->lazy && !tsan_ld_acq((TSAN_QUALIFIER int *)&key->decoded)) {
+        if (!CRYPTO_THREAD_write_lock(key->lock))
+            return NULL;
+        if (!key->decoded) {
+            /*
+             * Same as the opportunistic decode done by pubkey_cb(), and
+             * like there a failure is not retried: |pkey| stays NULL.
+             */
+            ERR_set_mark();
+            x509_pubkey_decode(&key->pkey, key);
+            ERR_pop_to_mark();
+            tsan_st_rel((TSAN_QUALIFIER int *)&key->decoded, 1);
+        }
+        CRYPTO_THREAD_unlock(key->lock);
+    }
+#endif
+
     if (key->pkey != NULL)
         return key->pkey;
 
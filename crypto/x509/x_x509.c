@@ -49,6 +49,7 @@ static int x509_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         policy_cache_free(ret->policy_cache);
         GENERAL_NAMES_free(ret->altname);
         NAME_CONSTRAINTS_free(ret->nc);
+        x509_nc_index_free(ret->nc_index);
 #ifndef OPENSSL_NO_RFC3779
         sk_IPAddressFamily_pop_free(ret->rfc3779_addr, IPAddressFamily_free);
         ASIdentifiers_free(ret->rfc3779_asid);
@@ -67,11 +68,14 @@ static int x509_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         ret->ex_flags = 0;
         ret->ex_pathlen = -1;
         ret->ex_pcpathlen = -1;
+        ret->ex_user_flags = 0;
+        ret->ex_user_pcpathlen = -1;
         ret->skid = NULL;
         ret->akid = NULL;
         ret->policy_cache = NULL;
         ret->altname = NULL;
         ret->nc = NULL;
+        ret->nc_index = NULL;
 #ifndef OPENSSL_NO_RFC3779
         ret->rfc3779_addr = NULL;
         ret->rfc3779_asid = NULL;
@@ -85,6 +89,24 @@ static int x509_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
             return 0;
         break;
 
+    case ASN1_OP_D2I_POST:
+        /*
+         * A lazy certificate would have to decode its names for this.  A bad
+         * extension only shows up when the certificate is used, so what it
+         * put on the error queue is dropped here.
+         */
+        if (it == ASN1_ITEM_rptr(X509)) {
+            ERR_set_mark();
+            x509v3_cache_extensions(ret);
+            ERR_pop_to_mark();
+        } else {
+            /* The lazy fields are decoded under the certificate's lock */
+            ret->cert_info.issuer->lock = ret->lock;
+            ret->cert_info.subject->lock = ret->lock;
+            x509_pubkey_set0_lock(ret->cert_info.key, ret->lock);
+        }
+        break;
+
     case ASN1_OP_FREE_POST:
         CRYPTO_free_ex_data(CRYPTO_EX_INDEX_X509, ret, &ret->ex_data);
         X509_CERT_AUX_free(ret->aux);
@@ -94,6 +116,7 @@ static int x509_cb(int operation, ASN1_VALUE **pval, const ASN1_ITEM *it,
         policy_cache_free(ret->policy_cache);
         GENERAL_NAMES_free(ret->altname);
         NAME_CONSTRAINTS_free(ret->nc);
+        x509_nc_index_free(ret->nc_index);
 #ifndef OPENSSL_NO_RFC3779
         sk_IPAddressFamily_pop_free(ret->rfc3779_addr, IPAddressFamily_free);
         ASIdentifiers_free(ret->rfc3779_asid);
@@ -118,6 +141,40 @@ ASN1_SEQUENCE_ref(X509, x509_cb) = {
 IMPLEMENT_ASN1_FUNCTIONS(X509)
 IMPLEMENT_ASN1_DUP_FUNCTION(X509)
 
+/*
+ * Lazily decoded certificates: the same structures, but the names only
+ * keep their encoding and the public key is not decoded until it is first
+ * used.  The objects are freed and encoded through the normal X509 item.
+ */
+
+typedef X509_CINF X509_CINF_LAZY;
+typedef X509 X509_LAZY;
+
+ASN1_SEQUENCE_enc(X509_CINF_LAZY, enc, 0) = {
+        ASN1_EXP_OPT(X509_CINF, version, ASN1_INTEGER, 0),
+        ASN1_EMBED(X509_CINF, serialNumber, ASN1_INTEGER),
+        ASN1_EMBED(X509_CINF, signature, X509_ALGOR),
+        ASN1_SIMPLE(X509_CINF, issuer, X509_NAME_LAZY),
+        ASN1_EMBED(X509_CINF, validity, X509_VAL),
+        ASN1_SIMPLE(X509_CINF, subject, X509_NAME_LAZY),
+        ASN1_SIMPLE(X509_CINF, key, X509_PUBKEY_LAZY),
+        ASN1_IMP_OPT(X509_CINF, issuerUID, ASN1_BIT_STRING, 1),
+        ASN1_IMP_OPT(X509_CINF, subjectUID, ASN1_BIT_STRING, 2),
+        ASN1_EXP_SEQUENCE_OF_OPT(X509_CINF, extensions, X509_EXTENSION, 3)
+} static_ASN1_SEQUENCE_END_ref(X509_CINF, X509_CINF_LAZY)
+
+ASN1_SEQUENCE_ref(X509_LAZY, x509_cb) = {
+        ASN1_EMBED(X509, cert_info, X509_CINF_LAZY),
+        ASN1_EMBED(X509, sig_alg, X509_ALGOR),
+        ASN1_EMBED(X509, signature, ASN1_BIT_STRING)
+} static_ASN1_SEQUENCE_END_ref(X509, X509_LAZY)
+
+X509 *d2i_X509_lazy(X509 **a, const unsigned char **in, long len)
+{
+    return (X509 *)ASN1_item_d2i((ASN1_VALUE **)a, in, len,
+                                 ASN1_ITEM_rptr(X509_LAZY));
+}
+
 int X509_set_ex_data(X509 *r, int idx, void *arg)
 {
     return CRYPTO_set_ex_data(&r->ex_data, idx, arg);
@@ -234,9 +291,47 @@ int i2d_X509_AUX(const X509 *a, unsigned char **pp)
     return length;
 }
 
+/*
+ * Drop what x509v3_cache_extensions() worked out for a certificate that has
+ * been changed, it is worked out again the next time it is needed.
+ */
+void x509v3_cache_clear(X509 *x)
+{
+    CRYPTO_THREAD_write_lock(x->lock);
+    ASN1_OCTET_STRING_free(x->skid);
+    x->skid = NULL;
+    AUTHORITY_KEYID_free(x->akid);
+    x->akid = NULL;
+    CRL_DIST_POINTS_free(x->crldp);
+    x->crldp = NULL;
+    policy_cache_free(x->policy_cache);
+    x->policy_cache = NULL;
+    GENERAL_NAMES_free(x->altname);
+    x->altname = NULL;
+    NAME_CONSTRAINTS_free(x->nc);
+    x->nc = NULL;
+    x509_nc_index_free(x->nc_index);
+    x->nc_index = NULL;
+#ifndef OPENSSL_NO_RFC3779
+    sk_IPAddressFamily_pop_free(x->rfc3779_addr, IPAddressFamily_free);
+    x->rfc3779_addr = NULL;
+    ASIdentifiers_free(x->rfc3779_asid);
+    x->rfc3779_asid = NULL;
+#endif
+    x->ex_kusage = 0;
+    x->ex_xkusage = 0;
+    x->ex_nscert = 0;
+    x->ex_flags = x->ex_user_flags;
+    x->ex_pathlen = -1;
+    x->ex_pcpathlen = x->ex_user_pcpathlen;
+    x->ex_cached = 0;
+    CRYPTO_THREAD_unlock(x->lock);
+}
+
 int i2d_re_X509_tbs(X509 *x, unsigned char **pp)
 {
     x->cert_info.enc.modified = 1;
+    x509v3_cache_clear(x);
     return i2d_X509_CINF(&x->cert_info, pp);
 }
 
@@ -0,0 +1,1104 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * Async batching engine.
+ *
+ * Private key operations issued from within an ASYNC_JOB are not executed
+ * straight away.  Instead they are queued, and the job is paused until the
+ * queue holds BATCH_SIZE requests of the same kind or until the oldest
+ * request has waited LATENCY_US microseconds.  Whichever job notices one of
+ * these conditions first runs the whole batch and wakes up the other jobs
+ * through their ASYNC_WAIT_CTX file descriptors (or callbacks).
+ *
+ * Operations issued outside of an ASYNC_JOB are executed directly.
+ *
+ * The latency budget is enforced by a timer thread that wakes up the oldest
+ * request of a queue when its time is up.  Where there are no threads, the
+ * oldest request instead keeps its wait fd readable while it is paused so
+ * that the application keeps resuming it.
+ *
+ * A queued request is a copy on the heap of the one that the operation
+ * made, so that the queue never points into the stack of a paused job.
+ *
+ * When THREADS is set to a non-zero value, queued operations are instead
+ * handed to a pool of worker threads straight away, so that the thread
+ * running the jobs is free to serve other connections in the meantime.  A
+ * worker takes at most BATCH_SIZE requests at a time, and LATENCY_US is not
+ * used.  This is only available on POSIX systems.
+ */
+
+#if defined(_WIN32)
+# include <windows.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include <openssl/engine.h>
+#include <openssl/async.h>
+#include <openssl/crypto.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <openssl/dh.h>
+#include <openssl/evp.h>
+#include <openssl/err.h>
+
+#if defined(OPENSSL_SYS_UNIX) && defined(OPENSSL_THREADS)
+# undef ASYNC_POSIX
+# define ASYNC_POSIX
+# include <errno.h>
+# include <unistd.h>
+# include <pthread.h>
+# include <sys/time.h>
+# if defined(__linux__)
+#  define BATCH_EVENTFD
+#  include <sys/eventfd.h>
+# endif
+#elif defined(_WIN32)
+# undef ASYNC_WIN
+# define ASYNC_WIN
+#endif
+
+#include "e_batch_err.c"
+
+/* Engine Id and Name */
+static const char *engine_batch_id = "batch";
+static const char *engine_batch_name = "Async batching engine support";
+
+#define BATCH_DEFAULT_SIZE          8
+#define BATCH_MAX_SIZE              1024
+#define BATCH_DEFAULT_LATENCY_US    100
+#define BATCH_MAX_THREADS           64
+
+#define BATCH_CMD_SIZE              ENGINE_CMD_BASE
+#define BATCH_CMD_LATENCY_US        (ENGINE_CMD_BASE + 1)
+#define BATCH_CMD_THREADS           (ENGINE_CMD_BASE + 2)
+
+static const ENGINE_CMD_DEFN batch_cmds[] = {
+    {BATCH_CMD_SIZE,
+     "BATCH_SIZE",
+     "number of queued operations of one kind that triggers a flush [default="
+         OPENSSL_MSTR(BATCH_DEFAULT_SIZE) "]",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {BATCH_CMD_LATENCY_US,
+     "LATENCY_US",
+     "maximum time in microseconds an operation waits for its batch to fill "
+         "[default=" OPENSSL_MSTR(BATCH_DEFAULT_LATENCY_US) "]",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {BATCH_CMD_THREADS,
+     "THREADS",
+     "number of worker threads operations are offloaded to, 0 to run them "
+         "in the calling jobs [default=0]",
+     ENGINE_CMD_FLAG_NUMERIC},
+    {0, NULL, NULL, 0}
+};
+
+/* Engine Lifetime functions */
+static int batch_destroy(ENGINE *e);
+static int batch_init(ENGINE *e);
+static int batch_finish(ENGINE *e);
+static int batch_ctrl(ENGINE *e, int cmd, long i, void *p, void (*f) (void));
+
+/*
+ * Requests of different kinds go to different queues, so that every batch
+ * is homogeneous.
+ */
+enum {
+    BATCH_QUEUE_RSA,
+    BATCH_QUEUE_ECDSA,
+    BATCH_QUEUE_X25519,
+    BATCH_QUEUE_DH,
+    BATCH_QUEUES
+};
+
+/*
+ * Errors raised by a request that was executed on another thread, or by
+ * another job, and that are raised again for the job that issued it.
+ */
+typedef struct {
+    unsigned long code;
+    const char *file;
+    int line;
+    char *data;
+} BATCH_ERROR;
+
+typedef struct {
+    BATCH_ERROR err[ERR_NUM_ERRORS];
+    int num;
+} BATCH_ERRORS;
+
+typedef struct batch_req_st BATCH_REQ;
+
+struct batch_req_st {
+    int (*run)(BATCH_REQ *req);
+    int ret;
+    BATCH_ERRORS errs;
+    /* The following are protected by batch_lock */
+    int queued;
+    int done;
+    int signalled;
+    ASYNC_callback_fn callback;
+    void *callback_arg;
+    OSSL_ASYNC_FD readfd;
+    OSSL_ASYNC_FD writefd;
+    BATCH_REQ *next;
+    union {
+        struct {
+            int (*fn)(int flen, const unsigned char *from, unsigned char *to,
+                      RSA *rsa, int padding);
+            int flen;
+            const unsigned char *from;
+            unsigned char *to;
+            RSA *rsa;
+            int padding;
+        } rsa;
+#ifndef OPENSSL_NO_EC
+        struct {
+            int type;
+            const unsigned char *dgst;
+            int dlen;
+            unsigned char *sig;
+            unsigned int *siglen;
+            const BIGNUM *kinv;
+            const BIGNUM *r;
+            EC_KEY *eckey;
+        } sign;
+        struct {
+            EVP_PKEY_CTX *ctx;
+            unsigned char *key;
+            size_t *keylen;
+        } derive;
+#endif
+#ifndef OPENSSL_NO_DH
+        struct {
+            unsigned char *key;
+            const BIGNUM *pub_key;
+            DH *dh;
+        } dh;
+#endif
+    } u;
+};
+
+typedef struct {
+    BATCH_REQ *head;
+    BATCH_REQ *tail;
+    size_t count;
+    /* Time by which the batch must be flushed, in microseconds */
+    uint64_t deadline;
+} BATCH_QUEUE;
+
+static CRYPTO_RWLOCK *batch_lock = NULL;
+static BATCH_QUEUE batch_queues[BATCH_QUEUES];
+static size_t batch_size = BATCH_DEFAULT_SIZE;
+static uint64_t batch_latency = BATCH_DEFAULT_LATENCY_US;
+
+#if defined(ASYNC_POSIX)
+# define BATCH_OFFLOAD
+/*
+ * Requests waiting for a worker thread.  The queues are protected by
+ * batch_lock, |offload_pending| (their total length) and |offload_stop| by
+ * offload_mutex as well.
+ */
+static BATCH_QUEUE offload_queues[BATCH_QUEUES];
+static size_t offload_pending = 0;
+static int offload_stop = 0;
+static pthread_mutex_t offload_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t offload_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t offload_threads[BATCH_MAX_THREADS];
+/* Number of running workers, protected by batch_lock */
+static int offload_nthreads = 0;
+
+static int batch_offload_start(int nthreads);
+static void batch_offload_stop(void);
+
+# define BATCH_TIMER
+/*
+ * The timer thread.  |timer_kick| tells it that a queue has a new deadline;
+ * it and |timer_stop| are protected by timer_mutex, |timer_running| by
+ * batch_lock.
+ */
+static int timer_kick = 0;
+static int timer_stop = 0;
+static pthread_mutex_t timer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t timer_thread;
+static int timer_running = 0;
+
+static void batch_timer_stop(void);
+#endif
+
+static RSA_METHOD *batch_rsa_method = NULL;
+
+#ifndef OPENSSL_NO_DH
+static DH_METHOD *batch_dh_method = NULL;
+
+static int batch_dh_compute_key(unsigned char *key, const BIGNUM *pub_key,
+                                DH *dh);
+#endif
+
+#ifndef OPENSSL_NO_EC
+static EC_KEY_METHOD *batch_ec_method = NULL;
+static EVP_PKEY_METHOD *batch_x25519_pmeth = NULL;
+
+static int (*orig_ecdsa_sign)(int type, const unsigned char *dgst, int dlen,
+                              unsigned char *sig, unsigned int *siglen,
+                              const BIGNUM *kinv, const BIGNUM *r,
+                              EC_KEY *eckey);
+static int (*orig_x25519_derive)(EVP_PKEY_CTX *ctx, unsigned char *key,
+                                 size_t *keylen);
+
+static int batch_ecdsa_sign(int type, const unsigned char *dgst, int dlen,
+                            unsigned char *sig, unsigned int *siglen,
+                            const BIGNUM *kinv, const BIGNUM *r,
+                            EC_KEY *eckey);
+static int batch_x25519_derive(EVP_PKEY_CTX *ctx, unsigned char *key,
+                               size_t *keylen);
+static int batch_pkey_meths(ENGINE *e, EVP_PKEY_METHOD **pmeth,
+                            const int **nids, int nid);
+
+static int batch_pkey_nids[] = {
+    EVP_PKEY_X25519,
+    0
+};
+#endif
+
+static int batch_rsa_priv_enc(int flen, const unsigned char *from,
+                              unsigned char *to, RSA *rsa, int padding);
+static int batch_rsa_priv_dec(int flen, const unsigned char *from,
+                              unsigned char *to, RSA *rsa, int padding);
+
+static int bind_batch(ENGINE *e)
+{
+    int i;
+
+    /* Ensure the batch error handling is set up */
+    ERR_load_BATCH_strings();
+
+    if (batch_lock == NULL && (batch_lock = CRYPTO_THREAD_lock_new()) == NULL) {
+        BATCHerr(BATCH_F_BIND_BATCH, BATCH_R_INIT_FAILED);
+        return 0;
+    }
+    for (i = 0; i < BATCH_QUEUES; i++) {
+        memset(&batch_queues[i], 0, sizeof(batch_queues[i]));
+#ifdef BATCH_OFFLOAD
+        memset(&offload_queues[i], 0, sizeof(offload_queues[i]));
+#endif
+    }
+
+    /* Public key operations are cheap, so only private ones are batched */
+    if ((batch_rsa_method = RSA_meth_dup(RSA_PKCS1_OpenSSL())) == NULL
+        || RSA_meth_set1_name(batch_rsa_method, "Batching RSA method") == 0
+        || RSA_meth_set_priv_enc(batch_rsa_method, batch_rsa_priv_enc) == 0
+        || RSA_meth_set_priv_dec(batch_rsa_method, batch_rsa_priv_dec) == 0) {
+        BATCHerr(BATCH_F_BIND_BATCH, BATCH_R_INIT_FAILED);
+        return 0;
+    }
+
+#ifndef OPENSSL_NO_DH
+    if ((batch_dh_method = DH_meth_dup(DH_OpenSSL())) == NULL
+        || DH_meth_set1_name(batch_dh_method, "Batching DH method") == 0
+        || DH_meth_set_compute_key(batch_dh_method,
+                                   batch_dh_compute_key) == 0) {
+        BATCHerr(BATCH_F_BIND_BATCH, BATCH_R_INIT_FAILED);
+        return 0;
+    }
+#endif
+
+#ifndef OPENSSL_NO_EC
+    {
+        const EVP_PKEY_METHOD *x25519 = EVP_PKEY_meth_find(EVP_PKEY_X25519);
+        int (*derive_init)(EVP_PKEY_CTX *ctx);
+        int (*sign_setup)(EC_KEY *eckey, BN_CTX *ctx_in, BIGNUM **kinvp,
+                          BIGNUM **rp);
+        ECDSA_SIG *(*sign_sig)(const unsigned char *dgst, int dgst_len,
+                               const BIGNUM *in_kinv, const BIGNUM *in_r,
+                               EC_KEY *eckey);
+
+        if ((batch_ec_method = EC_KEY_METHOD_new(EC_KEY_OpenSSL())) == NULL
+            || x25519 == NULL
+            || (batch_x25519_pmeth =
+                    EVP_PKEY_meth_new(EVP_PKEY_X25519, 0)) == NULL) {
+            BATCHerr(BATCH_F_BIND_BATCH, BATCH_R_INIT_FAILED);
+            return 0;
+        }
+
+        /*
+         * Only the outermost entry point is wrapped: the original sign
+         * function calls back into |sign_sig|, which must not be queued a
+         * second time.  Verification is a public key operation and is left
+         * as it is.
+         */
+        EC_KEY_METHOD_get_sign(EC_KEY_OpenSSL(), &orig_ecdsa_sign,
+                               &sign_setup, &sign_sig);
+        EC_KEY_METHOD_set_sign(batch_ec_method, batch_ecdsa_sign,
+                               sign_setup, sign_sig);
+
+        EVP_PKEY_meth_copy(batch_x25519_pmeth, x25519);
+        EVP_PKEY_meth_get_derive(x25519, &derive_init, &orig_x25519_derive);
+        EVP_PKEY_meth_set_derive(batch_x25519_pmeth, derive_init,
+                                 batch_x25519_derive);
+    }
+#endif
+
+    if (!ENGINE_set_id(e, engine_batch_id)
+        || !ENGINE_set_name(e, engine_batch_name)
+        || !ENGINE_set_RSA(e, batch_rsa_method)
+#ifndef OPENSSL_NO_DH
+        || !ENGINE_set_DH(e, batch_dh_method)
+#endif
+#ifndef OPENSSL_NO_EC
+        || !ENGINE_set_EC(e, batch_ec_method)
+        || !ENGINE_set_pkey_meths(e, batch_pkey_meths)
+#endif
+        || !ENGINE_set_cmd_defns(e, batch_cmds)
+        || !ENGINE_set_ctrl_function(e, batch_ctrl)
+        || !ENGINE_set_destroy_function(e, batch_destroy)
+        || !ENGINE_set_init_function(e, batch_init)
+        || !ENGINE_set_finish_function(e, batch_finish)) {
+        BATCHerr(BATCH_F_BIND_BATCH, BATCH_R_INIT_FAILED);
+        return 0;
+    }
+
+    return 1;
+}
+
+# ifndef OPENSSL_NO_DYNAMIC_ENGINE
+static int bind_helper(ENGINE *e, const char *id)
+{
+    if (id && (strcmp(id, engine_batch_id) != 0))
+        return 0;
+    if (!bind_batch(e))
+        return 0;
+    return 1;
+}
+
+IMPLEMENT_DYNAMIC_CHECK_FN()
+    IMPLEMENT_DYNAMIC_BIND_FN(bind_helper)
+# endif
+
+static int batch_init(ENGINE *e)
+{
+    return 1;
+}
+
+
+static int batch_finish(ENGINE *e)
+{
+    return 1;
+}
+
+
+static int batch_destroy(ENGINE *e)
+{
+#ifdef BATCH_OFFLOAD
+    batch_offload_stop();
+    batch_timer_stop();
+#endif
+    RSA_meth_free(batch_rsa_method);
+    batch_rsa_method = NULL;
+#ifndef OPENSSL_NO_DH
+    DH_meth_free(batch_dh_method);
+    batch_dh_method = NULL;
+#endif
+#ifndef OPENSSL_NO_EC
+    EC_KEY_METHOD_free(batch_ec_method);
+    batch_ec_method = NULL;
+    /* The pkey method has already been freed by engine_pkey_meths_free() */
+    batch_x25519_pmeth = NULL;
+#endif
+    CRYPTO_THREAD_lock_free(batch_lock);
+    batch_lock = NULL;
+    ERR_unload_BATCH_strings();
+    return 1;
+}
+
+static int batch_ctrl(ENGINE *e, int cmd, long i, void *p, void (*f) (void))
+{
+    switch (cmd) {
+    case BATCH_CMD_SIZE:
+        if (i < 1 || i > BATCH_MAX_SIZE) {
+            BATCHerr(BATCH_F_BATCH_CTRL, BATCH_R_INVALID_BATCH_SIZE);
+            return 0;
+        }
+        CRYPTO_THREAD_write_lock(batch_lock);
+        batch_size = (size_t)i;
+        CRYPTO_THREAD_unlock(batch_lock);
+        return 1;
+
+    case BATCH_CMD_LATENCY_US:
+        if (i < 0) {
+            BATCHerr(BATCH_F_BATCH_CTRL, BATCH_R_INVALID_LATENCY);
+            return 0;
+        }
+        CRYPTO_THREAD_write_lock(batch_lock);
+        batch_latency = (uint64_t)i;
+        CRYPTO_THREAD_unlock(batch_lock);
+        return 1;
+
+    case BATCH_CMD_THREADS:
+        if (i < 0 || i > BATCH_MAX_THREADS) {
+            BATCHerr(BATCH_F_BATCH_CTRL, BATCH_R_INVALID_THREADS);
+            return 0;
+        }
+#ifdef BATCH_OFFLOAD
+        batch_offload_stop();
+        if (i > 0 && !batch_offload_start((int)i)) {
+            BATCHerr(BATCH_F_BATCH_CTRL, BATCH_R_THREAD_CREATION_FAILED);
+            return 0;
+        }
+        return 1;
+#else
+        if (i == 0)
+            return 1;
+        BATCHerr(BATCH_F_BATCH_CTRL, BATCH_R_THREADS_NOT_SUPPORTED);
+        return 0;
+#endif
+
+    default:
+        break;
+    }
+    BATCHerr(BATCH_F_BATCH_CTRL, BATCH_R_CTRL_COMMAND_NOT_IMPLEMENTED);
+    return 0;
+}
+
+#ifndef OPENSSL_NO_EC
+static int batch_pkey_meths(ENGINE *e, EVP_PKEY_METHOD **pmeth,
+                            const int **nids, int nid)
+{
+    if (pmeth == NULL) {
+        /* We are returning a list of supported nids */
+        *nids = batch_pkey_nids;
+        return (sizeof(batch_pkey_nids) - 1) / sizeof(batch_pkey_nids[0]);
+    }
+    /* We are being asked for a specific pkey method */
+    if (nid == EVP_PKEY_X25519) {
+        *pmeth = batch_x25519_pmeth;
+        return 1;
+    }
+    *pmeth = NULL;
+    return 0;
+}
+#endif
+
+/*
+ * Queueing and wake-up machinery
+ */
+
+static uint64_t batch_now(void)
+{
+#if defined(ASYNC_WIN)
+    return (uint64_t)GetTickCount64() * 1000;
+#elif defined(ASYNC_POSIX)
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return (uint64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+#else
+    return 0;
+#endif
+}
+
+static void wait_cleanup(ASYNC_WAIT_CTX *ctx, const void *key,
+                         OSSL_ASYNC_FD readfd, void *pvwritefd)
+{
+    OSSL_ASYNC_FD *pwritefd = (OSSL_ASYNC_FD *)pvwritefd;
+#if defined(ASYNC_WIN)
+    CloseHandle(readfd);
+    CloseHandle(*pwritefd);
+#elif defined(ASYNC_POSIX)
+    close(readfd);
+    if (*pwritefd != readfd)
+        close(*pwritefd);
+#endif
+    OPENSSL_free(pwritefd);
+}
+
+/*
+ * Find out how the job owning |req| wants to be woken up: through the
+ * callback set on its wait context, or else through an eventfd (a pipe
+ * where there is no eventfd) that is created on first use and kept in the
+ * wait context.
+ */
+static int batch_setup_wait(BATCH_REQ *req, ASYNC_WAIT_CTX *waitctx)
+{
+#if defined(ASYNC_POSIX) || defined(ASYNC_WIN)
+    OSSL_ASYNC_FD pipefds[2];
+    OSSL_ASYNC_FD *writefd;
+
+    if (ASYNC_WAIT_CTX_get_callback(waitctx, &req->callback,
+                                    &req->callback_arg)
+        && req->callback != NULL)
+        return 1;
+    req->callback = NULL;
+
+    if (ASYNC_WAIT_CTX_get_fd(waitctx, engine_batch_id, &req->readfd,
+                              (void **)&writefd)) {
+        req->writefd = *writefd;
+        return 1;
+    }
+
+    if ((writefd = OPENSSL_malloc(sizeof(*writefd))) == NULL)
+        return 0;
+# if defined(ASYNC_WIN)
+    if (CreatePipe(&pipefds[0], &pipefds[1], NULL, 256) == 0) {
+        OPENSSL_free(writefd);
+        return 0;
+    }
+# elif defined(BATCH_EVENTFD)
+    if ((pipefds[0] = eventfd(0, EFD_CLOEXEC)) < 0) {
+        OPENSSL_free(writefd);
+        return 0;
+    }
+    pipefds[1] = pipefds[0];
+# else
+    if (pipe(pipefds) != 0) {
+        OPENSSL_free(writefd);
+        return 0;
+    }
+# endif
+    *writefd = pipefds[1];
+    if (!ASYNC_WAIT_CTX_set_wait_fd(waitctx, engine_batch_id, pipefds[0],
+                                    writefd, wait_cleanup)) {
+        wait_cleanup(waitctx, engine_batch_id, pipefds[0], writefd);
+        return 0;
+    }
+    req->readfd = pipefds[0];
+    req->writefd = pipefds[1];
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+#define WAKE_CHAR 'X'
+
+/*
+ * Make the job owning |req| runnable.  Called with batch_lock held; at most
+ * one wake-up is ever pending for a request.
+ */
+static void batch_wake(BATCH_REQ *req)
+{
+#if defined(ASYNC_WIN)
+    DWORD numwritten;
+#endif
+#if defined(BATCH_EVENTFD)
+    uint64_t buf = 1;
+#else
+    char buf = WAKE_CHAR;
+#endif
+
+    if (req->signalled)
+        return;
+    req->signalled = 1;
+    if (req->callback != NULL) {
+        (*req->callback)(req->callback_arg);
+        return;
+    }
+#if defined(ASYNC_WIN)
+    WriteFile(req->writefd, &buf, 1, &numwritten, NULL);
+#elif defined(ASYNC_POSIX)
+    if (write(req->writefd, &buf, sizeof(buf)) < 0)
+        req->signalled = 0;
+#endif
+}
+
+/* Consume a wake-up of |req|, if there is one.  Called with batch_lock held */
+static void batch_clear_wake(BATCH_REQ *req)
+{
+#if defined(ASYNC_WIN)
+    DWORD numread;
+#endif
+#if defined(BATCH_EVENTFD)
+    uint64_t buf;
+#else
+    char buf;
+#endif
+
+    if (!req->signalled)
+        return;
+    req->signalled = 0;
+    if (req->callback != NULL)
+        return;
+#if defined(ASYNC_WIN)
+    ReadFile(req->readfd, &buf, 1, &numread, NULL);
+#elif defined(ASYNC_POSIX)
+    if (read(req->readfd, &buf, sizeof(buf)) < 0)
+        return;
+#endif
+}
+
+/* Move the errors of the current thread to |errs| */
+static void batch_errors_save(BATCH_ERRORS *errs)
+{
+    BATCH_ERROR *e;
+    const char *file, *data;
+    unsigned long code;
+    int line, flags;
+
+    errs->num = 0;
+    while ((code = ERR_get_error_line_data(&file, &line, &data, &flags))
+           != 0) {
+        /* Like the error queue itself, keep the most recent errors */
+        if (errs->num == ERR_NUM_ERRORS) {
+            OPENSSL_free(errs->err[0].data);
+            memmove(&errs->err[0], &errs->err[1],
+                    sizeof(errs->err[0]) * (ERR_NUM_ERRORS - 1));
+            errs->num--;
+        }
+        e = &errs->err[errs->num++];
+        e->code = code;
+        e->file = file;
+        e->line = line;
+        e->data = (flags & ERR_TXT_STRING) != 0 ? OPENSSL_strdup(data) : NULL;
+    }
+}
+
+/* Raise the errors in |errs| on the current thread */
+static void batch_errors_restore(BATCH_ERRORS *errs)
+{
+    BATCH_ERROR *e;
+    int i;
+
+    for (i = 0; i < errs->num; i++) {
+        e = &errs->err[i];
+        ERR_put_error(ERR_GET_LIB(e->code), ERR_GET_FUNC(e->code),
+                      ERR_GET_REASON(e->code), e->file, e->line);
+        if (e->data != NULL)
+            ERR_add_error_data(1, e->data);
+        OPENSSL_free(e->data);
+    }
+    errs->num = 0;
+}
+
+/*
+ * Execute the first |max| requests queued on |q|, and wake up their jobs
+ * except for |self|, the request of the job doing the work.  Called with
+ * batch_lock held, returns with it released.
+ */
+static void batch_flush(BATCH_QUEUE *q, size_t max, BATCH_REQ *self)
+{
+    BATCH_REQ *list = q->head, *last = NULL, *req, *next;
+    BATCH_ERRORS saved;
+    size_t n;
+
+    for (n = 0, req = list; req != NULL && n < max; n++, req = req->next) {
+        req->queued = 0;
+        last = req;
+    }
+    q->head = req;
+    if (req == NULL)
+        q->tail = NULL;
+    q->count -= n;
+    if (last != NULL)
+        last->next = NULL;
+    CRYPTO_THREAD_unlock(batch_lock);
+
+    /*
+     * This is where a multi-lane implementation would process the whole
+     * batch at once.  For now the requests are run back to back, which
+     * still saves one pause/resume round trip per operation.  The errors
+     * of each request are kept for the job that issued it.
+     */
+    batch_errors_save(&saved);
+    for (req = list; req != NULL; req = req->next) {
+        req->ret = req->run(req);
+        batch_errors_save(&req->errs);
+    }
+    batch_errors_restore(&saved);
+
+    CRYPTO_THREAD_write_lock(batch_lock);
+    for (req = list; req != NULL; req = next) {
+        /* |req| may go away as soon as it is marked done and we unlock */
+        next = req->next;
+        req->done = 1;
+        if (req != self)
+            batch_wake(req);
+    }
+    CRYPTO_THREAD_unlock(batch_lock);
+}
+
+#ifdef BATCH_OFFLOAD
+static void *batch_worker(void *arg)
+{
+    for (;;) {
+        BATCH_QUEUE *q = NULL;
+        size_t n;
+        int i;
+
+        pthread_mutex_lock(&offload_mutex);
+        while (offload_pending == 0 && !offload_stop)
+            pthread_cond_wait(&offload_cond, &offload_mutex);
+        /* Requests still queued are served before stopping */
+        if (offload_pending == 0) {
+            pthread_mutex_unlock(&offload_mutex);
+            break;
+        }
+        pthread_mutex_unlock(&offload_mutex);
+
+        CRYPTO_THREAD_write_lock(batch_lock);
+        for (i = 0; i < BATCH_QUEUES; i++)
+            if (q == NULL || offload_queues[i].count > q->count)
+                q = &offload_queues[i];
+        /* Leave some of a long queue to the other workers */
+        n = q->count / (offload_nthreads > 1 ? offload_nthreads : 1);
+        if (n == 0)
+            n = q->count;
+        if (n > batch_size)
+            n = batch_size;
+        pthread_mutex_lock(&offload_mutex);
+        offload_pending -= n;
+        pthread_mutex_unlock(&offload_mutex);
+        if (n == 0)
+            CRYPTO_THREAD_unlock(batch_lock);
+        else
+            batch_flush(q, n, NULL);
+    }
+    OPENSSL_thread_stop();
+    return NULL;
+}
+
+static int batch_offload_start(int nthreads)
+{
+    int i;
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&offload_threads[i], NULL, batch_worker,
+                           NULL) != 0) {
+            CRYPTO_THREAD_write_lock(batch_lock);
+            offload_nthreads = i;
+            CRYPTO_THREAD_unlock(batch_lock);
+            batch_offload_stop();
+            return 0;
+        }
+    }
+    CRYPTO_THREAD_write_lock(batch_lock);
+    offload_nthreads = nthreads;
+    CRYPTO_THREAD_unlock(batch_lock);
+    return 1;
+}
+
+/* Stop the workers once they have drained the offload queues */
+static void batch_offload_stop(void)
+{
+    int i, nthreads;
+
+    if (batch_lock == NULL)
+        return;
+    /* From here on new requests are batched in the calling jobs */
+    CRYPTO_THREAD_write_lock(batch_lock);
+    nthreads = offload_nthreads;
+    offload_nthreads = 0;
+    CRYPTO_THREAD_unlock(batch_lock);
+    if (nthreads == 0)
+        return;
+
+    pthread_mutex_lock(&offload_mutex);
+    offload_stop = 1;
+    pthread_cond_broadcast(&offload_cond);
+    pthread_mutex_unlock(&offload_mutex);
+    for (i = 0; i < nthreads; i++)
+        pthread_join(offload_threads[i], NULL);
+    pthread_mutex_lock(&offload_mutex);
+    offload_stop = 0;
+    pthread_mutex_unlock(&offload_mutex);
+}
+
+/*
+ * Wake up the oldest request of every queue whose deadline has passed, then
+ * sleep until the next deadline or until a queue gets a new one.
+ */
+static void *batch_timer(void *arg)
+{
+    struct timespec ts;
+    uint64_t now, next;
+    int i, stop = 0;
+
+    while (!stop) {
+        next = 0;
+        CRYPTO_THREAD_write_lock(batch_lock);
+        now = batch_now();
+        for (i = 0; i < BATCH_QUEUES; i++) {
+            BATCH_QUEUE *q = &batch_queues[i];
+
+            if (q->head == NULL)
+                continue;
+            /* The woken job flushes the queue, which then gets a new one */
+            if (now >= q->deadline)
+                batch_wake(q->head);
+            else if (next == 0 || q->deadline < next)
+                next = q->deadline;
+        }
+        CRYPTO_THREAD_unlock(batch_lock);
+
+        pthread_mutex_lock(&timer_mutex);
+        while (!timer_kick && !timer_stop) {
+            if (next == 0) {
+                pthread_cond_wait(&timer_cond, &timer_mutex);
+                continue;
+            }
+            ts.tv_sec = (time_t)(next / 1000000);
+            ts.tv_nsec = (long)(next % 1000000) * 1000;
+            if (pthread_cond_timedwait(&timer_cond, &timer_mutex,
+                                       &ts) == ETIMEDOUT)
+                break;
+        }
+        timer_kick = 0;
+        stop = timer_stop;
+        pthread_mutex_unlock(&timer_mutex);
+    }
+    OPENSSL_thread_stop();
+    return NULL;
+}
+
+/* Tell the timer thread about a new deadline.  Called with batch_lock held */
+static void batch_timer_kick(void)
+{
+    if (!timer_running) {
+        if (pthread_create(&timer_thread, NULL, batch_timer, NULL) == 0)
+            timer_running = 1;
+        return;
+    }
+    pthread_mutex_lock(&timer_mutex);
+    timer_kick = 1;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+}
+
+static void batch_timer_stop(void)
+{
+    int running;
+
+    if (batch_lock == NULL)
+        return;
+    CRYPTO_THREAD_write_lock(batch_lock);
+    running = timer_running;
+    timer_running = 0;
+    CRYPTO_THREAD_unlock(batch_lock);
+    if (!running)
+        return;
+
+    pthread_mutex_lock(&timer_mutex);
+    timer_stop = 1;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_mutex);
+    pthread_join(timer_thread, NULL);
+    timer_stop = 0;
+}
+#endif
+
+/*
+ * Queue a copy of |tmpl| on queue |qidx| and return its result once it has
+ * been executed as part of a batch.
+ */
+static int batch_submit(int qidx, BATCH_REQ *tmpl)
+{
+    ASYNC_JOB *job = ASYNC_get_current_job();
+    BATCH_QUEUE *q = &batch_queues[qidx];
+    BATCH_REQ *req;
+    int offload = 0, polling = 1, ret;
+
+    if (job == NULL || batch_lock == NULL
+        || (req = OPENSSL_memdup(tmpl, sizeof(*tmpl))) == NULL)
+        return tmpl->run(tmpl);
+    if (!batch_setup_wait(req, ASYNC_get_wait_ctx(job))) {
+        OPENSSL_free(req);
+        return tmpl->run(tmpl);
+    }
+
+    req->queued = 1;
+    req->done = 0;
+    req->signalled = 0;
+    req->next = NULL;
+    req->errs.num = 0;
+
+    CRYPTO_THREAD_write_lock(batch_lock);
+#ifdef BATCH_OFFLOAD
+    if (offload_nthreads > 0) {
+        offload = 1;
+        q = &offload_queues[qidx];
+    }
+#endif
+    if (q->tail == NULL) {
+        q->head = req;
+        q->deadline = batch_now() + batch_latency;
+#ifdef BATCH_TIMER
+        if (!offload)
+            batch_timer_kick();
+#endif
+    } else {
+        q->tail->next = req;
+    }
+    q->tail = req;
+    q->count++;
+#ifdef BATCH_OFFLOAD
+    if (offload) {
+        pthread_mutex_lock(&offload_mutex);
+        offload_pending++;
+        pthread_cond_signal(&offload_cond);
+        pthread_mutex_unlock(&offload_mutex);
+    }
+#endif
+
+    while (!req->done) {
+        if (!offload && req->queued
+            && (q->count >= batch_size || batch_now() >= q->deadline)) {
+            batch_flush(q, (size_t)-1, req);
+            goto done;
+        }
+
+#ifdef BATCH_TIMER
+        polling = !timer_running;
+#endif
+        /* Without a timer the oldest request keeps polling for the deadline */
+        if (!offload && polling && q->head == req)
+            batch_wake(req);
+        CRYPTO_THREAD_unlock(batch_lock);
+
+        ASYNC_pause_job();
+
+        CRYPTO_THREAD_write_lock(batch_lock);
+        batch_clear_wake(req);
+    }
+    /* We may have been woken up without pausing again */
+    batch_clear_wake(req);
+    CRYPTO_THREAD_unlock(batch_lock);
+
+ done:
+    batch_errors_restore(&req->errs);
+    ret = req->ret;
+    OPENSSL_free(req);
+    return ret;
+}
+
+/*
+ * RSA implementation
+ */
+
+static int batch_rsa_run(BATCH_REQ *req)
+{
+    return req->u.rsa.fn(req->u.rsa.flen, req->u.rsa.from, req->u.rsa.to,
+                         req->u.rsa.rsa, req->u.rsa.padding);
+}
+
+static int batch_rsa_submit(int (*fn)(int flen, const unsigned char *from,
+                                      unsigned char *to, RSA *rsa,
+                                      int padding),
+                            int flen, const unsigned char *from,
+                            unsigned char *to, RSA *rsa, int padding)
+{
+    BATCH_REQ req;
+
+    req.run = batch_rsa_run;
+    req.u.rsa.fn = fn;
+    req.u.rsa.flen = flen;
+    req.u.rsa.from = from;
+    req.u.rsa.to = to;
+    req.u.rsa.rsa = rsa;
+    req.u.rsa.padding = padding;
+    return batch_submit(BATCH_QUEUE_RSA, &req);
+}
+
+static int batch_rsa_priv_enc(int flen, const unsigned char *from,
+                              unsigned char *to, RSA *rsa, int padding)
+{
+    return batch_rsa_submit(RSA_meth_get_priv_enc(RSA_PKCS1_OpenSSL()),
+                            flen, from, to, rsa, padding);
+}
+
+static int batch_rsa_priv_dec(int flen, const unsigned char *from,
+                              unsigned char *to, RSA *rsa, int padding)
+{
+    return batch_rsa_submit(RSA_meth_get_priv_dec(RSA_PKCS1_OpenSSL()),
+                            flen, from, to, rsa, padding);
+}
+
+#ifndef OPENSSL_NO_EC
+/*
+ * ECDSA implementation
+ */
+
+static int batch_ecdsa_sign_run(BATCH_REQ *req)
+{
+    return orig_ecdsa_sign(req->u.sign.type, req->u.sign.dgst,
+                           req->u.sign.dlen, req->u.sign.sig,
+                           req->u.sign.siglen, req->u.sign.kinv,
+                           req->u.sign.r, req->u.sign.eckey);
+}
+
+static int batch_ecdsa_sign(int type, const unsigned char *dgst, int dlen,
+                            unsigned char *sig, unsigned int *siglen,
+                            const BIGNUM *kinv, const BIGNUM *r,
+                            EC_KEY *eckey)
+{
+    BATCH_REQ req;
+
+    req.run = batch_ecdsa_sign_run;
+    req.u.sign.type = type;
+    req.u.sign.dgst = dgst;
+    req.u.sign.dlen = dlen;
+    req.u.sign.sig = sig;
+    req.u.sign.siglen = siglen;
+    req.u.sign.kinv = kinv;
+    req.u.sign.r = r;
+    req.u.sign.eckey = eckey;
+    return batch_submit(BATCH_QUEUE_ECDSA, &req);
+}
+
+/*
+ * X25519 implementation
+ */
+
+static int batch_x25519_derive_run(BATCH_REQ *req)
+{
+    return orig_x25519_derive(req->u.derive.ctx, req->u.derive.key,
+                              req->u.derive.keylen);
+}
+
+static int batch_x25519_derive(EVP_PKEY_CTX *ctx, unsigned char *key,
+                               size_t *keylen)
+{
+    BATCH_REQ req;
+
+    /* A length query does not need any computation */
+    if (key == NULL)
+        return orig_x25519_derive(ctx, key, keylen);
+
+    req.run = batch_x25519_derive_run;
+    req.u.derive.ctx = ctx;
+    req.u.derive.key = key;
+    req.u.derive.keylen = keylen;
+    return batch_submit(BATCH_QUEUE_X25519, &req);
+}
+#endif
+
+#ifndef OPENSSL_NO_DH
+/*
+ * DH implementation
+ */
+
+static int batch_dh_run(BATCH_REQ *req)
+{
+    return DH_meth_get_compute_key(DH_OpenSSL())(req->u.dh.key,
+                                                 req->u.dh.pub_key,
+                                                 req->u.dh.dh);
+}
+
+static int batch_dh_compute_key(unsigned char *key, const BIGNUM *pub_key,
+                                DH *dh)
+{
+    BATCH_REQ req;
+
+    req.run = batch_dh_run;
+    req.u.dh.key = key;
+    req.u.dh.pub_key = pub_key;
+    req.u.dh.dh = dh;
+    return batch_submit(BATCH_QUEUE_DH, &req);
+}
+#endif
@@ -0,0 +1,40 @@
+/*
+ * Generated by util/mkerr.pl DO NOT EDIT
+ * Copyright 1995-2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+#ifndef HEADER_BATCHERR_H
+# define HEADER_BATCHERR_H
+
+# include <openssl/opensslconf.h>
+# include <openssl/symhacks.h>
+
+
+# define BATCHerr(f, r) ERR_BATCH_error(0, (r), OPENSSL_FILE, OPENSSL_LINE)
+
+
+/*
+ * BATCH function codes.
+ */
+# if !OPENSSL_API_3
+#  define BATCH_F_BATCH_CTRL                               0
+#  define BATCH_F_BIND_BATCH                               0
+# endif
+
+/*
+ * BATCH reason codes.
+ */
+# define BATCH_R_CTRL_COMMAND_NOT_IMPLEMENTED             100
+# define BATCH_R_INIT_FAILED                              101
+# define BATCH_R_INVALID_BATCH_SIZE                       102
+# define BATCH_R_INVALID_LATENCY                          103
+# define BATCH_R_INVALID_THREADS                          104
+# define BATCH_R_THREADS_NOT_SUPPORTED                    105
+# define BATCH_R_THREAD_CREATION_FAILED                   106
+
+#endif
@@ -306,6 +306,16 @@ int CRYPTO_secure_allocated(const void *ptr);
 int CRYPTO_secure_malloc_initialized(void);
 size_t CRYPTO_secure_actual_size(void *ptr);
 size_t CRYPTO_secure_used(void);
+int CRYPTO_secure_malloc_stats(size_t *arena, size_t *used, size_t *cached,
+                               size_t *free_chunks, size_t *largest_free);
+
+int CRYPTO_mem_cache_enable(void);
+void *CRYPTO_mem_cache_malloc(size_t num, const char *file, int line);
+void *CRYPTO_mem_cache_realloc(void *addr, size_t num,
+                               const char *file, int line);
+void CRYPTO_mem_cache_free(void *ptr, const char *file, int line);
+int CRYPTO_mem_cache_get_stats(int idx, size_t *size, uint64_t *allocs,
+                               uint64_t *hits, uint64_t *frees);
 
 void OPENSSL_cleanse(void *ptr, size_t len);
 
@@ -35,6 +35,11 @@
 # define RAND_DRBG_FLAG_PUBLIC               0x8
 /* Used by RAND_DRBG_set_defaults() to set the private DRBG type and flags. */
 # define RAND_DRBG_FLAG_PRIVATE              0x10
+/*
+ * Generate output for small RAND_DRBG_bytes() requests in larger blocks
+ * ahead of time and serve the requests from that buffer.
+ */
+# define RAND_DRBG_FLAG_BUFFERED             0x20
 
 # if !OPENSSL_API_3
 /* This #define was replaced by an internal constant and should not be used. */
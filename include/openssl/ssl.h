@@ -1823,6 +1823,43 @@ size_t SSL_client_hello_get0_compression_methods(SSL *s,
 int SSL_client_hello_get1_extensions_present(SSL *s, int **out, size_t *outlen);
 int SSL_client_hello_get0_ext(SSL *s, unsigned int type,
                               const unsigned char **out, size_t *outlen);
+void SSL_CTX_set_client_hello_filter(SSL_CTX *c, SSL_client_hello_cb_fn cb,
+                                     void *arg);
+size_t SSL_client_hello_get0_servername(SSL *s, const unsigned char **out);
+size_t SSL_client_hello_get0_alpn(SSL *s, const unsigned char **out);
+size_t SSL_client_hello_get0_supported_versions(SSL *s,
+                                                const unsigned char **out);
+size_t SSL_client_hello_get0_key_share_groups(SSL *s,
+                                              const unsigned char **out);
+
+/*
+ * Certificate compression (RFC8879)
+ */
+typedef int (*SSL_cert_compress_cb_fn)(SSL *s,
+                                       const unsigned char *in, size_t inlen,
+                                       unsigned char *out, size_t *outlen);
+typedef int (*SSL_cert_decompress_cb_fn)(SSL *s,
+                                         const unsigned char *in, size_t inlen,
+                                         unsigned char *out, size_t outlen);
+int SSL_CTX_add_cert_compression_alg(SSL_CTX *ctx, int alg,
+                                     SSL_cert_compress_cb_fn compress,
+                                     SSL_cert_decompress_cb_fn decompress);
+int SSL_get_cert_compression_alg(const SSL *s);
+
+# ifndef OPENSSL_NO_OCSP
+/*
+ * Cache of OCSP responses to staple
+ */
+typedef int (*SSL_ocsp_fetch_cb_fn)(SSL_CTX *ctx, X509 *cert, X509 *issuer,
+                                    unsigned char **resp, size_t *resplen,
+                                    void *arg);
+int SSL_CTX_set_ocsp_staple_fetcher(SSL_CTX *ctx, SSL_ocsp_fetch_cb_fn fetch,
+                                    void *arg);
+int SSL_CTX_refresh_ocsp_staples(SSL_CTX *ctx);
+void SSL_CTX_get_ocsp_staple_stats(SSL_CTX *ctx, unsigned long *stapled,
+                                   unsigned long *unstapled, long *max_age,
+                                   unsigned long *refresh_ms);
+# endif
 
 void SSL_certs_clear(SSL *s);
 void SSL_free(SSL *ssl);
@@ -2438,6 +2475,15 @@ int SSL_CTX_set_session_ticket_cb(SSL_CTX *ctx,
 int SSL_SESSION_set1_ticket_appdata(SSL_SESSION *ss, const void *data, size_t len);
 int SSL_SESSION_get0_ticket_appdata(SSL_SESSION *ss, void **data, size_t *len);
 
+/* Ticket keys that only decrypt tickets, which are then renewed */
+# define SSL_TICKET_KEY_DECRYPT_ONLY 0x1
+
+__owur int SSL_CTX_add_ticket_key(SSL_CTX *ctx, const unsigned char *keys,
+                                  size_t keylen, int flags);
+int SSL_CTX_remove_ticket_key(SSL_CTX *ctx, const unsigned char *name,
+                              size_t namelen);
+__owur int SSL_CTX_rotate_ticket_keys(SSL_CTX *ctx, size_t max_keys);
+
 typedef unsigned int (*DTLS_timer_cb)(SSL *s, unsigned int timer_us);
 
 void DTLS_set_timer_cb(SSL *s, DTLS_timer_cb cb);
@@ -2450,6 +2496,7 @@ void SSL_CTX_set_allow_early_data_cb(SSL_CTX *ctx,
 void SSL_set_allow_early_data_cb(SSL *s,
                                  SSL_allow_early_data_cb_fn cb,
                                  void *arg);
+__owur int SSL_CTX_set_anti_replay_filter(SSL_CTX *ctx, size_t bits);
 
 /* store the default cipher strings inside the library */
 const char *OSSL_default_cipher_list(void);
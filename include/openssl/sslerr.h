@@ -75,6 +75,7 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_FINAL_SIG_ALGS                             0
 #  define SSL_F_GET_CERT_VERIFY_TBS_DATA                   0
 #  define SSL_F_NSS_KEYLOG_INT                             0
+#  define SSL_F_OCSP_STAPLE_FETCH                          0
 #  define SSL_F_OPENSSL_INIT_SSL                           0
 #  define SSL_F_OSSL_STATEM_CLIENT13_READ_TRANSITION       0
 #  define SSL_F_OSSL_STATEM_CLIENT13_WRITE_TRANSITION      0
@@ -116,6 +117,7 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_SSL3_OUTPUT_CERT_CHAIN                     0
 #  define SSL_F_SSL3_READ_BYTES                            0
 #  define SSL_F_SSL3_READ_N                                0
+#  define SSL_F_SSL3_SETTLE_FINISHED_MAC                   0
 #  define SSL_F_SSL3_SETUP_KEY_BLOCK                       0
 #  define SSL_F_SSL3_SETUP_READ_BUFFER                     0
 #  define SSL_F_SSL3_SETUP_WRITE_BUFFER                    0
@@ -137,7 +139,9 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_SSL_BYTES_TO_CIPHER_LIST                   0
 #  define SSL_F_SSL_CACHE_CIPHERLIST                       0
 #  define SSL_F_SSL_CERT_ADD0_CHAIN_CERT                   0
+#  define SSL_F_SSL_CERT_COMPRESS                          0
 #  define SSL_F_SSL_CERT_DUP                               0
+#  define SSL_F_SSL_CERT_LIST_OUTPUT                       0
 #  define SSL_F_SSL_CERT_NEW                               0
 #  define SSL_F_SSL_CERT_SET0_CHAIN                        0
 #  define SSL_F_SSL_CHECK_PRIVATE_KEY                      0
@@ -155,14 +159,17 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_SSL_CONF_CMD                               0
 #  define SSL_F_SSL_CREATE_CIPHER_LIST                     0
 #  define SSL_F_SSL_CTRL                                   0
+#  define SSL_F_SSL_CTX_ADD_CERT_COMPRESSION_ALG           0
 #  define SSL_F_SSL_CTX_CHECK_PRIVATE_KEY                  0
 #  define SSL_F_SSL_CTX_ENABLE_CT                          0
 #  define SSL_F_SSL_CTX_MAKE_PROFILES                      0
 #  define SSL_F_SSL_CTX_NEW                                0
+#  define SSL_F_SSL_CTX_REFRESH_OCSP_STAPLES               0
 #  define SSL_F_SSL_CTX_SET_ALPN_PROTOS                    0
 #  define SSL_F_SSL_CTX_SET_CIPHER_LIST                    0
 #  define SSL_F_SSL_CTX_SET_CLIENT_CERT_ENGINE             0
 #  define SSL_F_SSL_CTX_SET_CT_VALIDATION_CALLBACK         0
+#  define SSL_F_SSL_CTX_SET_OCSP_STAPLE_FETCHER            0
 #  define SSL_F_SSL_CTX_SET_SESSION_ID_CONTEXT             0
 #  define SSL_F_SSL_CTX_SET_SSL_VERSION                    0
 #  define SSL_F_SSL_CTX_SET_TLSEXT_MAX_FRAGMENT_LENGTH     0
@@ -305,6 +312,7 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_TLS_CONSTRUCT_CLIENT_VERIFY                0
 #  define SSL_F_TLS_CONSTRUCT_CTOS_ALPN                    0
 #  define SSL_F_TLS_CONSTRUCT_CTOS_CERTIFICATE             0
+#  define SSL_F_TLS_CONSTRUCT_CTOS_COMPRESS_CERTIFICATE    0
 #  define SSL_F_TLS_CONSTRUCT_CTOS_COOKIE                  0
 #  define SSL_F_TLS_CONSTRUCT_CTOS_EARLY_DATA              0
 #  define SSL_F_TLS_CONSTRUCT_CTOS_EC_PT_FORMATS           0
@@ -374,6 +382,7 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_TLS_PARSE_CERTIFICATE_AUTHORITIES          0
 #  define SSL_F_TLS_PARSE_CLIENTHELLO_TLSEXT               0
 #  define SSL_F_TLS_PARSE_CTOS_ALPN                        0
+#  define SSL_F_TLS_PARSE_CTOS_COMPRESS_CERTIFICATE        0
 #  define SSL_F_TLS_PARSE_CTOS_COOKIE                      0
 #  define SSL_F_TLS_PARSE_CTOS_EARLY_DATA                  0
 #  define SSL_F_TLS_PARSE_CTOS_EC_PT_FORMATS               0
@@ -411,6 +420,7 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_TLS_POST_PROCESS_CLIENT_HELLO              0
 #  define SSL_F_TLS_POST_PROCESS_CLIENT_KEY_EXCHANGE       0
 #  define SSL_F_TLS_PREPARE_CLIENT_CERTIFICATE             0
+#  define SSL_F_TLS_PREPARE_SERVER_CERTIFICATE             0
 #  define SSL_F_TLS_PROCESS_AS_HELLO_RETRY_REQUEST         0
 #  define SSL_F_TLS_PROCESS_CERTIFICATE_REQUEST            0
 #  define SSL_F_TLS_PROCESS_CERT_STATUS                    0
@@ -437,6 +447,7 @@ int ERR_load_SSL_strings(void);
 #  define SSL_F_TLS_PROCESS_NEW_SESSION_TICKET             0
 #  define SSL_F_TLS_PROCESS_NEXT_PROTO                     0
 #  define SSL_F_TLS_PROCESS_SERVER_CERTIFICATE             0
+#  define SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE  0
 #  define SSL_F_TLS_PROCESS_SERVER_DONE                    0
 #  define SSL_F_TLS_PROCESS_SERVER_HELLO                   0
 #  define SSL_F_TLS_PROCESS_SKE_DHE                        0
@@ -618,6 +629,7 @@ int ERR_load_SSL_strings(void);
 # define SSL_R_NO_COMPRESSION_SPECIFIED                   187
 # define SSL_R_NO_COOKIE_CALLBACK_SET                     287
 # define SSL_R_NO_GOST_CERTIFICATE_SENT_BY_PEER           330
+# define SSL_R_NO_ISSUER_CERTIFICATE                      444
 # define SSL_R_NO_METHOD_SPECIFIED                        188
 # define SSL_R_NO_PEM_EXTENSIONS                          389
 # define SSL_R_NO_PRIVATE_KEY_ASSIGNED                    190
@@ -187,6 +187,7 @@ void X509_STORE_CTX_set_depth(X509_STORE_CTX *ctx, int depth);
 
 # define         X509_V_ERR_SIGNATURE_ALGORITHM_MISMATCH         76
 # define         X509_V_ERR_NO_ISSUER_PUBLIC_KEY                 77
+# define         X509_V_ERR_UNABLE_TO_DECODE_CRL_ENTRY           78
 
 
 /* Certificate verify flags */
@@ -282,6 +283,10 @@ int X509_STORE_set_purpose(X509_STORE *ctx, int purpose);
 int X509_STORE_set_trust(X509_STORE *ctx, int trust);
 int X509_STORE_set1_param(X509_STORE *ctx, X509_VERIFY_PARAM *pm);
 X509_VERIFY_PARAM *X509_STORE_get0_param(X509_STORE *ctx);
+int X509_STORE_set_verify_cache_size(X509_STORE *ctx, size_t size);
+void X509_STORE_flush_verify_cache(X509_STORE *ctx);
+void X509_STORE_get_verify_cache_stats(X509_STORE *ctx, unsigned long *hits,
+                                       unsigned long *misses);
 
 void X509_STORE_set_verify(X509_STORE *ctx, X509_STORE_CTX_verify_fn verify);
 #define X509_STORE_set_verify_func(ctx, func) \
@@ -13,7 +13,6 @@
 #include <openssl/rand.h>
 #include "ssl_locl.h"
 
-static void get_current_time(struct timeval *t);
 static int dtls1_handshake_write(SSL *s);
 static size_t dtls1_link_min_mtu(void);
 
@@ -264,7 +263,7 @@ void dtls1_start_timer(SSL *s)
     }
 
     /* Set timeout to current time */
-    get_current_time(&(s->d1->next_timeout));
+    ssl_get_current_time(&(s->d1->next_timeout));
 
     /* Add duration to current time */
 
@@ -293,7 +292,7 @@ struct timeval *dtls1_get_timeout(SSL *s, struct timeval *timeleft)
     }
 
     /* Get current time */
-    get_current_time(&timenow);
+    ssl_get_current_time(&timenow);
 
     /* If timer already expired, set remaining time to 0 */
     if (s->d1->next_timeout.tv_sec < timenow.tv_sec ||
@@ -413,7 +412,7 @@ int dtls1_handle_timeout(SSL *s)
     return dtls1_retransmit_buffered_messages(s);
 }
 
-static void get_current_time(struct timeval *t)
+void ssl_get_current_time(struct timeval *t)
 {
 #if defined(_WIN32)
     SYSTEMTIME st;
@@ -318,16 +318,64 @@ void ssl3_cleanup_key_block(SSL *s)
     s->s3.tmp.key_block_length = 0;
 }
 
+/*
+ * A server hashes the first ClientHello of a handshake with each of these
+ * instead of buffering it.  The handshake hash is nearly always one of them.
+ */
+static const int spec_dgst_idx[SSL_SPEC_DGST_COUNT] = {
+    SSL_HANDSHAKE_MAC_SHA256, SSL_HANDSHAKE_MAC_SHA384
+};
+
+static int init_speculative_digests(SSL *s)
+{
+    const EVP_MD *md;
+    size_t i;
+
+    for (i = 0; i < SSL_SPEC_DGST_COUNT; i++) {
+        md = ssl_md(spec_dgst_idx[i]);
+        if (md == NULL
+                || (s->s3.handshake_spec_dgst[i] = EVP_MD_CTX_new()) == NULL
+                || !EVP_DigestInit_ex(s->s3.handshake_spec_dgst[i], md, NULL))
+            return 0;
+    }
+    s->s3.handshake_spec_len = 0;
+    return 1;
+}
+
+static void free_speculative_digests(SSL *s)
+{
+    size_t i;
+
+    for (i = 0; i < SSL_SPEC_DGST_COUNT; i++) {
+        EVP_MD_CTX_free(s->s3.handshake_spec_dgst[i]);
+        s->s3.handshake_spec_dgst[i] = NULL;
+    }
+    s->s3.handshake_spec_len = 0;
+}
+
 int ssl3_init_finished_mac(SSL *s)
 {
-    BIO *buf = BIO_new(BIO_s_mem());
+    BIO *buf;
+
+    ssl3_free_digest_list(s);
 
+    /*
+     * Before a HelloRetryRequest the transcript starts with the ClientHello,
+     * which is all that needs to be hashed before the ciphersuite is chosen.
+     */
+    if (s->server && !SSL_IS_DTLS(s)
+            && s->hello_retry_request == SSL_HRR_NONE) {
+        if (init_speculative_digests(s))
+            return 1;
+        free_speculative_digests(s);
+    }
+
+    buf = BIO_new(BIO_s_mem());
     if (buf == NULL) {
         SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL3_INIT_FINISHED_MAC,
                  ERR_R_MALLOC_FAILURE);
         return 0;
     }
-    ssl3_free_digest_list(s);
     s->s3.handshake_buffer = buf;
     (void)BIO_set_close(s->s3.handshake_buffer, BIO_CLOSE);
     return 1;
@@ -344,13 +392,86 @@ void ssl3_free_digest_list(SSL *s)
     s->s3.handshake_buffer = NULL;
     EVP_MD_CTX_free(s->s3.handshake_dgst);
     s->s3.handshake_dgst = NULL;
+    free_speculative_digests(s);
+}
+
+/*
+ * Returns the speculative digest of the ClientHello with |md|, or NULL if
+ * there is none.
+ */
+EVP_MD_CTX *ssl3_speculative_digest(SSL *s, const EVP_MD *md)
+{
+    size_t i;
+
+    if (md == NULL)
+        return NULL;
+    for (i = 0; i < SSL_SPEC_DGST_COUNT; i++) {
+        if (s->s3.handshake_spec_dgst[i] != NULL
+                && EVP_MD_CTX_type(s->s3.handshake_spec_dgst[i])
+                   == EVP_MD_type(md))
+            return s->s3.handshake_spec_dgst[i];
+    }
+    return NULL;
+}
+
+/*
+ * Called by the server once the ciphersuite is chosen, while the ClientHello
+ * is still in |s->init_buf|.  The speculative digest of the handshake hash is
+ * kept if there is one.  Otherwise, or if the handshake messages are needed
+ * for a TLSv1.2 CertificateVerify, the ClientHello is put into the handshake
+ * buffer after all.
+ */
+int ssl3_settle_finished_mac(SSL *s)
+{
+    EVP_MD_CTX *dgst;
+    size_t i;
+
+    if (s->s3.handshake_spec_dgst[0] == NULL)
+        return 1;
+
+    dgst = ssl3_speculative_digest(s, ssl_handshake_md(s));
+    if (dgst != NULL
+            && (SSL_IS_TLS13(s) || (s->verify_mode & SSL_VERIFY_PEER) == 0)) {
+        for (i = 0; i < SSL_SPEC_DGST_COUNT; i++)
+            if (s->s3.handshake_spec_dgst[i] == dgst)
+                s->s3.handshake_spec_dgst[i] = NULL;
+        s->s3.handshake_dgst = dgst;
+    } else {
+        if (s->s3.handshake_spec_len > INT_MAX
+                || (s->s3.handshake_buffer = BIO_new(BIO_s_mem())) == NULL
+                || BIO_write(s->s3.handshake_buffer, s->init_buf->data,
+                             (int)s->s3.handshake_spec_len)
+                   != (int)s->s3.handshake_spec_len) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                     SSL_F_SSL3_SETTLE_FINISHED_MAC, ERR_R_INTERNAL_ERROR);
+            return 0;
+        }
+    }
+    free_speculative_digests(s);
+    return 1;
 }
 
 int ssl3_finish_mac(SSL *s, const unsigned char *buf, size_t len)
 {
     int ret;
+    size_t i;
 
-    if (s->s3.handshake_dgst == NULL) {
+    if (s->s3.handshake_spec_dgst[0] != NULL) {
+        /* Only the ClientHello can be hashed before the transcript settles */
+        if (s->s3.handshake_spec_len != 0) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL3_FINISH_MAC,
+                     ERR_R_INTERNAL_ERROR);
+            return 0;
+        }
+        for (i = 0; i < SSL_SPEC_DGST_COUNT; i++) {
+            if (!EVP_DigestUpdate(s->s3.handshake_spec_dgst[i], buf, len)) {
+                SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL3_FINISH_MAC,
+                         ERR_R_INTERNAL_ERROR);
+                return 0;
+            }
+        }
+        s->s3.handshake_spec_len = len;
+    } else if (s->s3.handshake_dgst == NULL) {
         /* Note: this writes to a memory BIO so a failure is a fatal error */
         if (len > INT_MAX) {
             SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL3_FINISH_MAC,
@@ -380,6 +501,11 @@ int ssl3_digest_cached_records(SSL *s, int keep)
     long hdatalen;
     void *hdata;
 
+    if (!ssl3_settle_finished_mac(s)) {
+        /* SSLfatal() already called */
+        return 0;
+    }
+
     if (s->s3.handshake_dgst == NULL) {
         hdatalen = BIO_get_mem_data(s->s3.handshake_buffer, &hdata);
         if (hdatalen <= 0) {
@@ -3209,13 +3209,71 @@ static int cipher_compare(const void *a, const void *b)
     return ap->id < bp->id ? -1 : 1;
 }
 
+/*
+ * Direct index of the ciphers above by their two byte code point, built by
+ * ssl_sort_cipher_list().  Each first byte that is used gets a page of 256
+ * entries, cipher_index_page[] holds one plus its page number.  A first byte
+ * without a page when all of them are used up is CIPHER_INDEX_NONE, and its
+ * ciphers are looked up in the tables.
+ */
+#define CIPHER_INDEX_PAGES      (SSL3_CIPHER_SLOTS / 256)
+#define CIPHER_INDEX_NONE       0xff
+
+static unsigned char cipher_index_page[256];
+static const SSL_CIPHER *cipher_index[CIPHER_INDEX_PAGES][256];
+static int cipher_index_built = 0;
+
+static void cipher_index_add(const SSL_CIPHER *c)
+{
+    static int pages = 0;
+    unsigned int hi = (c->id >> 8) & 0xff;
+
+    if ((c->id & 0xffff0000) != SSL3_CK_CIPHERSUITE_FLAG)
+        return;
+    if (cipher_index_page[hi] == 0)
+        cipher_index_page[hi] = pages < CIPHER_INDEX_PAGES ? ++pages
+                                                           : CIPHER_INDEX_NONE;
+    if (cipher_index_page[hi] != CIPHER_INDEX_NONE)
+        cipher_index[cipher_index_page[hi] - 1][c->id & 0xff] = c;
+}
+
 void ssl_sort_cipher_list(void)
 {
+    size_t i;
+
     qsort(tls13_ciphers, TLS13_NUM_CIPHERS, sizeof(tls13_ciphers[0]),
           cipher_compare);
     qsort(ssl3_ciphers, SSL3_NUM_CIPHERS, sizeof(ssl3_ciphers[0]),
           cipher_compare);
     qsort(ssl3_scsvs, SSL3_NUM_SCSVS, sizeof(ssl3_scsvs[0]), cipher_compare);
+
+    if (cipher_index_built)
+        return;
+    for (i = 0; i < TLS13_NUM_CIPHERS; i++)
+        cipher_index_add(&tls13_ciphers[i]);
+    for (i = 0; i < SSL3_NUM_CIPHERS; i++)
+        cipher_index_add(&ssl3_ciphers[i]);
+    for (i = 0; i < SSL3_NUM_SCSVS; i++)
+        cipher_index_add(&ssl3_scsvs[i]);
+    cipher_index_built = 1;
+}
+
+/*
+ * Returns the slot of |c| in the cipher index, below SSL3_CIPHER_SLOTS, or -1
+ * if it doesn't have one.
+ */
+int ssl3_cipher_slot(const SSL_CIPHER *c)
+{
+    unsigned int page;
+
+    if (!cipher_index_built
+            || (c->id & 0xffff0000) != SSL3_CK_CIPHERSUITE_FLAG)
+        return -1;
+    page = cipher_index_page[(c->id >> 8) & 0xff];
+    if (page == 0 || page == CIPHER_INDEX_NONE
+            || cipher_index[page - 1][c->id & 0xff] != c)
+        return -1;
+    return (int)((page - 1) * 256 + (c->id & 0xff));
 }
 
 static int ssl_undefined_function_1(SSL *ssl, unsigned char *r, size_t s,
@@ -3323,6 +3381,7 @@ void ssl3_free(SSL *s)
     OPENSSL_clear_free(s->s3.tmp.pms, s->s3.tmp.pmslen);
     OPENSSL_free(s->s3.tmp.peer_sigalgs);
     OPENSSL_free(s->s3.tmp.peer_cert_sigalgs);
+    BUF_MEM_free(s->s3.tmp.cert_msg);
     ssl3_free_digest_list(s);
     OPENSSL_free(s->s3.alpn_selected);
     OPENSSL_free(s->s3.alpn_proposed);
@@ -3342,6 +3401,7 @@ int ssl3_clear(SSL *s)
     OPENSSL_clear_free(s->s3.tmp.pms, s->s3.tmp.pmslen);
     OPENSSL_free(s->s3.tmp.peer_sigalgs);
     OPENSSL_free(s->s3.tmp.peer_cert_sigalgs);
+    BUF_MEM_free(s->s3.tmp.cert_msg);
 
 #if !defined(OPENSSL_NO_EC) || !defined(OPENSSL_NO_DH)
     EVP_PKEY_free(s->s3.tmp.pkey);
@@ -3810,40 +3870,10 @@ long ssl3_ctx_ctrl(SSL_CTX *ctx, int cmd, long larg, void *parg)
         break;
     case SSL_CTRL_SET_TLSEXT_TICKET_KEYS:
     case SSL_CTRL_GET_TLSEXT_TICKET_KEYS:
-        {
-            unsigned char *keys = parg;
-            long tick_keylen = (sizeof(ctx->ext.tick_key_name) +
-                                sizeof(ctx->ext.secure->tick_hmac_key) +
-                                sizeof(ctx->ext.secure->tick_aes_key));
-            if (keys == NULL)
-                return tick_keylen;
-            if (larg != tick_keylen) {
-                SSLerr(SSL_F_SSL3_CTX_CTRL, SSL_R_INVALID_TICKET_KEYS_LENGTH);
-                return 0;
-            }
-            if (cmd == SSL_CTRL_SET_TLSEXT_TICKET_KEYS) {
-                memcpy(ctx->ext.tick_key_name, keys,
-                       sizeof(ctx->ext.tick_key_name));
-                memcpy(ctx->ext.secure->tick_hmac_key,
-                       keys + sizeof(ctx->ext.tick_key_name),
-                       sizeof(ctx->ext.secure->tick_hmac_key));
-                memcpy(ctx->ext.secure->tick_aes_key,
-                       keys + sizeof(ctx->ext.tick_key_name) +
-                       sizeof(ctx->ext.secure->tick_hmac_key),
-                       sizeof(ctx->ext.secure->tick_aes_key));
-            } else {
-                memcpy(keys, ctx->ext.tick_key_name,
-                       sizeof(ctx->ext.tick_key_name));
-                memcpy(keys + sizeof(ctx->ext.tick_key_name),
-                       ctx->ext.secure->tick_hmac_key,
-                       sizeof(ctx->ext.secure->tick_hmac_key));
-                memcpy(keys + sizeof(ctx->ext.tick_key_name) +
-                       sizeof(ctx->ext.secure->tick_hmac_key),
-                       ctx->ext.secure->tick_aes_key,
-                       sizeof(ctx->ext.secure->tick_aes_key));
-            }
-            return 1;
-        }
+        if (parg == NULL)
+            return TLSEXT_KEYNAME_LENGTH + 2 * TLSEXT_TICK_KEY_LENGTH;
+        return tls_ticket_keys_ctrl(ctx, parg, larg,
+                                    cmd == SSL_CTRL_SET_TLSEXT_TICKET_KEYS);
 
     case SSL_CTRL_GET_TLSEXT_STATUS_REQ_TYPE:
         return ctx->ext.status_type;
@@ -4046,6 +4076,15 @@ const SSL_CIPHER *ssl3_get_cipher_by_id(uint32_t id)
 {
     SSL_CIPHER c;
     const SSL_CIPHER *cp;
+    unsigned int page;
+
+    if (cipher_index_built && (id & 0xffff0000) == SSL3_CK_CIPHERSUITE_FLAG) {
+        page = cipher_index_page[(id >> 8) & 0xff];
+        if (page == 0)
+            return NULL;
+        if (page != CIPHER_INDEX_NONE)
+            return cipher_index[page - 1][id & 0xff];
+    }
 
     c.id = id;
     cp = OBJ_bsearch_ssl_cipher_id(&c, tls13_ciphers, TLS13_NUM_CIPHERS);
@@ -4124,7 +4163,9 @@ const SSL_CIPHER *ssl3_choose_cipher(SSL *s, STACK_OF(SSL_CIPHER) *clnt,
 {
     const SSL_CIPHER *c, *ret = NULL;
     STACK_OF(SSL_CIPHER) *prio, *allow;
-    int i, ii, ok, prefer_sha256 = 0;
+    int i, slot, ok, prefer_sha256 = 0;
+    /* The slots in the cipher index of the ciphers in |allow| */
+    unsigned char allowed[SSL3_CIPHER_SLOTS / 8];
     unsigned long alg_k = 0, alg_a = 0, mask_k = 0, mask_a = 0;
     const EVP_MD *mdsha256 = EVP_sha256();
 #ifndef OPENSSL_NO_CHACHA
@@ -4135,9 +4176,9 @@ const SSL_CIPHER *ssl3_choose_cipher(SSL *s, STACK_OF(SSL_CIPHER) *clnt,
 
     /*
      * Do not set the compare functions, because this may lead to a
-     * reordering by "id". We want to keep the original ordering. We may pay
-     * a price in performance during sk_SSL_CIPHER_find(), but would have to
-     * pay with the price of sk_SSL_CIPHER_dup().
+     * reordering by "id". We want to keep the original ordering. Which
+     * ciphers are allowed is looked up in a bitmap of their slots in the
+     * cipher index instead.
      */
 
     OSSL_TRACE_BEGIN(TLS_CIPHER) {
@@ -4207,6 +4248,13 @@ const SSL_CIPHER *ssl3_choose_cipher(SSL *s, STACK_OF(SSL_CIPHER) *clnt,
         allow = srvr;
     }
 
+    memset(allowed, 0, sizeof(allowed));
+    for (i = 0; i < sk_SSL_CIPHER_num(allow); i++) {
+        slot = ssl3_cipher_slot(sk_SSL_CIPHER_value(allow, i));
+        if (slot >= 0)
+            allowed[slot / 8] |= 1 << (slot % 8);
+    }
+
     if (SSL_IS_TLS13(s)) {
 #ifndef OPENSSL_NO_PSK
         int j;
@@ -4283,8 +4331,9 @@ const SSL_CIPHER *ssl3_choose_cipher(SSL *s, STACK_OF(SSL_CIPHER) *clnt,
             if (!ok)
                 continue;
         }
-        ii = sk_SSL_CIPHER_find(allow, c);
-        if (ii >= 0) {
+        slot = ssl3_cipher_slot(c);
+        if (slot >= 0 ? (allowed[slot / 8] & (1 << (slot % 8))) != 0
+                      : sk_SSL_CIPHER_find(allow, c) >= 0) {
             /* Check security callback permits this cipher */
             if (!ssl_security(s, SSL_SECOP_CIPHER_SHARED,
                               c->strength_bits, 0, (void *)c))
@@ -4293,22 +4342,20 @@ const SSL_CIPHER *ssl3_choose_cipher(SSL *s, STACK_OF(SSL_CIPHER) *clnt,
             if ((alg_k & SSL_kECDHE) && (alg_a & SSL_aECDSA)
                 && s->s3.is_probably_safari) {
                 if (!ret)
-                    ret = sk_SSL_CIPHER_value(allow, ii);
+                    ret = c;
                 continue;
             }
 #endif
             if (prefer_sha256) {
-                const SSL_CIPHER *tmp = sk_SSL_CIPHER_value(allow, ii);
-
-                if (ssl_md(tmp->algorithm2) == mdsha256) {
-                    ret = tmp;
+                if (ssl_md(c->algorithm2) == mdsha256) {
+                    ret = c;
                     break;
                 }
                 if (ret == NULL)
-                    ret = tmp;
+                    ret = c;
                 continue;
             }
-            ret = sk_SSL_CIPHER_value(allow, ii);
+            ret = c;
             break;
         }
     }
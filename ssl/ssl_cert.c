@@ -19,14 +19,22 @@
 #include <openssl/dh.h>
 #include <openssl/bn.h>
 #include <openssl/crypto.h>
+#include <openssl/comp.h>
 #include "internal/refcount.h"
 #include "ssl_locl.h"
+#include "statem/statem_locl.h"
 #include "ssl_cert_table.h"
 #include "internal/thread_once.h"
 
 static int ssl_security_default_callback(const SSL *s, const SSL_CTX *ctx,
                                          int op, int bits, int nid, void *other,
                                          void *ex);
+static CERT_COMP_CACHE *cert_comp_cache_new(void);
+static void cert_comp_cache_up_ref(CERT_COMP_CACHE *cache);
+static void cert_comp_cache_free(CERT_COMP_CACHE *cache);
+static CERT_LIST_CACHE *cert_list_cache_new(void);
+static void cert_list_cache_up_ref(CERT_LIST_CACHE *cache);
+static void cert_list_cache_free(CERT_LIST_CACHE *cache);
 
 static CRYPTO_ONCE ssl_x509_store_ctx_once = CRYPTO_ONCE_STATIC_INIT;
 static volatile int ssl_x509_store_ctx_idx = -1;
@@ -67,6 +75,12 @@ CERT *ssl_cert_new(void)
         OPENSSL_free(ret);
         return NULL;
     }
+    if ((ret->comp_cache = cert_comp_cache_new()) == NULL
+            || (ret->list_cache = cert_list_cache_new()) == NULL) {
+        SSLerr(SSL_F_SSL_CERT_NEW, ERR_R_MALLOC_FAILURE);
+        ssl_cert_free(ret);
+        return NULL;
+    }
 
     return ret;
 }
@@ -89,6 +103,14 @@ CERT *ssl_cert_dup(CERT *cert)
         OPENSSL_free(ret);
         return NULL;
     }
+    if (cert->comp_cache != NULL) {
+        cert_comp_cache_up_ref(cert->comp_cache);
+        ret->comp_cache = cert->comp_cache;
+    }
+    if (cert->list_cache != NULL) {
+        cert_list_cache_up_ref(cert->list_cache);
+        ret->list_cache = cert->list_cache;
+    }
 #ifndef OPENSSL_NO_DH
     if (cert->dh_tmp != NULL) {
         ret->dh_tmp = cert->dh_tmp;
@@ -245,6 +267,8 @@ void ssl_cert_free(CERT *c)
 #ifndef OPENSSL_NO_PSK
     OPENSSL_free(c->psk_identity_hint);
 #endif
+    cert_comp_cache_free(c->comp_cache);
+    cert_list_cache_free(c->list_cache);
     CRYPTO_THREAD_lock_free(c->lock);
     OPENSSL_free(c);
 }
@@ -1035,3 +1059,495 @@ const SSL_CERT_LOOKUP *ssl_cert_lookup_by_idx(size_t idx)
         return NULL;
     return &ssl_cert_info[idx];
 }
+
+/*
+ * Certificate compression (RFC8879).  The server's Certificate message only
+ * changes with its configuration, so the compressed forms are kept in a cache
+ * that a CERT shares with all its copies, and so with every connection made
+ * from the same SSL_CTX.  An entry holds the message that it was made from
+ * and is only used for exactly that message, so no entry needs to be thrown
+ * away when certificates, chains or the data added to them change.
+ */
+
+#define CERT_COMP_CACHE_SIZE    8
+
+typedef struct {
+    uint16_t alg;
+    /* The uncompressed message */
+    unsigned char *msg;
+    size_t msglen;
+    /* Its compressed form, NULL if it did not compress */
+    unsigned char *comp;
+    size_t complen;
+} CERT_COMP_ENTRY;
+
+struct cert_comp_cache_st {
+    CERT_COMP_ENTRY entries[CERT_COMP_CACHE_SIZE];
+    /* The entry that the next new one replaces */
+    size_t next;
+    CRYPTO_REF_COUNT references;
+    CRYPTO_RWLOCK *lock;
+};
+
+static CERT_COMP_CACHE *cert_comp_cache_new(void)
+{
+    CERT_COMP_CACHE *cache = OPENSSL_zalloc(sizeof(*cache));
+
+    if (cache == NULL)
+        return NULL;
+    cache->references = 1;
+    if ((cache->lock = CRYPTO_THREAD_lock_new()) == NULL) {
+        OPENSSL_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+static void cert_comp_cache_up_ref(CERT_COMP_CACHE *cache)
+{
+    int ref;
+
+    CRYPTO_UP_REF(&cache->references, &ref, cache->lock);
+    REF_PRINT_COUNT("CERT_COMP_CACHE", cache);
+    REF_ASSERT_ISNT(ref < 2);
+}
+
+static void cert_comp_entry_clear(CERT_COMP_ENTRY *e)
+{
+    OPENSSL_free(e->msg);
+    OPENSSL_free(e->comp);
+    memset(e, 0, sizeof(*e));
+}
+
+static void cert_comp_cache_free(CERT_COMP_CACHE *cache)
+{
+    size_t i;
+    int ref;
+
+    if (cache == NULL)
+        return;
+    CRYPTO_DOWN_REF(&cache->references, &ref, cache->lock);
+    REF_PRINT_COUNT("CERT_COMP_CACHE", cache);
+    if (ref > 0)
+        return;
+    REF_ASSERT_ISNT(ref < 0);
+
+    for (i = 0; i < OSSL_NELEM(cache->entries); i++)
+        cert_comp_entry_clear(&cache->entries[i]);
+    CRYPTO_THREAD_lock_free(cache->lock);
+    OPENSSL_free(cache);
+}
+
+#ifndef OPENSSL_NO_COMP
+/*
+ * zlib through the COMP layer.  The one shot method makes each message a
+ * complete zlib stream, and only takes a complete one back.
+ */
+static int cert_comp_zlib_compress(SSL *s,
+                                   const unsigned char *in, size_t inlen,
+                                   unsigned char *out, size_t *outlen)
+{
+    COMP_CTX *cctx;
+    int ret;
+
+    if (inlen > INT_MAX || *outlen > INT_MAX
+            || (cctx = COMP_CTX_new(COMP_zlib_oneshot())) == NULL)
+        return 0;
+    ret = COMP_compress_block(cctx, out, (int)*outlen, (unsigned char *)in,
+                              (int)inlen);
+    COMP_CTX_free(cctx);
+
+    if (ret <= 0)
+        return 0;
+    *outlen = ret;
+    return 1;
+}
+
+static int cert_comp_zlib_decompress(SSL *s,
+                                     const unsigned char *in, size_t inlen,
+                                     unsigned char *out, size_t outlen)
+{
+    COMP_CTX *cctx;
+    int ret = -1;
+
+    if (inlen > INT_MAX || outlen > INT_MAX)
+        return 0;
+    /* A stream that is longer than |outlen| does not fit and fails */
+    if ((cctx = COMP_CTX_new(COMP_zlib_oneshot())) != NULL)
+        ret = COMP_expand_block(cctx, out, (int)outlen,
+                                (unsigned char *)in, (int)inlen);
+    COMP_CTX_free(cctx);
+    return ret >= 0 && (size_t)ret == outlen;
+}
+#endif
+
+int SSL_CTX_add_cert_compression_alg(SSL_CTX *ctx, int alg,
+                                     SSL_cert_compress_cb_fn compress,
+                                     SSL_cert_decompress_cb_fn decompress)
+{
+    CERT_COMP_ALG *ca;
+
+    if (alg <= 0 || alg > 0xffff) {
+        SSLerr(SSL_F_SSL_CTX_ADD_CERT_COMPRESSION_ALG,
+               SSL_R_INVALID_COMPRESSION_ALGORITHM);
+        return 0;
+    }
+    if (ssl_cert_comp_alg_lookup(ctx, alg) != NULL) {
+        SSLerr(SSL_F_SSL_CTX_ADD_CERT_COMPRESSION_ALG,
+               SSL_R_DUPLICATE_COMPRESSION_ID);
+        return 0;
+    }
+    if (compress == NULL && decompress == NULL) {
+        /* The built in methods */
+#ifndef OPENSSL_NO_COMP
+        if (alg == TLSEXT_cert_compression_zlib
+                && COMP_get_type(COMP_zlib_oneshot()) != NID_undef) {
+            compress = cert_comp_zlib_compress;
+            decompress = cert_comp_zlib_decompress;
+        }
+#endif
+        if (compress == NULL) {
+            SSLerr(SSL_F_SSL_CTX_ADD_CERT_COMPRESSION_ALG,
+                   SSL_R_UNSUPPORTED_COMPRESSION_ALGORITHM);
+            return 0;
+        }
+    }
+    if (ctx->cert_comp_algs_len == OSSL_NELEM(ctx->cert_comp_algs)) {
+        SSLerr(SSL_F_SSL_CTX_ADD_CERT_COMPRESSION_ALG,
+               ERR_R_PASSED_INVALID_ARGUMENT);
+        return 0;
+    }
+
+    ca = &ctx->cert_comp_algs[ctx->cert_comp_algs_len++];
+    ca->alg = (uint16_t)alg;
+    ca->compress = compress;
+    ca->decompress = decompress;
+    return 1;
+}
+
+int SSL_get_cert_compression_alg(const SSL *s)
+{
+    return s->s3.cert_comp_alg;
+}
+
+const CERT_COMP_ALG *ssl_cert_comp_alg_lookup(const SSL_CTX *ctx,
+                                              unsigned int alg)
+{
+    size_t i;
+
+    for (i = 0; i < ctx->cert_comp_algs_len; i++)
+        if (ctx->cert_comp_algs[i].alg == alg)
+            return &ctx->cert_comp_algs[i];
+    return NULL;
+}
+
+static int cert_comp_write(SSL *s, WPACKET *pkt, uint16_t alg, size_t msglen,
+                           const unsigned char *comp, size_t complen)
+{
+    if (!WPACKET_put_bytes_u16(pkt, alg)
+            || !WPACKET_put_bytes_u24(pkt, msglen)
+            || !WPACKET_sub_memcpy_u24(pkt, comp, complen)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_SSL_CERT_COMPRESS, ERR_R_INTERNAL_ERROR);
+        return -1;
+    }
+    return 1;
+}
+
+/*
+ * Write the body of a CompressedCertificate message for the Certificate
+ * message body |msg| to |pkt|, compressed with |ca|.  Returns 1 if it was
+ * written, 0 if |msg| does not compress and -1 on error.
+ */
+int ssl_cert_compress(SSL *s, const CERT_COMP_ALG *ca,
+                      const unsigned char *msg, size_t msglen, WPACKET *pkt)
+{
+    CERT_COMP_CACHE *cache = s->cert->comp_cache;
+    CERT_COMP_ENTRY *e, new;
+    size_t i;
+    int ret = -1;
+
+    if (cache == NULL || ca->compress == NULL) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_SSL_CERT_COMPRESS, ERR_R_INTERNAL_ERROR);
+        return -1;
+    }
+
+    if (!CRYPTO_THREAD_read_lock(cache->lock)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_SSL_CERT_COMPRESS, ERR_R_INTERNAL_ERROR);
+        return -1;
+    }
+    for (i = 0; i < OSSL_NELEM(cache->entries); i++) {
+        e = &cache->entries[i];
+        if (e->alg == ca->alg && e->msglen == msglen
+                && memcmp(e->msg, msg, msglen) == 0) {
+            ret = e->comp == NULL ? 0
+                                  : cert_comp_write(s, pkt, ca->alg, msglen,
+                                                    e->comp, e->complen);
+            CRYPTO_THREAD_unlock(cache->lock);
+            return ret;
+        }
+    }
+    CRYPTO_THREAD_unlock(cache->lock);
+
+    /*
+     * Compress it without the lock held.  Two connections may both do this
+     * for the same message, the second entry is just never found.
+     */
+    new.alg = ca->alg;
+    new.msglen = msglen;
+    new.complen = msglen;
+    new.msg = OPENSSL_memdup(msg, msglen);
+    new.comp = OPENSSL_malloc(msglen);
+    if (new.msg == NULL || new.comp == NULL) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_SSL_CERT_COMPRESS, ERR_R_MALLOC_FAILURE);
+        cert_comp_entry_clear(&new);
+        return -1;
+    }
+    if (!ca->compress(s, msg, msglen, new.comp, &new.complen)
+            || new.complen == 0 || new.complen >= msglen) {
+        OPENSSL_free(new.comp);
+        new.comp = NULL;
+        new.complen = 0;
+    }
+    ret = new.comp == NULL ? 0 : cert_comp_write(s, pkt, ca->alg, msglen,
+                                                 new.comp, new.complen);
+    if (ret < 0) {
+        cert_comp_entry_clear(&new);
+        return ret;
+    }
+
+    if (!CRYPTO_THREAD_write_lock(cache->lock)) {
+        cert_comp_entry_clear(&new);
+        return ret;
+    }
+    e = &cache->entries[cache->next];
+    cache->next = (cache->next + 1) % OSSL_NELEM(cache->entries);
+    cert_comp_entry_clear(e);
+    *e = new;
+    CRYPTO_THREAD_unlock(cache->lock);
+    return ret;
+}
+
+/*
+ * The certificate_list of the Certificate message.  Building the chain and
+ * encoding its certificates gives the same result for every handshake until
+ * the configuration changes, so the encoded list for each of the CERT's
+ * certificates is kept in a cache that is shared like the one above.  An
+ * entry holds references to the certificates that it was made from and is
+ * only used while the chain still consists of exactly those.
+ */
+
+typedef struct {
+    /* The certificates, leaf first */
+    STACK_OF(X509) *certs;
+    /*
+     * The list as it is sent in TLSv1.2 and below and as it is sent in
+     * TLSv1.3, with an empty extensions block after each certificate
+     */
+    unsigned char *list, *list13;
+    size_t listlen, list13len;
+    /* Where the extensions of the leaf start in |list13| */
+    size_t leaf_ext_off;
+} CERT_LIST_ENTRY;
+
+struct cert_list_cache_st {
+    CERT_LIST_ENTRY entries[SSL_PKEY_NUM];
+    CRYPTO_REF_COUNT references;
+    CRYPTO_RWLOCK *lock;
+};
+
+static CERT_LIST_CACHE *cert_list_cache_new(void)
+{
+    CERT_LIST_CACHE *cache = OPENSSL_zalloc(sizeof(*cache));
+
+    if (cache == NULL)
+        return NULL;
+    cache->references = 1;
+    if ((cache->lock = CRYPTO_THREAD_lock_new()) == NULL) {
+        OPENSSL_free(cache);
+        return NULL;
+    }
+    return cache;
+}
+
+static void cert_list_cache_up_ref(CERT_LIST_CACHE *cache)
+{
+    int ref;
+
+    CRYPTO_UP_REF(&cache->references, &ref, cache->lock);
+    REF_PRINT_COUNT("CERT_LIST_CACHE", cache);
+    REF_ASSERT_ISNT(ref < 2);
+}
+
+static void cert_list_entry_clear(CERT_LIST_ENTRY *e)
+{
+    sk_X509_pop_free(e->certs, X509_free);
+    OPENSSL_free(e->list);
+    OPENSSL_free(e->list13);
+    memset(e, 0, sizeof(*e));
+}
+
+static void cert_list_cache_free(CERT_LIST_CACHE *cache)
+{
+    size_t i;
+    int ref;
+
+    if (cache == NULL)
+        return;
+    CRYPTO_DOWN_REF(&cache->references, &ref, cache->lock);
+    REF_PRINT_COUNT("CERT_LIST_CACHE", cache);
+    if (ref > 0)
+        return;
+    REF_ASSERT_ISNT(ref < 0);
+
+    for (i = 0; i < OSSL_NELEM(cache->entries); i++)
+        cert_list_entry_clear(&cache->entries[i]);
+    CRYPTO_THREAD_lock_free(cache->lock);
+    OPENSSL_free(cache);
+}
+
+static int cert_list_entry_matches(const CERT_LIST_ENTRY *e, X509 *x,
+                                   STACK_OF(X509) *chain)
+{
+    int i, n = chain == NULL ? 0 : sk_X509_num(chain);
+
+    if (e->certs == NULL || sk_X509_num(e->certs) != n + 1
+            || sk_X509_value(e->certs, 0) != x)
+        return 0;
+    for (i = 0; i < n; i++)
+        if (sk_X509_value(e->certs, i + 1) != sk_X509_value(chain, i))
+            return 0;
+    return 1;
+}
+
+/* Encode the leaf |x| and |chain| into |e| */
+static int cert_list_entry_build(CERT_LIST_ENTRY *e, X509 *x,
+                                 STACK_OF(X509) *chain)
+{
+    int i, len, n = chain == NULL ? 0 : sk_X509_num(chain);
+    unsigned char *p, *q;
+    X509 *c;
+
+    if ((e->certs = sk_X509_new_reserve(NULL, n + 1)) == NULL)
+        return 0;
+    for (i = 0; i <= n; i++) {
+        c = i == 0 ? x : sk_X509_value(chain, i - 1);
+        if ((len = i2d_X509(c, NULL)) <= 0)
+            return 0;
+        X509_up_ref(c);
+        sk_X509_push(e->certs, c);
+        e->listlen += 3 + (size_t)len;
+    }
+    e->list13len = e->listlen + 2 * (size_t)(n + 1);
+    if ((e->list = OPENSSL_malloc(e->listlen)) == NULL
+            || (e->list13 = OPENSSL_malloc(e->list13len)) == NULL)
+        return 0;
+
+    p = e->list;
+    q = e->list13;
+    for (i = 0; i <= n; i++) {
+        c = sk_X509_value(e->certs, i);
+        len = i2d_X509(c, NULL);
+        l2n3(len, p);
+        if (i2d_X509(c, &p) != len)
+            return 0;
+        memcpy(q, p - len - 3, len + 3);
+        q += len + 3;
+        if (i == 0)
+            e->leaf_ext_off = q - e->list13;
+        *q++ = 0;
+        *q++ = 0;
+    }
+    return 1;
+}
+
+/*
+ * A server sends the status of its certificate, which is set for each
+ * connection, in an extension of the leaf.  All the other extensions of a
+ * TLSv1.3 certificate_list are empty.
+ */
+static int cert_list_entry_write(SSL *s, const CERT_LIST_ENTRY *e,
+                                 WPACKET *pkt)
+{
+    size_t rest;
+
+    if (!SSL_IS_TLS13(s)) {
+        if (!WPACKET_memcpy(pkt, e->list, e->listlen))
+            goto err;
+        return 1;
+    }
+    if (!s->server || !s->ext.status_expected) {
+        if (!WPACKET_memcpy(pkt, e->list13, e->list13len))
+            goto err;
+        return 1;
+    }
+
+    rest = e->leaf_ext_off + 2;
+    if (!WPACKET_memcpy(pkt, e->list13, e->leaf_ext_off))
+        goto err;
+    if (!tls_construct_extensions(s, pkt, SSL_EXT_TLS1_3_CERTIFICATE,
+                                  sk_X509_value(e->certs, 0), 0)) {
+        /* SSLfatal() already called */
+        return -1;
+    }
+    if (!WPACKET_memcpy(pkt, e->list13 + rest, e->list13len - rest))
+        goto err;
+    return 1;
+
+ err:
+    SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL_CERT_LIST_OUTPUT,
+             ERR_R_INTERNAL_ERROR);
+    return -1;
+}
+
+/*
+ * Write the certificates of the certificate_list for |cpk|, its leaf followed
+ * by |chain|, to |pkt|.  The caller must not call this if there are custom
+ * extensions for TLSv1.3 certificates.  Returns 1 on success, 0 if |cpk| has
+ * no place in the cache, or -1 on error.
+ */
+int ssl_cert_list_output(SSL *s, CERT_PKEY *cpk, STACK_OF(X509) *chain,
+                         WPACKET *pkt)
+{
+    CERT_LIST_CACHE *cache = s->cert->list_cache;
+    CERT_LIST_ENTRY *e, new;
+    size_t idx = cpk - s->cert->pkeys;
+    int ret;
+
+    if (cache == NULL || cpk < s->cert->pkeys || idx >= SSL_PKEY_NUM)
+        return 0;
+
+    if (!CRYPTO_THREAD_read_lock(cache->lock)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL_CERT_LIST_OUTPUT,
+                 ERR_R_INTERNAL_ERROR);
+        return -1;
+    }
+    e = &cache->entries[idx];
+    if (cert_list_entry_matches(e, cpk->x509, chain)) {
+        ret = cert_list_entry_write(s, e, pkt);
+        CRYPTO_THREAD_unlock(cache->lock);
+        return ret;
+    }
+    CRYPTO_THREAD_unlock(cache->lock);
+
+    memset(&new, 0, sizeof(new));
+    if (!cert_list_entry_build(&new, cpk->x509, chain)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL_CERT_LIST_OUTPUT,
+                 ERR_R_MALLOC_FAILURE);
+        cert_list_entry_clear(&new);
+        return -1;
+    }
+    ret = cert_list_entry_write(s, &new, pkt);
+    if (ret <= 0 || !CRYPTO_THREAD_write_lock(cache->lock)) {
+        cert_list_entry_clear(&new);
+        return ret;
+    }
+    e = &cache->entries[idx];
+    cert_list_entry_clear(e);
+    *e = new;
+    CRYPTO_THREAD_unlock(cache->lock);
+    return ret;
+}
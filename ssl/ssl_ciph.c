@@ -362,6 +362,7 @@ int ssl_load_ciphers(void)
 
     disabled_enc_mask = 0;
     ssl_sort_cipher_list();
+    tls1_build_sigalg_index();
     for (i = 0, t = ssl_cipher_table_cipher; i < SSL_ENC_NUM_IDX; i++, t++) {
         if (t->nid == NID_undef) {
             ssl_cipher_methods[i] = NULL;
@@ -611,6 +611,8 @@ int SSL_clear(SSL *s)
 
     BUF_MEM_free(s->init_buf);
     s->init_buf = NULL;
+    BUF_MEM_free(s->flight_buf);
+    s->flight_buf = NULL;
     clear_ciphers(s);
     s->first_packet = 0;
 
@@ -1169,6 +1171,7 @@ void SSL_free(SSL *s)
     s->rbio = NULL;
 
     BUF_MEM_free(s->init_buf);
+    BUF_MEM_free(s->flight_buf);
 
     /* add extra stuff */
     sk_SSL_CIPHER_free(s->cipher_list);
@@ -3121,7 +3124,7 @@ SSL_CTX *SSL_CTX_new(const SSL_METHOD *meth)
     if (!CRYPTO_new_ex_data(CRYPTO_EX_INDEX_SSL_CTX, ret, &ret->ex_data))
         goto err;
 
-    if ((ret->ext.secure = OPENSSL_secure_zalloc(sizeof(*ret->ext.secure))) == NULL)
+    if ((ret->ext.tick_keys = sk_SSL_TICKET_KEY_new_null()) == NULL)
         goto err;
 
     /* No compression for DTLS */
@@ -3132,12 +3135,7 @@ SSL_CTX *SSL_CTX_new(const SSL_METHOD *meth)
     ret->split_send_fragment = SSL3_RT_MAX_PLAIN_LENGTH;
 
     /* Setup RFC5077 ticket keys */
-    if ((RAND_bytes(ret->ext.tick_key_name,
-                    sizeof(ret->ext.tick_key_name)) <= 0)
-        || (RAND_priv_bytes(ret->ext.secure->tick_hmac_key,
-                       sizeof(ret->ext.secure->tick_hmac_key)) <= 0)
-        || (RAND_priv_bytes(ret->ext.secure->tick_aes_key,
-                       sizeof(ret->ext.secure->tick_aes_key)) <= 0))
+    if (!SSL_CTX_rotate_ticket_keys(ret, 0))
         ret->options |= SSL_OP_NO_TICKET;
 
     if (RAND_priv_bytes(ret->ext.cookie_hmac_key,
@@ -3293,7 +3291,11 @@ void SSL_CTX_free(SSL_CTX *a)
     OPENSSL_free(a->ext.supportedgroups);
 #endif
     OPENSSL_free(a->ext.alpn);
-    OPENSSL_secure_free(a->ext.secure);
+    sk_SSL_TICKET_KEY_pop_free(a->ext.tick_keys, tls_ticket_key_free);
+    ssl_anti_replay_free(a->anti_replay);
+#ifndef OPENSSL_NO_OCSP
+    ssl_ocsp_staples_free(a->ocsp_staples);
+#endif
 
     CRYPTO_THREAD_lock_free(a->lock);
 
@@ -3547,7 +3549,7 @@ void ssl_update_cache(SSL *s, int mode)
          * with only a dummy session id so there is no reason to cache it,
          * unless:
          * - we are doing early_data, in which case we cache so that we can
-         *   detect replays
+         *   detect replays, unless that is done with the anti-replay filter
          * - the application has set a remove_session_cb so needs to know about
          *   session timeout events
          * - SSL_OP_NO_TICKET is set in which case it is a stateful ticket
@@ -3555,8 +3557,7 @@ void ssl_update_cache(SSL *s, int mode)
         if ((i & SSL_SESS_CACHE_NO_INTERNAL_STORE) == 0
                 && (!SSL_IS_TLS13(s)
                     || !s->server
-                    || (s->max_early_data > 0
-                        && (s->options & SSL_OP_NO_ANTI_REPLAY) == 0)
+                    || SSL_USE_REPLAY_CACHE(s)
                     || s->session_ctx->remove_session_cb != NULL
                     || (s->options & SSL_OP_NO_TICKET) != 0))
             SSL_CTX_add_session(s->session_ctx, s->session);
@@ -5144,6 +5145,27 @@ void SSL_CTX_set_client_hello_cb(SSL_CTX *c, SSL_client_hello_cb_fn cb,
     c->client_hello_cb_arg = arg;
 }
 
+void SSL_CTX_set_client_hello_filter(SSL_CTX *c, SSL_client_hello_cb_fn cb,
+                                     void *arg)
+{
+    c->client_hello_filter = cb;
+    c->client_hello_filter_arg = arg;
+}
+
+/*
+ * The ClientHello filter runs before |s->clienthello| exists, the getters
+ * fall back to the summary of the raw ClientHello then.
+ */
+static size_t client_hello_summary_get0(SSL *s, const PACKET *field,
+                                        const unsigned char **out)
+{
+    if (!s->hello_summary.valid)
+        return 0;
+    if (out != NULL)
+        *out = PACKET_data(field);
+    return PACKET_remaining(field);
+}
+
 int SSL_client_hello_isv2(SSL *s)
 {
     if (s->clienthello == NULL)
@@ -5154,14 +5176,14 @@ int SSL_client_hello_isv2(SSL *s)
 unsigned int SSL_client_hello_get0_legacy_version(SSL *s)
 {
     if (s->clienthello == NULL)
-        return 0;
+        return s->hello_summary.valid ? s->hello_summary.legacy_version : 0;
     return s->clienthello->legacy_version;
 }
 
 size_t SSL_client_hello_get0_random(SSL *s, const unsigned char **out)
 {
     if (s->clienthello == NULL)
-        return 0;
+        return client_hello_summary_get0(s, &s->hello_summary.random, out);
     if (out != NULL)
         *out = s->clienthello->random;
     return SSL3_RANDOM_SIZE;
@@ -5170,7 +5192,7 @@ size_t SSL_client_hello_get0_random(SSL *s, const unsigned char **out)
 size_t SSL_client_hello_get0_session_id(SSL *s, const unsigned char **out)
 {
     if (s->clienthello == NULL)
-        return 0;
+        return client_hello_summary_get0(s, &s->hello_summary.session_id, out);
     if (out != NULL)
         *out = s->clienthello->session_id;
     return s->clienthello->session_id_len;
@@ -5179,7 +5201,8 @@ size_t SSL_client_hello_get0_session_id(SSL *s, const unsigned char **out)
 size_t SSL_client_hello_get0_ciphers(SSL *s, const unsigned char **out)
 {
     if (s->clienthello == NULL)
-        return 0;
+        return client_hello_summary_get0(s, &s->hello_summary.ciphersuites,
+                                         out);
     if (out != NULL)
         *out = PACKET_data(&s->clienthello->ciphersuites);
     return PACKET_remaining(&s->clienthello->ciphersuites);
@@ -5188,7 +5211,8 @@ size_t SSL_client_hello_get0_ciphers(SSL *s, const unsigned char **out)
 size_t SSL_client_hello_get0_compression_methods(SSL *s, const unsigned char **out)
 {
     if (s->clienthello == NULL)
-        return 0;
+        return client_hello_summary_get0(s, &s->hello_summary.compressions,
+                                         out);
     if (out != NULL)
         *out = s->clienthello->compressions;
     return s->clienthello->compressions_len;
@@ -5238,9 +5262,26 @@ int SSL_client_hello_get0_ext(SSL *s, unsigned int type, const unsigned char **o
 {
     size_t i;
     RAW_EXTENSION *r;
+    PACKET extensions, ext;
+    unsigned int exttype;
 
-    if (s->clienthello == NULL)
+    if (s->clienthello == NULL) {
+        if (!s->hello_summary.valid)
+            return 0;
+        /* Look through the raw extensions */
+        extensions = s->hello_summary.extensions;
+        while (PACKET_get_net_2(&extensions, &exttype)
+               && PACKET_get_length_prefixed_2(&extensions, &ext)) {
+            if (exttype == type) {
+                if (out != NULL)
+                    *out = PACKET_data(&ext);
+                if (outlen != NULL)
+                    *outlen = PACKET_remaining(&ext);
+                return 1;
+            }
+        }
         return 0;
+    }
     for (i = 0; i < s->clienthello->pre_proc_exts_len; ++i) {
         r = s->clienthello->pre_proc_exts + i;
         if (r->present && r->type == type) {
@@ -5254,6 +5295,28 @@ int SSL_client_hello_get0_ext(SSL *s, unsigned int type, const unsigned char **o
     return 0;
 }
 
+size_t SSL_client_hello_get0_servername(SSL *s, const unsigned char **out)
+{
+    return client_hello_summary_get0(s, &s->hello_summary.servername, out);
+}
+
+size_t SSL_client_hello_get0_alpn(SSL *s, const unsigned char **out)
+{
+    return client_hello_summary_get0(s, &s->hello_summary.alpn, out);
+}
+
+size_t SSL_client_hello_get0_supported_versions(SSL *s,
+                                                const unsigned char **out)
+{
+    return client_hello_summary_get0(s, &s->hello_summary.versions, out);
+}
+
+size_t SSL_client_hello_get0_key_share_groups(SSL *s,
+                                              const unsigned char **out)
+{
+    return client_hello_summary_get0(s, &s->hello_summary.groups, out);
+}
+
 int SSL_free_buffers(SSL *ssl)
 {
     RECORD_LAYER *rl = &ssl->rlayer;
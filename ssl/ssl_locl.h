@@ -288,6 +288,9 @@
 # define SSL_HANDSHAKE_MAC_GOST12_512 SSL_MD_GOST12_512_IDX
 # define SSL_HANDSHAKE_MAC_DEFAULT  SSL_HANDSHAKE_MAC_MD5_SHA1
 
+/* Number of handshake MACs a server starts a transcript with, see s3_enc.c */
+# define SSL_SPEC_DGST_COUNT 2
+
 /* Bits 8-15 bits are PRF */
 # define TLS1_PRF_DGST_SHIFT 8
 # define TLS1_PRF_SHA1_MD5 (SSL_MD_MD5_SHA1_IDX << TLS1_PRF_DGST_SHIFT)
@@ -653,6 +656,24 @@ typedef enum {
  */
 # define TICKET_AGE_ALLOWANCE   (10 * 1000)
 
+/*
+ * A ClientHello with early data passes the ticket age check for as long as
+ * TICKET_AGE_ALLOWANCE, so the anti-replay filter has to remember it for at
+ * least that many seconds, plus one for the rounding of our ticket age.
+ */
+# define ANTI_REPLAY_WINDOW     (TICKET_AGE_ALLOWANCE / 1000 + 1)
+/* The number of bits the anti-replay filter sets for each ClientHello */
+# define ANTI_REPLAY_HASHES     4
+
+/*
+ * Does the server detect replays of early data by keeping its tickets in the
+ * session cache, so that each can be used only once?
+ */
+# define SSL_USE_REPLAY_CACHE(s) \
+    ((s)->max_early_data > 0 \
+     && ((s)->options & SSL_OP_NO_ANTI_REPLAY) == 0 \
+     && (s)->session_ctx->anti_replay == NULL)
+
 #define MAX_COMPRESSIONS_SIZE   255
 
 struct ssl_comp_st {
@@ -690,6 +711,33 @@ typedef struct {
     RAW_EXTENSION *pre_proc_exts;
 } CLIENTHELLO_MSG;
 
+/* The most key_share groups a CLIENTHELLO_SUMMARY records */
+# define CLIENTHELLO_SUMMARY_MAX_GROUPS 32
+
+/*
+ * The fields of a ClientHello that a ClientHello filter is likely to look at,
+ * picked out of the raw message before anything is allocated for it.  The
+ * PACKETs point into the handshake message buffer.
+ */
+typedef struct {
+    int valid;
+    unsigned int legacy_version;
+    PACKET random;
+    PACKET session_id;
+    PACKET ciphersuites;
+    PACKET compressions;
+    PACKET extensions;
+    /* The host_name of the server_name extension */
+    PACKET servername;
+    /* The protocol_name_list of the ALPN extension */
+    PACKET alpn;
+    /* The versions of the supported_versions extension */
+    PACKET versions;
+    /* The groups of the key_share extension, over |group_list| */
+    PACKET groups;
+    unsigned char group_list[2 * CLIENTHELLO_SUMMARY_MAX_GROUPS];
+} CLIENTHELLO_SUMMARY;
+
 /*
  * Extension index values NOTE: Any updates to these defines should be mirrored
  * with equivalent updates to ext_defs in extensions.c
@@ -719,6 +767,7 @@ typedef enum tlsext_index_en {
     TLSEXT_IDX_cryptopro_bug,
     TLSEXT_IDX_early_data,
     TLSEXT_IDX_certificate_authorities,
+    TLSEXT_IDX_compress_certificate,
     TLSEXT_IDX_padding,
     TLSEXT_IDX_psk,
     /* Dummy index - must always be the last entry */
@@ -732,10 +781,39 @@ DEFINE_LHASH_OF(X509_NAME);
 # define TLSEXT_KEYNAME_LENGTH  16
 # define TLSEXT_TICK_KEY_LENGTH 32
 
-typedef struct ssl_ctx_ext_secure_st {
-    unsigned char tick_hmac_key[TLSEXT_TICK_KEY_LENGTH];
-    unsigned char tick_aes_key[TLSEXT_TICK_KEY_LENGTH];
-} SSL_CTX_EXT_SECURE;
+/*
+ * A session ticket key.  It is allocated from the secure heap, the cipher
+ * and HMAC contexts are keyed once and copied for each ticket.
+ */
+typedef struct ssl_ticket_key_st {
+    unsigned char name[TLSEXT_KEYNAME_LENGTH];
+    unsigned char hmac_key[TLSEXT_TICK_KEY_LENGTH];
+    unsigned char aes_key[TLSEXT_TICK_KEY_LENGTH];
+    int flags;                  /* SSL_TICKET_KEY_DECRYPT_ONLY */
+    EVP_CIPHER_CTX *enc_ctx;
+    EVP_CIPHER_CTX *dec_ctx;
+    HMAC_CTX *hctx;
+} SSL_TICKET_KEY;
+
+DEFINE_STACK_OF(SSL_TICKET_KEY)
+
+typedef struct ssl_anti_replay_st SSL_ANTI_REPLAY;
+typedef struct ssl_ocsp_staples_st SSL_OCSP_STAPLES;
+
+# define SSL_CERT_COMP_MAX_ALGS 8
+
+/*
+ * A certificate compression algorithm (RFC8879).  Either function may be NULL
+ * if the algorithm is only used in one direction.
+ */
+typedef struct cert_comp_alg_st {
+    uint16_t alg;
+    SSL_cert_compress_cb_fn compress;
+    SSL_cert_decompress_cb_fn decompress;
+} CERT_COMP_ALG;
+
+typedef struct cert_comp_cache_st CERT_COMP_CACHE;
+typedef struct cert_list_cache_st CERT_LIST_CACHE;
 
 struct ssl_ctx_st {
     const SSL_METHOD *method;
@@ -925,15 +1003,25 @@ struct ssl_ctx_st {
     /* ClientHello callback.  Mostly for extensions, but not entirely. */
     SSL_client_hello_cb_fn client_hello_cb;
     void *client_hello_cb_arg;
+    /* Called on the raw ClientHello, before anything is allocated for it */
+    SSL_client_hello_cb_fn client_hello_filter;
+    void *client_hello_filter_arg;
+
+    /* Certificate compression algorithms, in order of preference */
+    CERT_COMP_ALG cert_comp_algs[SSL_CERT_COMP_MAX_ALGS];
+    size_t cert_comp_algs_len;
 
     /* TLS extensions. */
     struct {
         /* TLS extensions servername callback */
         int (*servername_cb) (SSL *, int *, void *);
         void *servername_arg;
-        /* RFC 4507 session ticket keys */
-        unsigned char tick_key_name[TLSEXT_KEYNAME_LENGTH];
-        SSL_CTX_EXT_SECURE *secure;
+        /*
+         * RFC 4507 session ticket keys, oldest first.  The newest one that is
+         * not SSL_TICKET_KEY_DECRYPT_ONLY encrypts new tickets.  |lock|
+         * protects them.
+         */
+        STACK_OF(SSL_TICKET_KEY) *tick_keys;
         /* Callback to support customisation of ticket key setting */
         int (*ticket_key_cb) (SSL *ssl,
                               unsigned char *name, unsigned char *iv,
@@ -1067,6 +1155,17 @@ struct ssl_ctx_st {
     SSL_allow_early_data_cb_fn allow_early_data_cb;
     void *allow_early_data_cb_data;
 
+    /*
+     * Filter of the ClientHellos recently accepted with early data, used to
+     * detect replays instead of the session cache if set
+     */
+    SSL_ANTI_REPLAY *anti_replay;
+
+# ifndef OPENSSL_NO_OCSP
+    /* Cached OCSP responses for the certificates in |cert| */
+    SSL_OCSP_STAPLES *ocsp_staples;
+# endif
+
     /* Do we advertise Post-handshake auth support? */
     int pha_enabled;
 
@@ -1130,6 +1229,11 @@ struct ssl_st {
                                  * ssl3_get_message() */
     size_t init_num;               /* amount read/written */
     size_t init_off;               /* amount read/written */
+    /*
+     * Encrypted TLSv1.3 server handshake messages waiting for statem_flush()
+     * to write them out together
+     */
+    BUF_MEM *flight_buf;
 
     struct {
         long flags;
@@ -1149,6 +1253,14 @@ struct ssl_st {
          * freed and MD_CTX for the required digest is stored here.
          */
         EVP_MD_CTX *handshake_dgst;
+        /*
+         * A server hashes the first ClientHello of a handshake with each of
+         * the digests TLSv1.2 and TLSv1.3 mostly use instead of buffering it,
+         * until ssl3_settle_finished_mac() keeps the one that is needed.
+         * |handshake_spec_len| is the length of the ClientHello.
+         */
+        EVP_MD_CTX *handshake_spec_dgst[SSL_SPEC_DGST_COUNT];
+        size_t handshake_spec_len;
         /*
          * Set whenever an expected ChangeCipherSpec message is processed.
          * Unset when the peer's Finished message is received.
@@ -1231,6 +1343,11 @@ struct ssl_st {
             size_t peer_cert_sigalgslen;
             /* Sigalg peer actually uses */
             const struct sigalg_lookup_st *peer_sigalg;
+            /*
+             * The server's TLSv1.3 Certificate or CompressedCertificate
+             * message body, built before its header
+             */
+            BUF_MEM *cert_msg;
             /*
              * Set if corresponding CERT_PKEY can be used with current
              * SSL session: e.g. appropriate curve, signature algorithms etc.
@@ -1284,6 +1401,8 @@ struct ssl_st {
         size_t alpn_proposed_len;
         /* used by the client to know if it actually sent alpn */
         int alpn_sent;
+        /* The algorithm the server's Certificate message was compressed with */
+        uint16_t cert_comp_alg;
 
 # ifndef OPENSSL_NO_EC
         /*
@@ -1548,6 +1667,12 @@ struct ssl_st {
          * selected.
          */
         int tick_identity;
+
+        /*
+         * The server's choice of the certificate compression algorithms that
+         * the client offered, or 0
+         */
+        uint16_t cert_comp_alg;
     } ext;
 
     /*
@@ -1555,6 +1680,11 @@ struct ssl_st {
      * calls.
      */
     CLIENTHELLO_MSG *clienthello;
+    /*
+     * Fields of the ClientHello being processed for the ClientHello filter
+     * and callback, valid while |hello_summary.valid| is set.
+     */
+    CLIENTHELLO_SUMMARY hello_summary;
 
     /*-
      * no further mod of servername
@@ -1958,6 +2088,10 @@ typedef struct cert_st {
     /* If not NULL psk identity hint to use for servers */
     char *psk_identity_hint;
 # endif
+    /* Compressed Certificate messages, shared with the copies of this CERT */
+    CERT_COMP_CACHE *comp_cache;
+    /* Encoded certificate_lists of |pkeys|, shared like |comp_cache| */
+    CERT_LIST_CACHE *list_cache;
     CRYPTO_REF_COUNT references;             /* >1 only if SSL_copy_session_id is used */
     CRYPTO_RWLOCK *lock;
 } CERT;
@@ -2275,12 +2409,26 @@ __owur CERT *ssl_cert_new(void);
 __owur CERT *ssl_cert_dup(CERT *cert);
 void ssl_cert_clear_certs(CERT *c);
 void ssl_cert_free(CERT *c);
+const CERT_COMP_ALG *ssl_cert_comp_alg_lookup(const SSL_CTX *ctx,
+                                              unsigned int alg);
+__owur int ssl_cert_compress(SSL *s, const CERT_COMP_ALG *ca,
+                             const unsigned char *msg, size_t msglen,
+                             WPACKET *pkt);
+__owur int ssl_cert_list_output(SSL *s, CERT_PKEY *cpk, STACK_OF(X509) *chain,
+                                WPACKET *pkt);
 __owur int ssl_generate_session_id(SSL *s, SSL_SESSION *ss);
 __owur int ssl_get_new_session(SSL *s, int session);
 __owur SSL_SESSION *lookup_sess_in_cache(SSL *s, const unsigned char *sess_id,
                                          size_t sess_id_len);
 __owur int ssl_get_prev_session(SSL *s, CLIENTHELLO_MSG *hello);
 __owur SSL_SESSION *ssl_session_dup(const SSL_SESSION *src, int ticket);
+void ssl_anti_replay_free(SSL_ANTI_REPLAY *ar);
+__owur int ssl_anti_replay_check(SSL_ANTI_REPLAY *ar,
+                                 const unsigned char *random);
+# ifndef OPENSSL_NO_OCSP
+void ssl_ocsp_staples_free(SSL_OCSP_STAPLES *st);
+__owur int ssl_ocsp_staple_get(SSL *s, X509 *x);
+# endif
 __owur int ssl_cipher_id_cmp(const SSL_CIPHER *a, const SSL_CIPHER *b);
 DECLARE_OBJ_BSEARCH_GLOBAL_CMP_FN(SSL_CIPHER, SSL_CIPHER, ssl_cipher_id);
 __owur int ssl_cipher_ptr_id_cmp(const SSL_CIPHER *const *ap,
@@ -2340,6 +2488,10 @@ void ssl_set_masks(SSL *s);
 __owur STACK_OF(SSL_CIPHER) *ssl_get_ciphers_by_id(SSL *s);
 __owur int ssl_x509err2alert(int type);
 void ssl_sort_cipher_list(void);
+/* The number of slots in the index of ciphers by code point */
+# define SSL3_CIPHER_SLOTS       (8 * 256)
+__owur int ssl3_cipher_slot(const SSL_CIPHER *c);
+void tls1_build_sigalg_index(void);
 int ssl_load_ciphers(void);
 __owur int ssl_fill_hello_random(SSL *s, int server, unsigned char *field,
                                  size_t len, DOWNGRADE dgrd);
@@ -2384,6 +2536,8 @@ __owur const SSL_CIPHER *ssl3_choose_cipher(SSL *ssl,
                                             STACK_OF(SSL_CIPHER) *clnt,
                                             STACK_OF(SSL_CIPHER) *srvr);
 __owur int ssl3_digest_cached_records(SSL *s, int keep);
+__owur int ssl3_settle_finished_mac(SSL *s);
+EVP_MD_CTX *ssl3_speculative_digest(SSL *s, const EVP_MD *md);
 __owur int ssl3_new(SSL *s);
 void ssl3_free(SSL *s);
 __owur int ssl3_read(SSL *s, void *buf, size_t len, size_t *readbytes);
@@ -2448,6 +2602,7 @@ void dtls1_start_timer(SSL *s);
 void dtls1_stop_timer(SSL *s);
 __owur int dtls1_is_timer_expired(SSL *s);
 void dtls1_double_timeout(SSL *s);
+void ssl_get_current_time(struct timeval *t);
 __owur int dtls_raw_hello_verify_request(WPACKET *pkt, unsigned char *cookie,
                                          size_t cookie_len);
 __owur size_t dtls1_min_mtu(SSL *s);
@@ -2557,6 +2712,12 @@ __owur SSL_TICKET_STATUS tls_decrypt_ticket(SSL *s, const unsigned char *etick,
                                             size_t eticklen,
                                             const unsigned char *sess_id,
                                             size_t sesslen, SSL_SESSION **psess);
+void tls_ticket_key_free(SSL_TICKET_KEY *key);
+__owur int tls_ticket_key_init(SSL_CTX *tctx, unsigned char *name,
+                               const unsigned char *iv, EVP_CIPHER_CTX *ctx,
+                               HMAC_CTX *hctx, int enc);
+__owur int tls_ticket_keys_ctrl(SSL_CTX *ctx, unsigned char *keys, long len,
+                                int set);
 
 __owur int tls_use_ticket(SSL *s);
 
@@ -0,0 +1,379 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * A cache of OCSP responses for the certificates of an SSL_CTX.  Responses
+ * are fetched, checked and replaced by SSL_CTX_refresh_ocsp_staples(), which
+ * the application calls from a thread or timer of its own.  A handshake only
+ * copies the DER response of its certificate, it never waits for a fetch.
+ */
+
+#include <time.h>
+#include <openssl/ocsp.h>
+#include "internal/tsan_assist.h"
+#include "ssl_locl.h"
+
+#ifndef OPENSSL_NO_OCSP
+
+/* Refresh a response without a nextUpdate this often, in seconds */
+# define STAPLE_DEFAULT_REFRESH     (60 * 60)
+/* Clock skew allowed for the thisUpdate of a new response, in seconds */
+# define STAPLE_MAX_SKEW            (5 * 60)
+
+typedef struct {
+    /*
+     * The certificate, with a reference held so that a handshake can find
+     * its response by address
+     */
+    X509 *cert;
+    OCSP_CERTID *id;
+    unsigned char *resp;
+    size_t resplen;
+    time_t this_update;
+    /* 0 if the response has no nextUpdate */
+    time_t next_update;
+    /* When to fetch a new response */
+    time_t refresh;
+} OCSP_STAPLE;
+
+struct ssl_ocsp_staples_st {
+    SSL_ocsp_fetch_cb_fn fetch;
+    void *arg;
+    /* The response for each of the SSL_CTX's CERT_PKEYs */
+    OCSP_STAPLE staples[SSL_PKEY_NUM];
+    CRYPTO_RWLOCK *lock;
+    TSAN_QUALIFIER unsigned long stapled;
+    TSAN_QUALIFIER unsigned long unstapled;
+    /* The slowest fetch of the last refresh, in milliseconds */
+    TSAN_QUALIFIER unsigned long refresh_ms;
+};
+
+static void ocsp_staple_clear(OCSP_STAPLE *st)
+{
+    X509_free(st->cert);
+    OCSP_CERTID_free(st->id);
+    OPENSSL_free(st->resp);
+    memset(st, 0, sizeof(*st));
+}
+
+void ssl_ocsp_staples_free(SSL_OCSP_STAPLES *st)
+{
+    size_t i;
+
+    if (st == NULL)
+        return;
+    for (i = 0; i < OSSL_NELEM(st->staples); i++)
+        ocsp_staple_clear(&st->staples[i]);
+    CRYPTO_THREAD_lock_free(st->lock);
+    OPENSSL_free(st);
+}
+
+int SSL_CTX_set_ocsp_staple_fetcher(SSL_CTX *ctx, SSL_ocsp_fetch_cb_fn fetch,
+                                    void *arg)
+{
+    SSL_OCSP_STAPLES *st = ctx->ocsp_staples;
+    OCSP_STAPLE old[SSL_PKEY_NUM];
+    size_t i;
+
+    if (fetch == NULL) {
+        if (st == NULL)
+            return 1;
+        /*
+         * Handshakes may be looking into the cache, so it is only emptied.
+         * It is freed with |ctx|.
+         */
+        if (!CRYPTO_THREAD_write_lock(st->lock))
+            return 0;
+        st->fetch = NULL;
+        st->arg = NULL;
+        memcpy(old, st->staples, sizeof(old));
+        memset(st->staples, 0, sizeof(st->staples));
+        CRYPTO_THREAD_unlock(st->lock);
+        for (i = 0; i < OSSL_NELEM(old); i++)
+            ocsp_staple_clear(&old[i]);
+        return 1;
+    }
+    if (st == NULL) {
+        st = OPENSSL_zalloc(sizeof(*st));
+        if (st == NULL || (st->lock = CRYPTO_THREAD_lock_new()) == NULL) {
+            SSLerr(SSL_F_SSL_CTX_SET_OCSP_STAPLE_FETCHER,
+                   ERR_R_MALLOC_FAILURE);
+            OPENSSL_free(st);
+            return 0;
+        }
+        ctx->ocsp_staples = st;
+    }
+    if (!CRYPTO_THREAD_write_lock(st->lock))
+        return 0;
+    st->fetch = fetch;
+    st->arg = arg;
+    CRYPTO_THREAD_unlock(st->lock);
+    return 1;
+}
+
+/* Find the issuer of |cpk| in its chain, or else in the certificate store */
+static X509 *ocsp_staple_issuer(SSL_CTX *ctx, CERT_PKEY *cpk)
+{
+    STACK_OF(X509) *chain = cpk->chain != NULL ? cpk->chain
+                                               : ctx->extra_certs;
+    X509_STORE *store = ctx->cert->chain_store != NULL ? ctx->cert->chain_store
+                                                       : ctx->cert_store;
+    X509_STORE_CTX *xs_ctx;
+    X509 *issuer = NULL;
+    int i;
+
+    for (i = 0; i < sk_X509_num(chain); i++) {
+        issuer = sk_X509_value(chain, i);
+        if (X509_check_issued(issuer, cpk->x509) == X509_V_OK) {
+            X509_up_ref(issuer);
+            return issuer;
+        }
+    }
+
+    issuer = NULL;
+    if (store == NULL || (xs_ctx = X509_STORE_CTX_new()) == NULL)
+        return NULL;
+    if (!X509_STORE_CTX_init(xs_ctx, store, cpk->x509, NULL)
+            || X509_STORE_CTX_get1_issuer(&issuer, xs_ctx, cpk->x509) <= 0)
+        issuer = NULL;
+    X509_STORE_CTX_free(xs_ctx);
+    return issuer;
+}
+
+static time_t ocsp_staple_time(const ASN1_GENERALIZEDTIME *t, time_t now)
+{
+    int day, sec;
+
+    if (!ASN1_TIME_diff(&day, &sec, NULL, t))
+        return 0;
+    return now + (time_t)day * 24 * 60 * 60 + sec;
+}
+
+/*
+ * Check that |bs| was signed by |issuer|, or by a responder that |issuer|
+ * delegated to, which is all a server can know to trust.
+ */
+static int ocsp_staple_verify(OCSP_BASICRESP *bs, X509 *issuer)
+{
+    X509_STORE *store = X509_STORE_new();
+    STACK_OF(X509) *certs = sk_X509_new_null();
+    int ret = 0;
+
+    if (store != NULL && certs != NULL
+            && X509_STORE_add_cert(store, issuer)
+            && X509_STORE_set_flags(store, X509_V_FLAG_PARTIAL_CHAIN)
+            && sk_X509_push(certs, issuer))
+        ret = OCSP_basic_verify(bs, certs, store, OCSP_NOEXPLICIT) > 0;
+    sk_X509_free(certs);
+    X509_STORE_free(store);
+    return ret;
+}
+
+/*
+ * Fetch a response for |cpk| into |new|.  It must be a successful response,
+ * signed for the issuer of the certificate, with the status of the
+ * certificate that is current, whatever that status is.  Sets |*ms| to the
+ * time that the fetch took.
+ */
+static int ocsp_staple_fetch(SSL_CTX *ctx, SSL_OCSP_STAPLES *st,
+                             CERT_PKEY *cpk, OCSP_STAPLE *new, time_t now,
+                             unsigned long *ms)
+{
+    X509 *issuer;
+    OCSP_RESPONSE *rsp = NULL;
+    OCSP_BASICRESP *bs = NULL;
+    ASN1_GENERALIZEDTIME *thisupd, *nextupd;
+    const unsigned char *p;
+    struct timeval start, end;
+    int status, reason, ok, ret = 0;
+
+    if ((issuer = ocsp_staple_issuer(ctx, cpk)) == NULL) {
+        SSLerr(SSL_F_OCSP_STAPLE_FETCH, SSL_R_NO_ISSUER_CERTIFICATE);
+        return 0;
+    }
+    if ((new->id = OCSP_cert_to_id(NULL, cpk->x509, issuer)) == NULL) {
+        SSLerr(SSL_F_OCSP_STAPLE_FETCH, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+
+    ssl_get_current_time(&start);
+    ok = st->fetch(ctx, cpk->x509, issuer, &new->resp, &new->resplen,
+                   st->arg);
+    ssl_get_current_time(&end);
+    *ms = (unsigned long)((end.tv_sec - start.tv_sec) * 1000
+                          + (end.tv_usec - start.tv_usec) / 1000);
+    if (!ok || new->resp == NULL || new->resplen > LONG_MAX) {
+        SSLerr(SSL_F_OCSP_STAPLE_FETCH, SSL_R_CALLBACK_FAILED);
+        goto err;
+    }
+
+    p = new->resp;
+    if ((rsp = d2i_OCSP_RESPONSE(NULL, &p, (long)new->resplen)) == NULL
+            || p != new->resp + new->resplen
+            || OCSP_response_status(rsp) != OCSP_RESPONSE_STATUS_SUCCESSFUL
+            || (bs = OCSP_response_get1_basic(rsp)) == NULL
+            || !ocsp_staple_verify(bs, issuer)
+            || !OCSP_resp_find_status(bs, new->id, &status, &reason, NULL,
+                                      &thisupd, &nextupd)
+            || !OCSP_check_validity(thisupd, nextupd, STAPLE_MAX_SKEW, -1)) {
+        SSLerr(SSL_F_OCSP_STAPLE_FETCH, SSL_R_INVALID_STATUS_RESPONSE);
+        goto err;
+    }
+
+    new->this_update = ocsp_staple_time(thisupd, now);
+    if (nextupd != NULL) {
+        new->next_update = ocsp_staple_time(nextupd, now);
+        /* Halfway between now and the end of its validity */
+        new->refresh = now + (new->next_update - now) / 2;
+    } else {
+        new->refresh = now + STAPLE_DEFAULT_REFRESH;
+    }
+    X509_up_ref(cpk->x509);
+    new->cert = cpk->x509;
+    ret = 1;
+
+ err:
+    OCSP_BASICRESP_free(bs);
+    OCSP_RESPONSE_free(rsp);
+    X509_free(issuer);
+    return ret;
+}
+
+int SSL_CTX_refresh_ocsp_staples(SSL_CTX *ctx)
+{
+    SSL_OCSP_STAPLES *st = ctx->ocsp_staples;
+    OCSP_STAPLE new, old, *cur;
+    CERT_PKEY *cpk;
+    time_t now = time(NULL);
+    unsigned long ms, slowest = 0;
+    size_t i;
+    int ret = 1;
+
+    if (st == NULL || st->fetch == NULL) {
+        SSLerr(SSL_F_SSL_CTX_REFRESH_OCSP_STAPLES,
+               ERR_R_SHOULD_NOT_HAVE_BEEN_CALLED);
+        return 0;
+    }
+
+    for (i = 0; i < OSSL_NELEM(st->staples); i++) {
+        cpk = &ctx->cert->pkeys[i];
+        cur = &st->staples[i];
+        /*
+         * Only this function and disabling the cache, which must not happen
+         * at the same time, change the entries, no lock to read them
+         */
+        if (cur->cert != NULL && cur->cert == cpk->x509 && now < cur->refresh)
+            continue;
+
+        memset(&new, 0, sizeof(new));
+        if (cpk->x509 != NULL) {
+            ms = 0;
+            if (!ocsp_staple_fetch(ctx, st, cpk, &new, now, &ms)) {
+                ocsp_staple_clear(&new);
+                ret = 0;
+            }
+            if (ms > slowest)
+                slowest = ms;
+            /* Keep serving a response that has not expired yet */
+            if (new.cert == NULL && cur->cert == cpk->x509
+                    && (cur->next_update == 0 || now < cur->next_update))
+                continue;
+        } else if (cur->cert == NULL) {
+            continue;
+        }
+
+        if (!CRYPTO_THREAD_write_lock(st->lock)) {
+            ocsp_staple_clear(&new);
+            return 0;
+        }
+        old = *cur;
+        *cur = new;
+        CRYPTO_THREAD_unlock(st->lock);
+        ocsp_staple_clear(&old);
+    }
+
+    tsan_store(&st->refresh_ms, slowest);
+    return ret;
+}
+
+void SSL_CTX_get_ocsp_staple_stats(SSL_CTX *ctx, unsigned long *stapled,
+                                   unsigned long *unstapled, long *max_age,
+                                   unsigned long *refresh_ms)
+{
+    SSL_OCSP_STAPLES *st = ctx->ocsp_staples;
+    time_t now = time(NULL);
+    long age = 0;
+    size_t i;
+
+    if (stapled != NULL)
+        *stapled = st == NULL ? 0 : tsan_load(&st->stapled);
+    if (unstapled != NULL)
+        *unstapled = st == NULL ? 0 : tsan_load(&st->unstapled);
+    if (refresh_ms != NULL)
+        *refresh_ms = st == NULL ? 0 : tsan_load(&st->refresh_ms);
+    if (max_age == NULL)
+        return;
+
+    if (st != NULL && CRYPTO_THREAD_read_lock(st->lock)) {
+        for (i = 0; i < OSSL_NELEM(st->staples); i++)
+            if (st->staples[i].resp != NULL
+                    && now - st->staples[i].this_update > age)
+                age = (long)(now - st->staples[i].this_update);
+        CRYPTO_THREAD_unlock(st->lock);
+    }
+    *max_age = age;
+}
+
+/*
+ * Set the OCSP response of |s| to a copy of the cached one for its
+ * certificate |x|.  Returns 1 if there is one that has not expired, 0 if not
+ * or -1 on error.
+ */
+int ssl_ocsp_staple_get(SSL *s, X509 *x)
+{
+    SSL_OCSP_STAPLES *st = s->ctx->ocsp_staples;
+    const OCSP_STAPLE *cur;
+    unsigned char *resp = NULL;
+    size_t i, resplen = 0;
+    time_t now = time(NULL);
+    int ret = 0;
+
+    if (!CRYPTO_THREAD_read_lock(st->lock))
+        return -1;
+    /* A disabled cache does not count */
+    if (st->fetch == NULL) {
+        CRYPTO_THREAD_unlock(st->lock);
+        return 0;
+    }
+    for (i = 0; i < OSSL_NELEM(st->staples); i++) {
+        cur = &st->staples[i];
+        if (cur->cert != x || cur->resp == NULL
+                || (cur->next_update != 0 && now >= cur->next_update))
+            continue;
+        if ((resp = OPENSSL_memdup(cur->resp, cur->resplen)) == NULL)
+            ret = -1;
+        else
+            ret = 1;
+        resplen = cur->resplen;
+        break;
+    }
+    CRYPTO_THREAD_unlock(st->lock);
+
+    if (ret > 0) {
+        OPENSSL_free(s->ext.ocsp.resp);
+        s->ext.ocsp.resp = resp;
+        s->ext.ocsp.resp_len = resplen;
+        tsan_counter(&st->stapled);
+    } else if (ret == 0) {
+        tsan_counter(&st->unstapled);
+    }
+    return ret;
+}
+
+#endif
@@ -744,6 +744,111 @@ static int remove_session_lock(SSL_CTX *ctx, SSL_SESSION *c, int lck)
     return ret;
 }
 
+/*
+ * Replays of early data can be detected without keeping every ticket in the
+ * session cache by remembering the ClientHellos that were accepted with early
+ * data while their ticket age would still be accepted (RFC 8446, 8.2).  They
+ * are kept in two Bloom filters, each in use for ANTI_REPLAY_WINDOW seconds,
+ * so that every ClientHello is remembered for at least that long.
+ */
+struct ssl_anti_replay_st {
+    CRYPTO_RWLOCK *lock;
+    /* Secret, so that clients can't choose the bits that are set */
+    unsigned char salt[16];
+    size_t bits;
+    /* The current and the previous filter, each of |bits| bits */
+    unsigned char *cur;
+    unsigned char *prev;
+    time_t start;
+};
+
+void ssl_anti_replay_free(SSL_ANTI_REPLAY *ar)
+{
+    if (ar == NULL)
+        return;
+    CRYPTO_THREAD_lock_free(ar->lock);
+    OPENSSL_free(ar->cur);
+    OPENSSL_free(ar->prev);
+    OPENSSL_free(ar);
+}
+
+int SSL_CTX_set_anti_replay_filter(SSL_CTX *ctx, size_t bits)
+{
+    SSL_ANTI_REPLAY *ar = NULL;
+    size_t len = bits / 8 + (bits % 8 != 0);
+
+    if (bits != 0) {
+        ar = OPENSSL_zalloc(sizeof(*ar));
+        if (ar == NULL
+                || (ar->lock = CRYPTO_THREAD_lock_new()) == NULL
+                || (ar->cur = OPENSSL_zalloc(len)) == NULL
+                || (ar->prev = OPENSSL_zalloc(len)) == NULL) {
+            ssl_anti_replay_free(ar);
+            SSLerr(0, ERR_R_MALLOC_FAILURE);
+            return 0;
+        }
+        if (RAND_bytes(ar->salt, sizeof(ar->salt)) <= 0) {
+            ssl_anti_replay_free(ar);
+            return 0;
+        }
+        ar->bits = len * 8;
+        ar->start = time(NULL);
+    }
+
+    ssl_anti_replay_free(ctx->anti_replay);
+    ctx->anti_replay = ar;
+    return 1;
+}
+
+/*
+ * Check whether the ClientHello with the given |random| was seen before, and
+ * remember it.  Returns 1 if it is new and 0 if it may be a replay.
+ */
+int ssl_anti_replay_check(SSL_ANTI_REPLAY *ar, const unsigned char *random)
+{
+    unsigned char buf[sizeof(ar->salt) + SSL3_RANDOM_SIZE];
+    unsigned char md[SHA256_DIGEST_LENGTH];
+    size_t pos[ANTI_REPLAY_HASHES];
+    time_t now = time(NULL);
+    unsigned char *tmp;
+    int i, j, incur = 1, inprev = 1;
+
+    memcpy(buf, ar->salt, sizeof(ar->salt));
+    memcpy(buf + sizeof(ar->salt), random, SSL3_RANDOM_SIZE);
+    if (!EVP_Digest(buf, sizeof(buf), md, NULL, EVP_sha256(), NULL))
+        return 0;
+    for (i = 0; i < ANTI_REPLAY_HASHES; i++) {
+        uint64_t v = 0;
+
+        for (j = 0; j < 8; j++)
+            v = (v << 8) | md[i * 8 + j];
+        pos[i] = (size_t)(v % ar->bits);
+    }
+
+    if (!CRYPTO_THREAD_write_lock(ar->lock))
+        return 0;
+    if (now >= ar->start + ANTI_REPLAY_WINDOW) {
+        /* Start a new filter, and forget the previous one */
+        if (now < ar->start + 2 * ANTI_REPLAY_WINDOW) {
+            tmp = ar->prev;
+            ar->prev = ar->cur;
+            ar->cur = tmp;
+        } else {
+            memset(ar->prev, 0, ar->bits / 8);
+        }
+        memset(ar->cur, 0, ar->bits / 8);
+        ar->start = now;
+    }
+    for (i = 0; i < ANTI_REPLAY_HASHES; i++) {
+        incur &= (ar->cur[pos[i] / 8] >> (pos[i] % 8)) & 1;
+        inprev &= (ar->prev[pos[i] / 8] >> (pos[i] % 8)) & 1;
+        ar->cur[pos[i] / 8] |= 1 << (pos[i] % 8);
+    }
+    CRYPTO_THREAD_unlock(ar->lock);
+
+    return !incur && !inprev;
+}
+
 void SSL_SESSION_free(SSL_SESSION *ss)
 {
     int i;
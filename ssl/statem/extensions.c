@@ -54,6 +54,7 @@ static int final_sig_algs(SSL *s, unsigned int context, int sent);
 static int final_early_data(SSL *s, unsigned int context, int sent);
 static int final_maxfragmentlen(SSL *s, unsigned int context, int sent);
 static int init_post_handshake_auth(SSL *s, unsigned int context);
+static int init_compress_certificate(SSL *s, unsigned int context);
 
 /* Structure to define a built-in extension */
 typedef struct extensions_definition_st {
@@ -372,6 +373,15 @@ static const EXTENSION_DEFINITION ext_defs[] = {
         tls_construct_certificate_authorities,
         tls_construct_certificate_authorities, NULL,
     },
+    {
+        TLSEXT_TYPE_compress_certificate,
+        SSL_EXT_CLIENT_HELLO | SSL_EXT_TLS_IMPLEMENTATION_ONLY
+        | SSL_EXT_TLS1_3_ONLY,
+        init_compress_certificate,
+        tls_parse_ctos_compress_certificate, NULL,
+        NULL, tls_construct_ctos_compress_certificate,
+        NULL,
+    },
     {
         /* Must be immediately before pre_shared_key */
         TLSEXT_TYPE_padding,
@@ -1647,7 +1657,11 @@ static int final_early_data(SSL *s, unsigned int context, int sent)
             || s->hello_retry_request != SSL_HRR_NONE
             || (s->ctx->allow_early_data_cb != NULL
                 && !s->ctx->allow_early_data_cb(s,
-                                         s->ctx->allow_early_data_cb_data))) {
+                                         s->ctx->allow_early_data_cb_data))
+            || ((s->options & SSL_OP_NO_ANTI_REPLAY) == 0
+                && s->session_ctx->anti_replay != NULL
+                && !ssl_anti_replay_check(s->session_ctx->anti_replay,
+                                          s->s3.client_random))) {
         s->ext.early_data = SSL_EARLY_DATA_REJECTED;
     } else {
         s->ext.early_data = SSL_EARLY_DATA_ACCEPTED;
@@ -1693,3 +1707,10 @@ static int init_post_handshake_auth(SSL *s, unsigned int context)
 
     return 1;
 }
+
+static int init_compress_certificate(SSL *s, unsigned int context)
+{
+    s->ext.cert_comp_alg = 0;
+
+    return 1;
+}
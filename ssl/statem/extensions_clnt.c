@@ -1254,6 +1254,54 @@ EXT_RETURN tls_construct_ctos_post_handshake_auth(SSL *s, WPACKET *pkt,
 #endif
 }
 
+/*
+ * Offer the certificate compression algorithms that we can decompress
+ */
+EXT_RETURN tls_construct_ctos_compress_certificate(SSL *s, WPACKET *pkt,
+                                                   unsigned int context,
+                                                   X509 *x, size_t chainidx)
+{
+#ifndef OPENSSL_NO_TLS1_3
+    size_t i;
+    int any = 0;
+
+    s->s3.cert_comp_alg = 0;
+    for (i = 0; i < s->ctx->cert_comp_algs_len; i++)
+        if (s->ctx->cert_comp_algs[i].decompress != NULL)
+            any = 1;
+    if (!any)
+        return EXT_RETURN_NOT_SENT;
+
+    if (!WPACKET_put_bytes_u16(pkt, TLSEXT_TYPE_compress_certificate)
+            || !WPACKET_start_sub_packet_u16(pkt)
+            || !WPACKET_start_sub_packet_u8(pkt)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_CONSTRUCT_CTOS_COMPRESS_CERTIFICATE,
+                 ERR_R_INTERNAL_ERROR);
+        return EXT_RETURN_FAIL;
+    }
+    for (i = 0; i < s->ctx->cert_comp_algs_len; i++) {
+        if (s->ctx->cert_comp_algs[i].decompress != NULL
+                && !WPACKET_put_bytes_u16(pkt, s->ctx->cert_comp_algs[i].alg)) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                     SSL_F_TLS_CONSTRUCT_CTOS_COMPRESS_CERTIFICATE,
+                     ERR_R_INTERNAL_ERROR);
+            return EXT_RETURN_FAIL;
+        }
+    }
+    if (!WPACKET_close(pkt) || !WPACKET_close(pkt)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_CONSTRUCT_CTOS_COMPRESS_CERTIFICATE,
+                 ERR_R_INTERNAL_ERROR);
+        return EXT_RETURN_FAIL;
+    }
+
+    return EXT_RETURN_SENT;
+#else
+    return EXT_RETURN_NOT_SENT;
+#endif
+}
+
 
 /*
  * Parse the server's renegotiation binding and abort if it's not right
@@ -929,6 +929,12 @@ int tls_parse_ctos_cookie(SSL *s, PACKET *pkt, unsigned int context, X509 *x,
         return 0;
     }
 
+    /*
+     * Act as if this ClientHello came after a HelloRetryRequest.  This is set
+     * first so that the transcript is reconstructed in the handshake buffer.
+     */
+    s->hello_retry_request = 1;
+
     /* Reconstruct the transcript hash */
     if (!create_synthetic_message_hash(s, PACKET_data(&chhash),
                                        PACKET_remaining(&chhash), hrr,
@@ -937,9 +943,6 @@ int tls_parse_ctos_cookie(SSL *s, PACKET *pkt, unsigned int context, X509 *x,
         return 0;
     }
 
-    /* Act as if this ClientHello came after a HelloRetryRequest */
-    s->hello_retry_request = 1;
-
     s->ext.cookieok = 1;
 #endif
 
@@ -1169,13 +1172,13 @@ int tls_parse_ctos_psk(SSL *s, PACKET *pkt, unsigned int context, X509 *x,
             int ret;
 
             /*
-             * If we are using anti-replay protection then we behave as if
-             * SSL_OP_NO_TICKET is set - we are caching tickets anyway so there
-             * is no point in using full stateless tickets.
+             * If we are using the session cache for anti-replay protection
+             * then we behave as if SSL_OP_NO_TICKET is set - we are caching
+             * tickets anyway so there is no point in using full stateless
+             * tickets.
              */
             if ((s->options & SSL_OP_NO_TICKET) != 0
-                    || (s->max_early_data > 0
-                        && (s->options & SSL_OP_NO_ANTI_REPLAY) == 0))
+                    || SSL_USE_REPLAY_CACHE(s))
                 ret = tls_get_stateful_ticket(s, &identity, &sess);
             else
                 ret = tls_decrypt_ticket(s, PACKET_data(&identity),
@@ -1198,8 +1201,7 @@ int tls_parse_ctos_psk(SSL *s, PACKET *pkt, unsigned int context, X509 *x,
                 continue;
 
             /* Check for replay */
-            if (s->max_early_data > 0
-                    && (s->options & SSL_OP_NO_ANTI_REPLAY) == 0
+            if (SSL_USE_REPLAY_CACHE(s)
                     && !SSL_CTX_remove_session(s->session_ctx, sess)) {
                 SSL_SESSION_free(sess);
                 sess = NULL;
@@ -1301,6 +1303,44 @@ int tls_parse_ctos_post_handshake_auth(SSL *s, PACKET *pkt, unsigned int context
     return 1;
 }
 
+/*
+ * Pick the first of our certificate compression algorithms that the client
+ * offered
+ */
+int tls_parse_ctos_compress_certificate(SSL *s, PACKET *pkt,
+                                        unsigned int context, X509 *x,
+                                        size_t chainidx)
+{
+#ifndef OPENSSL_NO_TLS1_3
+    PACKET algs, tmp;
+    unsigned int alg;
+    size_t i;
+
+    if (!PACKET_as_length_prefixed_1(pkt, &algs)
+            || PACKET_remaining(&algs) == 0
+            || (PACKET_remaining(&algs) & 1) != 0) {
+        SSLfatal(s, SSL_AD_DECODE_ERROR,
+                 SSL_F_TLS_PARSE_CTOS_COMPRESS_CERTIFICATE,
+                 SSL_R_BAD_EXTENSION);
+        return 0;
+    }
+
+    for (i = 0; i < s->ctx->cert_comp_algs_len; i++) {
+        if (s->ctx->cert_comp_algs[i].compress == NULL)
+            continue;
+        tmp = algs;
+        while (PACKET_get_net_2(&tmp, &alg)) {
+            if (alg == s->ctx->cert_comp_algs[i].alg) {
+                s->ext.cert_comp_alg = alg;
+                return 1;
+            }
+        }
+    }
+#endif
+
+    return 1;
+}
+
 /*
  * Add the server's renegotiation binding
  */
@@ -895,10 +895,24 @@ static SUB_STATE_RETURN write_state_machine(SSL *s)
 }
 
 /*
- * Flush the write BIO
+ * Write out any queued flight and flush the write BIO
  */
 int statem_flush(SSL *s)
 {
+    size_t written;
+
+    /*
+     * The record layer splits the flight at the maximum fragment length. On a
+     * retry it must be passed the same buffer again, so the flight is only
+     * dropped once it has all been written.
+     */
+    if (s->flight_buf != NULL && s->flight_buf->length > 0) {
+        if (ssl3_write_bytes(s, SSL3_RT_HANDSHAKE, s->flight_buf->data,
+                             s->flight_buf->length, &written) <= 0)
+            return 0;
+        s->flight_buf->length = 0;
+    }
+
     s->rwstate = SSL_WRITING;
     if (BIO_flush(s->wbio) <= 0) {
         return 0;
@@ -83,6 +83,16 @@ static int key_exchange_expected(SSL *s)
  * Return values are 1 for success (transition allowed) and  0 on error
  * (transition not allowed)
  */
+/*
+ * A CompressedCertificate message is only allowed if we offered to take one
+ */
+static int cert_comp_expected(SSL *s, int mt)
+{
+    return mt == SSL3_MT_COMPRESSED_CERTIFICATE
+           && (s->ext.extflags[TLSEXT_IDX_compress_certificate]
+               & SSL_EXT_FLAG_SENT) != 0;
+}
+
 static int ossl_statem_client13_read_transition(SSL *s, int mt)
 {
     OSSL_STATEM *st = &s->statem;
@@ -126,7 +136,7 @@ static int ossl_statem_client13_read_transition(SSL *s, int mt)
                 st->hand_state = TLS_ST_CR_CERT_REQ;
                 return 1;
             }
-            if (mt == SSL3_MT_CERTIFICATE) {
+            if (mt == SSL3_MT_CERTIFICATE || cert_comp_expected(s, mt)) {
                 st->hand_state = TLS_ST_CR_CERT;
                 return 1;
             }
@@ -134,7 +144,7 @@ static int ossl_statem_client13_read_transition(SSL *s, int mt)
         break;
 
     case TLS_ST_CR_CERT_REQ:
-        if (mt == SSL3_MT_CERTIFICATE) {
+        if (mt == SSL3_MT_CERTIFICATE || cert_comp_expected(s, mt)) {
             st->hand_state = TLS_ST_CR_CERT;
             return 1;
         }
@@ -1037,6 +1047,8 @@ MSG_PROCESS_RETURN ossl_statem_client_process_message(SSL *s, PACKET *pkt)
         return dtls_process_hello_verify(s, pkt);
 
     case TLS_ST_CR_CERT:
+        if (s->s3.tmp.message_type == SSL3_MT_COMPRESSED_CERTIFICATE)
+            return tls_process_server_compressed_certificate(s, pkt);
         return tls_process_server_certificate(s, pkt);
 
     case TLS_ST_CR_CERT_VRFY:
@@ -1986,6 +1998,72 @@ MSG_PROCESS_RETURN tls_process_server_certificate(SSL *s, PACKET *pkt)
     return ret;
 }
 
+/*
+ * Decompress a CompressedCertificate message (RFC8879) and process the
+ * Certificate message in it
+ */
+MSG_PROCESS_RETURN tls_process_server_compressed_certificate(SSL *s,
+                                                             PACKET *pkt)
+{
+    const CERT_COMP_ALG *ca;
+    unsigned int alg;
+    unsigned long msglen;
+    PACKET comp, msg;
+    unsigned char *buf;
+    MSG_PROCESS_RETURN ret;
+
+    if (!PACKET_get_net_2(pkt, &alg)
+            || !PACKET_get_net_3(pkt, &msglen)
+            || !PACKET_get_length_prefixed_3(pkt, &comp)
+            || PACKET_remaining(pkt) != 0
+            || PACKET_remaining(&comp) == 0
+            || msglen == 0) {
+        SSLfatal(s, SSL_AD_DECODE_ERROR,
+                 SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE,
+                 SSL_R_LENGTH_MISMATCH);
+        return MSG_PROCESS_ERROR;
+    }
+    ca = ssl_cert_comp_alg_lookup(s->ctx, alg);
+    if (ca == NULL || ca->decompress == NULL) {
+        SSLfatal(s, SSL_AD_ILLEGAL_PARAMETER,
+                 SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE,
+                 SSL_R_UNSUPPORTED_COMPRESSION_ALGORITHM);
+        return MSG_PROCESS_ERROR;
+    }
+    if (msglen > s->max_cert_list) {
+        SSLfatal(s, SSL_AD_BAD_CERTIFICATE,
+                 SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE,
+                 SSL_R_EXCESSIVE_MESSAGE_SIZE);
+        return MSG_PROCESS_ERROR;
+    }
+    if ((buf = OPENSSL_malloc(msglen)) == NULL) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE,
+                 ERR_R_MALLOC_FAILURE);
+        return MSG_PROCESS_ERROR;
+    }
+    if (!ca->decompress(s, PACKET_data(&comp), PACKET_remaining(&comp),
+                        buf, msglen)) {
+        SSLfatal(s, SSL_AD_BAD_CERTIFICATE,
+                 SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE,
+                 SSL_R_BAD_DECOMPRESSION);
+        OPENSSL_free(buf);
+        return MSG_PROCESS_ERROR;
+    }
+
+    s->s3.cert_comp_alg = alg;
+    if (!PACKET_buf_init(&msg, buf, msglen)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_PROCESS_SERVER_COMPRESSED_CERTIFICATE,
+                 ERR_R_INTERNAL_ERROR);
+        OPENSSL_free(buf);
+        return MSG_PROCESS_ERROR;
+    }
+    ret = tls_process_server_certificate(s, &msg);
+    OPENSSL_free(buf);
+    return ret;
+}
+
 static int tls_process_ske_psk_preamble(SSL *s, PACKET *pkt)
 {
 #ifndef OPENSSL_NO_PSK
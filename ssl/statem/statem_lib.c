@@ -35,6 +35,35 @@ const unsigned char hrrrandom[] = {
     0x07, 0x9e, 0x09, 0xe2, 0xc8, 0xa8, 0x33, 0x9c
 };
 
+/*
+ * Should the message in s->init_buf be held back in s->flight_buf? The
+ * messages that a TLSv1.3 server sends under the handshake keys all go out
+ * before it waits for the client, so they can share records rather than
+ * taking at least one each. The flight ends with the Finished, whose post
+ * work calls statem_flush().
+ */
+static int ssl3_queue_in_flight(SSL *s, int type)
+{
+    if (!s->server || type != SSL3_RT_HANDSHAKE || SSL_IS_DTLS(s)
+            || !SSL_IS_TLS13(s))
+        return 0;
+
+    switch (s->statem.hand_state) {
+    case TLS_ST_SW_ENCRYPTED_EXTENSIONS:
+    case TLS_ST_SW_CERT:
+    case TLS_ST_SW_CERT_VRFY:
+    case TLS_ST_SW_FINISHED:
+        return 1;
+
+    case TLS_ST_SW_CERT_REQ:
+        /* A post-handshake CertificateRequest is a flight on its own */
+        return s->post_handshake_auth != SSL_PHA_REQUEST_PENDING;
+
+    default:
+        return 0;
+    }
+}
+
 /*
  * send s->init_buf in records of type 'type' (SSL3_RT_HANDSHAKE or
  * SSL3_RT_CHANGE_CIPHER_SPEC)
@@ -42,12 +71,29 @@ const unsigned char hrrrandom[] = {
 int ssl3_do_write(SSL *s, int type)
 {
     int ret;
-    size_t written = 0;
+    size_t written = 0, len;
 
-    ret = ssl3_write_bytes(s, type, &s->init_buf->data[s->init_off],
-                           s->init_num, &written);
-    if (ret < 0)
-        return -1;
+    if (ssl3_queue_in_flight(s, type)) {
+        if (s->flight_buf == NULL && (s->flight_buf = BUF_MEM_new()) == NULL) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_WRITE_STATE_MACHINE,
+                     ERR_R_MALLOC_FAILURE);
+            return -1;
+        }
+        len = s->flight_buf->length;
+        if (!BUF_MEM_grow(s->flight_buf, len + s->init_num)) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_WRITE_STATE_MACHINE,
+                     ERR_R_MALLOC_FAILURE);
+            return -1;
+        }
+        memcpy(s->flight_buf->data + len, &s->init_buf->data[s->init_off],
+               s->init_num);
+        written = s->init_num;
+    } else {
+        ret = ssl3_write_bytes(s, type, &s->init_buf->data[s->init_off],
+                               s->init_num, &written);
+        if (ret < 0)
+            return -1;
+    }
     if (type == SSL3_RT_HANDSHAKE)
         /*
          * should not be done for 'Hello Request's, but in that case we'll
@@ -901,7 +947,25 @@ static int ssl_add_cert_to_wpacket(SSL *s, WPACKET *pkt, X509 *x, int chain)
     return 1;
 }
 
-/* Add certificate chain to provided WPACKET */
+/*
+ * Whether there are custom extensions that may be added to the certificates of
+ * a TLSv1.3 Certificate message.
+ */
+static int cert_exts_custom(SSL *s)
+{
+    custom_ext_methods *exts = &s->cert->custext;
+    size_t i;
+
+    for (i = 0; i < exts->meths_count; i++)
+        if ((exts->meths[i].context & SSL_EXT_TLS1_3_CERTIFICATE) != 0)
+            return 1;
+    return 0;
+}
+
+/*
+ * Add certificate chain to provided WPACKET.  A chain that is not built from
+ * a store is written from the cache of encoded chains.
+ */
 static int ssl_add_cert_chain(SSL *s, WPACKET *pkt, CERT_PKEY *cpk)
 {
     int i, chain_count;
@@ -983,6 +1047,12 @@ static int ssl_add_cert_chain(SSL *s, WPACKET *pkt, CERT_PKEY *cpk)
             SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_SSL_ADD_CERT_CHAIN, i);
             return 0;
         }
+        if (!SSL_IS_TLS13(s) || !cert_exts_custom(s)) {
+            i = ssl_cert_list_output(s, cpk, extra_certs, pkt);
+            if (i != 0)
+                /* SSLfatal() already called on error */
+                return i > 0;
+        }
         if (!ssl_add_cert_to_wpacket(s, pkt, x, 0)) {
             /* SSLfatal() already called */
             return 0;
@@ -1037,6 +1107,8 @@ WORK_STATE tls_finish_handshake(SSL *s, WORK_STATE wst, int clearbufs, int stop)
             BUF_MEM_free(s->init_buf);
             s->init_buf = NULL;
         }
+        BUF_MEM_free(s->flight_buf);
+        s->flight_buf = NULL;
         if (!ssl_free_wbio_buffer(s)) {
             SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_TLS_FINISH_HANDSHAKE,
                      ERR_R_INTERNAL_ERROR);
@@ -28,6 +28,7 @@
 #define TICKET_NONCE_SIZE       8
 
 static int tls_construct_encrypted_extensions(SSL *s, WPACKET *pkt);
+static int tls_prepare_server_certificate(SSL *s, int *mt);
 
 /*
  * ossl_statem_server13_read_transition() encapsulates the logic for the allowed
@@ -1029,6 +1030,14 @@ int ossl_statem_server_construct_message(SSL *s, WPACKET *pkt,
         break;
 
     case TLS_ST_SW_CERT:
+        if (s->ext.cert_comp_alg != 0) {
+            if (!tls_prepare_server_certificate(s, mt)) {
+                /* SSLfatal() already called */
+                return 0;
+            }
+            *confunc = tls_construct_prepared_certificate;
+            break;
+        }
         *confunc = tls_construct_server_certificate;
         *mt = SSL3_MT_CERTIFICATE;
         break;
@@ -1356,6 +1365,95 @@ static void ssl_check_for_safari(SSL *s, const CLIENTHELLO_MSG *hello)
 }
 #endif                          /* !OPENSSL_NO_EC */
 
+/*
+ * Fill in |s->hello_summary| from the raw ClientHello in |hello| without
+ * allocating anything.  Only the framing of the message, and of the
+ * extensions that are looked into, is checked here: anything else is left to
+ * the full parse.  Returns 1 if the summary was filled in, -1 if the
+ * ClientHello is answered with a HelloVerifyRequest without being processed,
+ * and 0 if it is malformed.
+ */
+static int tls_summarise_client_hello(SSL *s, const PACKET *hello)
+{
+    CLIENTHELLO_SUMMARY *sum = &s->hello_summary;
+    PACKET pkt = *hello, cookie, extensions, ext, list, name;
+    unsigned int type, name_type, group;
+    size_t ngroups = 0;
+
+    /* All the PACKETs start out empty */
+    memset(sum, 0, sizeof(*sum));
+
+    if (!PACKET_get_net_2(&pkt, &sum->legacy_version)
+            || !PACKET_get_sub_packet(&pkt, &sum->random, SSL3_RANDOM_SIZE)
+            || !PACKET_get_length_prefixed_1(&pkt, &sum->session_id)
+            || PACKET_remaining(&sum->session_id)
+               > SSL_MAX_SSL_SESSION_ID_LENGTH)
+        return 0;
+    if (SSL_IS_DTLS(s)) {
+        if (!PACKET_get_length_prefixed_1(&pkt, &cookie))
+            return 0;
+        /* Only ClientHellos that will be processed are summarised */
+        if (PACKET_remaining(&cookie) == 0
+                && (SSL_get_options(s) & SSL_OP_COOKIE_EXCHANGE) != 0)
+            return -1;
+    }
+    if (!PACKET_get_length_prefixed_2(&pkt, &sum->ciphersuites)
+            || !PACKET_get_length_prefixed_1(&pkt, &sum->compressions))
+        return 0;
+    if (PACKET_remaining(&pkt) != 0
+            && (!PACKET_get_length_prefixed_2(&pkt, &sum->extensions)
+                || PACKET_remaining(&pkt) != 0))
+        return 0;
+
+    extensions = sum->extensions;
+    while (PACKET_remaining(&extensions) > 0) {
+        if (!PACKET_get_net_2(&extensions, &type)
+                || !PACKET_get_length_prefixed_2(&extensions, &ext))
+            return 0;
+
+        switch (type) {
+        case TLSEXT_TYPE_server_name:
+            /* As in tls_parse_ctos_server_name(), exactly one host_name */
+            if (!PACKET_as_length_prefixed_2(&ext, &list)
+                    || !PACKET_get_1(&list, &name_type)
+                    || name_type != TLSEXT_NAMETYPE_host_name
+                    || !PACKET_as_length_prefixed_2(&list, &sum->servername))
+                return 0;
+            break;
+        case TLSEXT_TYPE_application_layer_protocol_negotiation:
+            if (!PACKET_as_length_prefixed_2(&ext, &sum->alpn))
+                return 0;
+            break;
+        case TLSEXT_TYPE_supported_versions:
+            if (!PACKET_as_length_prefixed_1(&ext, &sum->versions))
+                return 0;
+            break;
+        case TLSEXT_TYPE_key_share:
+            if (!PACKET_as_length_prefixed_2(&ext, &list))
+                return 0;
+            ngroups = 0;
+            while (PACKET_remaining(&list) > 0) {
+                if (!PACKET_get_net_2(&list, &group)
+                        || !PACKET_get_length_prefixed_2(&list, &name))
+                    return 0;
+                if (ngroups < CLIENTHELLO_SUMMARY_MAX_GROUPS) {
+                    sum->group_list[2 * ngroups] = group >> 8;
+                    sum->group_list[2 * ngroups + 1] = group & 0xff;
+                    ngroups++;
+                }
+            }
+            break;
+        default:
+            break;
+        }
+    }
+    if (!PACKET_buf_init(&sum->groups, sum->group_list, 2 * ngroups))
+        return 0;
+
+    sum->valid = 1;
+    return 1;
+}
+
 MSG_PROCESS_RETURN tls_process_client_hello(SSL *s, PACKET *pkt)
 {
     /* |cookie| will only be initialized for DTLS. */
@@ -1381,6 +1479,34 @@ MSG_PROCESS_RETURN tls_process_client_hello(SSL *s, PACKET *pkt)
         s->new_session = 1;
     }
 
+    /*
+     * Let the ClientHello filter reject or route the connection before
+     * anything is allocated for the ClientHello.  The ClientHello callback
+     * gets the summary too.  A ClientHello that the filter cannot be given a
+     * summary of must not get past it.
+     */
+    if (!RECORD_LAYER_is_sslv2_record(&s->rlayer)
+            && (s->ctx->client_hello_filter != NULL
+                || s->ctx->client_hello_cb != NULL)) {
+        int summarised = tls_summarise_client_hello(s, pkt);
+        int al = SSL_AD_HANDSHAKE_FAILURE;
+
+        if (summarised == 0 && s->ctx->client_hello_filter != NULL) {
+            SSLfatal(s, SSL_AD_DECODE_ERROR, SSL_F_TLS_PROCESS_CLIENT_HELLO,
+                     SSL_R_LENGTH_MISMATCH);
+            goto err;
+        }
+        if (summarised == 1
+                && s->ctx->client_hello_filter != NULL
+                && s->ctx->client_hello_filter(s, &al,
+                                               s->ctx->client_hello_filter_arg)
+                   != SSL_CLIENT_HELLO_SUCCESS) {
+            SSLfatal(s, al, SSL_F_TLS_PROCESS_CLIENT_HELLO,
+                     SSL_R_CALLBACK_FAILED);
+            goto err;
+        }
+    }
+
     clienthello = OPENSSL_zalloc(sizeof(*clienthello));
     if (clienthello == NULL) {
         SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_TLS_PROCESS_CLIENT_HELLO,
@@ -1577,6 +1703,7 @@ MSG_PROCESS_RETURN tls_process_client_hello(SSL *s, PACKET *pkt)
     return MSG_PROCESS_CONTINUE_PROCESSING;
 
  err:
+    s->hello_summary.valid = 0;
     if (clienthello != NULL)
         OPENSSL_free(clienthello->pre_proc_exts);
     OPENSSL_free(clienthello);
@@ -2076,6 +2203,7 @@ static int tls_early_post_process_client_hello(SSL *s)
     OPENSSL_free(clienthello->pre_proc_exts);
     OPENSSL_free(s->clienthello);
     s->clienthello = NULL;
+    s->hello_summary.valid = 0;
     return 1;
  err:
     sk_SSL_CIPHER_free(ciphers);
@@ -2083,6 +2211,7 @@ static int tls_early_post_process_client_hello(SSL *s)
     OPENSSL_free(clienthello->pre_proc_exts);
     OPENSSL_free(s->clienthello);
     s->clienthello = NULL;
+    s->hello_summary.valid = 0;
 
     return 0;
 }
@@ -2133,6 +2262,20 @@ static int tls_handle_status_request(SSL *s)
             }
         }
     }
+#ifndef OPENSSL_NO_OCSP
+    /* Else staple the cached response, if there is one */
+    else if (s->ext.status_type == TLSEXT_STATUSTYPE_ocsp && s->ctx != NULL
+             && s->ctx->ocsp_staples != NULL && s->s3.tmp.cert != NULL) {
+        int ret = ssl_ocsp_staple_get(s, s->s3.tmp.cert->x509);
+
+        if (ret < 0) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                     SSL_F_TLS_HANDLE_STATUS_REQUEST, ERR_R_MALLOC_FAILURE);
+            return 0;
+        }
+        s->ext.status_expected = ret;
+    }
+#endif
 
     return 1;
 }
@@ -2334,6 +2477,12 @@ WORK_STATE tls_post_process_client_hello(SSL *s, WORK_STATE wst)
     }
 #endif
 
+    /* The ClientHello is still at hand if it has to be buffered */
+    if (!ssl3_settle_finished_mac(s)) {
+        /* SSLfatal() already called */
+        goto err;
+    }
+
     return WORK_FINISHED_STOP;
  err:
     return WORK_ERROR;
@@ -3793,6 +3942,101 @@ int tls_construct_server_certificate(SSL *s, WPACKET *pkt)
     return 1;
 }
 
+/*
+ * Build the TLSv1.3 Certificate message body ahead of its header, to find out
+ * whether it compresses with the algorithm that we picked from the client's
+ * offer.  Sets |*mt| to the type of the message that will be sent and keeps
+ * its body until tls_construct_prepared_certificate() writes it out.
+ */
+static int tls_prepare_server_certificate(SSL *s, int *mt)
+{
+    const CERT_COMP_ALG *ca = ssl_cert_comp_alg_lookup(s->ctx,
+                                                       s->ext.cert_comp_alg);
+    BUF_MEM *plain = NULL, *comp = NULL;
+    WPACKET pkt;
+    size_t len;
+    int ret;
+
+    if ((plain = BUF_MEM_new()) == NULL || !WPACKET_init(&pkt, plain)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_PREPARE_SERVER_CERTIFICATE, ERR_R_MALLOC_FAILURE);
+        BUF_MEM_free(plain);
+        return 0;
+    }
+    if (!tls_construct_server_certificate(s, &pkt)) {
+        /* SSLfatal() already called */
+        WPACKET_cleanup(&pkt);
+        BUF_MEM_free(plain);
+        return 0;
+    }
+    if (!WPACKET_get_total_written(&pkt, &len) || !WPACKET_finish(&pkt)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_PREPARE_SERVER_CERTIFICATE, ERR_R_INTERNAL_ERROR);
+        WPACKET_cleanup(&pkt);
+        BUF_MEM_free(plain);
+        return 0;
+    }
+    plain->length = len;
+
+    /* The SSL_CTX may have changed since the ClientHello */
+    ret = 0;
+    if (ca != NULL && ca->compress != NULL) {
+        if ((comp = BUF_MEM_new()) == NULL || !WPACKET_init(&pkt, comp)) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                     SSL_F_TLS_PREPARE_SERVER_CERTIFICATE,
+                     ERR_R_MALLOC_FAILURE);
+            BUF_MEM_free(comp);
+            BUF_MEM_free(plain);
+            return 0;
+        }
+        ret = ssl_cert_compress(s, ca, (unsigned char *)plain->data, len,
+                                &pkt);
+        if (ret > 0 && (!WPACKET_get_total_written(&pkt, &comp->length)
+                        || !WPACKET_finish(&pkt))) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                     SSL_F_TLS_PREPARE_SERVER_CERTIFICATE,
+                     ERR_R_INTERNAL_ERROR);
+            ret = -1;
+        }
+        if (ret <= 0)
+            WPACKET_cleanup(&pkt);
+        if (ret < 0) {
+            /* SSLfatal() already called */
+            BUF_MEM_free(comp);
+            BUF_MEM_free(plain);
+            return 0;
+        }
+    }
+
+    BUF_MEM_free(s->s3.tmp.cert_msg);
+    if (ret > 0) {
+        s->s3.tmp.cert_msg = comp;
+        s->s3.cert_comp_alg = s->ext.cert_comp_alg;
+        *mt = SSL3_MT_COMPRESSED_CERTIFICATE;
+        BUF_MEM_free(plain);
+    } else {
+        s->s3.tmp.cert_msg = plain;
+        *mt = SSL3_MT_CERTIFICATE;
+        BUF_MEM_free(comp);
+    }
+    return 1;
+}
+
+int tls_construct_prepared_certificate(SSL *s, WPACKET *pkt)
+{
+    BUF_MEM *msg = s->s3.tmp.cert_msg;
+
+    s->s3.tmp.cert_msg = NULL;
+    if (msg == NULL || !WPACKET_memcpy(pkt, msg->data, msg->length)) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                 SSL_F_TLS_CONSTRUCT_SERVER_CERTIFICATE, ERR_R_INTERNAL_ERROR);
+        BUF_MEM_free(msg);
+        return 0;
+    }
+    BUF_MEM_free(msg);
+    return 1;
+}
+
 static int create_ticket_prequel(SSL *s, WPACKET *pkt, uint32_t age_add,
                                  unsigned char *tick_nonce)
 {
@@ -3836,14 +4080,12 @@ static int construct_stateless_ticket(SSL *s, WPACKET *pkt, uint32_t age_add,
     EVP_CIPHER_CTX *ctx = NULL;
     HMAC_CTX *hctx = NULL;
     unsigned char *p, *encdata1, *encdata2, *macdata1, *macdata2;
-    const unsigned char *const_p;
     int len, slen_full, slen, lenfinal;
-    SSL_SESSION *sess;
     unsigned int hlen;
     SSL_CTX *tctx = s->session_ctx;
     unsigned char iv[EVP_MAX_IV_LENGTH];
     unsigned char key_name[TLSEXT_KEYNAME_LENGTH];
-    int iv_len, ok = 0;
+    int iv_len, ret, ok = 0;
     size_t macoffset, macendoffset;
 
     /* get session encoding length */
@@ -3873,87 +4115,48 @@ static int construct_stateless_ticket(SSL *s, WPACKET *pkt, uint32_t age_add,
     }
 
     p = senc;
-    if (!i2d_SSL_SESSION(s->session, &p)) {
+    if ((slen = i2d_SSL_SESSION(s->session, &p)) != slen_full) {
         SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
                  ERR_R_INTERNAL_ERROR);
         goto err;
     }
 
     /*
-     * create a fresh copy (not shared with other threads) to clean up
+     * Initialize HMAC and cipher contexts. If callback present it does
+     * all the work otherwise use the current key of the ticket key ring.
      */
-    const_p = senc;
-    sess = d2i_SSL_SESSION(NULL, &const_p, slen_full);
-    if (sess == NULL) {
+    if (tctx->ext.ticket_key_cb != NULL) {
+        ret = tctx->ext.ticket_key_cb(s, key_name, iv, ctx, hctx, 1);
+    } else if (RAND_bytes(iv, EVP_CIPHER_iv_length(EVP_aes_256_cbc())) <= 0) {
         SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
                  ERR_R_INTERNAL_ERROR);
         goto err;
+    } else {
+        ret = tls_ticket_key_init(tctx, key_name, iv, ctx, hctx, 1);
     }
 
-    slen = i2d_SSL_SESSION(sess, NULL);
-    if (slen == 0 || slen > slen_full) {
-        /* shouldn't ever happen */
-        SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
-                 ERR_R_INTERNAL_ERROR);
-        SSL_SESSION_free(sess);
-        goto err;
-    }
-    p = senc;
-    if (!i2d_SSL_SESSION(sess, &p)) {
-        SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
-                 ERR_R_INTERNAL_ERROR);
-        SSL_SESSION_free(sess);
-        goto err;
-    }
-    SSL_SESSION_free(sess);
-
-    /*
-     * Initialize HMAC and cipher contexts. If callback present it does
-     * all the work otherwise use generated values from parent ctx.
-     */
-    if (tctx->ext.ticket_key_cb) {
-        /* if 0 is returned, write an empty ticket */
-        int ret = tctx->ext.ticket_key_cb(s, key_name, iv, ctx,
-                                             hctx, 1);
-
-        if (ret == 0) {
-
-            /* Put timeout and length */
-            if (!WPACKET_put_bytes_u32(pkt, 0)
-                    || !WPACKET_put_bytes_u16(pkt, 0)) {
-                SSLfatal(s, SSL_AD_INTERNAL_ERROR,
-                         SSL_F_CONSTRUCT_STATELESS_TICKET,
-                         ERR_R_INTERNAL_ERROR);
-                goto err;
-            }
-            OPENSSL_free(senc);
-            EVP_CIPHER_CTX_free(ctx);
-            HMAC_CTX_free(hctx);
-            return 1;
-        }
-        if (ret < 0) {
-            SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
-                     SSL_R_CALLBACK_FAILED);
-            goto err;
-        }
-        iv_len = EVP_CIPHER_CTX_iv_length(ctx);
-    } else {
-        const EVP_CIPHER *cipher = EVP_aes_256_cbc();
-
-        iv_len = EVP_CIPHER_iv_length(cipher);
-        if (RAND_bytes(iv, iv_len) <= 0
-                || !EVP_EncryptInit_ex(ctx, cipher, NULL,
-                                       tctx->ext.secure->tick_aes_key, iv)
-                || !HMAC_Init_ex(hctx, tctx->ext.secure->tick_hmac_key,
-                                 sizeof(tctx->ext.secure->tick_hmac_key),
-                                 EVP_sha256(), NULL)) {
-            SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
+    /* if 0 is returned, write an empty ticket */
+    if (ret == 0) {
+        /* Put timeout and length */
+        if (!WPACKET_put_bytes_u32(pkt, 0)
+                || !WPACKET_put_bytes_u16(pkt, 0)) {
+            SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                     SSL_F_CONSTRUCT_STATELESS_TICKET,
                      ERR_R_INTERNAL_ERROR);
             goto err;
         }
-        memcpy(key_name, tctx->ext.tick_key_name,
-               sizeof(tctx->ext.tick_key_name));
+        OPENSSL_free(senc);
+        EVP_CIPHER_CTX_free(ctx);
+        HMAC_CTX_free(hctx);
+        return 1;
+    }
+    if (ret < 0) {
+        SSLfatal(s, SSL_AD_INTERNAL_ERROR, SSL_F_CONSTRUCT_STATELESS_TICKET,
+                 tctx->ext.ticket_key_cb != NULL ? SSL_R_CALLBACK_FAILED
+                                                 : ERR_R_INTERNAL_ERROR);
+        goto err;
     }
+    iv_len = EVP_CIPHER_CTX_iv_length(ctx);
 
     if (!create_ticket_prequel(s, pkt, age_add, tick_nonce)) {
         /* SSLfatal() already called */
@@ -4053,9 +4256,11 @@ int tls_construct_new_session_ticket(SSL *s, WPACKET *pkt)
         /*
          * If we already sent one NewSessionTicket, or we resumed then
          * s->session may already be in a cache and so we must not modify it.
-         * Instead we need to take a copy of it and modify that.
+         * Instead we need to take a copy of it and modify that.  If nothing
+         * else holds a reference to it, as with a batch of stateless tickets
+         * and no cache, it can be reused for the next ticket as it is.
          */
-        if (s->sent_tickets != 0 || s->hit) {
+        if ((s->sent_tickets != 0 || s->hit) && s->session->references > 1) {
             SSL_SESSION *new_sess = ssl_session_dup(s->session, 0);
 
             if (new_sess == NULL) {
@@ -4118,14 +4323,13 @@ int tls_construct_new_session_ticket(SSL *s, WPACKET *pkt)
         goto err;
 
     /*
-     * If we are using anti-replay protection then we behave as if
-     * SSL_OP_NO_TICKET is set - we are caching tickets anyway so there
-     * is no point in using full stateless tickets.
+     * If we are using the session cache for anti-replay protection then we
+     * behave as if SSL_OP_NO_TICKET is set - we are caching tickets anyway so
+     * there is no point in using full stateless tickets.
      */
     if (SSL_IS_TLS13(s)
             && ((s->options & SSL_OP_NO_TICKET) != 0
-                || (s->max_early_data > 0
-                    && (s->options & SSL_OP_NO_ANTI_REPLAY) == 0))) {
+                || SSL_USE_REPLAY_CACHE(s))) {
         if (!construct_stateful_ticket(s, pkt, age_add_u.age_add, tick_nonce)) {
             /* SSLfatal() already called */
             goto err;
@@ -13,6 +13,7 @@
 #include <openssl/evp.h>
 #include <openssl/hmac.h>
 #include <openssl/ocsp.h>
+#include <openssl/rand.h>
 #include <openssl/conf.h>
 #include <openssl/x509v3.h>
 #include <openssl/dh.h>
@@ -865,12 +866,52 @@ static const uint16_t tls_default_sigalg[] = {
     0, /* SSL_PKEY_ED448 */
 };
 
+/*
+ * Open addressed hash table of sigalg_lookup_tbl by code point, built by
+ * tls1_build_sigalg_index() when the library is initialised.  Each slot holds
+ * one plus the index of an entry, or 0 if it is free.  The hash has no
+ * collisions for the code points we know.
+ */
+#define SIGALG_INDEX_SIZE       64
+#define SIGALG_HASH(sigalg) \
+    ((((sigalg) >> 8) * 3 + (sigalg)) & (SIGALG_INDEX_SIZE - 1))
+
+static unsigned char sigalg_index[SIGALG_INDEX_SIZE];
+static int sigalg_index_built = 0;
+
+void tls1_build_sigalg_index(void)
+{
+    size_t i, h;
+
+    /* Without a free slot a lookup would not end, use the table instead */
+    if (sigalg_index_built
+            || OSSL_NELEM(sigalg_lookup_tbl) >= SIGALG_INDEX_SIZE)
+        return;
+    for (i = 0; i < OSSL_NELEM(sigalg_lookup_tbl); i++) {
+        h = SIGALG_HASH(sigalg_lookup_tbl[i].sigalg);
+        while (sigalg_index[h] != 0)
+            h = (h + 1) & (SIGALG_INDEX_SIZE - 1);
+        sigalg_index[h] = (unsigned char)(i + 1);
+    }
+    sigalg_index_built = 1;
+}
+
 /* Lookup TLS signature algorithm */
 static const SIGALG_LOOKUP *tls1_lookup_sigalg(uint16_t sigalg)
 {
     size_t i;
     const SIGALG_LOOKUP *s;
 
+    if (sigalg_index_built) {
+        for (i = SIGALG_HASH(sigalg); sigalg_index[i] != 0;
+             i = (i + 1) & (SIGALG_INDEX_SIZE - 1)) {
+            s = &sigalg_lookup_tbl[sigalg_index[i] - 1];
+            if (s->sigalg == sigalg)
+                return s;
+        }
+        return NULL;
+    }
+
     for (i = 0, s = sigalg_lookup_tbl; i < OSSL_NELEM(sigalg_lookup_tbl);
          i++, s++) {
         if (s->sigalg == sigalg)
@@ -1366,6 +1407,261 @@ SSL_TICKET_STATUS tls_get_ticket_from_client(SSL *s, CLIENTHELLO_MSG *hello,
                               hello->session_id, hello->session_id_len, ret);
 }
 
+void tls_ticket_key_free(SSL_TICKET_KEY *key)
+{
+    if (key == NULL)
+        return;
+    EVP_CIPHER_CTX_free(key->enc_ctx);
+    EVP_CIPHER_CTX_free(key->dec_ctx);
+    HMAC_CTX_free(key->hctx);
+    OPENSSL_secure_clear_free(key, sizeof(*key));
+}
+
+/*
+ * Make a ticket key from |keys|: the name, the HMAC key and the AES key, as
+ * for SSL_CTX_set_tlsext_ticket_keys().
+ */
+static SSL_TICKET_KEY *ticket_key_new(const unsigned char *keys, int flags)
+{
+    SSL_TICKET_KEY *key = OPENSSL_secure_zalloc(sizeof(*key));
+
+    if (key == NULL) {
+        SSLerr(0, ERR_R_MALLOC_FAILURE);
+        return NULL;
+    }
+    memcpy(key->name, keys, sizeof(key->name));
+    keys += sizeof(key->name);
+    memcpy(key->hmac_key, keys, sizeof(key->hmac_key));
+    keys += sizeof(key->hmac_key);
+    memcpy(key->aes_key, keys, sizeof(key->aes_key));
+    key->flags = flags;
+
+    if ((key->enc_ctx = EVP_CIPHER_CTX_new()) == NULL
+            || (key->dec_ctx = EVP_CIPHER_CTX_new()) == NULL
+            || (key->hctx = HMAC_CTX_new()) == NULL) {
+        SSLerr(0, ERR_R_MALLOC_FAILURE);
+        goto err;
+    }
+    /* The IV is set for each ticket */
+    if (EVP_EncryptInit_ex(key->enc_ctx, EVP_aes_256_cbc(), NULL,
+                           key->aes_key, NULL) <= 0
+            || EVP_DecryptInit_ex(key->dec_ctx, EVP_aes_256_cbc(), NULL,
+                                  key->aes_key, NULL) <= 0
+            || HMAC_Init_ex(key->hctx, key->hmac_key, sizeof(key->hmac_key),
+                            EVP_sha256(), NULL) <= 0) {
+        SSLerr(0, ERR_R_INTERNAL_ERROR);
+        goto err;
+    }
+    return key;
+
+ err:
+    tls_ticket_key_free(key);
+    return NULL;
+}
+
+static int ticket_key_find(STACK_OF(SSL_TICKET_KEY) *keys,
+                           const unsigned char *name)
+{
+    int i;
+
+    for (i = 0; i < sk_SSL_TICKET_KEY_num(keys); i++)
+        if (memcmp(sk_SSL_TICKET_KEY_value(keys, i)->name, name,
+                   TLSEXT_KEYNAME_LENGTH) == 0)
+            return i;
+    return -1;
+}
+
+/* The newest key that encrypts new tickets, or NULL */
+static SSL_TICKET_KEY *ticket_key_current(STACK_OF(SSL_TICKET_KEY) *keys)
+{
+    SSL_TICKET_KEY *key;
+    int i;
+
+    for (i = sk_SSL_TICKET_KEY_num(keys) - 1; i >= 0; i--) {
+        key = sk_SSL_TICKET_KEY_value(keys, i);
+        if ((key->flags & SSL_TICKET_KEY_DECRYPT_ONLY) == 0)
+            return key;
+    }
+    return NULL;
+}
+
+/*
+ * Set up |ctx| and |hctx| for a ticket with a key from the ring of |tctx|,
+ * the way the ticket key callback does.  For encryption (|enc| = 1) the
+ * current key is used and its name is copied to |name|, for decryption the
+ * key called |name|.  Returns 1 on success, 2 if the ticket should be
+ * renewed because its key is decrypt-only, 0 if there is no such key or -1
+ * on error.
+ */
+int tls_ticket_key_init(SSL_CTX *tctx, unsigned char *name,
+                        const unsigned char *iv, EVP_CIPHER_CTX *ctx,
+                        HMAC_CTX *hctx, int enc)
+{
+    SSL_TICKET_KEY *key = NULL;
+    int idx, ret = -1;
+
+    if (!CRYPTO_THREAD_read_lock(tctx->lock))
+        return -1;
+    if (enc) {
+        key = ticket_key_current(tctx->ext.tick_keys);
+    } else if ((idx = ticket_key_find(tctx->ext.tick_keys, name)) >= 0) {
+        key = sk_SSL_TICKET_KEY_value(tctx->ext.tick_keys, idx);
+    }
+    if (key == NULL) {
+        ret = 0;
+        goto end;
+    }
+    /* Copying keyed contexts saves the key schedule and the HMAC pads */
+    if (!EVP_CIPHER_CTX_copy(ctx, enc ? key->enc_ctx : key->dec_ctx)
+            || EVP_CipherInit_ex(ctx, NULL, NULL, NULL, iv, enc) <= 0
+            || !HMAC_CTX_copy(hctx, key->hctx))
+        goto end;
+    if (enc)
+        memcpy(name, key->name, sizeof(key->name));
+    ret = (key->flags & SSL_TICKET_KEY_DECRYPT_ONLY) != 0 ? 2 : 1;
+
+ end:
+    CRYPTO_THREAD_unlock(tctx->lock);
+    return ret;
+}
+
+/*
+ * SSL_CTX_set_tlsext_ticket_keys() replaces the whole ring with one key,
+ * SSL_CTX_get_tlsext_ticket_keys() gets the current key.
+ */
+int tls_ticket_keys_ctrl(SSL_CTX *ctx, unsigned char *keys, long len, int set)
+{
+    STACK_OF(SSL_TICKET_KEY) *old = NULL;
+    SSL_TICKET_KEY *key = NULL;
+    int ret = 0;
+
+    if (len != sizeof(key->name) + sizeof(key->hmac_key)
+               + sizeof(key->aes_key)) {
+        SSLerr(SSL_F_SSL3_CTX_CTRL, SSL_R_INVALID_TICKET_KEYS_LENGTH);
+        return 0;
+    }
+    if (set) {
+        STACK_OF(SSL_TICKET_KEY) *new = sk_SSL_TICKET_KEY_new_null();
+
+        if (new == NULL || (key = ticket_key_new(keys, 0)) == NULL
+                || !sk_SSL_TICKET_KEY_push(new, key)) {
+            SSLerr(SSL_F_SSL3_CTX_CTRL, ERR_R_MALLOC_FAILURE);
+            tls_ticket_key_free(key);
+            sk_SSL_TICKET_KEY_free(new);
+            return 0;
+        }
+        if (!CRYPTO_THREAD_write_lock(ctx->lock)) {
+            sk_SSL_TICKET_KEY_pop_free(new, tls_ticket_key_free);
+            return 0;
+        }
+        old = ctx->ext.tick_keys;
+        ctx->ext.tick_keys = new;
+        CRYPTO_THREAD_unlock(ctx->lock);
+        sk_SSL_TICKET_KEY_pop_free(old, tls_ticket_key_free);
+        return 1;
+    }
+
+    if (!CRYPTO_THREAD_read_lock(ctx->lock))
+        return 0;
+    if ((key = ticket_key_current(ctx->ext.tick_keys)) != NULL) {
+        memcpy(keys, key->name, sizeof(key->name));
+        keys += sizeof(key->name);
+        memcpy(keys, key->hmac_key, sizeof(key->hmac_key));
+        keys += sizeof(key->hmac_key);
+        memcpy(keys, key->aes_key, sizeof(key->aes_key));
+        ret = 1;
+    }
+    CRYPTO_THREAD_unlock(ctx->lock);
+    return ret;
+}
+
+int SSL_CTX_add_ticket_key(SSL_CTX *ctx, const unsigned char *keys,
+                           size_t keylen, int flags)
+{
+    SSL_TICKET_KEY *key = NULL, *old = NULL;
+    int idx;
+
+    if (keylen != sizeof(key->name) + sizeof(key->hmac_key)
+                  + sizeof(key->aes_key)) {
+        SSLerr(0, SSL_R_INVALID_TICKET_KEYS_LENGTH);
+        return 0;
+    }
+    if ((key = ticket_key_new(keys, flags)) == NULL)
+        return 0;
+
+    if (!CRYPTO_THREAD_write_lock(ctx->lock)) {
+        tls_ticket_key_free(key);
+        return 0;
+    }
+    if (!sk_SSL_TICKET_KEY_reserve(ctx->ext.tick_keys, 1)) {
+        CRYPTO_THREAD_unlock(ctx->lock);
+        SSLerr(0, ERR_R_MALLOC_FAILURE);
+        tls_ticket_key_free(key);
+        return 0;
+    }
+    /* A key with the same name is replaced */
+    if ((idx = ticket_key_find(ctx->ext.tick_keys, key->name)) >= 0)
+        old = sk_SSL_TICKET_KEY_delete(ctx->ext.tick_keys, idx);
+    sk_SSL_TICKET_KEY_push(ctx->ext.tick_keys, key);
+    CRYPTO_THREAD_unlock(ctx->lock);
+    tls_ticket_key_free(old);
+    return 1;
+}
+
+int SSL_CTX_remove_ticket_key(SSL_CTX *ctx, const unsigned char *name,
+                              size_t namelen)
+{
+    SSL_TICKET_KEY *key = NULL;
+    int idx;
+
+    if (namelen != TLSEXT_KEYNAME_LENGTH)
+        return 0;
+    if (!CRYPTO_THREAD_write_lock(ctx->lock))
+        return 0;
+    if ((idx = ticket_key_find(ctx->ext.tick_keys, name)) >= 0)
+        key = sk_SSL_TICKET_KEY_delete(ctx->ext.tick_keys, idx);
+    CRYPTO_THREAD_unlock(ctx->lock);
+    tls_ticket_key_free(key);
+    return key != NULL;
+}
+
+int SSL_CTX_rotate_ticket_keys(SSL_CTX *ctx, size_t max_keys)
+{
+    SSL_TICKET_KEY *key;
+    unsigned char keys[TLSEXT_KEYNAME_LENGTH + 2 * TLSEXT_TICK_KEY_LENGTH];
+    int i;
+
+    if (RAND_bytes(keys, TLSEXT_KEYNAME_LENGTH) <= 0
+            || RAND_priv_bytes(keys + TLSEXT_KEYNAME_LENGTH,
+                               sizeof(keys) - TLSEXT_KEYNAME_LENGTH) <= 0) {
+        OPENSSL_cleanse(keys, sizeof(keys));
+        return 0;
+    }
+    key = ticket_key_new(keys, 0);
+    OPENSSL_cleanse(keys, sizeof(keys));
+    if (key == NULL)
+        return 0;
+
+    if (!CRYPTO_THREAD_write_lock(ctx->lock)) {
+        tls_ticket_key_free(key);
+        return 0;
+    }
+    if (!sk_SSL_TICKET_KEY_push(ctx->ext.tick_keys, key)) {
+        CRYPTO_THREAD_unlock(ctx->lock);
+        SSLerr(0, ERR_R_MALLOC_FAILURE);
+        tls_ticket_key_free(key);
+        return 0;
+    }
+    for (i = 0; i < sk_SSL_TICKET_KEY_num(ctx->ext.tick_keys) - 1; i++)
+        sk_SSL_TICKET_KEY_value(ctx->ext.tick_keys, i)->flags
+            |= SSL_TICKET_KEY_DECRYPT_ONLY;
+    while (max_keys > 0
+           && (size_t)sk_SSL_TICKET_KEY_num(ctx->ext.tick_keys) > max_keys)
+        tls_ticket_key_free(sk_SSL_TICKET_KEY_shift(ctx->ext.tick_keys));
+    CRYPTO_THREAD_unlock(ctx->lock);
+    return 1;
+}
+
 /*-
  * tls_decrypt_ticket attempts to decrypt a session ticket.
  *
@@ -1456,22 +1752,20 @@ SSL_TICKET_STATUS tls_decrypt_ticket(SSL *s, const unsigned char *etick,
         if (rv == 2)
             renew_ticket = 1;
     } else {
-        /* Check key name matches */
-        if (memcmp(etick, tctx->ext.tick_key_name,
-                   TLSEXT_KEYNAME_LENGTH) != 0) {
-            ret = SSL_TICKET_NO_DECRYPT;
+        /* Look the key name up in the ring */
+        int rv = tls_ticket_key_init(tctx, (unsigned char *)etick,
+                                     etick + TLSEXT_KEYNAME_LENGTH,
+                                     ctx, hctx, 0);
+        if (rv < 0) {
+            ret = SSL_TICKET_FATAL_ERR_OTHER;
             goto end;
         }
-        if (HMAC_Init_ex(hctx, tctx->ext.secure->tick_hmac_key,
-                         sizeof(tctx->ext.secure->tick_hmac_key),
-                         EVP_sha256(), NULL) <= 0
-            || EVP_DecryptInit_ex(ctx, EVP_aes_256_cbc(), NULL,
-                                  tctx->ext.secure->tick_aes_key,
-                                  etick + TLSEXT_KEYNAME_LENGTH) <= 0) {
-            ret = SSL_TICKET_FATAL_ERR_OTHER;
+        if (rv == 0) {
+            ret = SSL_TICKET_NO_DECRYPT;
             goto end;
         }
-        if (SSL_IS_TLS13(s))
+        /* Tickets under a decrypt-only key are replaced */
+        if (rv == 2 || SSL_IS_TLS13(s))
             renew_ticket = 1;
     }
     /*
@@ -467,9 +467,9 @@ int tls13_change_cipher_state(SSL *s, int which)
     if (((which & SSL3_CC_CLIENT) && (which & SSL3_CC_WRITE))
             || ((which & SSL3_CC_SERVER) && (which & SSL3_CC_READ))) {
         if (which & SSL3_CC_EARLY) {
-            EVP_MD_CTX *mdctx = NULL;
-            long handlen;
-            void *hdata;
+            EVP_MD_CTX *mdctx = NULL, *specdgst = NULL;
+            long handlen = 0;
+            void *hdata = NULL;
             unsigned int hashlenui;
             const SSL_CIPHER *sslcipher = SSL_SESSION_get0_cipher(s->session);
 
@@ -478,12 +478,15 @@ int tls13_change_cipher_state(SSL *s, int which)
             labellen = sizeof(client_early_traffic) - 1;
             log_label = CLIENT_EARLY_LABEL;
 
-            handlen = BIO_get_mem_data(s->s3.handshake_buffer, &hdata);
-            if (handlen <= 0) {
-                SSLfatal(s, SSL_AD_INTERNAL_ERROR,
-                         SSL_F_TLS13_CHANGE_CIPHER_STATE,
-                         SSL_R_BAD_HANDSHAKE_LENGTH);
-                goto err;
+            /* A server may have hashed the ClientHello already */
+            if (s->s3.handshake_buffer != NULL) {
+                handlen = BIO_get_mem_data(s->s3.handshake_buffer, &hdata);
+                if (handlen <= 0) {
+                    SSLfatal(s, SSL_AD_INTERNAL_ERROR,
+                             SSL_F_TLS13_CHANGE_CIPHER_STATE,
+                             SSL_R_BAD_HANDSHAKE_LENGTH);
+                    goto err;
+                }
             }
 
             if (s->early_data_state == SSL_EARLY_DATA_CONNECTING
@@ -523,8 +526,15 @@ int tls13_change_cipher_state(SSL *s, int which)
             }
             cipher = EVP_get_cipherbynid(SSL_CIPHER_get_cipher_nid(sslcipher));
             md = ssl_md(sslcipher->algorithm2);
-            if (md == NULL || !EVP_DigestInit_ex(mdctx, md, NULL)
-                    || !EVP_DigestUpdate(mdctx, hdata, handlen)
+            if (hdata == NULL)
+                specdgst = ssl3_speculative_digest(s, md);
+            if (md == NULL
+                    || (hdata != NULL
+                        && (!EVP_DigestInit_ex(mdctx, md, NULL)
+                            || !EVP_DigestUpdate(mdctx, hdata, handlen)))
+                    || (hdata == NULL
+                        && (specdgst == NULL
+                            || !EVP_MD_CTX_copy_ex(mdctx, specdgst)))
                     || !EVP_DigestFinal_ex(mdctx, hashval, &hashlenui)) {
                 SSLfatal(s, SSL_AD_INTERNAL_ERROR,
                          SSL_F_TLS13_CHANGE_CIPHER_STATE, ERR_R_INTERNAL_ERROR);
@@ -0,0 +1,407 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+#include <string.h>
+#include <openssl/e_os2.h>
+#if defined(OPENSSL_SYS_UNIX) && defined(OPENSSL_THREADS)
+# define TEST_OFFLOAD
+# include <sys/select.h>
+#endif
+#include <openssl/async.h>
+#include <openssl/engine.h>
+#include <openssl/rsa.h>
+#include <openssl/ec.h>
+#include <openssl/bn.h>
+#include <openssl/err.h>
+#include "testutil.h"
+
+#define NUM_JOBS    4
+
+static ENGINE *e = NULL;
+static RSA *rsa = NULL;
+
+static const unsigned char msg[20] = "batched message hash";
+
+typedef struct {
+    unsigned char sig[512];
+    int siglen;
+} JOB_RESULT;
+
+static int rsa_sign_job(void *arg)
+{
+    JOB_RESULT *res = *(JOB_RESULT **)arg;
+
+    res->siglen = RSA_private_encrypt(sizeof(msg), msg, res->sig, rsa,
+                                      RSA_PKCS1_PADDING);
+    return res->siglen > 0;
+}
+
+static int check_rsa_result(const JOB_RESULT *res)
+{
+    unsigned char buf[512];
+    int len;
+
+    len = RSA_public_decrypt(res->siglen, res->sig, buf, rsa,
+                             RSA_PKCS1_PADDING);
+    return TEST_mem_eq(buf, len, msg, sizeof(msg));
+}
+
+/* A signature of too much data, which must fail with the RSA error */
+static int rsa_bad_sign_job(void *arg)
+{
+    JOB_RESULT *res = *(JOB_RESULT **)arg;
+    unsigned char big[512] = { 0 };
+
+    ERR_clear_error();
+    res->siglen = RSA_private_encrypt(RSA_size(rsa), big, res->sig, rsa,
+                                      RSA_PKCS1_PADDING);
+    return res->siglen < 0
+        && ERR_GET_REASON(ERR_peek_last_error())
+           == RSA_R_DATA_TOO_LARGE_FOR_KEY_SIZE;
+}
+
+static int start_job(ASYNC_JOB **job, ASYNC_WAIT_CTX *waitctx, int *ret,
+                     int (*func)(void *), JOB_RESULT *res)
+{
+    return ASYNC_start_job(job, waitctx, ret, func, &res, sizeof(res));
+}
+
+/*
+ * The first NUM_JOBS - 1 jobs must pause, and the last one must run the
+ * whole batch.
+ */
+static int test_batch_full(void)
+{
+    ASYNC_JOB *job[NUM_JOBS] = { NULL };
+    ASYNC_WAIT_CTX *waitctx[NUM_JOBS] = { NULL };
+    JOB_RESULT res[NUM_JOBS];
+    int ret[NUM_JOBS];
+    int i, testresult = 0;
+
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "BATCH_SIZE", NUM_JOBS, NULL, NULL, 0))
+        || !TEST_true(ENGINE_ctrl_cmd(e, "LATENCY_US", 60 * 1000000L, NULL,
+                                      NULL, 0)))
+        return 0;
+
+    for (i = 0; i < NUM_JOBS; i++) {
+        if (!TEST_ptr(waitctx[i] = ASYNC_WAIT_CTX_new()))
+            goto err;
+        if (!TEST_int_eq(start_job(&job[i], waitctx[i], &ret[i], rsa_sign_job,
+                                   &res[i]),
+                         i < NUM_JOBS - 1 ? ASYNC_PAUSE : ASYNC_FINISH))
+            goto err;
+    }
+    if (!TEST_int_eq(ret[NUM_JOBS - 1], 1)
+        || !check_rsa_result(&res[NUM_JOBS - 1]))
+        goto err;
+
+    for (i = 0; i < NUM_JOBS - 1; i++) {
+        if (!TEST_int_eq(start_job(&job[i], waitctx[i], &ret[i], rsa_sign_job,
+                                   &res[i]), ASYNC_FINISH)
+            || !TEST_int_eq(ret[i], 1)
+            || !check_rsa_result(&res[i]))
+            goto err;
+    }
+    testresult = 1;
+
+ err:
+    for (i = 0; i < NUM_JOBS; i++)
+        ASYNC_WAIT_CTX_free(waitctx[i]);
+    return testresult;
+}
+
+/* A lone job must be flushed once the latency budget is exhausted */
+static int test_batch_deadline(void)
+{
+    ASYNC_JOB *job = NULL;
+    ASYNC_WAIT_CTX *waitctx = NULL;
+    JOB_RESULT res;
+    OSSL_ASYNC_FD fd;
+    size_t numfds;
+    int ret = 0, status, tries = 0, testresult = 0;
+
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "BATCH_SIZE", 64, NULL, NULL, 0))
+        || !TEST_true(ENGINE_ctrl_cmd(e, "LATENCY_US", 1000, NULL, NULL, 0))
+        || !TEST_ptr(waitctx = ASYNC_WAIT_CTX_new()))
+        goto err;
+
+    status = start_job(&job, waitctx, &ret, rsa_sign_job, &res);
+    if (!TEST_int_eq(status, ASYNC_PAUSE)
+        || !TEST_true(ASYNC_WAIT_CTX_get_all_fds(waitctx, NULL, &numfds))
+        || !TEST_size_t_eq(numfds, 1)
+        || !TEST_true(ASYNC_WAIT_CTX_get_all_fds(waitctx, &fd, &numfds)))
+        goto err;
+
+#ifdef TEST_OFFLOAD
+    /* The timer makes the fd readable once, when the deadline has passed */
+    while (status == ASYNC_PAUSE && tries++ < 10) {
+        fd_set fds;
+
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (!TEST_int_gt(select(fd + 1, &fds, NULL, NULL, NULL), 0))
+            goto err;
+        status = start_job(&job, waitctx, &ret, rsa_sign_job, &res);
+    }
+    if (!TEST_int_eq(tries, 1))
+        goto err;
+#else
+    while (status == ASYNC_PAUSE && tries++ < 10000000)
+        status = start_job(&job, waitctx, &ret, rsa_sign_job, &res);
+#endif
+    if (!TEST_int_eq(status, ASYNC_FINISH)
+        || !TEST_int_eq(ret, 1)
+        || !check_rsa_result(&res))
+        goto err;
+    testresult = 1;
+
+ err:
+    ASYNC_WAIT_CTX_free(waitctx);
+    return testresult;
+}
+
+/* Outside of an async job operations are executed directly */
+static int test_batch_sync(void)
+{
+    JOB_RESULT res, *pres = &res;
+
+    return TEST_true(ENGINE_ctrl_cmd(e, "BATCH_SIZE", 64, NULL, NULL, 0))
+        && TEST_true(rsa_sign_job(&pres))
+        && check_rsa_result(&res);
+}
+
+static int test_batch_ctrl(void)
+{
+    return TEST_false(ENGINE_ctrl_cmd(e, "BATCH_SIZE", 0, NULL, NULL, 0))
+        && TEST_false(ENGINE_ctrl_cmd(e, "LATENCY_US", -1, NULL, NULL, 0))
+        && TEST_false(ENGINE_ctrl_cmd(e, "THREADS", -1, NULL, NULL, 0));
+}
+
+#ifdef TEST_OFFLOAD
+/*
+ * With worker threads every job pauses, and is resumed once its wait fd
+ * becomes readable.
+ */
+static int test_batch_offload(void)
+{
+    ASYNC_JOB *job[NUM_JOBS] = { NULL };
+    ASYNC_WAIT_CTX *waitctx[NUM_JOBS] = { NULL };
+    JOB_RESULT res[NUM_JOBS];
+    int ret[NUM_JOBS];
+    int i, running = 0, testresult = 0;
+
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "BATCH_SIZE", 2, NULL, NULL, 0))
+        || !TEST_true(ENGINE_ctrl_cmd(e, "THREADS", 2, NULL, NULL, 0)))
+        goto err;
+
+    for (i = 0; i < NUM_JOBS; i++) {
+        if (!TEST_ptr(waitctx[i] = ASYNC_WAIT_CTX_new())
+            || !TEST_int_eq(start_job(&job[i], waitctx[i], &ret[i],
+                                      rsa_sign_job, &res[i]), ASYNC_PAUSE))
+            goto err;
+        running++;
+    }
+
+    while (running > 0) {
+        fd_set fds;
+        OSSL_ASYNC_FD fd, maxfd = -1;
+        size_t numfds;
+
+        FD_ZERO(&fds);
+        for (i = 0; i < NUM_JOBS; i++) {
+            if (job[i] == NULL)
+                continue;
+            if (!TEST_true(ASYNC_WAIT_CTX_get_all_fds(waitctx[i], NULL,
+                                                      &numfds))
+                || !TEST_size_t_eq(numfds, 1)
+                || !TEST_true(ASYNC_WAIT_CTX_get_all_fds(waitctx[i], &fd,
+                                                         &numfds)))
+                goto err;
+            FD_SET(fd, &fds);
+            if (fd > maxfd)
+                maxfd = fd;
+        }
+        if (!TEST_int_gt(select(maxfd + 1, &fds, NULL, NULL, NULL), 0))
+            goto err;
+        for (i = 0; i < NUM_JOBS; i++) {
+            if (job[i] == NULL)
+                continue;
+            ASYNC_WAIT_CTX_get_all_fds(waitctx[i], &fd, &numfds);
+            if (!FD_ISSET(fd, &fds))
+                continue;
+            if (!TEST_int_eq(start_job(&job[i], waitctx[i], &ret[i],
+                                       rsa_sign_job, &res[i]), ASYNC_FINISH)
+                || !TEST_int_eq(ret[i], 1)
+                || !check_rsa_result(&res[i]))
+                goto err;
+            running--;
+        }
+    }
+    testresult = 1;
+
+ err:
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "THREADS", 0, NULL, NULL, 0)))
+        testresult = 0;
+    for (i = 0; i < NUM_JOBS; i++)
+        ASYNC_WAIT_CTX_free(waitctx[i]);
+    return testresult;
+}
+
+/* The errors of an offloaded operation are raised in the job that made it */
+static int test_batch_offload_error(void)
+{
+    ASYNC_JOB *job = NULL;
+    ASYNC_WAIT_CTX *waitctx = NULL;
+    JOB_RESULT res;
+    fd_set fds;
+    OSSL_ASYNC_FD fd;
+    size_t numfds;
+    int ret = 0, status, testresult = 0;
+
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "THREADS", 1, NULL, NULL, 0))
+        || !TEST_ptr(waitctx = ASYNC_WAIT_CTX_new()))
+        goto err;
+
+    status = start_job(&job, waitctx, &ret, rsa_bad_sign_job, &res);
+    while (status == ASYNC_PAUSE) {
+        if (!TEST_true(ASYNC_WAIT_CTX_get_all_fds(waitctx, &fd, &numfds))
+            || !TEST_size_t_eq(numfds, 1))
+            goto err;
+        FD_ZERO(&fds);
+        FD_SET(fd, &fds);
+        if (!TEST_int_gt(select(fd + 1, &fds, NULL, NULL, NULL), 0))
+            goto err;
+        status = start_job(&job, waitctx, &ret, rsa_bad_sign_job, &res);
+    }
+    if (!TEST_int_eq(status, ASYNC_FINISH)
+        || !TEST_int_eq(ret, 1))
+        goto err;
+    testresult = 1;
+
+ err:
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "THREADS", 0, NULL, NULL, 0)))
+        testresult = 0;
+    ASYNC_WAIT_CTX_free(waitctx);
+    ERR_clear_error();
+    return testresult;
+}
+#endif
+
+#ifndef OPENSSL_NO_EC
+static EC_KEY *eckey = NULL;
+
+static int ecdsa_sign_job(void *arg)
+{
+    JOB_RESULT *res = *(JOB_RESULT **)arg;
+    unsigned int siglen = sizeof(res->sig);
+
+    if (!ECDSA_sign(0, msg, sizeof(msg), res->sig, &siglen, eckey))
+        return 0;
+    res->siglen = (int)siglen;
+    return ECDSA_verify(0, msg, sizeof(msg), res->sig, res->siglen, eckey);
+}
+
+/* The signatures of two jobs share a batch, verification is not batched */
+static int test_batch_ecdsa(void)
+{
+    ASYNC_JOB *job[2] = { NULL };
+    ASYNC_WAIT_CTX *waitctx[2] = { NULL };
+    JOB_RESULT res[2];
+    int ret[2] = { 0, 0 };
+    int status[2], i, testresult = 0;
+
+    if (!TEST_true(ENGINE_ctrl_cmd(e, "BATCH_SIZE", 2, NULL, NULL, 0))
+        || !TEST_true(ENGINE_ctrl_cmd(e, "LATENCY_US", 60 * 1000000L, NULL,
+                                      NULL, 0))
+        || !TEST_ptr(waitctx[0] = ASYNC_WAIT_CTX_new())
+        || !TEST_ptr(waitctx[1] = ASYNC_WAIT_CTX_new()))
+        goto err;
+
+    for (i = 0; i < 2; i++)
+        status[i] = start_job(&job[i], waitctx[i], &ret[i], ecdsa_sign_job,
+                              &res[i]);
+    /* Job 1 ran both signatures and verified its own straight away */
+    if (!TEST_int_eq(status[0], ASYNC_PAUSE)
+        || !TEST_int_eq(status[1], ASYNC_FINISH))
+        goto err;
+    status[0] = start_job(&job[0], waitctx[0], &ret[0], ecdsa_sign_job,
+                          &res[0]);
+    if (!TEST_int_eq(status[0], ASYNC_FINISH)
+        || !TEST_int_eq(ret[0], 1)
+        || !TEST_int_eq(ret[1], 1))
+        goto err;
+    testresult = 1;
+
+ err:
+    ASYNC_WAIT_CTX_free(waitctx[0]);
+    ASYNC_WAIT_CTX_free(waitctx[1]);
+    return testresult;
+}
+#endif
+
+int setup_tests(void)
+{
+    BIGNUM *bn = NULL;
+#ifndef OPENSSL_NO_EC
+    EC_GROUP *group = NULL;
+#endif
+
+    if (!ASYNC_is_capable()) {
+        TEST_note("Async not supported, skipping batch engine tests");
+        return 1;
+    }
+    ENGINE_load_builtin_engines();
+    if (!TEST_ptr(e = ENGINE_by_id("batch"))
+        || !TEST_true(ENGINE_init(e))
+        || !TEST_true(ASYNC_init_thread(NUM_JOBS, NUM_JOBS))
+        || !TEST_ptr(bn = BN_new())
+        || !TEST_true(BN_set_word(bn, RSA_F4))
+        || !TEST_ptr(rsa = RSA_new_method(e))
+        || !TEST_true(RSA_generate_key_ex(rsa, 1024, bn, NULL))) {
+        BN_free(bn);
+        return 0;
+    }
+    BN_free(bn);
+#ifndef OPENSSL_NO_EC
+    if (!TEST_ptr(eckey = EC_KEY_new_method(e))
+        || !TEST_ptr(group = EC_GROUP_new_by_curve_name(NID_X9_62_prime256v1))
+        || !TEST_true(EC_KEY_set_group(eckey, group))
+        || !TEST_true(EC_KEY_generate_key(eckey))) {
+        EC_GROUP_free(group);
+        return 0;
+    }
+    EC_GROUP_free(group);
+#endif
+
+    ADD_TEST(test_batch_ctrl);
+    ADD_TEST(test_batch_sync);
+    ADD_TEST(test_batch_full);
+    ADD_TEST(test_batch_deadline);
+#ifdef TEST_OFFLOAD
+    ADD_TEST(test_batch_offload);
+    ADD_TEST(test_batch_offload_error);
+#endif
+#ifndef OPENSSL_NO_EC
+    ADD_TEST(test_batch_ecdsa);
+#endif
+    return 1;
+}
+
+void cleanup_tests(void)
+{
+#ifndef OPENSSL_NO_EC
+    EC_KEY_free(eckey);
+#endif
+    RSA_free(rsa);
+    if (e != NULL) {
+        ENGINE_finish(e);
+        ENGINE_free(e);
+    }
+    ASYNC_cleanup_thread();
+}
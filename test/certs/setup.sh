@@ -358,6 +358,19 @@ REQMASK=MASK:0x800 ./mkcert.sh req badalt7-key "O = Bad NC Test Certificate 7" \
     "email.1 = good@good.org" "email.2 = any@good.com" \
     "IP = 127.0.0.1" "IP = 192.168.0.1"
 
+# Too many names and constraints to compare one by one, but few enough
+# constraints left out of the index (none for DNS, all for URI)
+
+NC=$(for i in $(seq 0 4095); do printf "permitted;DNS:h%d.test, " $i; done)
+NC=${NC%, } ./mkcert.sh genca "Test NC index CA" ncca1-key \
+    many-dns-constraints root-key root-cert
+NC=$(for i in $(seq 0 4095); do printf "permitted;URI:h%d.test, " $i; done)
+NC=${NC%, } ./mkcert.sh genca "Test NC index CA" ncca1-key \
+    many-uri-constraints root-key root-cert
+./mkcert.sh req alt1-key "CN = h0.test" | \
+    ./mkcert.sh geneealt alt1-key many-names4 ncca1-key many-dns-constraints \
+    $(for i in $(seq 0 511); do echo "DNS.$i=h$i.test"; done)
+
 # RSA-PSS signatures
 # SHA1
 ./mkcert.sh genee PSS-SHA1 ee-key ee-pss-sha1-cert ca-key ca-cert \
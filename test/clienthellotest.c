@@ -1,5 +1,5 @@
 /*
- * Copyright 2015-2018 The OpenSSL Project Authors. All Rights Reserved.
+ * Copyright 2015-2019 The OpenSSL Project Authors. All Rights Reserved.
  *
  * Licensed under the Apache License 2.0 (the "License").  You may not use
  * this file except in compliance with the License.  You can obtain a copy
@@ -7,6 +7,7 @@
  * https://www.openssl.org/source/license.html
  */
 
+#include <stdlib.h>
 #include <string.h>
 
 #include <openssl/opensslconf.h>
@@ -44,6 +45,9 @@
 #define F5_WORKAROUND_MAX_MSG_LEN   0x200
 
 static const char *sessionfile = NULL;
+static const char *certfile = NULL;
+/* The number of ClientHellos test_client_hello_processing() processes */
+static int hello_count = 1000;
 /* Dummy ALPN protocols used to pad out the size of the ClientHello */
 static const char alpn_prots[] =
     "0123456789012345678901234567890123456789012345678901234567890123456789"
@@ -245,13 +249,359 @@ end:
     return testresult;
 }
 
-OPT_TEST_DECLARE_USAGE("sessionfile\n")
+/*
+ * Have a client with |cctx| write its ClientHello, which is copied to |*hello|.
+ * The server name is sent if |servername| is not NULL.  Returns the length of
+ * the ClientHello or 0 on error.
+ */
+static long get_client_hello(SSL_CTX *cctx, const char *servername,
+                             unsigned char **hello)
+{
+    SSL *con = NULL;
+    BIO *rbio = NULL, *wbio = NULL;
+    char *data;
+    long len = 0;
+
+    if (!TEST_ptr(con = SSL_new(cctx))
+            || !TEST_ptr(rbio = BIO_new(BIO_s_mem()))
+            || !TEST_ptr(wbio = BIO_new(BIO_s_mem()))
+            || (servername != NULL
+                && !TEST_true(SSL_set_tlsext_host_name(con, servername))))
+        goto end;
+    SSL_set_bio(con, rbio, wbio);
+    rbio = wbio = NULL;
+    if (!TEST_int_le(SSL_connect(con), 0)
+            || !TEST_long_gt(len = BIO_get_mem_data(SSL_get_wbio(con), &data),
+                             0)
+            || !TEST_ptr(*hello = OPENSSL_memdup(data, len)))
+        len = 0;
+
+ end:
+    BIO_free(rbio);
+    BIO_free(wbio);
+    SSL_free(con);
+    return len;
+}
+
+/*
+ * Feed |hello| to a new server connection with |sctx|.  The connection is
+ * returned in |*con| after SSL_accept() was called on it once.
+ */
+static int accept_client_hello(SSL_CTX *sctx, const unsigned char *hello,
+                               long len, SSL **con)
+{
+    BIO *rbio = NULL, *wbio = NULL;
+
+    if (!TEST_ptr(rbio = BIO_new(BIO_s_mem()))
+            || !TEST_ptr(wbio = BIO_new(BIO_s_mem()))
+            || !TEST_ptr(*con = SSL_new(sctx))) {
+        BIO_free(rbio);
+        BIO_free(wbio);
+        return 0;
+    }
+    BIO_set_mem_eof_return(rbio, -1);
+    SSL_set_bio(*con, rbio, wbio);
+    /* With nothing but the ClientHello to read it cannot finish */
+    if (!TEST_int_eq(BIO_write(rbio, hello, (int)len), (int)len)
+            || !TEST_int_le(SSL_accept(*con), 0))
+        return 0;
+    return 1;
+}
+
+/*
+ * Time how long a server takes to process a ClientHello offering every
+ * ciphersuite and signature algorithm we know, as scanners send, and to write
+ * its reply.  RSA key exchange keeps public key operations out of the reply.
+ * Pass a larger count to use this as a benchmark.
+ */
+static int test_client_hello_processing(void)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *con = NULL;
+    const SSL_CIPHER *cipher;
+    unsigned char *hello = NULL;
+    long len;
+    clock_t start;
+    int i, testresult = 0;
+
+#ifdef OPENSSL_NO_TLS1_2
+    return 1;
+#endif
+
+    cctx = SSL_CTX_new(TLS_client_method());
+    if (!TEST_ptr(cctx)
+            || !TEST_true(SSL_CTX_set_cipher_list(cctx,
+                                                  "ALL:COMPLEMENTOFALL"))
+            || !TEST_long_gt(len = get_client_hello(cctx, NULL, &hello), 0))
+        goto end;
+
+    sctx = SSL_CTX_new(TLS_server_method());
+    if (!TEST_ptr(sctx)
+            || !TEST_true(SSL_CTX_set_max_proto_version(sctx, TLS1_2_VERSION))
+            || !TEST_true(SSL_CTX_set_cipher_list(sctx, "kRSA"))
+            || !TEST_int_eq(SSL_CTX_use_certificate_file(sctx, certfile,
+                                                         SSL_FILETYPE_PEM), 1)
+            || !TEST_int_eq(SSL_CTX_use_PrivateKey_file(sctx, certfile,
+                                                        SSL_FILETYPE_PEM), 1))
+        goto end;
+    SSL_CTX_set_options(sctx, SSL_OP_CIPHER_SERVER_PREFERENCE);
+    SSL_CTX_set_mode(sctx, SSL_MODE_NO_AUTO_CHAIN);
+
+    start = clock();
+    for (i = 0; i < hello_count; i++) {
+        if (!accept_client_hello(sctx, hello, len, &con)
+                || !TEST_int_eq(SSL_get_error(con, -1), SSL_ERROR_WANT_READ)
+                || !TEST_ptr(cipher = SSL_get_pending_cipher(con))
+                || !TEST_int_eq(SSL_CIPHER_get_kx_nid(cipher), NID_kx_rsa))
+            goto end;
+        SSL_free(con);
+        con = NULL;
+    }
+    TEST_info("Processed %d ClientHellos of %ld bytes in %.3f seconds",
+              hello_count, len, (double)(clock() - start) / CLOCKS_PER_SEC);
+    testresult = 1;
+
+ end:
+    SSL_free(con);
+    SSL_CTX_free(cctx);
+    SSL_CTX_free(sctx);
+    OPENSSL_free(hello);
+    return testresult;
+}
+
+/* What the ClientHello filter and callback saw */
+static struct {
+    int filter_calls, cb_calls;
+    char servername[64];
+    unsigned char alpn[16];
+    size_t alpn_len;
+    unsigned char versions[16];
+    size_t versions_len;
+    size_t groups_len;
+    size_t ciphers_len;
+    int cb_servername_ok;
+} seen;
+
+static int reject_hello = 0;
+
+static size_t copy_field(size_t len, const unsigned char *p,
+                         unsigned char *buf, size_t buflen)
+{
+    if (len > buflen)
+        return 0;
+    if (len > 0)
+        memcpy(buf, p, len);
+    return len;
+}
+
+static int hello_filter(SSL *s, int *al, void *arg)
+{
+    const unsigned char *p = NULL;
+    size_t len;
+
+    seen.filter_calls++;
+    if (reject_hello) {
+        *al = SSL_AD_UNRECOGNIZED_NAME;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
+    len = SSL_client_hello_get0_servername(s, &p);
+    copy_field(len, p, (unsigned char *)seen.servername,
+               sizeof(seen.servername) - 1);
+    len = SSL_client_hello_get0_alpn(s, &p);
+    seen.alpn_len = copy_field(len, p, seen.alpn, sizeof(seen.alpn));
+    len = SSL_client_hello_get0_supported_versions(s, &p);
+    seen.versions_len = copy_field(len, p, seen.versions,
+                                   sizeof(seen.versions));
+    seen.groups_len = SSL_client_hello_get0_key_share_groups(s, NULL);
+    seen.ciphers_len = SSL_client_hello_get0_ciphers(s, NULL);
+    return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+static int hello_cb(SSL *s, int *al, void *arg)
+{
+    const unsigned char *p = NULL;
+    size_t len;
+
+    seen.cb_calls++;
+    if (reject_hello) {
+        *al = SSL_AD_UNRECOGNIZED_NAME;
+        return SSL_CLIENT_HELLO_ERROR;
+    }
+    len = SSL_client_hello_get0_servername(s, &p);
+    seen.cb_servername_ok = len == strlen(seen.servername)
+                            && memcmp(p, seen.servername, len) == 0;
+    return SSL_CLIENT_HELLO_SUCCESS;
+}
+
+static SSL_CTX *make_filter_server_ctx(int filter, int cb)
+{
+    SSL_CTX *sctx = SSL_CTX_new(TLS_server_method());
+
+    if (!TEST_ptr(sctx)
+            || !TEST_int_eq(SSL_CTX_use_certificate_file(sctx, certfile,
+                                                         SSL_FILETYPE_PEM), 1)
+            || !TEST_int_eq(SSL_CTX_use_PrivateKey_file(sctx, certfile,
+                                                        SSL_FILETYPE_PEM), 1)) {
+        SSL_CTX_free(sctx);
+        return NULL;
+    }
+    if (filter)
+        SSL_CTX_set_client_hello_filter(sctx, hello_filter, NULL);
+    if (cb)
+        SSL_CTX_set_client_hello_cb(sctx, hello_cb, NULL);
+    return sctx;
+}
+
+/*
+ * The ClientHello filter sees the fields of the raw ClientHello, the
+ * ClientHello callback sees them too, and rejecting the ClientHello in the
+ * filter, or sending one that the filter cannot be shown, ends the handshake
+ * before the callback runs.
+ */
+static int test_client_hello_filter(void)
+{
+    static const unsigned char alpn[] = { 2, 'h', '2', 8, 'h', 't', 't', 'p',
+                                          '/', '1', '.', '1' };
+    static const unsigned char tls13[] = { 0x03, 0x04 };
+    static const char name[] = "example.com";
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *con = NULL;
+    unsigned char *hello = NULL, *p;
+    long len;
+    int testresult = 0;
+
+#ifdef OPENSSL_NO_TLS1_3
+    return 1;
+#endif
+
+    memset(&seen, 0, sizeof(seen));
+    reject_hello = 0;
+    cctx = SSL_CTX_new(TLS_client_method());
+    if (!TEST_ptr(cctx)
+            || !TEST_int_eq(SSL_CTX_set_alpn_protos(cctx, alpn, sizeof(alpn)),
+                            0)
+            || !TEST_long_gt(len = get_client_hello(cctx, name, &hello), 0)
+            || !TEST_ptr(sctx = make_filter_server_ctx(1, 1))
+            || !accept_client_hello(sctx, hello, len, &con)
+            || !TEST_int_eq(SSL_get_error(con, -1), SSL_ERROR_WANT_READ)
+            || !TEST_int_eq(seen.filter_calls, 1)
+            || !TEST_int_eq(seen.cb_calls, 1)
+            || !TEST_str_eq(seen.servername, "example.com")
+            || !TEST_mem_eq(seen.alpn, seen.alpn_len, alpn, sizeof(alpn))
+            || !TEST_mem_eq(seen.versions, 2, tls13, sizeof(tls13))
+            || !TEST_size_t_eq(seen.groups_len, 2)
+            || !TEST_size_t_gt(seen.ciphers_len, 0)
+            || !TEST_true(seen.cb_servername_ok)
+            /* Outside the callbacks there is nothing to see */
+            || !TEST_size_t_eq(SSL_client_hello_get0_servername(con, NULL), 0))
+        goto end;
+    SSL_free(con);
+    con = NULL;
+
+    reject_hello = 1;
+    if (!accept_client_hello(sctx, hello, len, &con)
+            || !TEST_int_eq(SSL_get_error(con, -1), SSL_ERROR_SSL)
+            || !TEST_int_eq(seen.filter_calls, 2)
+            || !TEST_int_eq(seen.cb_calls, 1))
+        goto end;
+    SSL_free(con);
+    con = NULL;
+
+    /*
+     * A ClientHello that cannot be summarised never gets past the filter:
+     * make the server_name a type other than host_name
+     */
+    reject_hello = 0;
+    for (p = hello; p + sizeof(name) - 1 <= hello + len; p++)
+        if (memcmp(p, name, sizeof(name) - 1) == 0)
+            break;
+    if (!TEST_true(p + sizeof(name) - 1 <= hello + len)
+            || !TEST_int_eq(p[-3], TLSEXT_NAMETYPE_host_name))
+        goto end;
+    p[-3] = TLSEXT_NAMETYPE_host_name + 1;
+    ERR_clear_error();
+    if (!accept_client_hello(sctx, hello, len, &con)
+            || !TEST_int_eq(SSL_get_error(con, -1), SSL_ERROR_SSL)
+            || !TEST_int_eq(ERR_GET_REASON(ERR_peek_error()),
+                            SSL_R_LENGTH_MISMATCH)
+            || !TEST_int_eq(seen.filter_calls, 2)
+            || !TEST_int_eq(seen.cb_calls, 1))
+        goto end;
+    testresult = 1;
+
+ end:
+    SSL_free(con);
+    SSL_CTX_free(cctx);
+    SSL_CTX_free(sctx);
+    OPENSSL_free(hello);
+    return testresult;
+}
+
+/*
+ * Time how long it takes to reject a flood of ClientHellos in the ClientHello
+ * filter and in the ClientHello callback.  Pass a larger count to use this as
+ * a benchmark.
+ */
+static int test_client_hello_flood(void)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *con = NULL;
+    unsigned char *hello = NULL;
+    long len;
+    clock_t start;
+    double secs[2];
+    int i, filter, testresult = 0;
+
+    reject_hello = 1;
+    cctx = SSL_CTX_new(TLS_client_method());
+    if (!TEST_ptr(cctx)
+            || !TEST_long_gt(len = get_client_hello(cctx, "example.com",
+                                                    &hello), 0))
+        goto end;
+
+    for (filter = 1; filter >= 0; filter--) {
+        if (!TEST_ptr(sctx = make_filter_server_ctx(filter, !filter)))
+            goto end;
+        start = clock();
+        for (i = 0; i < hello_count; i++) {
+            if (!accept_client_hello(sctx, hello, len, &con)
+                    || !TEST_int_eq(SSL_get_error(con, -1), SSL_ERROR_SSL))
+                goto end;
+            SSL_free(con);
+            con = NULL;
+        }
+        secs[filter] = (double)(clock() - start) / CLOCKS_PER_SEC;
+        SSL_CTX_free(sctx);
+        sctx = NULL;
+    }
+    ERR_clear_error();
+    TEST_info("Rejected %d ClientHellos of %ld bytes in %.3f seconds in the "
+              "filter and in %.3f seconds in the callback",
+              hello_count, len, secs[1], secs[0]);
+    testresult = 1;
+
+ end:
+    SSL_free(con);
+    SSL_CTX_free(cctx);
+    SSL_CTX_free(sctx);
+    OPENSSL_free(hello);
+    return testresult;
+}
+
+OPT_TEST_DECLARE_USAGE("sessionfile certfile [count]\n")
 
 int setup_tests(void)
 {
-    if (!TEST_ptr(sessionfile = test_get_argument(0)))
+    if (!TEST_ptr(sessionfile = test_get_argument(0))
+            || !TEST_ptr(certfile = test_get_argument(1)))
+        return 0;
+    if (test_get_argument_count() > 2
+            && !TEST_int_gt(hello_count = atoi(test_get_argument(2)), 0))
         return 0;
 
     ADD_ALL_TESTS(test_client_hello, TOTAL_NUM_TESTS);
+    ADD_TEST(test_client_hello_processing);
+    ADD_TEST(test_client_hello_filter);
+    ADD_TEST(test_client_hello_flood);
     return 1;
 }
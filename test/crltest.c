@@ -14,6 +14,7 @@
 #include <openssl/err.h>
 #include <openssl/pem.h>
 #include <openssl/x509.h>
+#include <openssl/x509v3.h>
 
 #include "testutil.h"
 
@@ -209,6 +210,22 @@ static X509_CRL *CRL_from_strings(const char **pem)
     return crl;
 }
 
+/*
+ * Same as CRL_from_strings() but decode with d2i_X509_CRL_lazy().
+ */
+static X509_CRL *CRL_lazy_from_strings(const char **pem)
+{
+    char *p;
+    BIO *b = glue2bio(pem, &p);
+    X509_CRL *crl = PEM_ASN1_read_bio((d2i_of_void *)d2i_X509_CRL_lazy,
+                                      PEM_STRING_X509_CRL, b, NULL, NULL,
+                                      NULL);
+
+    OPENSSL_free(p);
+    BIO_free(b);
+    return crl;
+}
+
 /*
  * Create an X509 from an array of strings.
  */
@@ -371,6 +388,295 @@ static int test_reuse_crl(void)
     return 1;
 }
 
+static const char **lazy_crls[] = {
+    kBasicCRL, kRevokedCRL, kBadIssuerCRL, kKnownCriticalCRL,
+    kUnknownCriticalCRL, kUnknownCriticalCRL2
+};
+
+/* A lazily decoded CRL must verify the same as a normal one */
+static int test_lazy_crl(int n)
+{
+    X509_CRL *crl = CRL_from_strings(lazy_crls[n]);
+    X509_CRL *lazy = CRL_lazy_from_strings(lazy_crls[n]);
+    int r;
+
+    r = TEST_ptr(crl)
+        && TEST_ptr(lazy)
+        && TEST_int_eq(verify(test_leaf, test_root, make_CRL_stack(lazy, NULL),
+                              X509_V_FLAG_CRL_CHECK),
+                       verify(test_leaf, test_root, make_CRL_stack(crl, NULL),
+                              X509_V_FLAG_CRL_CHECK));
+    X509_CRL_free(crl);
+    X509_CRL_free(lazy);
+    return r;
+}
+
+#ifndef OPENSSL_NO_EC
+# define LAZY_NUM_REVOKED 1000
+# define LAZY_SERIAL_MOD 10007
+
+/*
+ * Make a CRL with many revoked entries, some with a reason code.  Variant 1
+ * has a negative serial number and variant 2 an indirect CRL entry, which
+ * cannot be indexed.
+ */
+static X509_CRL *make_large_crl(int variant)
+{
+    static const unsigned char key[32] = { 1 };
+    X509_CRL *crl = X509_CRL_new();
+    X509_NAME *name = X509_NAME_new();
+    ASN1_TIME *tm = ASN1_TIME_set(NULL, PARAM_TIME);
+    EVP_PKEY *pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL,
+                                                  key, sizeof(key));
+    ASN1_INTEGER *serial = ASN1_INTEGER_new();
+    ASN1_ENUMERATED *reason = ASN1_ENUMERATED_new();
+    GENERAL_NAMES *gens = NULL;
+    GENERAL_NAME *gen = NULL;
+    X509_REVOKED *rev = NULL;
+    int i, ok = 0;
+
+    if (!TEST_ptr(crl) || !TEST_ptr(name) || !TEST_ptr(tm) || !TEST_ptr(pkey)
+        || !TEST_ptr(serial) || !TEST_ptr(reason)
+        || !TEST_true(X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                                 (unsigned char *)"Test CA",
+                                                 -1, -1, 0))
+        || !TEST_true(X509_CRL_set_version(crl, 1))
+        || !TEST_true(X509_CRL_set_issuer_name(crl, name))
+        || !TEST_true(X509_CRL_set1_lastUpdate(crl, tm)))
+        goto err;
+
+    for (i = 0; i < LAZY_NUM_REVOKED; i++) {
+        long s = (i * 7919L) % LAZY_SERIAL_MOD;
+
+        if (variant == 1 && i == LAZY_NUM_REVOKED / 2)
+            s = -s;
+        if (!TEST_ptr(rev = X509_REVOKED_new())
+            || !TEST_true(ASN1_INTEGER_set(serial, s))
+            || !TEST_true(X509_REVOKED_set_serialNumber(rev, serial))
+            || !TEST_true(X509_REVOKED_set_revocationDate(rev, tm)))
+            goto err;
+        if (i % 3 == 0
+            && (!TEST_true(ASN1_ENUMERATED_set(reason, i % 9 == 0
+                                               ? CRL_REASON_REMOVE_FROM_CRL
+                                               : CRL_REASON_KEY_COMPROMISE))
+                || !TEST_true(X509_REVOKED_add1_ext_i2d(rev, NID_crl_reason,
+                                                        reason, 0, 0))))
+            goto err;
+        if (variant == 2 && i == LAZY_NUM_REVOKED / 2) {
+            X509_NAME *dirname = X509_NAME_dup(name);
+
+            if (!TEST_ptr(dirname)
+                || !TEST_ptr(gens = GENERAL_NAMES_new())
+                || !TEST_ptr(gen = GENERAL_NAME_new())) {
+                X509_NAME_free(dirname);
+                goto err;
+            }
+            GENERAL_NAME_set0_value(gen, GEN_DIRNAME, dirname);
+            if (!TEST_true(sk_GENERAL_NAME_push(gens, gen)))
+                goto err;
+            gen = NULL;
+            if (!TEST_true(X509_REVOKED_add1_ext_i2d(rev,
+                                                     NID_certificate_issuer,
+                                                     gens, 1, 0)))
+                goto err;
+        }
+        if (!TEST_true(X509_CRL_add0_revoked(crl, rev)))
+            goto err;
+        rev = NULL;
+    }
+    if (!TEST_int_gt(X509_CRL_sign(crl, pkey, NULL), 0))
+        goto err;
+    ok = 1;
+
+ err:
+    X509_REVOKED_free(rev);
+    GENERAL_NAME_free(gen);
+    GENERAL_NAMES_free(gens);
+    ASN1_ENUMERATED_free(reason);
+    ASN1_INTEGER_free(serial);
+    EVP_PKEY_free(pkey);
+    ASN1_TIME_free(tm);
+    X509_NAME_free(name);
+    if (!ok) {
+        X509_CRL_free(crl);
+        crl = NULL;
+    }
+    return crl;
+}
+
+/* Look up all serial numbers in both CRLs */
+static int lookups_equal(X509_CRL *crl, X509_CRL *lazy)
+{
+    ASN1_INTEGER *serial = ASN1_INTEGER_new();
+    X509_REVOKED *rev, *lrev;
+    long s;
+    int ret = 0, r;
+
+    if (!TEST_ptr(serial))
+        return 0;
+    for (s = -LAZY_SERIAL_MOD; s < LAZY_SERIAL_MOD; s++) {
+        rev = lrev = NULL;
+        if (!TEST_true(ASN1_INTEGER_set(serial, s))
+            || !TEST_int_eq(r = X509_CRL_get0_by_serial(crl, &rev, serial),
+                            X509_CRL_get0_by_serial(lazy, &lrev, serial)))
+            goto err;
+        if (r > 0
+            && (!TEST_int_eq(ASN1_INTEGER_cmp(X509_REVOKED_get0_serialNumber(rev),
+                                              X509_REVOKED_get0_serialNumber(lrev)),
+                             0)
+                || !TEST_int_eq(X509_REVOKED_get_ext_count(rev),
+                                X509_REVOKED_get_ext_count(lrev))))
+            goto err;
+    }
+    ret = 1;
+
+ err:
+    ASN1_INTEGER_free(serial);
+    return ret;
+}
+
+static int test_lazy_crl_lookup(int variant)
+{
+    X509_CRL *crl = NULL, *lazy = NULL, *ordered = NULL;
+    STACK_OF(X509_REVOKED) *revs, *lrevs;
+    unsigned char *der = NULL, *der2 = NULL;
+    const unsigned char *p;
+    int i, len, len2 = 0, ret = 0;
+
+    if (!TEST_ptr(crl = make_large_crl(variant))
+        || !TEST_int_gt(len = i2d_X509_CRL(crl, &der), 0))
+        goto err;
+    X509_CRL_free(crl);
+    p = der;
+    crl = d2i_X509_CRL(NULL, &p, len);
+    p = der;
+    lazy = d2i_X509_CRL_lazy(NULL, &p, len);
+    if (!TEST_ptr(crl)
+        || !TEST_ptr(lazy)
+        || !TEST_ptr_eq(p, der + len)
+        || !TEST_int_eq(X509_CRL_cmp(crl, lazy), 0)
+        || !TEST_int_eq(len2 = i2d_X509_CRL(lazy, &der2), len)
+        || !TEST_mem_eq(der, len, der2, len2)
+        || !lookups_equal(crl, lazy))
+        goto err;
+
+    /*
+     * The full list of an indexed CRL comes in the encoding order, while
+     * lookups have sorted it if it was decoded.
+     */
+    p = der;
+    if (!TEST_ptr(ordered = d2i_X509_CRL(NULL, &p, len))
+        || !TEST_ptr(revs = X509_CRL_get_REVOKED(ordered))
+        || !TEST_ptr(lrevs = X509_CRL_get_REVOKED(lazy))
+        || !TEST_int_eq(sk_X509_REVOKED_num(lrevs),
+                        sk_X509_REVOKED_num(revs)))
+        goto err;
+    if (sk_X509_REVOKED_is_sorted(lrevs))
+        sk_X509_REVOKED_sort(revs);
+    for (i = 0; i < sk_X509_REVOKED_num(revs); i++) {
+        const X509_REVOKED *rev = sk_X509_REVOKED_value(revs, i);
+        const X509_REVOKED *lrev = sk_X509_REVOKED_value(lrevs, i);
+
+        if (!TEST_int_eq(ASN1_INTEGER_cmp(X509_REVOKED_get0_serialNumber(rev),
+                                          X509_REVOKED_get0_serialNumber(lrev)),
+                         0))
+            goto err;
+    }
+    if (!lookups_equal(crl, lazy))
+        goto err;
+    ret = 1;
+
+ err:
+    OPENSSL_free(der);
+    OPENSSL_free(der2);
+    X509_CRL_free(crl);
+    X509_CRL_free(lazy);
+    X509_CRL_free(ordered);
+    return ret;
+}
+
+/* Signing a lazily decoded CRL again must keep all its entries */
+static int test_lazy_crl_resign(void)
+{
+    static const unsigned char key[32] = { 2 };
+    EVP_PKEY *pkey = NULL;
+    X509_CRL *crl = NULL, *lazy = NULL, *resigned = NULL;
+    unsigned char *der = NULL, *der2 = NULL;
+    const unsigned char *p;
+    int len, len2, ret = 0;
+
+    if (!TEST_ptr(pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL,
+                                                      key, sizeof(key)))
+        || !TEST_ptr(crl = make_large_crl(0))
+        || !TEST_int_gt(len = i2d_X509_CRL(crl, &der), 0))
+        goto err;
+    X509_CRL_free(crl);
+    p = der;
+    crl = d2i_X509_CRL(NULL, &p, len);
+    p = der;
+    if (!TEST_ptr(crl)
+        || !TEST_ptr(lazy = d2i_X509_CRL_lazy(NULL, &p, len))
+        || !TEST_int_gt(X509_CRL_sign(lazy, pkey, NULL), 0)
+        || !TEST_int_gt(len2 = i2d_X509_CRL(lazy, &der2), 0))
+        goto err;
+    p = der2;
+    if (!TEST_ptr(resigned = d2i_X509_CRL(NULL, &p, len2))
+        || !TEST_int_eq(X509_CRL_verify(resigned, pkey), 1)
+        || !TEST_int_eq(sk_X509_REVOKED_num(X509_CRL_get_REVOKED(resigned)),
+                        LAZY_NUM_REVOKED)
+        || !lookups_equal(crl, resigned))
+        goto err;
+    ret = 1;
+
+ err:
+    OPENSSL_free(der);
+    OPENSSL_free(der2);
+    X509_CRL_free(crl);
+    X509_CRL_free(lazy);
+    X509_CRL_free(resigned);
+    EVP_PKEY_free(pkey);
+    return ret;
+}
+#endif
+
+/* X509_load_crl_file() decodes lazily */
+static int test_load_crl_file(void)
+{
+    const char *file = test_get_argument(0);
+    X509_STORE *store = NULL;
+    X509_LOOKUP *lookup;
+    X509_CRL *crl = NULL, *loaded;
+    BIO *bio = NULL;
+    int ret = 0;
+
+    if (!TEST_ptr(file)
+        || !TEST_ptr(bio = BIO_new_file(file, "r"))
+        || !TEST_ptr(crl = PEM_read_bio_X509_CRL(bio, NULL, NULL, NULL))
+        || !TEST_ptr(store = X509_STORE_new())
+        || !TEST_ptr(lookup = X509_STORE_add_lookup(store,
+                                                    X509_LOOKUP_file()))
+        || !TEST_int_eq(X509_load_crl_file(lookup, file, X509_FILETYPE_PEM),
+                        1)
+        || !TEST_int_eq(sk_X509_OBJECT_num(X509_STORE_get0_objects(store)),
+                        1)
+        || !TEST_ptr(loaded = X509_OBJECT_get0_X509_CRL(
+                         sk_X509_OBJECT_value(X509_STORE_get0_objects(store),
+                                              0)))
+        || !TEST_int_eq(X509_CRL_cmp(crl, loaded), 0)
+        || !TEST_int_eq(sk_X509_REVOKED_num(X509_CRL_get_REVOKED(loaded)),
+                        sk_X509_REVOKED_num(X509_CRL_get_REVOKED(crl))))
+        goto err;
+    ret = 1;
+
+ err:
+    BIO_free(bio);
+    X509_CRL_free(crl);
+    X509_STORE_free(store);
+    return ret;
+}
+
+OPT_TEST_DECLARE_USAGE("crl.pem\n")
+
 int setup_tests(void)
 {
     if (!TEST_ptr(test_root = X509_from_strings(kCRLTestRoot))
@@ -383,6 +689,12 @@ int setup_tests(void)
     ADD_TEST(test_known_critical_crl);
     ADD_ALL_TESTS(test_unknown_critical_crl, OSSL_NELEM(unknown_critical_crls));
     ADD_TEST(test_reuse_crl);
+    ADD_ALL_TESTS(test_lazy_crl, OSSL_NELEM(lazy_crls));
+#ifndef OPENSSL_NO_EC
+    ADD_ALL_TESTS(test_lazy_crl_lookup, 3);
+    ADD_TEST(test_lazy_crl_resign);
+#endif
+    ADD_TEST(test_load_crl_file);
     return 1;
 }
 
@@ -1141,6 +1141,54 @@ err:
     return rv;
 }
 
+static int test_buffered(void)
+{
+    int rv = 0;
+    RAND_DRBG *drbg = NULL;
+    unsigned char a[16], b[16], big[DRBG_OUTBUF_MAX_REQUEST + 1];
+
+    if (!TEST_ptr(drbg = RAND_DRBG_new(NID_aes_256_ctr,
+                                       RAND_DRBG_FLAG_BUFFERED, NULL))
+        || !TEST_true(disable_crngt(drbg))
+        || !TEST_int_gt(RAND_DRBG_instantiate(drbg, NULL, 0), 0))
+        goto err;
+
+    /* The first small request fills the buffer, the next one uses it */
+    if (!TEST_true(RAND_DRBG_bytes(drbg, a, sizeof(a)))
+        || !TEST_size_t_eq(drbg->outbuf_len, DRBG_OUTBUF_SIZE - sizeof(a))
+        || !TEST_true(RAND_DRBG_bytes(drbg, b, sizeof(b)))
+        || !TEST_size_t_eq(drbg->outbuf_len,
+                           DRBG_OUTBUF_SIZE - sizeof(a) - sizeof(b))
+        || !TEST_mem_ne(a, sizeof(a), b, sizeof(b))
+        || !TEST_uint_eq(drbg->reseed_gen_counter, 2))
+        goto err;
+
+    /* Large requests bypass the buffer */
+    if (!TEST_true(RAND_DRBG_bytes(drbg, big, sizeof(big)))
+        || !TEST_size_t_eq(drbg->outbuf_len,
+                           DRBG_OUTBUF_SIZE - sizeof(a) - sizeof(b)))
+        goto err;
+
+    /* A reseed discards what was generated before it */
+    if (!TEST_true(RAND_DRBG_reseed(drbg, NULL, 0, 0))
+        || !TEST_size_t_eq(drbg->outbuf_len, 0)
+        || !TEST_true(RAND_DRBG_bytes(drbg, a, sizeof(a)))
+        || !TEST_size_t_eq(drbg->outbuf_len, DRBG_OUTBUF_SIZE - sizeof(a)))
+        goto err;
+
+    /* So does a fork: the child reseeds instead of using the buffer */
+    drbg->fork_count++;
+    if (!TEST_true(RAND_DRBG_bytes(drbg, b, sizeof(b)))
+        || !TEST_uint_eq(drbg->reseed_gen_counter, 2)
+        || !TEST_size_t_eq(drbg->outbuf_len, DRBG_OUTBUF_SIZE - sizeof(b)))
+        goto err;
+
+    rv = 1;
+err:
+    RAND_DRBG_free(drbg);
+    return rv;
+}
+
 static int test_set_defaults(void)
 {
     RAND_DRBG *master = NULL, *public = NULL, *private = NULL;
@@ -1346,6 +1394,7 @@ int setup_tests(void)
     ADD_TEST(test_rand_add);
     ADD_TEST(test_rand_drbg_prediction_resistance);
     ADD_TEST(test_multi_set);
+    ADD_TEST(test_buffered);
     ADD_TEST(test_set_defaults);
 #if defined(OPENSSL_THREADS)
     ADD_TEST(test_multi_thread);
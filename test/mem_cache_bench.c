@@ -0,0 +1,140 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * Times a loop of in-memory TLS handshakes, with the C library allocator or,
+ * with -cache, with the thread-caching allocator of CRYPTO_mem_cache_enable().
+ * Compare the two runs to see what the cache buys:
+ *
+ *     mem_cache_bench -n 2000 servercert.pem serverkey.pem
+ *     mem_cache_bench -cache -n 2000 servercert.pem serverkey.pem
+ *
+ * Like mem_cache_test this is a plain program, the allocator has to be
+ * installed before anything is allocated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/crypto.h>
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+static int do_handshake(SSL_CTX *sctx, SSL_CTX *cctx)
+{
+    SSL *server = SSL_new(sctx), *client = SSL_new(cctx);
+    BIO *sbio, *cbio;
+    int i, rv, sdone = 0, cdone = 0;
+
+    if (server == NULL || client == NULL
+            || !BIO_new_bio_pair(&sbio, 0, &cbio, 0))
+        goto err;
+    SSL_set_bio(server, sbio, sbio);
+    SSL_set_bio(client, cbio, cbio);
+    SSL_set_accept_state(server);
+    SSL_set_connect_state(client);
+
+    for (i = 0; i < 10 && !(sdone && cdone); i++) {
+        if (!cdone) {
+            if ((rv = SSL_do_handshake(client)) == 1)
+                cdone = 1;
+            else if (SSL_get_error(client, rv) != SSL_ERROR_WANT_READ)
+                goto err;
+        }
+        if (!sdone) {
+            if ((rv = SSL_do_handshake(server)) == 1)
+                sdone = 1;
+            else if (SSL_get_error(server, rv) != SSL_ERROR_WANT_READ)
+                goto err;
+        }
+    }
+
+ err:
+    SSL_free(server);
+    SSL_free(client);
+    return sdone && cdone;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-cache] [-n count] certfile keyfile\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    SSL_CTX *sctx = NULL, *cctx = NULL;
+    const char *prog = argv[0];
+    int cache = 0, count = 1000, i, ret = 1;
+    clock_t start, end;
+    double secs;
+    size_t size;
+    uint64_t allocs, hits;
+
+    for (argc--, argv++; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+        if (strcmp(argv[0], "-cache") == 0) {
+            cache = 1;
+        } else if (strcmp(argv[0], "-n") == 0 && argc > 1) {
+            count = atoi(argv[1]);
+            argc--, argv++;
+        } else {
+            usage(prog);
+            return 1;
+        }
+    }
+    if (argc != 2 || count <= 0) {
+        usage(prog);
+        return 1;
+    }
+
+    if (cache && !CRYPTO_mem_cache_enable()) {
+        fprintf(stderr, "CRYPTO_mem_cache_enable failed\n");
+        return 1;
+    }
+
+    sctx = SSL_CTX_new(TLS_server_method());
+    cctx = SSL_CTX_new(TLS_client_method());
+    if (sctx == NULL || cctx == NULL
+            || SSL_CTX_use_certificate_file(sctx, argv[0],
+                                            SSL_FILETYPE_PEM) <= 0
+            || SSL_CTX_use_PrivateKey_file(sctx, argv[1],
+                                           SSL_FILETYPE_PEM) <= 0)
+        goto err;
+
+    start = clock();
+    for (i = 0; i < count; i++) {
+        if (!do_handshake(sctx, cctx)) {
+            fprintf(stderr, "handshake %d failed\n", i);
+            goto err;
+        }
+    }
+    end = clock();
+
+    secs = (double)(end - start) / CLOCKS_PER_SEC;
+    printf("%d handshakes with the %s allocator in %.2fs", count,
+           cache ? "caching" : "C library", secs);
+    if (secs > 0)
+        printf(", %.1f per second", count / secs);
+    printf("\n");
+    if (cache) {
+        for (i = 0; CRYPTO_mem_cache_get_stats(i, &size, &allocs, &hits, NULL);
+             i++)
+            printf("  %5d bytes: %10llu allocations, %10llu from the cache\n",
+                   (int)size, (unsigned long long)allocs,
+                   (unsigned long long)hits);
+    }
+    ret = 0;
+
+ err:
+    if (ret != 0)
+        ERR_print_errors_fp(stderr);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    return ret;
+}
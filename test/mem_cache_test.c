@@ -0,0 +1,117 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * The allocator has to be installed before the first allocation, which
+ * rules out the test framework (it allocates its output BIOs first), so
+ * this is a plain program in the style of aborttest.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include "internal/nelem.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: check failed: %s\n",                \
+                    __FILE__, __LINE__, #cond);                         \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static uint64_t class_hits(size_t num)
+{
+    size_t size;
+    uint64_t hits = 0;
+    int i;
+
+    for (i = 0; CRYPTO_mem_cache_get_stats(i, &size, NULL, &hits, NULL); i++)
+        if (size >= num)
+            return hits;
+    return 0;
+}
+
+static void test_reuse(void)
+{
+    unsigned char *p, *q;
+    uint64_t before;
+
+    p = OPENSSL_malloc(40);
+    CHECK(p != NULL);
+    OPENSSL_free(p);
+    before = class_hits(40);
+    q = OPENSSL_malloc(33);
+    CHECK(q == p);
+    CHECK(class_hits(40) == before + 1);
+    OPENSSL_clear_free(q, 33);
+}
+
+static void test_realloc(void)
+{
+    unsigned char *p, *q;
+    size_t i;
+
+    p = OPENSSL_malloc(20);
+    CHECK(p != NULL);
+    for (i = 0; i < 20; i++)
+        p[i] = (unsigned char)i;
+    q = OPENSSL_realloc(p, 32);
+    CHECK(q == p);
+    p = OPENSSL_realloc(q, 5000);
+    CHECK(p != NULL);
+    for (i = 0; i < 20; i++)
+        CHECK(p[i] == (unsigned char)i);
+    q = OPENSSL_realloc(p, 10000);
+    CHECK(q != NULL);
+    for (i = 0; i < 20; i++)
+        CHECK(q[i] == (unsigned char)i);
+    OPENSSL_free(q);
+}
+
+static void test_churn(void)
+{
+    void *ptrs[500];
+    size_t i;
+
+    for (i = 0; i < OSSL_NELEM(ptrs); i++) {
+        ptrs[i] = OPENSSL_zalloc(1 + (i * 37) % 3000);
+        CHECK(ptrs[i] != NULL);
+    }
+    for (i = 0; i < OSSL_NELEM(ptrs); i++)
+        OPENSSL_free(ptrs[i]);
+}
+
+int main(int argc, char **argv)
+{
+    size_t size;
+    uint64_t allocs, hits, frees;
+
+    if (!CRYPTO_mem_cache_enable()) {
+        fprintf(stderr, "CRYPTO_mem_cache_enable failed\n");
+        return 1;
+    }
+    CHECK(!CRYPTO_mem_cache_enable());
+
+    test_reuse();
+    test_realloc();
+    test_churn();
+
+    CHECK(CRYPTO_mem_cache_get_stats(0, &size, &allocs, &hits, &frees));
+    CHECK(size == 16);
+    CHECK(hits <= allocs);
+    CHECK(!CRYPTO_mem_cache_get_stats(-1, NULL, NULL, NULL, NULL));
+    CHECK(!CRYPTO_mem_cache_get_stats(100, NULL, NULL, NULL, NULL));
+
+    OPENSSL_cleanup();
+    return failures == 0 ? 0 : 1;
+}
@@ -27,7 +27,7 @@ subtest 'crl conversions' => sub {
     tconversion("crl", srctop_file("test","testcrl.pem"));
 };
 
-ok(run(test(['crltest'])));
+ok(run(test(["crltest", srctop_file("test", "testcrl.pem")])));
 
 ok(compare1stline([qw{openssl crl -noout -fingerprint -in},
                    srctop_file('test', 'testcrl.pem')],
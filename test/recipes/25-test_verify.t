@@ -27,7 +27,7 @@ sub verify {
     run(app([@args]));
 }
 
-plan tests => 137;
+plan tests => 139;
 
 # Canonical success
 ok(verify("ee-cert", "sslserver", ["root-cert"], ["ca-cert"]),
@@ -348,12 +348,16 @@ ok(!verify("ee-pss-sha1-cert", "sslserver", ["root-cert"], ["ca-cert"], "-auth_l
 ok(verify("ee-pss-sha256-cert", "sslserver", ["root-cert"], ["ca-cert"], "-auth_level", "2"),
     "PSS signature using SHA256 and auth level 2");
 
-ok(!verify("many-names1", "sslserver", ["many-constraints"], ["many-constraints"], ),
-    "Too many names and constraints to check (1)");
-ok(!verify("many-names2", "sslserver", ["many-constraints"], ["many-constraints"], ),
-    "Too many names and constraints to check (2)");
-ok(!verify("many-names3", "sslserver", ["many-constraints"], ["many-constraints"], ),
-    "Too many names and constraints to check (3)");
+ok(verify("many-names1", "sslserver", ["many-constraints"], ["many-constraints"], ),
+    "Many names checked against indexed constraints (1)");
+ok(verify("many-names2", "sslserver", ["many-constraints"], ["many-constraints"], ),
+    "Many names checked against indexed constraints (2)");
+ok(verify("many-names3", "sslserver", ["many-constraints"], ["many-constraints"], ),
+    "Many names checked against indexed constraints (3)");
+ok(verify("many-names4", "sslserver", ["root-cert"], ["many-dns-constraints"], ),
+    "Many names checked against indexed constraints (4)");
+ok(!verify("many-names4", "sslserver", ["root-cert"], ["many-uri-constraints"], ),
+    "Too many names and constraints to check");
 
 ok(verify("some-names1", "sslserver", ["many-constraints"], ["many-constraints"], ),
     "Not too many names and constraints to check (1)");
@@ -0,0 +1,29 @@
+#! /usr/bin/env perl
+# Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+#
+# Licensed under the Apache License 2.0 (the "License").  You may not use
+# this file except in compliance with the License.  You can obtain a copy
+# in the file LICENSE in the source distribution or at
+# https://www.openssl.org/source/license.html
+
+
+use OpenSSL::Test qw/:DEFAULT srctop_file/;
+
+setup("test_x509_lazy");
+
+plan tests => 4;
+
+ok(run(test(["x509_lazy_test",
+             srctop_file("test", "certs", "root-cert.pem"),
+             srctop_file("test", "certs", "ca-cert.pem"),
+             srctop_file("test", "certs", "ee-cert.pem")])));
+
+# The benchmark is meant to be run by hand with a larger count, these only
+# check that the parsing loop still works either way.
+my $cert = srctop_file("test", "certs", "ee-cert.pem");
+ok(run(test(["x509_lazy_bench", "-n", "10", $cert])),
+   "running x509_lazy_bench");
+ok(run(test(["x509_lazy_bench", "-lazy", "-n", "10", $cert])),
+   "running x509_lazy_bench -lazy");
+ok(run(test(["x509_lazy_bench", "-lazy", "-use", "-n", "10", $cert])),
+   "running x509_lazy_bench -lazy -use");
@@ -0,0 +1,20 @@
+#! /usr/bin/env perl
+# Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+#
+# Licensed under the Apache License 2.0 (the "License").  You may not use
+# this file except in compliance with the License.  You can obtain a copy
+# in the file LICENSE in the source distribution or at
+# https://www.openssl.org/source/license.html
+
+
+use OpenSSL::Test qw/:DEFAULT srctop_file/;
+use OpenSSL::Test::Utils;
+
+setup("test_x509_load");
+
+plan skip_all => "test_x509_load needs EC" if disabled("ec");
+
+plan tests => 1;
+
+ok(run(test(["x509_load_test",
+             srctop_file("test", "certs", "ee-ecdsa-key.pem")])));
@@ -0,0 +1,25 @@
+#! /usr/bin/env perl
+# Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+#
+# Licensed under the Apache License 2.0 (the "License").  You may not use
+# this file except in compliance with the License.  You can obtain a copy
+# in the file LICENSE in the source distribution or at
+# https://www.openssl.org/source/license.html
+
+
+use OpenSSL::Test qw/:DEFAULT srctop_file/;
+
+setup("test_mem_cache");
+
+plan tests => 3;
+
+ok(run(test(["mem_cache_test"])), "running mem_cache_test");
+
+# The benchmark is meant to be run by hand with a larger count, these only
+# check that the handshake loop still works with and without the cache.
+my @certs = (srctop_file("test", "certs", "servercert.pem"),
+             srctop_file("test", "certs", "serverkey.pem"));
+ok(run(test(["mem_cache_bench", "-n", "10", @certs])),
+   "running mem_cache_bench");
+ok(run(test(["mem_cache_bench", "-cache", "-n", "10", @certs])),
+   "running mem_cache_bench -cache");
@@ -11,6 +11,7 @@
 
 #include "testutil.h"
 #include "../e_os.h"
+#include "internal/nelem.h"
 
 static int test_sec_mem(void)
 {
@@ -175,9 +176,68 @@ err:
 #endif
 }
 
+static int test_sec_mem_cache(void)
+{
+#ifdef OPENSSL_SECURE_MEMORY
+    unsigned char *p[64] = { NULL };
+    size_t arena, used, cached, chunks, largest;
+    size_t i;
+    int res = 0;
+
+    if (!TEST_false(CRYPTO_secure_malloc_stats(NULL, NULL, NULL, NULL, NULL))
+            || !TEST_true(CRYPTO_secure_malloc_init(4096, 32)))
+        goto err;
+
+    /* Enough small blocks to overflow the cache of the calling thread */
+    for (i = 0; i < OSSL_NELEM(p); i++)
+        if (!TEST_ptr(p[i] = OPENSSL_secure_malloc(20)))
+            goto err;
+    for (i = 0; i < OSSL_NELEM(p); i++) {
+        OPENSSL_secure_free(p[i]);
+        p[i] = NULL;
+    }
+    if (!TEST_size_t_eq(CRYPTO_secure_used(), 0)
+            || !TEST_true(CRYPTO_secure_malloc_stats(&arena, &used, &cached,
+                                                     &chunks, &largest))
+            || !TEST_size_t_eq(arena, 4096)
+            || !TEST_size_t_eq(used, 0)
+            || !TEST_size_t_gt(cached, 0)
+            || !TEST_size_t_le(cached + largest, arena))
+        goto err;
+
+    /* A block larger than what is left has to come from drained caches */
+    if (!TEST_ptr(p[0] = OPENSSL_secure_malloc(4096))
+            || !TEST_size_t_eq(CRYPTO_secure_used(), 4096)
+            || !TEST_true(CRYPTO_secure_malloc_stats(NULL, NULL, &cached,
+                                                     &chunks, &largest))
+            || !TEST_size_t_eq(cached, 0)
+            || !TEST_size_t_eq(chunks, 0)
+            || !TEST_size_t_eq(largest, 0))
+        goto err;
+    OPENSSL_secure_free(p[0]);
+    p[0] = NULL;
+
+    if (!TEST_true(CRYPTO_secure_malloc_stats(NULL, &used, NULL,
+                                              &chunks, &largest))
+            || !TEST_size_t_eq(used, 0)
+            || !TEST_size_t_eq(chunks, 1)
+            || !TEST_size_t_eq(largest, 4096))
+        goto err;
+    res = 1;
+ err:
+    for (i = 0; i < OSSL_NELEM(p); i++)
+        OPENSSL_secure_free(p[i]);
+    CRYPTO_secure_malloc_done();
+    return res;
+#else
+    return TEST_false(CRYPTO_secure_malloc_stats(NULL, NULL, NULL, NULL, NULL));
+#endif
+}
+
 int setup_tests(void)
 {
     ADD_TEST(test_sec_mem);
     ADD_TEST(test_sec_mem_clear);
+    ADD_TEST(test_sec_mem_cache);
     return 1;
 }
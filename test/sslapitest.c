@@ -19,6 +19,7 @@
 #include <openssl/txt_db.h>
 #include <openssl/aes.h>
 #include <openssl/rand.h>
+#include <openssl/comp.h>
 
 #include "ssltestlib.h"
 #include "testutil.h"
@@ -2937,6 +2938,98 @@ static int test_early_data_replay(int idx)
     return ret;
 }
 
+/*
+ * Test that the anti-replay filter rejects early data in a replayed
+ * ClientHello, but not a new ClientHello with the same ticket.
+ * idx == 0: Standard early_data setup
+ * idx == 1: early_data setup using read_ahead
+ */
+static int test_early_data_replay_filter(int idx)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *clientssl = NULL, *serverssl = NULL, *replayssl = NULL;
+    BIO *rbio = NULL, *wbio = NULL;
+    SSL_SESSION *sess = NULL;
+    size_t readbytes, written;
+    unsigned char buf[20];
+    char *data;
+    long len;
+    int i, testresult = 0;
+
+    if (!TEST_true(create_ssl_ctx_pair(TLS_server_method(), TLS_client_method(),
+                                       TLS1_VERSION, 0, &sctx,
+                                       &cctx, cert, privkey))
+            || !TEST_true(SSL_CTX_set_anti_replay_filter(sctx, 1024))
+            || !TEST_true(setupearly_data_test(&cctx, &sctx, &clientssl,
+                                               &serverssl, &sess, idx)))
+        goto end;
+
+    /* The ticket can be used for early data more than once */
+    for (i = 0; i < 2; i++) {
+        if (i > 0
+                && (!TEST_true(create_ssl_objects(sctx, cctx, &serverssl,
+                                                  &clientssl, NULL, NULL))
+                    || !TEST_true(SSL_set_session(clientssl, sess))))
+            goto end;
+        if (!TEST_true(SSL_write_early_data(clientssl, MSG1, strlen(MSG1),
+                                            &written)))
+            goto end;
+
+        /* Keep a copy of the ClientHello and early data for the replay */
+        if (i == 1
+                && (!TEST_ptr(rbio = BIO_new(BIO_s_mem()))
+                    || !TEST_ptr(wbio = BIO_new(BIO_s_mem()))
+                    || !TEST_long_gt(len = BIO_get_mem_data(
+                                         SSL_get_rbio(serverssl), &data), 0)
+                    || !TEST_int_eq(BIO_write(rbio, data, (int)len),
+                                    (int)len)))
+            goto end;
+
+        if (!TEST_int_eq(SSL_read_early_data(serverssl, buf, sizeof(buf),
+                                             &readbytes),
+                         SSL_READ_EARLY_DATA_SUCCESS)
+                || !TEST_mem_eq(MSG1, strlen(MSG1), buf, readbytes)
+                || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                    SSL_ERROR_NONE))
+                || !TEST_int_eq(SSL_get_early_data_status(serverssl),
+                                SSL_EARLY_DATA_ACCEPTED))
+            goto end;
+        SSL_shutdown(clientssl);
+        SSL_shutdown(serverssl);
+        SSL_free(serverssl);
+        SSL_free(clientssl);
+        serverssl = clientssl = NULL;
+    }
+
+    /* The replayed ClientHello resumes the session, without early data */
+    BIO_set_mem_eof_return(rbio, -1);
+    BIO_set_mem_eof_return(wbio, -1);
+    if (!TEST_ptr(replayssl = SSL_new(sctx)))
+        goto end;
+    SSL_set_bio(replayssl, rbio, wbio);
+    rbio = wbio = NULL;
+    if (!TEST_int_eq(SSL_read_early_data(replayssl, buf, sizeof(buf),
+                                         &readbytes),
+                     SSL_READ_EARLY_DATA_FINISH)
+            || !TEST_int_eq(SSL_get_early_data_status(replayssl),
+                            SSL_EARLY_DATA_REJECTED)
+            || !TEST_true(SSL_session_reused(replayssl)))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    SSL_SESSION_free(sess);
+    BIO_free(rbio);
+    BIO_free(wbio);
+    SSL_free(replayssl);
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    return testresult;
+}
+
 /*
  * Helper function to test that a server attempting to read early data can
  * handle a connection from a client where the early data should be skipped.
@@ -6070,6 +6163,131 @@ static int test_ticket_callbacks(int tst)
     return testresult;
 }
 
+/*
+ * Resume |sess| and check whether the session was reused.  The session the
+ * client ends up with is returned in |*newsess|.
+ */
+static int ticket_resume(SSL_CTX *sctx, SSL_CTX *cctx, SSL_SESSION *sess,
+                         int reused, SSL_SESSION **newsess)
+{
+    SSL *clientssl = NULL, *serverssl = NULL;
+    int ret = 0;
+
+    if (!TEST_true(create_ssl_objects(sctx, cctx, &serverssl, &clientssl, NULL,
+                                      NULL))
+            || (sess != NULL && !TEST_true(SSL_set_session(clientssl, sess)))
+            || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                SSL_ERROR_NONE))
+            || !TEST_int_eq(SSL_session_reused(clientssl), reused)
+            || !TEST_ptr(*newsess = SSL_get1_session(clientssl)))
+        goto end;
+    ret = 1;
+
+ end:
+    if (clientssl != NULL)
+        SSL_shutdown(clientssl);
+    if (serverssl != NULL)
+        SSL_shutdown(serverssl);
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    return ret;
+}
+
+/* The name of the ticket key that encrypted the ticket of |sess| */
+static const unsigned char *ticket_key_name(SSL_SESSION *sess)
+{
+    const unsigned char *tick;
+    size_t len;
+
+    SSL_SESSION_get0_ticket(sess, &tick, &len);
+    return len >= 16 ? tick : NULL;
+}
+
+/*
+ * Test the ticket key ring.
+ * Test 0: TLSv1.2
+ * Test 1: TLSv1.3
+ */
+static int test_ticket_key_ring(int tst)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL_SESSION *sess1 = NULL, *sess2 = NULL, *sess3 = NULL;
+    unsigned char keys[80], name1[16];
+    int testresult = 0;
+
+#ifdef OPENSSL_NO_TLS1_2
+    if (tst == 0)
+        return 1;
+#endif
+#ifdef OPENSSL_NO_TLS1_3
+    if (tst == 1)
+        return 1;
+#endif
+
+    if (!TEST_true(create_ssl_ctx_pair(TLS_server_method(),
+                                       TLS_client_method(),
+                                       TLS1_VERSION,
+                                       tst == 0 ? TLS1_2_VERSION
+                                                : TLS1_3_VERSION,
+                                       &sctx, &cctx, cert, privkey))
+            || !TEST_true(SSL_CTX_set_session_cache_mode(sctx,
+                                                         SSL_SESS_CACHE_OFF))
+            || !ticket_resume(sctx, cctx, NULL, 0, &sess1)
+            || !TEST_ptr(ticket_key_name(sess1)))
+        goto end;
+    memcpy(name1, ticket_key_name(sess1), sizeof(name1));
+
+    /*
+     * After a rotation the ticket is still accepted, and replaced by one
+     * under the new key
+     */
+    if (!TEST_true(SSL_CTX_rotate_ticket_keys(sctx, 0))
+            || !TEST_int_eq(SSL_CTX_get_tlsext_ticket_keys(sctx, keys,
+                                                           sizeof(keys)), 1)
+            || !TEST_mem_ne(keys, 16, name1, sizeof(name1))
+            || !ticket_resume(sctx, cctx, sess1, 1, &sess2)
+            || !TEST_ptr(ticket_key_name(sess2))
+            || !TEST_mem_eq(ticket_key_name(sess2), 16, keys, 16))
+        goto end;
+
+    /* Keeping two keys drops the first */
+    if (!TEST_true(SSL_CTX_rotate_ticket_keys(sctx, 2))
+            || !ticket_resume(sctx, cctx, sess2, 1, &sess3))
+        goto end;
+    SSL_SESSION_free(sess3);
+    sess3 = NULL;
+    if (!ticket_resume(sctx, cctx, sess1, 0, &sess3))
+        goto end;
+    SSL_SESSION_free(sess3);
+    sess3 = NULL;
+
+    /* Removed keys no longer decrypt, added ones do */
+    if (!TEST_true(SSL_CTX_remove_ticket_key(sctx, ticket_key_name(sess2), 16))
+            || !TEST_false(SSL_CTX_remove_ticket_key(sctx,
+                                                     ticket_key_name(sess2),
+                                                     16))
+            || !ticket_resume(sctx, cctx, sess2, 0, &sess3)
+            || !TEST_true(SSL_CTX_add_ticket_key(sctx, keys, sizeof(keys),
+                                                 SSL_TICKET_KEY_DECRYPT_ONLY))
+            || !TEST_false(SSL_CTX_add_ticket_key(sctx, keys, 16, 0)))
+        goto end;
+    SSL_SESSION_free(sess3);
+    sess3 = NULL;
+    if (!ticket_resume(sctx, cctx, sess2, 1, &sess3))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    SSL_SESSION_free(sess1);
+    SSL_SESSION_free(sess2);
+    SSL_SESSION_free(sess3);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+
+    return testresult;
+}
+
 /*
  * Test bi-directional shutdown.
  * Test 0: TLSv1.2
@@ -6592,6 +6810,792 @@ static int test_ca_names(int tst)
     return testresult;
 }
 
+#ifndef OPENSSL_NO_TLS1_3
+/* What the server wrote through the write counting filter */
+static struct {
+    int writes;
+    int records;
+    int encrypted_records;
+    /* Inner plaintext bytes of the encrypted records, less the type byte */
+    size_t encrypted_bytes;
+    unsigned char hdr[SSL3_RT_HEADER_LENGTH];
+    size_t hdrlen, left;
+} wcount;
+
+static BIO_METHOD *meth_write_counter = NULL;
+
+static int write_counter_new(BIO *bio)
+{
+    BIO_set_init(bio, 1);
+    return 1;
+}
+
+static int write_counter_read(BIO *bio, char *out, int outl)
+{
+    int ret = BIO_read(BIO_next(bio), out, outl);
+
+    BIO_clear_retry_flags(bio);
+    BIO_copy_next_retry(bio);
+    return ret;
+}
+
+/* Count the writes and the records in them */
+static int write_counter_write(BIO *bio, const char *in, int inl)
+{
+    int ret = BIO_write(BIO_next(bio), in, inl), i = 0;
+    size_t len;
+
+    BIO_clear_retry_flags(bio);
+    BIO_copy_next_retry(bio);
+    if (ret <= 0)
+        return ret;
+    wcount.writes++;
+    while (i < ret) {
+        if (wcount.left > 0) {
+            len = (size_t)(ret - i) < wcount.left ? (size_t)(ret - i)
+                                                   : wcount.left;
+            wcount.left -= len;
+            i += len;
+            continue;
+        }
+        wcount.hdr[wcount.hdrlen++] = in[i++];
+        if (wcount.hdrlen < SSL3_RT_HEADER_LENGTH)
+            continue;
+        wcount.left = (wcount.hdr[3] << 8) | wcount.hdr[4];
+        wcount.records++;
+        /* All TLSv1.3 ciphersuites have a 16 byte tag, except CCM_8 */
+        if (wcount.hdr[0] == SSL3_RT_APPLICATION_DATA) {
+            wcount.encrypted_records++;
+            wcount.encrypted_bytes += wcount.left - EVP_GCM_TLS_TAG_LEN - 1;
+        }
+        wcount.hdrlen = 0;
+    }
+    return ret;
+}
+
+static long write_counter_ctrl(BIO *bio, int cmd, long num, void *ptr)
+{
+    if (cmd == BIO_CTRL_DUP)
+        return 0;
+    return BIO_ctrl(BIO_next(bio), cmd, num, ptr);
+}
+
+static const BIO_METHOD *bio_f_write_counter(void)
+{
+    if (meth_write_counter == NULL) {
+        if (!TEST_ptr(meth_write_counter
+                          = BIO_meth_new(BIO_get_new_index() | BIO_TYPE_FILTER,
+                                         "write counter"))
+                || !TEST_true(BIO_meth_set_create(meth_write_counter,
+                                                  write_counter_new))
+                || !TEST_true(BIO_meth_set_read(meth_write_counter,
+                                                write_counter_read))
+                || !TEST_true(BIO_meth_set_write(meth_write_counter,
+                                                 write_counter_write))
+                || !TEST_true(BIO_meth_set_ctrl(meth_write_counter,
+                                                write_counter_ctrl)))
+            return NULL;
+    }
+    return meth_write_counter;
+}
+
+/*
+ * Test that a TLSv1.3 server packs the encrypted messages of its flight into
+ * as few records as it can and writes the whole flight at once.
+ * Test 0: The plain flight
+ * Test 1: With a CertificateRequest
+ * Test 2: With a small maximum fragment length
+ */
+static int test_tls13_flight_records(int tst)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *clientssl = NULL, *serverssl = NULL;
+    BIO *counter = NULL;
+    size_t frag = SSL3_RT_MAX_PLAIN_LENGTH;
+    int testresult = 0;
+
+    if (!TEST_true(create_ssl_ctx_pair(TLS_server_method(), TLS_client_method(),
+                                       TLS1_3_VERSION, 0,
+                                       &sctx, &cctx, cert, privkey))
+            || !TEST_true(SSL_CTX_set_num_tickets(sctx, 0)))
+        goto end;
+    if (tst == 1) {
+        SSL_CTX_set_verify(sctx, SSL_VERIFY_PEER, verify_cb);
+        if (!TEST_int_eq(SSL_CTX_use_certificate_file(cctx, cert,
+                                                      SSL_FILETYPE_PEM), 1)
+                || !TEST_int_eq(SSL_CTX_use_PrivateKey_file(cctx, privkey,
+                                                            SSL_FILETYPE_PEM),
+                                1))
+            goto end;
+    } else if (tst == 2) {
+        frag = 512;
+        if (!TEST_true(SSL_CTX_set_max_send_fragment(sctx, frag)))
+            goto end;
+    }
+
+    memset(&wcount, 0, sizeof(wcount));
+    if (!TEST_ptr(bio_f_write_counter())
+            || !TEST_ptr(counter = BIO_new(bio_f_write_counter()))
+            || !TEST_true(create_ssl_objects(sctx, cctx, &serverssl,
+                                             &clientssl, counter, NULL))
+            || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                SSL_ERROR_NONE))
+            || (tst == 1
+                && !TEST_ptr(SSL_get_peer_certificate(serverssl))))
+        goto end;
+    X509_free(SSL_get_peer_certificate(serverssl));
+
+    /* The ServerHello, the ChangeCipherSpec and the encrypted messages */
+    TEST_info("%d writes of %d records, %d of them encrypted with %zu bytes",
+              wcount.writes, wcount.records, wcount.encrypted_records,
+              wcount.encrypted_bytes);
+    if (!TEST_int_eq(wcount.writes, 1)
+            || !TEST_int_eq(wcount.encrypted_records,
+                            (int)((wcount.encrypted_bytes + frag - 1) / frag))
+            || !TEST_int_eq(wcount.records, wcount.encrypted_records + 2))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    return testresult;
+}
+
+/*
+ * Test the server's speculative ClientHello digests
+ * Test 0: TLSv1.3 with SHA-256
+ * Test 1: TLSv1.3 with SHA-384 and client authentication
+ * Test 2: TLSv1.3 after a HelloRetryRequest, with the buffered transcript
+ * Test 3: TLSv1.2 with SHA-384 and client authentication, for which the
+ *         ClientHello is buffered after all
+ * Test 4: TLSv1.1, whose MD5-SHA1 handshake hash is not one of the digests
+ * Test 5: Early data, whose key is derived from a copy of the SHA-384 digest
+ */
+static int test_speculative_transcript(int tst)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *clientssl = NULL, *serverssl = NULL;
+    SSL_SESSION *sess = NULL;
+    X509 *peer = NULL;
+    unsigned char buf[20];
+    size_t written, readbytes;
+    int minver = TLS1_3_VERSION, maxver = 0, testresult = 0;
+
+    switch (tst) {
+    case 3:
+#ifdef OPENSSL_NO_TLS1_2
+        return 1;
+#endif
+        minver = maxver = TLS1_2_VERSION;
+        break;
+    case 4:
+#ifdef OPENSSL_NO_TLS1_1
+        return 1;
+#endif
+        minver = maxver = TLS1_1_VERSION;
+        break;
+    case 5:
+        /* Early data with a PSK set up for TLS_AES_256_GCM_SHA384 */
+        if (!TEST_true(setupearly_data_test(&cctx, &sctx, &clientssl,
+                                            &serverssl, &sess, 2))
+                || !TEST_true(SSL_write_early_data(clientssl, MSG1,
+                                                   strlen(MSG1), &written))
+                || !TEST_int_eq(SSL_read_early_data(serverssl, buf,
+                                                    sizeof(buf), &readbytes),
+                                SSL_READ_EARLY_DATA_SUCCESS)
+                || !TEST_mem_eq(buf, readbytes, MSG1, strlen(MSG1))
+                || !TEST_int_eq(SSL_get_early_data_status(serverssl),
+                                SSL_EARLY_DATA_ACCEPTED)
+                || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                    SSL_ERROR_NONE))
+                || !TEST_str_eq(SSL_CIPHER_get_name(
+                                    SSL_get_current_cipher(serverssl)),
+                                "TLS_AES_256_GCM_SHA384"))
+            goto end;
+        testresult = 1;
+        goto end;
+    }
+
+    if (!TEST_true(create_ssl_ctx_pair(TLS_server_method(), TLS_client_method(),
+                                       minver, maxver,
+                                       &sctx, &cctx, cert, privkey)))
+        goto end;
+    if (tst == 1 || tst == 3) {
+        SSL_CTX_set_verify(sctx, SSL_VERIFY_PEER, verify_cb);
+        if (!TEST_int_eq(SSL_CTX_use_certificate_file(cctx, cert,
+                                                      SSL_FILETYPE_PEM), 1)
+                || !TEST_int_eq(SSL_CTX_use_PrivateKey_file(cctx, privkey,
+                                                            SSL_FILETYPE_PEM),
+                                1))
+            goto end;
+    }
+    if ((tst == 1 && !TEST_true(SSL_CTX_set_ciphersuites(cctx,
+                                                "TLS_AES_256_GCM_SHA384")))
+            || (tst == 3
+                && !TEST_true(SSL_CTX_set_cipher_list(cctx,
+                                                "ECDHE-RSA-AES256-GCM-SHA384"))))
+        goto end;
+
+    if (!TEST_true(create_ssl_objects(sctx, cctx, &serverssl, &clientssl,
+                                      NULL, NULL)))
+        goto end;
+    /* Force a HelloRetryRequest */
+#if defined(OPENSSL_NO_EC)
+    if (tst == 2 && !TEST_true(SSL_set1_groups_list(serverssl, "ffdhe3072")))
+        goto end;
+#else
+    if (tst == 2 && !TEST_true(SSL_set1_groups_list(serverssl, "P-256")))
+        goto end;
+#endif
+    if (!TEST_true(create_ssl_connection(serverssl, clientssl,
+                                         SSL_ERROR_NONE))
+            || !TEST_int_eq(SSL_version(serverssl),
+                            maxver != 0 ? maxver : TLS1_3_VERSION)
+            || ((tst == 1 || tst == 3)
+                && !TEST_ptr(peer = SSL_get_peer_certificate(serverssl))))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    X509_free(peer);
+    SSL_SESSION_free(sess);
+    SSL_SESSION_free(clientpsk);
+    SSL_SESSION_free(serverpsk);
+    clientpsk = serverpsk = NULL;
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    return testresult;
+}
+
+/* Not an assigned algorithm */
+#define TEST_CERT_COMP_ALG      0xfe00
+
+static int cert_comp_calls = 0, cert_decomp_calls = 0;
+
+/*
+ * A server's Certificate message starts with an empty context, which this
+ * "compression" leaves out
+ */
+static int cert_compress(SSL *s, const unsigned char *in, size_t inlen,
+                         unsigned char *out, size_t *outlen)
+{
+    cert_comp_calls++;
+    if (inlen < 2 || in[0] != 0 || *outlen < inlen - 1)
+        return 0;
+    memcpy(out, in + 1, inlen - 1);
+    *outlen = inlen - 1;
+    return 1;
+}
+
+static int cert_compress_fail(SSL *s, const unsigned char *in, size_t inlen,
+                              unsigned char *out, size_t *outlen)
+{
+    cert_comp_calls++;
+    return 0;
+}
+
+static int cert_decompress(SSL *s, const unsigned char *in, size_t inlen,
+                           unsigned char *out, size_t outlen)
+{
+    cert_decomp_calls++;
+    if (inlen + 1 != outlen)
+        return 0;
+    out[0] = 0;
+    memcpy(out + 1, in, inlen);
+    return 1;
+}
+
+/*
+ * Test certificate compression (RFC8879)
+ * Test 0: Both sides have the algorithm, it is compressed once for both
+ *         connections
+ * Test 1: Only the server has it
+ * Test 2: The Certificate message does not compress
+ * Test 3: The built-in zlib, if there is one
+ */
+static int test_cert_compression(int tst)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *clientssl = NULL, *serverssl = NULL;
+    X509 *peer = NULL;
+    int alg = tst == 3 ? TLSEXT_cert_compression_zlib : TEST_CERT_COMP_ALG;
+    int expected = alg, i, testresult = 0;
+    static const int comp_calls[] = { 1, 0, 1 };
+    static const int decomp_calls[] = { 2, 0, 0 };
+
+    if (!TEST_true(create_ssl_ctx_pair(TLS_server_method(), TLS_client_method(),
+                                       TLS1_VERSION, 0,
+                                       &sctx, &cctx, cert, privkey)))
+        goto end;
+
+    cert_comp_calls = cert_decomp_calls = 0;
+    switch (tst) {
+    case 0:
+        if (!TEST_true(SSL_CTX_add_cert_compression_alg(sctx, alg,
+                                                        cert_compress, NULL))
+                || !TEST_true(SSL_CTX_add_cert_compression_alg(cctx, alg, NULL,
+                                                               cert_decompress))
+                || !TEST_false(SSL_CTX_add_cert_compression_alg(cctx, alg, NULL,
+                                                                cert_decompress)))
+            goto end;
+        break;
+    case 1:
+        if (!TEST_true(SSL_CTX_add_cert_compression_alg(sctx, alg,
+                                                        cert_compress, NULL)))
+            goto end;
+        expected = 0;
+        break;
+    case 2:
+        if (!TEST_true(SSL_CTX_add_cert_compression_alg(sctx, alg,
+                                                        cert_compress_fail,
+                                                        NULL))
+                || !TEST_true(SSL_CTX_add_cert_compression_alg(cctx, alg, NULL,
+                                                               cert_decompress)))
+            goto end;
+        expected = 0;
+        break;
+    case 3:
+        if (!SSL_CTX_add_cert_compression_alg(sctx, alg, NULL, NULL)) {
+#ifndef OPENSSL_NO_COMP
+            /* Only when built with zlib */
+            if (!TEST_int_eq(COMP_get_type(COMP_zlib()), NID_undef))
+                goto end;
+#endif
+            testresult = 1;
+            goto end;
+        }
+        if (!TEST_true(SSL_CTX_add_cert_compression_alg(cctx, alg, NULL, NULL)))
+            goto end;
+        break;
+    }
+
+    for (i = 0; i < 2; i++) {
+        if (!TEST_true(create_ssl_objects(sctx, cctx, &serverssl, &clientssl,
+                                          NULL, NULL))
+                || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                    SSL_ERROR_NONE))
+                || !TEST_int_eq(SSL_get_cert_compression_alg(serverssl),
+                                expected)
+                || !TEST_int_eq(SSL_get_cert_compression_alg(clientssl),
+                                expected)
+                || !TEST_ptr(peer = SSL_get_peer_certificate(clientssl)))
+            goto end;
+        X509_free(peer);
+        peer = NULL;
+        SSL_shutdown(clientssl);
+        SSL_shutdown(serverssl);
+        SSL_free(serverssl);
+        SSL_free(clientssl);
+        serverssl = clientssl = NULL;
+    }
+
+    if (tst < 3
+            && (!TEST_int_eq(cert_comp_calls, comp_calls[tst])
+                || !TEST_int_eq(cert_decomp_calls, decomp_calls[tst])))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    return testresult;
+}
+
+#ifndef OPENSSL_NO_COMP
+/*
+ * The built-in zlib sends each Certificate message as a complete zlib stream,
+ * and takes back nothing but one that decompresses to exactly the announced
+ * length.
+ */
+static int test_cert_compression_zlib_stream(void)
+{
+    unsigned char in[1024], comp[1200], out[1024];
+    unsigned char adler[4];
+    unsigned long a = 1, b = 0;
+    COMP_CTX *cctx = NULL;
+    size_t i;
+    int len, testresult = 0;
+
+    if (COMP_get_type(COMP_zlib_oneshot()) == NID_undef)
+        return TEST_skip("not built with zlib");
+
+    for (i = 0; i < sizeof(in); i++) {
+        in[i] = (unsigned char)(i % 7);
+        a = (a + in[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    adler[0] = (unsigned char)(b >> 8);
+    adler[1] = (unsigned char)b;
+    adler[2] = (unsigned char)(a >> 8);
+    adler[3] = (unsigned char)a;
+
+    if (!TEST_ptr(cctx = COMP_CTX_new(COMP_zlib_oneshot()))
+            || !TEST_int_gt(len = COMP_compress_block(cctx, comp,
+                                                      sizeof(comp) - 1,
+                                                      in, sizeof(in)), 4)
+            /* A finished stream ends in the Adler-32 of the data */
+            || !TEST_mem_eq(comp + len - 4, 4, adler, sizeof(adler))
+            || !TEST_int_eq(COMP_expand_block(cctx, out, sizeof(out),
+                                              comp, len), (int)sizeof(out))
+            || !TEST_mem_eq(out, sizeof(out), in, sizeof(in))
+            /* Cut short, too long for the buffer and with a byte after it */
+            || !TEST_int_lt(COMP_expand_block(cctx, out, sizeof(out),
+                                              comp, len - 1), 0)
+            || !TEST_int_lt(COMP_expand_block(cctx, out, sizeof(out) - 1,
+                                              comp, len), 0))
+        goto end;
+    comp[len] = 0;
+    if (!TEST_int_lt(COMP_expand_block(cctx, out, sizeof(out), comp, len + 1),
+                     0))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    COMP_CTX_free(cctx);
+    return testresult;
+}
+#endif
+#endif
+
+static int peer_chain_is(SSL *clientssl, X509 *chaincert, int num)
+{
+    STACK_OF(X509) *chain = SSL_get_peer_cert_chain(clientssl);
+    int i;
+
+    if (!TEST_int_eq(sk_X509_num(chain), num))
+        return 0;
+    for (i = 1; i < num; i++)
+        if (!TEST_int_eq(X509_cmp(sk_X509_value(chain, i), chaincert), 0))
+            return 0;
+    return 1;
+}
+
+/*
+ * Test that a server writes its certificate chain from the cache of encoded
+ * chains correctly, and notices when the chain changes
+ * Test 0: TLSv1.2
+ * Test 1: TLSv1.3
+ * Test 2: TLSv1.2 with a certificate status
+ * Test 3: TLSv1.3 with a certificate status, sent with the leaf
+ */
+static int test_cert_list_cache(int tst)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *clientssl = NULL, *serverssl = NULL;
+    BIO *certbio = NULL;
+    X509 *chaincert = NULL;
+    int version = (tst & 1) != 0 ? TLS1_3_VERSION : TLS1_2_VERSION;
+    int i, testresult = 0;
+#ifndef OPENSSL_NO_OCSP
+    int ocsparg = 1;
+#endif
+
+#ifdef OPENSSL_NO_TLS1_2
+    if (version == TLS1_2_VERSION)
+        return 1;
+#endif
+#ifdef OPENSSL_NO_TLS1_3
+    if (version == TLS1_3_VERSION)
+        return 1;
+#endif
+#ifdef OPENSSL_NO_OCSP
+    if (tst >= 2)
+        return 1;
+#endif
+
+    if (!TEST_ptr(certbio = BIO_new_file(cert, "r"))
+            || !TEST_ptr(chaincert = PEM_read_bio_X509(certbio, NULL, NULL,
+                                                       NULL))
+            || !TEST_true(create_ssl_ctx_pair(TLS_server_method(),
+                                              TLS_client_method(),
+                                              version, version,
+                                              &sctx, &cctx, cert, privkey))
+            /* Any certificate will do, the client does not verify the chain */
+            || !TEST_true(SSL_CTX_add1_chain_cert(sctx, chaincert)))
+        goto end;
+
+#ifndef OPENSSL_NO_OCSP
+    if (tst >= 2) {
+        SSL_CTX_set_tlsext_status_type(cctx, TLSEXT_STATUSTYPE_ocsp);
+        SSL_CTX_set_tlsext_status_cb(cctx, ocsp_client_cb);
+        SSL_CTX_set_tlsext_status_arg(cctx, &ocsparg);
+        SSL_CTX_set_tlsext_status_cb(sctx, ocsp_server_cb);
+        SSL_CTX_set_tlsext_status_arg(sctx, &ocsparg);
+    }
+#endif
+
+    /* Twice from the cache, then the chain gets longer */
+    for (i = 0; i < 3; i++) {
+        if (i == 2 && !TEST_true(SSL_CTX_add1_chain_cert(sctx, chaincert)))
+            goto end;
+#ifndef OPENSSL_NO_OCSP
+        ocsp_client_called = 0;
+#endif
+        if (!TEST_true(create_ssl_objects(sctx, cctx, &serverssl, &clientssl,
+                                          NULL, NULL))
+                || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                    SSL_ERROR_NONE))
+                || !peer_chain_is(clientssl, chaincert, i == 2 ? 3 : 2))
+            goto end;
+#ifndef OPENSSL_NO_OCSP
+        if (tst >= 2 && !TEST_true(ocsp_client_called))
+            goto end;
+#endif
+        SSL_shutdown(clientssl);
+        SSL_shutdown(serverssl);
+        SSL_free(serverssl);
+        SSL_free(clientssl);
+        serverssl = clientssl = NULL;
+    }
+
+    testresult = 1;
+
+ end:
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    X509_free(chaincert);
+    BIO_free(certbio);
+    return testresult;
+}
+
+#ifndef OPENSSL_NO_OCSP
+# define STAPLE_FILE     "sslapitest_staple.der"
+
+static unsigned char *staple_der = NULL;
+static int staple_der_len = 0;
+static int staple_fetch_calls = 0;
+static int staple_client_called = 0;
+
+/* An issuer for |leaf| that signs its OCSP responses itself, with |key| */
+static X509 *make_staple_issuer(X509 *leaf, EVP_PKEY *key)
+{
+    X509 *x = X509_new();
+
+    if (!TEST_ptr(x)
+            || !TEST_true(X509_set_version(x, 2))
+            || !TEST_true(ASN1_INTEGER_set(X509_get_serialNumber(x), 1))
+            || !TEST_true(X509_set_subject_name(x, X509_get_issuer_name(leaf)))
+            || !TEST_true(X509_set_issuer_name(x, X509_get_issuer_name(leaf)))
+            || !TEST_ptr(X509_gmtime_adj(X509_getm_notBefore(x), 0))
+            || !TEST_ptr(X509_gmtime_adj(X509_getm_notAfter(x), 3600))
+            || !TEST_true(X509_set_pubkey(x, key))
+            || !TEST_int_gt(X509_sign(x, key, EVP_sha256()), 0)) {
+        X509_free(x);
+        return NULL;
+    }
+    return x;
+}
+
+/*
+ * Write a response for |leaf| to STAPLE_FILE that is valid from |from| to |to|
+ * seconds from now.  If |spoil| is set its signature is spoilt.
+ */
+static int write_staple(X509 *leaf, X509 *issuer, EVP_PKEY *key, long from,
+                        long to, int spoil)
+{
+    OCSP_CERTID *id = OCSP_cert_to_id(NULL, leaf, issuer);
+    OCSP_BASICRESP *bs = OCSP_BASICRESP_new();
+    OCSP_RESPONSE *rsp = NULL;
+    ASN1_TIME *thisupd = X509_gmtime_adj(NULL, from);
+    ASN1_TIME *nextupd = X509_gmtime_adj(NULL, to);
+    ASN1_BIT_STRING *sig;
+    BIO *out = NULL;
+    int ret = 0;
+
+    OPENSSL_free(staple_der);
+    staple_der = NULL;
+    if (TEST_ptr(id)
+            && TEST_ptr(bs)
+            && TEST_ptr(thisupd)
+            && TEST_ptr(nextupd)
+            && TEST_ptr(OCSP_basic_add1_status(bs, id, V_OCSP_CERTSTATUS_GOOD,
+                                               0, NULL, thisupd, nextupd))
+            && TEST_true(OCSP_basic_sign(bs, issuer, key, EVP_sha256(), NULL,
+                                         0))
+            && TEST_ptr(sig = (ASN1_BIT_STRING *)OCSP_resp_get0_signature(bs))
+            && (!spoil
+                || TEST_true(ASN1_BIT_STRING_set_bit(sig, 0,
+                                 !ASN1_BIT_STRING_get_bit(sig, 0))))
+            && TEST_ptr(rsp = OCSP_response_create(
+                                  OCSP_RESPONSE_STATUS_SUCCESSFUL, bs))
+            && TEST_int_gt(staple_der_len = i2d_OCSP_RESPONSE(rsp,
+                                                              &staple_der), 0)
+            && TEST_ptr(out = BIO_new_file(STAPLE_FILE, "wb"))
+            && TEST_int_eq(BIO_write(out, staple_der, staple_der_len),
+                           staple_der_len))
+        ret = 1;
+
+    BIO_free(out);
+    ASN1_TIME_free(thisupd);
+    ASN1_TIME_free(nextupd);
+    OCSP_RESPONSE_free(rsp);
+    OCSP_BASICRESP_free(bs);
+    OCSP_CERTID_free(id);
+    return ret;
+}
+
+/* A fetcher that reads the response from the file |arg| */
+static int staple_file_fetch(SSL_CTX *ctx, X509 *leaf, X509 *issuer,
+                             unsigned char **resp, size_t *resplen, void *arg)
+{
+    BIO *in = BIO_new_file(arg, "rb");
+    OCSP_RESPONSE *rsp = NULL;
+    int len = 0;
+
+    staple_fetch_calls++;
+    if (in != NULL && (rsp = d2i_OCSP_RESPONSE_bio(in, NULL)) != NULL) {
+        *resp = NULL;
+        len = i2d_OCSP_RESPONSE(rsp, resp);
+    }
+    OCSP_RESPONSE_free(rsp);
+    BIO_free(in);
+    if (len <= 0)
+        return 0;
+    *resplen = len;
+    return 1;
+}
+
+static int staple_client_cb(SSL *s, void *arg)
+{
+    const unsigned char *resp;
+    long len = SSL_get_tlsext_status_ocsp_resp(s, &resp);
+
+    staple_client_called = 1;
+    if (len <= 0)
+        return 1;
+    return TEST_mem_eq(resp, len, staple_der, staple_der_len);
+}
+
+/*
+ * Test the server's cache of OCSP responses
+ * Test 0: TLSv1.2
+ * Test 1: TLSv1.3
+ * Test 2: The response has expired, nothing is stapled
+ * Test 3: The response is not signed by the issuer, nothing is stapled
+ */
+static int test_ocsp_staple_cache(int tst)
+{
+    SSL_CTX *cctx = NULL, *sctx = NULL;
+    SSL *clientssl = NULL, *serverssl = NULL;
+    BIO *bio = NULL;
+    X509 *leaf = NULL, *issuer = NULL;
+    EVP_PKEY *key = NULL;
+    int version = tst == 0 ? TLS1_2_VERSION : TLS1_3_VERSION;
+    int valid = tst < 2, testresult = 0;
+    const unsigned char *resp;
+    unsigned long stapled, unstapled, refresh_ms;
+    long max_age;
+
+#ifdef OPENSSL_NO_TLS1_2
+    if (version == TLS1_2_VERSION)
+        return 1;
+#endif
+#ifdef OPENSSL_NO_TLS1_3
+    if (version == TLS1_3_VERSION)
+        return 1;
+#endif
+
+    if (!TEST_ptr(bio = BIO_new_file(cert, "r"))
+            || !TEST_ptr(leaf = PEM_read_bio_X509(bio, NULL, NULL, NULL)))
+        goto end;
+    BIO_free(bio);
+    if (!TEST_ptr(bio = BIO_new_file(privkey, "r"))
+            || !TEST_ptr(key = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL))
+            || !TEST_ptr(issuer = make_staple_issuer(leaf, key))
+            || !TEST_true(write_staple(leaf, issuer, key,
+                                       tst == 2 ? -7200 : -60,
+                                       tst == 2 ? -3600 : 3600, tst == 3)))
+        goto end;
+
+    if (!TEST_true(create_ssl_ctx_pair(TLS_server_method(), TLS_client_method(),
+                                       version, version,
+                                       &sctx, &cctx, cert, privkey))
+            || !TEST_true(SSL_CTX_add1_chain_cert(sctx, issuer))
+            || !TEST_true(SSL_CTX_set_ocsp_staple_fetcher(sctx,
+                                                          staple_file_fetch,
+                                                          STAPLE_FILE)))
+        goto end;
+
+    /*
+     * A valid response is not fetched again until it is halfway to its
+     * nextUpdate, one that was refused is
+     */
+    staple_fetch_calls = 0;
+    if (!TEST_int_eq(SSL_CTX_refresh_ocsp_staples(sctx), valid)
+            || !TEST_int_eq(SSL_CTX_refresh_ocsp_staples(sctx), valid)
+            || !TEST_int_eq(staple_fetch_calls, valid ? 1 : 2))
+        goto end;
+    ERR_clear_error();
+
+    SSL_CTX_set_tlsext_status_type(cctx, TLSEXT_STATUSTYPE_ocsp);
+    SSL_CTX_set_tlsext_status_cb(cctx, staple_client_cb);
+    staple_client_called = 0;
+    if (!TEST_true(create_ssl_objects(sctx, cctx, &serverssl, &clientssl,
+                                      NULL, NULL))
+            || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                SSL_ERROR_NONE))
+            || !TEST_true(staple_client_called)
+            || !TEST_int_eq(SSL_get_tlsext_status_ocsp_resp(clientssl, &resp)
+                            > 0, valid))
+        goto end;
+
+    SSL_CTX_get_ocsp_staple_stats(sctx, &stapled, &unstapled, &max_age,
+                                  &refresh_ms);
+    if (!TEST_ulong_eq(stapled, valid)
+            || !TEST_ulong_eq(unstapled, !valid)
+            || (valid && !TEST_long_ge(max_age, 59))
+            || !TEST_long_lt(max_age, 120))
+        goto end;
+
+    /* A disabled cache is emptied, and handshakes are no longer counted */
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    serverssl = clientssl = NULL;
+    staple_client_called = 0;
+    if (!TEST_true(SSL_CTX_set_ocsp_staple_fetcher(sctx, NULL, NULL))
+            || !TEST_false(SSL_CTX_refresh_ocsp_staples(sctx))
+            || !TEST_true(create_ssl_objects(sctx, cctx, &serverssl,
+                                             &clientssl, NULL, NULL))
+            || !TEST_true(create_ssl_connection(serverssl, clientssl,
+                                                SSL_ERROR_NONE))
+            || !TEST_true(staple_client_called)
+            || !TEST_long_le(SSL_get_tlsext_status_ocsp_resp(clientssl, &resp),
+                             0))
+        goto end;
+    ERR_clear_error();
+    SSL_CTX_get_ocsp_staple_stats(sctx, &stapled, &unstapled, &max_age, NULL);
+    if (!TEST_ulong_eq(stapled, valid)
+            || !TEST_ulong_eq(unstapled, !valid)
+            || !TEST_long_eq(max_age, 0))
+        goto end;
+
+    testresult = 1;
+
+ end:
+    SSL_free(serverssl);
+    SSL_free(clientssl);
+    SSL_CTX_free(sctx);
+    SSL_CTX_free(cctx);
+    X509_free(leaf);
+    X509_free(issuer);
+    EVP_PKEY_free(key);
+    BIO_free(bio);
+    return testresult;
+}
+#endif
 
 OPT_TEST_DECLARE_USAGE("certfile privkeyfile srpvfile tmpfile\n")
 
@@ -6678,6 +7682,7 @@ int setup_tests(void)
      * in that scenario.
      */
     ADD_ALL_TESTS(test_early_data_replay, 2);
+    ADD_ALL_TESTS(test_early_data_replay_filter, 2);
     ADD_ALL_TESTS(test_early_data_skip, 3);
     ADD_ALL_TESTS(test_early_data_skip_hrr, 3);
     ADD_ALL_TESTS(test_early_data_skip_hrr_fail, 3);
@@ -6720,10 +7725,23 @@ int setup_tests(void)
     ADD_ALL_TESTS(test_ssl_pending, 2);
     ADD_ALL_TESTS(test_ssl_get_shared_ciphers, OSSL_NELEM(shared_ciphers_data));
     ADD_ALL_TESTS(test_ticket_callbacks, 12);
+    ADD_ALL_TESTS(test_ticket_key_ring, 2);
     ADD_ALL_TESTS(test_shutdown, 7);
     ADD_ALL_TESTS(test_cert_cb, 4);
     ADD_ALL_TESTS(test_client_cert_cb, 2);
     ADD_ALL_TESTS(test_ca_names, 3);
+#ifndef OPENSSL_NO_TLS1_3
+    ADD_ALL_TESTS(test_tls13_flight_records, 3);
+    ADD_ALL_TESTS(test_speculative_transcript, 6);
+    ADD_ALL_TESTS(test_cert_compression, 4);
+#ifndef OPENSSL_NO_COMP
+    ADD_TEST(test_cert_compression_zlib_stream);
+#endif
+#endif
+    ADD_ALL_TESTS(test_cert_list_cache, 4);
+#ifndef OPENSSL_NO_OCSP
+    ADD_ALL_TESTS(test_ocsp_staple_cache, 4);
+#endif
     return 1;
 }
 
@@ -6731,4 +7749,11 @@ void cleanup_tests(void)
 {
     bio_s_mempacket_test_free();
     bio_s_always_retry_free();
+#ifndef OPENSSL_NO_TLS1_3
+    BIO_meth_free(meth_write_counter);
+#endif
+#ifndef OPENSSL_NO_OCSP
+    OPENSSL_free(staple_der);
+    remove(STAPLE_FILE);
+#endif
 }
@@ -12,6 +12,7 @@
 #include <openssl/x509v3.h>
 #include <openssl/pem.h>
 #include <openssl/err.h>
+#include <openssl/sha.h>
 
 #include "testutil.h"
 
@@ -37,6 +38,81 @@ end:
     return ret;
 }
 
+#ifndef OPENSSL_NO_EC
+/* What is cached about a certificate must follow changes to it */
+static int test_resign(void)
+{
+    static const unsigned char key[32] = { 3 };
+    X509 *x = NULL;
+    BIO *b = NULL;
+    EVP_PKEY *pkey = NULL;
+    unsigned char *der = NULL;
+    unsigned char md[SHA_DIGEST_LENGTH], md2[SHA_DIGEST_LENGTH];
+    int len, ret = 0;
+
+    if (!TEST_ptr(b = BIO_new_file(infile, "r"))
+            || !TEST_ptr(x = PEM_read_bio_X509(b, NULL, NULL, NULL))
+            || !TEST_true(X509_digest(x, EVP_sha1(), md, NULL))
+            || !TEST_long_eq(X509_get_pathlen(x), 6))
+        goto end;
+
+    X509_EXTENSION_free(X509_delete_ext(x,
+                            X509_get_ext_by_NID(x, NID_basic_constraints, -1)));
+    if (!TEST_long_eq(X509_get_pathlen(x), -1)
+            || !TEST_ptr(pkey = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519,
+                                                             NULL, key,
+                                                             sizeof(key)))
+            || !TEST_int_gt(X509_sign(x, pkey, NULL), 0)
+            || !TEST_long_eq(X509_get_pathlen(x), -1)
+            || !TEST_true(X509_digest(x, EVP_sha1(), md2, NULL))
+            || !TEST_mem_ne(md, sizeof(md), md2, sizeof(md2))
+            || !TEST_int_gt(len = i2d_X509(x, &der), 0)
+            || !TEST_true(EVP_Digest(der, len, md, NULL, EVP_sha1(), NULL))
+            || !TEST_mem_eq(md, sizeof(md), md2, sizeof(md2)))
+        goto end;
+
+    ret = 1;
+
+end:
+    OPENSSL_free(der);
+    EVP_PKEY_free(pkey);
+    BIO_free(b);
+    X509_free(x);
+    return ret;
+}
+#endif
+
+/* What the application set for a proxy certificate survives a change */
+static int test_proxy_kept(void)
+{
+    X509 *x = NULL;
+    BIO *b = NULL;
+    int ret = 0;
+
+    if (!TEST_ptr(b = BIO_new_file(infile, "r"))
+            || !TEST_ptr(x = PEM_read_bio_X509(b, NULL, NULL, NULL)))
+        goto end;
+
+    X509_set_proxy_flag(x);
+    X509_set_proxy_pathlen(x, 2);
+    X509_EXTENSION_free(X509_delete_ext(x,
+                            X509_get_ext_by_NID(x, NID_basic_constraints, -1)));
+    if (!TEST_long_eq(X509_get_pathlen(x), -1)
+            || !TEST_true(X509_get_extension_flags(x) & EXFLAG_PROXY)
+            || !TEST_long_eq(X509_get_proxy_pathlen(x), 2)
+            || !TEST_true(X509_set_version(x, 2))
+            || !TEST_true(X509_get_extension_flags(x) & EXFLAG_PROXY)
+            || !TEST_long_eq(X509_get_proxy_pathlen(x), 2))
+        goto end;
+
+    ret = 1;
+
+end:
+    BIO_free(b);
+    X509_free(x);
+    return ret;
+}
+
 OPT_TEST_DECLARE_USAGE("cert.pem\n")
 
 int setup_tests(void)
@@ -45,5 +121,9 @@ int setup_tests(void)
         return 0;
 
     ADD_TEST(test_pathlen);
+#ifndef OPENSSL_NO_EC
+    ADD_TEST(test_resign);
+#endif
+    ADD_TEST(test_proxy_kept);
     return 1;
 }
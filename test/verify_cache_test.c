@@ -0,0 +1,276 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+#include <openssl/crypto.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include "testutil.h"
+
+static X509 *root = NULL, *ca = NULL, *ee = NULL;
+
+static X509 *load_cert(const char *file)
+{
+    BIO *bio = NULL;
+    X509 *x = NULL;
+
+    if (TEST_ptr(bio = BIO_new_file(file, "r")))
+        x = PEM_read_bio_X509(bio, NULL, NULL, NULL);
+    BIO_free(bio);
+    return x;
+}
+
+static X509_STORE *make_store(size_t size)
+{
+    X509_STORE *store;
+
+    if (!TEST_ptr(store = X509_STORE_new())
+        || !TEST_true(X509_STORE_add_cert(store, root))
+        || !TEST_true(X509_STORE_set_verify_cache_size(store, size))) {
+        X509_STORE_free(store);
+        return NULL;
+    }
+    return store;
+}
+
+/*
+ * Verify |x| with |inter| as the only untrusted certificate, unless |inter|
+ * is NULL.  Returns the result of X509_verify_cert() and sets |*err| and
+ * |*depth| to the error and the length of the chain.
+ */
+static int verify(X509_STORE *store, X509 *x, X509 *inter, const char *host,
+                  X509_STORE_CTX_verify_cb cb, int *err, int *depth)
+{
+    X509_STORE_CTX *ctx = NULL;
+    STACK_OF(X509) *untrusted = NULL;
+    int ret = -1;
+
+    if (!TEST_ptr(untrusted = sk_X509_new_null())
+        || (inter != NULL && !TEST_true(sk_X509_push(untrusted, inter)))
+        || !TEST_ptr(ctx = X509_STORE_CTX_new())
+        || !TEST_true(X509_STORE_CTX_init(ctx, store, x, untrusted)))
+        goto err;
+    if (host != NULL
+        && !TEST_true(X509_VERIFY_PARAM_set1_host(X509_STORE_CTX_get0_param(ctx),
+                                                  host, 0)))
+        goto err;
+    if (cb != NULL)
+        X509_STORE_CTX_set_verify_cb(ctx, cb);
+    ret = X509_verify_cert(ctx);
+    *err = X509_STORE_CTX_get_error(ctx);
+    *depth = sk_X509_num(X509_STORE_CTX_get0_chain(ctx));
+
+ err:
+    X509_STORE_CTX_free(ctx);
+    sk_X509_free(untrusted);
+    return ret;
+}
+
+static int stats_are(X509_STORE *store, unsigned long hits,
+                     unsigned long misses)
+{
+    unsigned long h, m;
+
+    X509_STORE_get_verify_cache_stats(store, &h, &m);
+    return TEST_ulong_eq(h, hits) && TEST_ulong_eq(m, misses);
+}
+
+static int test_cache_hit(void)
+{
+    X509_STORE *store = make_store(10);
+    int err, depth, ret = 0;
+
+    if (store == NULL
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !TEST_int_eq(depth, 3)
+        || !stats_are(store, 0, 1)
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !TEST_int_eq(err, X509_V_OK)
+        || !TEST_int_eq(depth, 3)
+        || !stats_are(store, 1, 1)
+        /* Different untrusted certificates are a different entry */
+        || !TEST_int_le(verify(store, ee, NULL, NULL, NULL, &err, &depth), 0)
+        || !stats_are(store, 1, 2)
+        /* Failures are not cached */
+        || !TEST_int_le(verify(store, ee, NULL, NULL, NULL, &err, &depth), 0)
+        || !TEST_int_eq(err, X509_V_ERR_UNABLE_TO_GET_ISSUER_CERT_LOCALLY)
+        || !stats_are(store, 1, 3))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+/* Identity checks are repeated on a hit */
+static int test_cache_host(void)
+{
+    X509_STORE *store = make_store(10);
+    int err, depth, ret = 0;
+
+    if (store == NULL
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !TEST_int_le(verify(store, ee, ca, "example.org", NULL, &err,
+                               &depth), 0)
+        || !TEST_int_eq(err, X509_V_ERR_HOSTNAME_MISMATCH)
+        || !stats_are(store, 1, 1))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+static int test_cache_invalidate(void)
+{
+    X509_STORE *store = make_store(10);
+    int err, depth, ret = 0;
+
+    if (store == NULL
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !TEST_true(X509_STORE_add_cert(store, ca))
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !stats_are(store, 0, 2)
+        /* Adding the same certificate again changes nothing */
+        || !TEST_true(X509_STORE_add_cert(store, ca))
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !stats_are(store, 1, 2))
+        goto err;
+    X509_STORE_flush_verify_cache(store);
+    if (!TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !stats_are(store, 1, 3))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+static int test_cache_evict(void)
+{
+    X509_STORE *store = make_store(1);
+    int err, depth, ret = 0;
+
+    if (store == NULL
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !TEST_int_eq(verify(store, ca, NULL, NULL, NULL, &err, &depth), 1)
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !stats_are(store, 0, 3)
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !stats_are(store, 1, 3)
+        /* A size of 0 disables the cache */
+        || !TEST_true(X509_STORE_set_verify_cache_size(store, 0))
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !stats_are(store, 1, 3))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+static int cb_calls = 0;
+
+static int count_cb(int ok, X509_STORE_CTX *ctx)
+{
+    cb_calls++;
+    return ok;
+}
+
+/* A verify callback sees every certificate, so it bypasses the cache */
+static int test_cache_callback(void)
+{
+    X509_STORE *store = make_store(10);
+    int err, depth, calls, ret = 0;
+
+    if (store == NULL
+        || !TEST_int_eq(verify(store, ee, ca, NULL, NULL, &err, &depth), 1)
+        || !TEST_int_eq(verify(store, ee, ca, NULL, count_cb, &err, &depth), 1)
+        || !TEST_int_gt(calls = cb_calls, 0)
+        || !TEST_int_eq(verify(store, ee, ca, NULL, count_cb, &err, &depth), 1)
+        || !TEST_int_eq(cb_calls, 2 * calls)
+        || !stats_are(store, 0, 1))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+static int memo_stats_are(unsigned long hits, unsigned long misses)
+{
+    unsigned long h, m;
+
+    ASN1_item_verify_get_memo_stats(&h, &m);
+    return TEST_ulong_eq(h, hits) && TEST_ulong_eq(m, misses);
+}
+
+/* Signature verifications are memoised, failures are not */
+static int test_verify_memo(void)
+{
+    EVP_PKEY *rootkey = X509_get0_pubkey(root);
+    unsigned long hits, misses;
+    int ret = 0;
+
+    ASN1_item_verify_get_memo_stats(&hits, &misses);
+    if (!TEST_true(ASN1_item_verify_set_memo_size(16))
+        || !TEST_int_eq(X509_verify(ca, rootkey), 1)
+        || !memo_stats_are(hits, misses + 1)
+        || !TEST_int_eq(X509_verify(ca, rootkey), 1)
+        || !memo_stats_are(hits + 1, misses + 1)
+        || !TEST_int_le(X509_verify(ee, rootkey), 0)
+        || !TEST_int_le(X509_verify(ee, rootkey), 0)
+        || !memo_stats_are(hits + 1, misses + 3)
+        || !TEST_int_eq(X509_verify(ee, X509_get0_pubkey(ca)), 1)
+        || !TEST_int_eq(X509_verify(ee, X509_get0_pubkey(ca)), 1)
+        || !memo_stats_are(hits + 2, misses + 4))
+        goto err;
+    ERR_clear_error();
+    if (!TEST_true(ASN1_item_verify_set_memo_size(0))
+        || !TEST_int_eq(X509_verify(ca, rootkey), 1)
+        || !memo_stats_are(hits + 2, misses + 4))
+        goto err;
+    ret = 1;
+
+ err:
+    ASN1_item_verify_set_memo_size(0);
+    return ret;
+}
+
+OPT_TEST_DECLARE_USAGE("root.pem ca.pem ee.pem\n")
+
+int setup_tests(void)
+{
+    if (!TEST_int_eq(test_get_argument_count(), 3)
+        || !TEST_ptr(root = load_cert(test_get_argument(0)))
+        || !TEST_ptr(ca = load_cert(test_get_argument(1)))
+        || !TEST_ptr(ee = load_cert(test_get_argument(2))))
+        return 0;
+
+    ADD_TEST(test_cache_hit);
+    ADD_TEST(test_cache_host);
+    ADD_TEST(test_cache_invalidate);
+    ADD_TEST(test_cache_evict);
+    ADD_TEST(test_cache_callback);
+    ADD_TEST(test_verify_memo);
+    return 1;
+}
+
+void cleanup_tests(void)
+{
+    X509_free(root);
+    X509_free(ca);
+    X509_free(ee);
+}
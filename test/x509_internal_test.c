@@ -16,6 +16,7 @@
 #include <openssl/x509v3.h>
 #include "testutil.h"
 #include "internal/nelem.h"
+#include "internal/x509_int.h"
 
 /**********************************************************************
  *
@@ -48,8 +49,229 @@ static int test_standard_exts(void)
     return good;
 }
 
+/**********************************************************************
+ *
+ * Test of indexed name constraints
+ *
+ ***/
+
+static const char *nc_sets[] = {
+    "permitted;DNS:example.com, permitted;DNS:.example.org,"
+    "permitted;email:alice@Example.net, permitted;email:.example.net,"
+    "permitted;email:example.info, permitted;email:.example.info,"
+    "permitted;IP:10.0.0.0/255.0.0.0, permitted;IP:2001:db8::/ffff:ffff::,"
+    "excluded;DNS:bad.example.com, excluded;email:@bad.example.info,"
+    "excluded;IP:10.1.2.0/255.255.255.0",
+    "excluded;DNS:.example.com, excluded;email:example.com,"
+    "excluded;IP:192.168.0.0/255.255.0.0, permitted;URI:.example.com",
+    /* A mask with a hole keeps the IP subtrees from being indexed */
+    "permitted;IP:10.0.0.0/255.0.255.0, permitted;DNS:example",
+};
+
+static const struct {
+    int set;
+    const char *names;
+    int expected;
+} nc_tests[] = {
+    { 0, "DNS:example.com", X509_V_OK },
+    { 0, "DNS:WWW.Example.COM", X509_V_OK },
+    { 0, "DNS:wwwexample.com", X509_V_ERR_PERMITTED_VIOLATION },
+    { 0, "DNS:example.org", X509_V_ERR_PERMITTED_VIOLATION },
+    { 0, "DNS:a.b.example.org", X509_V_OK },
+    { 0, "DNS:bad.example.com", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 0, "DNS:x.BAD.example.com", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 0, "DNS:notbad.example.com", X509_V_OK },
+    { 0, "email:alice@EXAMPLE.net", X509_V_OK },
+    { 0, "email:Alice@example.net", X509_V_ERR_PERMITTED_VIOLATION },
+    { 0, "email:bob@mail.example.net", X509_V_OK },
+    { 0, "email:bob@example.info", X509_V_OK },
+    { 0, "email:bob@bad.example.info", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 0, "email:bob@x.bad.example.info", X509_V_OK },
+    { 0, "email:x@y@mail.example.net", X509_V_OK },
+    { 0, "email:nobody", X509_V_ERR_UNSUPPORTED_NAME_SYNTAX },
+    { 0, "IP:10.1.1.1", X509_V_OK },
+    { 0, "IP:10.1.2.3", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 0, "IP:11.0.0.1", X509_V_ERR_PERMITTED_VIOLATION },
+    { 0, "IP:2001:db8::1", X509_V_OK },
+    { 0, "IP:2001:db9::1", X509_V_ERR_PERMITTED_VIOLATION },
+    { 0, "DNS:example.com, IP:11.0.0.1", X509_V_ERR_PERMITTED_VIOLATION },
+    { 1, "DNS:example.com", X509_V_OK },
+    { 1, "DNS:www.example.com", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 1, "email:bob@Example.COM", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 1, "email:bob@www.example.com", X509_V_OK },
+    { 1, "IP:192.168.3.4, IP:::1", X509_V_ERR_EXCLUDED_VIOLATION },
+    { 1, "URI:http://www.example.com/", X509_V_OK },
+    { 1, "URI:http://www.example.net/", X509_V_ERR_PERMITTED_VIOLATION },
+    { 2, "IP:10.1.0.1", X509_V_OK },
+    { 2, "IP:10.1.1.1", X509_V_ERR_PERMITTED_VIOLATION },
+    { 2, "DNS:www.example, IP:10.2.0.3", X509_V_OK },
+    { 2, "DNS:wwwexample", X509_V_ERR_PERMITTED_VIOLATION },
+};
+
+static X509 *nc_cert(int nid, const char *value)
+{
+    X509 *x = X509_new();
+    X509_EXTENSION *ext = NULL;
+
+    if (!TEST_ptr(x)
+        || !TEST_ptr(ext = X509V3_EXT_nconf_nid(NULL, NULL, nid, value))
+        || !TEST_true(X509_add_ext(x, ext, -1))
+        /* Cache the extensions, and index the name constraints */
+        || !TEST_int_ge(X509_check_purpose(x, -1, 0), 0)) {
+        X509_free(x);
+        x = NULL;
+    }
+    X509_EXTENSION_free(ext);
+    return x;
+}
+
+static int test_nc_index(int n)
+{
+    X509 *ca = NULL, *ee = NULL;
+    int ret = 0;
+
+    if (!TEST_ptr(ca = nc_cert(NID_name_constraints, nc_sets[nc_tests[n].set]))
+        || !TEST_ptr(ca->nc_index)
+        || !TEST_ptr(ee = nc_cert(NID_subject_alt_name, nc_tests[n].names))
+        || !TEST_int_eq(NAME_CONSTRAINTS_check(ee, ca->nc),
+                        nc_tests[n].expected)
+        || !TEST_int_eq(x509_nc_check(ee, ca), nc_tests[n].expected)) {
+        TEST_note("%s", nc_tests[n].names);
+        goto err;
+    }
+    ret = 1;
+
+ err:
+    X509_free(ca);
+    X509_free(ee);
+    return ret;
+}
+
+/*
+ * Many constraints, which the index looks up rather than compares with each
+ * name, so that only the names it cannot take count against all of them
+ */
+static int test_nc_index_large(void)
+{
+    NAME_CONSTRAINTS *nc = NULL;
+    GENERAL_SUBTREE *sub = NULL;
+    GENERAL_NAMES *gens = NULL;
+    GENERAL_NAME *gen = NULL;
+    X509 *ca = NULL, *ee = NULL;
+    char name[32], names[60 * 32] = "DNS:www.host12345.example.com";
+    int i, ret = 0;
+
+    for (i = 1; i < 60; i++) {
+        BIO_snprintf(name, sizeof(name), ", DNS:host%d.example.com", i);
+        strcat(names, name);
+    }
+
+    if (!TEST_ptr(ca = X509_new())
+        || !TEST_ptr(nc = NAME_CONSTRAINTS_new())
+        || !TEST_ptr(nc->permittedSubtrees = sk_GENERAL_SUBTREE_new_null()))
+        goto err;
+    for (i = 0; i < 20000; i++) {
+        BIO_snprintf(name, sizeof(name), "host%d.example.com", i);
+        if (!TEST_ptr(sub = GENERAL_SUBTREE_new())
+            || !TEST_ptr(sub->base->d.dNSName = ASN1_IA5STRING_new())
+            || !TEST_true(ASN1_STRING_set(sub->base->d.dNSName, name, -1)))
+            goto err;
+        sub->base->type = GEN_DNS;
+        if (!TEST_true(sk_GENERAL_SUBTREE_push(nc->permittedSubtrees, sub)))
+            goto err;
+        sub = NULL;
+    }
+    if (!TEST_true(X509_add1_ext_i2d(ca, NID_name_constraints, nc, 1, 0))
+        || !TEST_int_ge(X509_check_purpose(ca, -1, 0), 0)
+        || !TEST_ptr(ee = nc_cert(NID_subject_alt_name, names))
+        || !TEST_int_eq(NAME_CONSTRAINTS_check(ee, ca->nc),
+                        X509_V_ERR_UNSPECIFIED)
+        || !TEST_int_eq(x509_nc_check(ee, ca), X509_V_OK))
+        goto err;
+    X509_free(ee);
+
+    /* Names with an embedded NUL are compared with each subtree */
+    if (!TEST_ptr(ee = X509_new())
+        || !TEST_ptr(gens = GENERAL_NAMES_new()))
+        goto err;
+    for (i = 0; i < 60; i++) {
+        BIO_snprintf(name, sizeof(name), "host%d.example.com", i);
+        if (!TEST_ptr(gen = GENERAL_NAME_new())
+            || !TEST_ptr(gen->d.dNSName = ASN1_IA5STRING_new())
+            || !TEST_true(ASN1_STRING_set(gen->d.dNSName, name,
+                                          strlen(name) + 1)))
+            goto err;
+        gen->type = GEN_DNS;
+        if (!TEST_true(sk_GENERAL_NAME_push(gens, gen)))
+            goto err;
+        gen = NULL;
+    }
+    if (!TEST_true(X509_add1_ext_i2d(ee, NID_subject_alt_name, gens, 0, 0))
+        || !TEST_int_ge(X509_check_purpose(ee, -1, 0), 0)
+        || !TEST_int_eq(x509_nc_check(ee, ca), X509_V_ERR_UNSPECIFIED))
+        goto err;
+    X509_free(ee);
+
+    if (!TEST_ptr(ee = nc_cert(NID_subject_alt_name, "DNS:host19999.example.com"))
+        || !TEST_int_eq(x509_nc_check(ee, ca), X509_V_OK))
+        goto err;
+    X509_free(ee);
+    if (!TEST_ptr(ee = nc_cert(NID_subject_alt_name, "DNS:host20000.example.com"))
+        || !TEST_int_eq(x509_nc_check(ee, ca), X509_V_ERR_PERMITTED_VIOLATION))
+        goto err;
+    ret = 1;
+
+ err:
+    GENERAL_NAME_free(gen);
+    GENERAL_NAMES_free(gens);
+    GENERAL_SUBTREE_free(sub);
+    NAME_CONSTRAINTS_free(nc);
+    X509_free(ca);
+    X509_free(ee);
+    return ret;
+}
+
+/* An IP address that is neither 4 nor 16 bytes long, as before the index */
+static int test_nc_index_bad_ip(int n)
+{
+    static const unsigned char addr[5] = { 10, 1, 1, 1, 0 };
+    GENERAL_NAMES *gens = NULL;
+    GENERAL_NAME *gen = NULL;
+    X509 *ca = NULL, *ee = NULL;
+    int ret = 0;
+
+    if (!TEST_ptr(ca = nc_cert(NID_name_constraints, nc_sets[n]))
+        || !TEST_ptr(ee = X509_new())
+        || !TEST_ptr(gens = GENERAL_NAMES_new())
+        || !TEST_ptr(gen = GENERAL_NAME_new())
+        || !TEST_ptr(gen->d.iPAddress = ASN1_OCTET_STRING_new())
+        || !TEST_true(ASN1_OCTET_STRING_set(gen->d.iPAddress, addr,
+                                            sizeof(addr))))
+        goto err;
+    gen->type = GEN_IPADD;
+    if (!TEST_true(sk_GENERAL_NAME_push(gens, gen)))
+        goto err;
+    gen = NULL;
+    if (!TEST_true(X509_add1_ext_i2d(ee, NID_subject_alt_name, gens, 0, 0))
+        || !TEST_int_ge(X509_check_purpose(ee, -1, 0), 0)
+        || !TEST_int_eq(x509_nc_check(ee, ca),
+                        NAME_CONSTRAINTS_check(ee, ca->nc)))
+        goto err;
+    ret = 1;
+
+ err:
+    GENERAL_NAME_free(gen);
+    GENERAL_NAMES_free(gens);
+    X509_free(ca);
+    X509_free(ee);
+    return ret;
+}
+
 int setup_tests(void)
 {
     ADD_TEST(test_standard_exts);
+    ADD_ALL_TESTS(test_nc_index, OSSL_NELEM(nc_tests));
+    ADD_TEST(test_nc_index_large);
+    ADD_ALL_TESTS(test_nc_index_bad_ip, OSSL_NELEM(nc_sets));
     return 1;
 }
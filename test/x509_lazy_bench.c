@@ -0,0 +1,196 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * Times a loop that parses and frees a certificate with d2i_X509() or, with
+ * -lazy, with d2i_X509_lazy(), and reports the memory that each parsed
+ * certificate keeps.  With -use the names and the public key are also used,
+ * which is what the lazy parser defers.  Compare the runs to see what the
+ * lazy parser buys:
+ *
+ *     x509_lazy_bench -n 100000 cert.pem
+ *     x509_lazy_bench -lazy -n 100000 cert.pem
+ *     x509_lazy_bench -lazy -use -n 100000 cert.pem
+ *
+ * Like mem_cache_bench this is a plain program, the counting allocator has
+ * to be installed before anything is allocated.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <openssl/crypto.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/err.h>
+
+/* The certificates that are kept to measure the memory they use */
+#define KEEP_MAX 1000
+
+/* Room for the size of each block, keeping the C library's alignment */
+#define HDR_SIZE 16
+
+static size_t mem_allocs, mem_live;
+
+static void *count_malloc(size_t num, const char *file, int line)
+{
+    unsigned char *p = malloc(num + HDR_SIZE);
+
+    if (p == NULL)
+        return NULL;
+    memcpy(p, &num, sizeof(num));
+    mem_allocs++;
+    mem_live += num;
+    return p + HDR_SIZE;
+}
+
+static void count_free(void *ptr, const char *file, int line)
+{
+    unsigned char *p = ptr;
+    size_t num;
+
+    if (p == NULL)
+        return;
+    p -= HDR_SIZE;
+    memcpy(&num, p, sizeof(num));
+    mem_live -= num;
+    free(p);
+}
+
+static void *count_realloc(void *ptr, size_t num, const char *file, int line)
+{
+    unsigned char *p = ptr;
+    size_t old;
+
+    if (p == NULL)
+        return count_malloc(num, file, line);
+    p -= HDR_SIZE;
+    memcpy(&old, p, sizeof(old));
+    if ((p = realloc(p, num + HDR_SIZE)) == NULL)
+        return NULL;
+    memcpy(p, &num, sizeof(num));
+    mem_allocs++;
+    mem_live += num - old;
+    return p + HDR_SIZE;
+}
+
+static X509 *parse(const unsigned char *der, long derlen, int lazy)
+{
+    const unsigned char *p = der;
+
+    if (lazy)
+        return d2i_X509_lazy(NULL, &p, derlen);
+    return d2i_X509(NULL, &p, derlen);
+}
+
+/* What a caller would look at once it has the certificate */
+static int use(X509 *x)
+{
+    X509_NAME_hash(X509_get_issuer_name(x));
+    return X509_NAME_entry_count(X509_get_subject_name(x)) >= 0
+        && X509_get0_pubkey(x) != NULL;
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-lazy] [-use] [-n count] certfile\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+    static X509 *keep[KEEP_MAX];
+    const char *prog = argv[0];
+    unsigned char *der = NULL;
+    X509 *x = NULL;
+    BIO *bio = NULL;
+    int lazy = 0, used = 0, count = 10000, nkeep, derlen, i, ret = 1;
+    size_t allocs, live;
+    clock_t start, end;
+    double secs;
+
+    if (!CRYPTO_set_mem_functions(count_malloc, count_realloc, count_free)) {
+        fprintf(stderr, "CRYPTO_set_mem_functions failed\n");
+        return 1;
+    }
+
+    for (argc--, argv++; argc > 0 && argv[0][0] == '-'; argc--, argv++) {
+        if (strcmp(argv[0], "-lazy") == 0) {
+            lazy = 1;
+        } else if (strcmp(argv[0], "-use") == 0) {
+            used = 1;
+        } else if (strcmp(argv[0], "-n") == 0 && argc > 1) {
+            count = atoi(argv[1]);
+            argc--, argv++;
+        } else {
+            usage(prog);
+            return 1;
+        }
+    }
+    if (argc != 1 || count <= 0) {
+        usage(prog);
+        return 1;
+    }
+
+    if ((bio = BIO_new_file(argv[0], "r")) == NULL
+            || (x = PEM_read_bio_X509(bio, NULL, NULL, NULL)) == NULL
+            || (derlen = i2d_X509(x, &der)) <= 0)
+        goto err;
+
+    /* Warm up, so that one-off allocations are not counted below */
+    X509_free(x);
+    if ((x = parse(der, derlen, lazy)) == NULL || (used && !use(x)))
+        goto err;
+    X509_free(x);
+    x = NULL;
+
+    start = clock();
+    for (i = 0; i < count; i++) {
+        if ((x = parse(der, derlen, lazy)) == NULL || (used && !use(x))) {
+            fprintf(stderr, "certificate %d failed\n", i);
+            goto err;
+        }
+        X509_free(x);
+        x = NULL;
+    }
+    end = clock();
+
+    nkeep = count < KEEP_MAX ? count : KEEP_MAX;
+    allocs = mem_allocs;
+    live = mem_live;
+    for (i = 0; i < nkeep; i++) {
+        if ((keep[i] = parse(der, derlen, lazy)) == NULL
+                || (used && !use(keep[i]))) {
+            fprintf(stderr, "certificate %d failed\n", i);
+            goto err;
+        }
+    }
+    allocs = mem_allocs - allocs;
+    live = mem_live - live;
+
+    secs = (double)(end - start) / CLOCKS_PER_SEC;
+    printf("%d certificates (%d bytes) parsed %s%s in %.2fs", count, derlen,
+           lazy ? "lazily" : "eagerly", used ? " and used" : "", secs);
+    if (secs > 0)
+        printf(", %.1f per second", count / secs);
+    printf("\n");
+    printf("  per certificate: %.1f allocations, %.1f bytes kept\n",
+           (double)allocs / nkeep, (double)live / nkeep);
+    ret = 0;
+
+ err:
+    if (ret != 0)
+        ERR_print_errors_fp(stderr);
+    for (i = 0; i < KEEP_MAX; i++)
+        X509_free(keep[i]);
+    X509_free(x);
+    OPENSSL_free(der);
+    BIO_free(bio);
+    return ret;
+}
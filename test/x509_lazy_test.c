@@ -0,0 +1,213 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+
+#include "internal/nelem.h"
+#include "testutil.h"
+
+/* Load |file| normally and lazily, |der| is set to its encoding */
+static int load_cert(const char *file, X509 **eager, X509 **lazy,
+                     unsigned char **der, int *derlen)
+{
+    BIO *bio = NULL;
+    const unsigned char *p;
+    int ret = 0;
+
+    *eager = *lazy = NULL;
+    *der = NULL;
+    if (!TEST_ptr(bio = BIO_new_file(file, "r"))
+        || !TEST_ptr(*eager = PEM_read_bio_X509(bio, NULL, NULL, NULL))
+        || !TEST_int_gt(*derlen = i2d_X509(*eager, der), 0))
+        goto err;
+    p = *der;
+    if (!TEST_ptr(*lazy = d2i_X509_lazy(NULL, &p, *derlen))
+        || !TEST_ptr_eq(p, *der + *derlen))
+        goto err;
+    ret = 1;
+
+ err:
+    BIO_free(bio);
+    return ret;
+}
+
+static int names_equal(X509_NAME *a, X509_NAME *b)
+{
+    char *sa = NULL, *sb = NULL;
+    int ret = 0;
+
+    if (TEST_int_eq(X509_NAME_cmp(a, b), 0)
+        && TEST_ulong_eq(X509_NAME_hash(a), X509_NAME_hash(b))
+        && TEST_int_eq(X509_NAME_entry_count(a), X509_NAME_entry_count(b))
+        && TEST_ptr(sa = X509_NAME_oneline(a, NULL, 0))
+        && TEST_ptr(sb = X509_NAME_oneline(b, NULL, 0))
+        && TEST_str_eq(sa, sb))
+        ret = 1;
+    OPENSSL_free(sa);
+    OPENSSL_free(sb);
+    return ret;
+}
+
+static int test_lazy_cert(int n)
+{
+    X509 *eager = NULL, *lazy = NULL;
+    unsigned char *der = NULL, *der2 = NULL;
+    int derlen, der2len = 0, ret = 0;
+
+    if (!load_cert(test_get_argument(n), &eager, &lazy, &der, &derlen))
+        goto err;
+
+    /* Encoding must not need the deferred fields */
+    if (!TEST_int_eq(der2len = i2d_X509(lazy, &der2), derlen)
+        || !TEST_mem_eq(der, derlen, der2, der2len))
+        goto err;
+
+    if (!names_equal(X509_get_subject_name(lazy),
+                     X509_get_subject_name(eager))
+        || !names_equal(X509_get_issuer_name(lazy),
+                        X509_get_issuer_name(eager))
+        || !TEST_int_eq(X509_cmp(lazy, eager), 0)
+        || !TEST_int_eq(EVP_PKEY_cmp(X509_get0_pubkey(lazy),
+                                     X509_get0_pubkey(eager)), 1)
+        || !TEST_uint_eq(X509_get_extension_flags(lazy),
+                         X509_get_extension_flags(eager))
+        || !TEST_int_eq(X509_check_issued(lazy, lazy),
+                        X509_check_issued(eager, eager)))
+        goto err;
+    ret = 1;
+
+ err:
+    OPENSSL_free(der);
+    OPENSSL_free(der2);
+    X509_free(eager);
+    X509_free(lazy);
+    return ret;
+}
+
+/*
+ * Caching the extensions compares the names with the certificate locked,
+ * which is also the lock the names are decoded under
+ */
+static int test_lazy_extensions_first(int n)
+{
+    X509 *eager = NULL, *lazy = NULL;
+    unsigned char *der = NULL;
+    int derlen, ret = 0;
+
+    if (!load_cert(test_get_argument(n), &eager, &lazy, &der, &derlen))
+        goto err;
+
+    if (!TEST_int_eq(X509_check_purpose(lazy, -1, 0),
+                     X509_check_purpose(eager, -1, 0))
+        || !TEST_uint_eq(X509_get_extension_flags(lazy),
+                         X509_get_extension_flags(eager))
+        || !names_equal(X509_get_subject_name(lazy),
+                        X509_get_subject_name(eager)))
+        goto err;
+    ret = 1;
+
+ err:
+    OPENSSL_free(der);
+    X509_free(eager);
+    X509_free(lazy);
+    return ret;
+}
+
+/* Names of a lazy certificate can still be changed */
+static int test_lazy_name_edit(void)
+{
+    X509 *eager = NULL, *lazy = NULL;
+    unsigned char *der = NULL;
+    X509_NAME *name;
+    X509_NAME_ENTRY *ne = NULL;
+    int derlen, count, ret = 0;
+
+    if (!load_cert(test_get_argument(0), &eager, &lazy, &der, &derlen))
+        goto err;
+
+    name = X509_get_subject_name(lazy);
+    if (!TEST_int_gt(count = X509_NAME_entry_count(name), 0)
+        || !TEST_ptr(ne = X509_NAME_delete_entry(name, count - 1))
+        || !TEST_int_eq(X509_NAME_entry_count(name), count - 1)
+        || !TEST_int_ne(X509_NAME_cmp(name, X509_get_subject_name(eager)), 0)
+        || !TEST_true(X509_NAME_add_entry(name, ne, -1, 0))
+        || !TEST_int_eq(X509_NAME_cmp(name, X509_get_subject_name(eager)), 0))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_NAME_ENTRY_free(ne);
+    OPENSSL_free(der);
+    X509_free(eager);
+    X509_free(lazy);
+    return ret;
+}
+
+/* Verify the last certificate given with the others as its chain */
+static int test_lazy_verify(void)
+{
+    size_t i, n = test_get_argument_count();
+    X509 *eager[3], *lazy[3];
+    unsigned char *der[3];
+    int derlen, ret = 0;
+    X509_STORE *store = NULL;
+    X509_STORE_CTX *ctx = NULL;
+    STACK_OF(X509) *chain = NULL;
+
+    memset(eager, 0, sizeof(eager));
+    memset(lazy, 0, sizeof(lazy));
+    memset(der, 0, sizeof(der));
+    if (!TEST_size_t_eq(n, OSSL_NELEM(lazy)))
+        return 0;
+    for (i = 0; i < n; i++)
+        if (!load_cert(test_get_argument(i), &eager[i], &lazy[i], &der[i],
+                       &derlen))
+            goto err;
+
+    if (!TEST_ptr(store = X509_STORE_new())
+        || !TEST_true(X509_STORE_add_cert(store, lazy[0]))
+        || !TEST_ptr(chain = sk_X509_new_null())
+        || !TEST_true(sk_X509_push(chain, lazy[1]))
+        || !TEST_ptr(ctx = X509_STORE_CTX_new())
+        || !TEST_true(X509_STORE_CTX_init(ctx, store, lazy[2], chain))
+        || !TEST_int_eq(X509_verify_cert(ctx), 1))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_CTX_free(ctx);
+    sk_X509_free(chain);
+    X509_STORE_free(store);
+    for (i = 0; i < OSSL_NELEM(lazy); i++) {
+        OPENSSL_free(der[i]);
+        X509_free(eager[i]);
+        X509_free(lazy[i]);
+    }
+    return ret;
+}
+
+OPT_TEST_DECLARE_USAGE("root.pem ca.pem ee.pem\n")
+
+int setup_tests(void)
+{
+    size_t n = test_get_argument_count();
+
+    if (!TEST_int_gt(n, 0))
+        return 0;
+
+    ADD_ALL_TESTS(test_lazy_cert, n);
+    ADD_ALL_TESTS(test_lazy_extensions_first, n);
+    ADD_TEST(test_lazy_name_edit);
+    ADD_TEST(test_lazy_verify);
+    return 1;
+}
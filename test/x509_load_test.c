@@ -0,0 +1,239 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/*
+ * Load a large CA bundle into an X509_STORE.  The time it takes is reported,
+ * pass a larger count to use this as a benchmark of trust store startup.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <openssl/pem.h>
+#include <openssl/x509.h>
+#include <openssl/x509_vfy.h>
+#include "testutil.h"
+
+#define BUNDLE_FILE     "x509_load_test.pem"
+#define NUM_CERTS       2000
+#define NUM_CRLS        10
+/* Every cert with an index that is a multiple of this appears twice */
+#define DUP_EVERY       10
+
+static EVP_PKEY *key = NULL;
+/* The first certificate of the bundle, signatures may be randomised */
+static X509 *first = NULL;
+static int num_certs = NUM_CERTS;
+
+static X509_NAME *make_name(const char *fmt, int n)
+{
+    X509_NAME *name = X509_NAME_new();
+    char cn[64];
+
+    BIO_snprintf(cn, sizeof(cn), fmt, n);
+    if (!TEST_ptr(name)
+        || !TEST_true(X509_NAME_add_entry_by_txt(name, "CN", MBSTRING_ASC,
+                                                 (unsigned char *)cn, -1, -1,
+                                                 0))) {
+        X509_NAME_free(name);
+        return NULL;
+    }
+    return name;
+}
+
+static X509 *make_cert(int n)
+{
+    X509 *x = X509_new();
+    X509_NAME *name = make_name("bundle CA %d", n);
+    int ok = 0;
+
+    if (TEST_ptr(x)
+        && TEST_ptr(name)
+        && TEST_true(X509_set_version(x, 2))
+        && TEST_true(ASN1_INTEGER_set(X509_get_serialNumber(x), n + 1))
+        && TEST_true(X509_set_subject_name(x, name))
+        && TEST_true(X509_set_issuer_name(x, name))
+        && TEST_ptr(X509_gmtime_adj(X509_getm_notBefore(x), 0))
+        && TEST_ptr(X509_gmtime_adj(X509_getm_notAfter(x), 3600))
+        && TEST_true(X509_set_pubkey(x, key))
+        && TEST_int_gt(X509_sign(x, key, EVP_sha256()), 0))
+        ok = 1;
+    X509_NAME_free(name);
+    if (!ok) {
+        X509_free(x);
+        x = NULL;
+    }
+    return x;
+}
+
+static X509_CRL *make_crl(int n)
+{
+    X509_CRL *crl = X509_CRL_new();
+    X509_NAME *name = make_name("bundle CA %d", n);
+    ASN1_TIME *t = X509_gmtime_adj(NULL, 0);
+    int ok = 0;
+
+    if (TEST_ptr(crl)
+        && TEST_ptr(name)
+        && TEST_ptr(t)
+        && TEST_true(X509_CRL_set_issuer_name(crl, name))
+        && TEST_true(X509_CRL_set1_lastUpdate(crl, t))
+        && TEST_int_gt(X509_CRL_sign(crl, key, EVP_sha256()), 0))
+        ok = 1;
+    ASN1_TIME_free(t);
+    X509_NAME_free(name);
+    if (!ok) {
+        X509_CRL_free(crl);
+        crl = NULL;
+    }
+    return crl;
+}
+
+/* Write the bundle, with some certificates and CRLs in it twice */
+static int write_bundle(void)
+{
+    BIO *out = BIO_new_file(BUNDLE_FILE, "w");
+    X509 *x = NULL;
+    X509_CRL *crl = NULL;
+    int i, ret = 0;
+
+    if (!TEST_ptr(out))
+        return 0;
+    for (i = 0; i < num_certs; i++) {
+        if (!TEST_ptr(x = make_cert(i))
+            || !TEST_true(PEM_write_bio_X509(out, x))
+            || (i % DUP_EVERY == 0 && !TEST_true(PEM_write_bio_X509(out, x))))
+            goto err;
+        if (i == 0)
+            first = x;
+        else
+            X509_free(x);
+        x = NULL;
+    }
+    for (i = 0; i < NUM_CRLS; i++) {
+        if (!TEST_ptr(crl = make_crl(i))
+            || !TEST_true(PEM_write_bio_X509_CRL(out, crl))
+            || !TEST_true(PEM_write_bio_X509_CRL(out, crl)))
+            goto err;
+        X509_CRL_free(crl);
+        crl = NULL;
+    }
+    ret = 1;
+
+ err:
+    X509_free(x);
+    X509_CRL_free(crl);
+    BIO_free(out);
+    return ret;
+}
+
+static int objects_are(X509_STORE *store, int certs, int crls)
+{
+    STACK_OF(X509_OBJECT) *objs = X509_STORE_get0_objects(store);
+    int i, c = 0, l = 0;
+
+    for (i = 0; i < sk_X509_OBJECT_num(objs); i++) {
+        switch (X509_OBJECT_get_type(sk_X509_OBJECT_value(objs, i))) {
+        case X509_LU_X509:
+            c++;
+            break;
+        case X509_LU_CRL:
+            l++;
+            break;
+        default:
+            break;
+        }
+    }
+    return TEST_int_eq(c, certs) && TEST_int_eq(l, crls);
+}
+
+static int test_load_bundle(void)
+{
+    X509_STORE *store = X509_STORE_new();
+    clock_t start;
+    int ret = 0;
+
+    if (!TEST_ptr(store)
+        || !TEST_true(X509_STORE_add_cert(store, first)))
+        goto err;
+
+    start = clock();
+    if (!TEST_true(X509_STORE_load_locations(store, BUNDLE_FILE, NULL)))
+        goto err;
+    TEST_info("Loaded %d certificates and %d CRLs in %.3f seconds",
+              num_certs + (num_certs + DUP_EVERY - 1) / DUP_EVERY,
+              2 * NUM_CRLS, (double)(clock() - start) / CLOCKS_PER_SEC);
+
+    /* The copies, and the certificate that was there before, are dropped */
+    if (!objects_are(store, num_certs, NUM_CRLS)
+        || !TEST_true(X509_STORE_load_locations(store, BUNDLE_FILE, NULL))
+        || !objects_are(store, num_certs, NUM_CRLS))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+/* Certificate only loads go through X509_load_cert_file() */
+static int test_load_cert_file(void)
+{
+    X509_STORE *store = X509_STORE_new();
+    X509_LOOKUP *lookup;
+    int ret = 0;
+
+    if (!TEST_ptr(store)
+        || !TEST_ptr(lookup = X509_STORE_add_lookup(store, X509_LOOKUP_file()))
+        || !TEST_int_eq(X509_load_cert_file(lookup, BUNDLE_FILE,
+                                            X509_FILETYPE_PEM),
+                        num_certs + (num_certs + DUP_EVERY - 1) / DUP_EVERY)
+        || !objects_are(store, num_certs, 0)
+        || !TEST_int_eq(X509_load_crl_file(lookup, BUNDLE_FILE,
+                                           X509_FILETYPE_PEM), 2 * NUM_CRLS)
+        || !objects_are(store, num_certs, NUM_CRLS))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_STORE_free(store);
+    return ret;
+}
+
+OPT_TEST_DECLARE_USAGE("key.pem [count]\n")
+
+int setup_tests(void)
+{
+    BIO *bio = NULL;
+
+    if (!TEST_int_ge(test_get_argument_count(), 1)
+        || !TEST_ptr(bio = BIO_new_file(test_get_argument(0), "r"))
+        || !TEST_ptr(key = PEM_read_bio_PrivateKey(bio, NULL, NULL, NULL))) {
+        BIO_free(bio);
+        return 0;
+    }
+    BIO_free(bio);
+    if (test_get_argument_count() > 1
+        && !TEST_int_gt(num_certs = atoi(test_get_argument(1)), 0))
+        return 0;
+    if (!write_bundle())
+        return 0;
+
+    ADD_TEST(test_load_bundle);
+    ADD_TEST(test_load_cert_file);
+    return 1;
+}
+
+void cleanup_tests(void)
+{
+    EVP_PKEY_free(key);
+    X509_free(first);
+    remove(BUNDLE_FILE);
+}
@@ -0,0 +1,270 @@
+/*
+ * Copyright 2019 The OpenSSL Project Authors. All Rights Reserved.
+ *
+ * Licensed under the Apache License 2.0 (the "License").  You may not use
+ * this file except in compliance with the License.  You can obtain a copy
+ * in the file LICENSE in the source distribution or at
+ * https://www.openssl.org/source/license.html
+ */
+
+/* Tests for the certificate policy checks of X509_policy_check() */
+
+#include <string.h>
+
+#include <openssl/objects.h>
+#include <openssl/x509.h>
+#include <openssl/x509v3.h>
+#include "testutil.h"
+#include "internal/nelem.h"
+
+#define OID_P(n)    "1.3.6.1.4.1.16604.998877." #n
+
+/*
+ * Add the comma separated |policies|.  There is no configuration database
+ * for X509V3_EXT_nconf_nid() to take them from.
+ */
+static int add_policies(X509 *x, const char *policies)
+{
+    CERTIFICATEPOLICIES *pols = sk_POLICYINFO_new_null();
+    POLICYINFO *pol = NULL;
+    char oid[80];
+    const char *p;
+    size_t len;
+    int ret = 0;
+
+    if (!TEST_ptr(pols))
+        return 0;
+    for (; *policies != '\0'; policies = *p == ',' ? p + 1 : p) {
+        p = strchr(policies, ',');
+        if (p == NULL)
+            p = policies + strlen(policies);
+        len = p - policies;
+        if (!TEST_size_t_lt(len, sizeof(oid)))
+            goto err;
+        memcpy(oid, policies, len);
+        oid[len] = '\0';
+        if (!TEST_ptr(pol = POLICYINFO_new())
+            || !TEST_ptr(pol->policyid = OBJ_txt2obj(oid, 0))
+            || !TEST_true(sk_POLICYINFO_push(pols, pol)))
+            goto err;
+        pol = NULL;
+    }
+    ret = TEST_true(X509_add1_ext_i2d(x, NID_certificate_policies, pols, 0, 0));
+
+ err:
+    POLICYINFO_free(pol);
+    CERTIFICATEPOLICIES_free(pols);
+    return ret;
+}
+
+/*
+ * Make certificate |depth| of a chain, where 0 is the leaf.  Only the names
+ * and the policy extensions matter to X509_policy_check(), the certificates
+ * are not signed.
+ */
+static X509 *make_cert(int depth, const char *policies, const char *mappings)
+{
+    X509 *x = X509_new();
+    X509_NAME *subject = X509_NAME_new(), *issuer = X509_NAME_new();
+    X509_EXTENSION *ext = NULL;
+    char cn[32];
+    int ok = 0;
+
+    if (!TEST_ptr(x) || !TEST_ptr(subject) || !TEST_ptr(issuer))
+        goto err;
+    /* Distinct names, self-issued certificates are treated specially */
+    BIO_snprintf(cn, sizeof(cn), "cert %d", depth);
+    if (!TEST_true(X509_NAME_add_entry_by_txt(subject, "CN", MBSTRING_ASC,
+                                              (unsigned char *)cn, -1, -1, 0)))
+        goto err;
+    BIO_snprintf(cn, sizeof(cn), "cert %d", depth + 1);
+    if (!TEST_true(X509_NAME_add_entry_by_txt(issuer, "CN", MBSTRING_ASC,
+                                              (unsigned char *)cn, -1, -1, 0))
+        || !TEST_true(X509_set_subject_name(x, subject))
+        || !TEST_true(X509_set_issuer_name(x, issuer)))
+        goto err;
+
+    if (policies != NULL && !add_policies(x, policies))
+        goto err;
+    if (mappings != NULL
+        && (!TEST_ptr(ext = X509V3_EXT_nconf_nid(NULL, NULL,
+                                                 NID_policy_mappings,
+                                                 mappings))
+            || !TEST_true(X509_add_ext(x, ext, -1))))
+        goto err;
+    ok = 1;
+
+ err:
+    X509_EXTENSION_free(ext);
+    X509_NAME_free(subject);
+    X509_NAME_free(issuer);
+    if (!ok) {
+        X509_free(x);
+        x = NULL;
+    }
+    return x;
+}
+
+static int push_cert(STACK_OF(X509) *chain, X509 *x)
+{
+    if (!TEST_ptr(x))
+        return 0;
+    if (!TEST_true(sk_X509_push(chain, x))) {
+        X509_free(x);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+ * The policies that are valid for the whole chain, as the certificate below
+ * the trust anchor names them.
+ */
+static int user_policies_are(X509_POLICY_TREE *tree, const char *expected)
+{
+    STACK_OF(X509_POLICY_NODE) *nodes;
+    char buf[80], got[256] = "";
+    int i;
+
+    nodes = X509_policy_tree_get0_user_policies(tree);
+    for (i = 0; i < sk_X509_POLICY_NODE_num(nodes); i++) {
+        OBJ_obj2txt(buf, sizeof(buf),
+                    X509_policy_node_get0_policy(
+                        sk_X509_POLICY_NODE_value(nodes, i)), 1);
+        if (i > 0)
+            strcat(got, ",");
+        strcat(got, buf);
+    }
+    return TEST_str_eq(got, expected);
+}
+
+static const struct {
+    const char *leaf, *ca, *ca_mappings;
+    int ret;
+    const char *user_policies;
+} policy_tests[] = {
+    { OID_P(1), OID_P(1) "," OID_P(2), NULL,
+      X509_PCY_TREE_VALID, OID_P(1) },
+    { OID_P(3), OID_P(1) "," OID_P(2), NULL,
+      X509_PCY_TREE_FAILURE, "" },
+    { OID_P(1), "anyPolicy", NULL,
+      X509_PCY_TREE_VALID, OID_P(1) },
+    /* Policy 1 of the CA is known as policy 3 by the leaf */
+    { OID_P(3), OID_P(1) "," OID_P(2), OID_P(1) ":" OID_P(3),
+      X509_PCY_TREE_VALID, OID_P(1) },
+    { OID_P(1), OID_P(1) "," OID_P(2), OID_P(1) ":" OID_P(3),
+      X509_PCY_TREE_FAILURE, "" },
+    /* Two CA policies known by the same name */
+    { OID_P(3), OID_P(1) "," OID_P(2),
+      OID_P(1) ":" OID_P(3) "," OID_P(2) ":" OID_P(3),
+      X509_PCY_TREE_VALID, OID_P(1) "," OID_P(2) },
+    /* The leaf accepts any policy, both CA policies are kept */
+    { "anyPolicy", OID_P(1) "," OID_P(2),
+      OID_P(1) ":" OID_P(3) "," OID_P(2) ":" OID_P(3),
+      X509_PCY_TREE_VALID, OID_P(1) "," OID_P(2) },
+    /* One CA policy known by two names */
+    { OID_P(3) "," OID_P(4) "," OID_P(5), OID_P(1),
+      OID_P(1) ":" OID_P(3) "," OID_P(1) ":" OID_P(4),
+      X509_PCY_TREE_VALID, OID_P(1) },
+};
+
+static STACK_OF(ASN1_OBJECT) *any_policy = NULL;
+
+static int test_policy_check(int n)
+{
+    STACK_OF(X509) *chain = sk_X509_new_null();
+    X509_POLICY_TREE *tree = NULL;
+    int explicit_policy, ret = 0;
+
+    if (!TEST_ptr(chain)
+        || !push_cert(chain, make_cert(0, policy_tests[n].leaf, NULL))
+        || !push_cert(chain, make_cert(1, policy_tests[n].ca,
+                                       policy_tests[n].ca_mappings))
+        || !push_cert(chain, make_cert(2, NULL, NULL))
+        || !TEST_int_eq(X509_policy_check(&tree, &explicit_policy, chain,
+                                          any_policy,
+                                          X509_V_FLAG_EXPLICIT_POLICY),
+                        policy_tests[n].ret)
+        || !TEST_true(explicit_policy)
+        || !user_policies_are(tree, policy_tests[n].user_policies))
+        goto err;
+    ret = 1;
+
+ err:
+    X509_policy_tree_free(tree);
+    sk_X509_pop_free(chain, X509_free);
+    return ret;
+}
+
+#define NUM_POLICIES    8
+#define NUM_CAS         16
+
+/*
+ * Every CA in the chain has the same NUM_POLICIES policies and maps each of
+ * them to all of the others.  Copying every node under each of the parents
+ * that it matches would create NUM_POLICIES ^ NUM_CAS nodes, here a level
+ * never has more than one node per policy.
+ */
+static int test_policy_mapping_blowup(void)
+{
+    STACK_OF(X509) *chain = sk_X509_new_null();
+    X509_POLICY_TREE *tree = NULL;
+    char policies[NUM_POLICIES * 40] = "";
+    char mappings[NUM_POLICIES * NUM_POLICIES * 80] = "";
+    char oid[40];
+    int explicit_policy, i, j, ret = 0;
+
+    for (i = 0; i < NUM_POLICIES; i++) {
+        BIO_snprintf(oid, sizeof(oid), "%s" OID_P(%d), i > 0 ? "," : "", i);
+        strcat(policies, oid);
+        for (j = 0; j < NUM_POLICIES; j++) {
+            BIO_snprintf(oid, sizeof(oid), "%s" OID_P(%d) ":",
+                         mappings[0] != '\0' ? "," : "", i);
+            strcat(mappings, oid);
+            BIO_snprintf(oid, sizeof(oid), OID_P(%d), j);
+            strcat(mappings, oid);
+        }
+    }
+
+    if (!TEST_ptr(chain)
+        || !push_cert(chain, make_cert(0, OID_P(0), NULL)))
+        goto err;
+    for (i = 1; i <= NUM_CAS; i++)
+        if (!push_cert(chain, make_cert(i, policies, mappings)))
+            goto err;
+    if (!push_cert(chain, make_cert(NUM_CAS + 1, NULL, NULL))
+        || !TEST_int_eq(X509_policy_check(&tree, &explicit_policy, chain,
+                                          any_policy,
+                                          X509_V_FLAG_EXPLICIT_POLICY),
+                        X509_PCY_TREE_VALID)
+        || !user_policies_are(tree, policies))
+        goto err;
+    for (i = 0; i < X509_policy_tree_level_count(tree); i++)
+        if (!TEST_int_le(X509_policy_level_node_count(
+                             X509_policy_tree_get0_level(tree, i)),
+                         NUM_POLICIES + 1))
+            goto err;
+    ret = 1;
+
+ err:
+    X509_policy_tree_free(tree);
+    sk_X509_pop_free(chain, X509_free);
+    return ret;
+}
+
+int setup_tests(void)
+{
+    if (!TEST_ptr(any_policy = sk_ASN1_OBJECT_new_null())
+        || !TEST_true(sk_ASN1_OBJECT_push(any_policy,
+                                          OBJ_nid2obj(NID_any_policy))))
+        return 0;
+
+    ADD_ALL_TESTS(test_policy_check, OSSL_NELEM(policy_tests));
+    ADD_TEST(test_policy_mapping_blowup);
+    return 1;
+}
+
+void cleanup_tests(void)
+{
+    sk_ASN1_OBJECT_free(any_policy);
+}